@@ -0,0 +1,486 @@
+#include "treegenerator.h"
+#include "../search/searchmanager.h"
+#include "../search/searchtrace.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QSet>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Run
+{
+    SearchMode mode;
+    bool cold;
+    int threads;                   // Traversal threads, 0 when tuned
+    bool traced;                   // Recorded a SearchTrace timeline
+    qint64 wallNs = 0;
+    qint64 firstResultNs = -1;     // None found
+    qint64 maxGapNs = 0;           // Longest wait for the next delivery
+    qint64 results = 0;
+    qint64 matchedFiles = 0;       // Distinct paths, a file can match on several lines
+    bool fromIndex = false;        // Answered by an index instead of a walk
+    qint64 peakRssKb = 0;
+    QJsonObject stages;            // Per-stage counters and latencies
+};
+
+const char *modeName(SearchMode mode)
+{
+    return mode == SearchMode::FileContent ? "content" : "name";
+}
+
+// Drops the page cache, and dentries and inodes too where allowed
+QString evictCaches(const QString &root)
+{
+#ifdef Q_OS_LINUX
+    ::sync();
+    QFile dropCaches("/proc/sys/vm/drop_caches");
+    if (dropCaches.open(QIODevice::WriteOnly) && dropCaches.write("3\n") == 2) {
+        return "drop_caches";
+    }
+
+    // Without root only file data can go, the walk itself stays warm
+    QDirIterator it(root, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const int fd = ::open(QFile::encodeName(it.next()).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+    return "fadvise";
+#else
+    Q_UNUSED(root);
+    return "none";
+#endif
+}
+
+// Peak resident set since the last reset, in KiB
+void resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5\n");
+    }
+#endif
+}
+
+qint64 peakRssKb()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    for (const QByteArray &line : status.readAll().split('\n')) {
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+        }
+    }
+    return 0;
+}
+
+// With tracePath, the run records a trace, written there once it is timed
+Run runSearch(SearchManager &manager, SearchMode mode, bool cold, int threads, const QString &root,
+              const SearchOptions &baseOptions, const QString &tracePath = QString())
+{
+    Run run;
+    run.mode = mode;
+    run.cold = cold;
+    run.threads = threads;
+    run.traced = !tracePath.isEmpty();
+
+    SearchOptions options = baseOptions;
+    options.mode = mode;
+    options.traversalThreads = threads;
+
+    QEventLoop loop;
+    QElapsedTimer timer;
+    qint64 lastDeliveryNs = 0;
+    QSet<QString> matchedPaths;
+    QObject::connect(&manager, &SearchManager::resultsFound, &loop, [&](const QList<SearchResult> &results) {
+        const qint64 now = timer.nsecsElapsed();
+        if (run.firstResultNs < 0) {
+            run.firstResultNs = now;
+        } else {
+            run.maxGapNs = qMax(run.maxGapNs, now - lastDeliveryNs);
+        }
+        lastDeliveryNs = now;
+        run.results += results.size();
+        for (const SearchResult &result : results) {
+            matchedPaths.insert(result.fullPath);
+        }
+    });
+    QObject::connect(&manager, &SearchManager::searchCompleted, &loop, &QEventLoop::quit);
+    QObject::connect(&manager, &SearchManager::searchCancelled, &loop, &QEventLoop::quit);
+
+    resetPeakRss();
+    if (run.traced) {
+        SearchTrace::start();
+    }
+    timer.start();
+    manager.startSearch(TreeGenerator::NEEDLE, root, options);
+    loop.exec();
+    run.wallNs = timer.nsecsElapsed();
+    if (run.traced && !SearchTrace::write(tracePath)) {
+        std::fprintf(stderr, "boba-bench: cannot write %s\n", qPrintable(tracePath));
+    }
+    run.peakRssKb = peakRssKb();
+    run.matchedFiles = matchedPaths.size();
+    const QJsonObject stats = manager.statsJson();
+    run.fromIndex = stats.value("answeredFromIndex").toBool();
+    run.stages = stats.value("stages").toObject();
+    return run;
+}
+
+double percentile(std::vector<qint64> values, double fraction)
+{
+    // Nearest rank, runs are few and interpolating would invent values
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t rank = size_t(std::max(1.0, fraction * double(values.size()) + 0.999999)) - 1;
+    return double(values[std::min(rank, values.size() - 1)]);
+}
+
+double toMs(double ns)
+{
+    return ns / 1e6;
+}
+
+QJsonObject runToJson(const Run &run, const TreeGenerator::Totals &totals)
+{
+    const double seconds = double(run.wallNs) / 1e9;
+    const qint64 expected = run.mode == SearchMode::FileContent ? totals.contentMatches : totals.nameMatches;
+    QJsonObject object;
+    object.insert("mode", modeName(run.mode));
+    object.insert("cache", run.cold ? "cold" : "warm");
+    object.insert("threads", run.threads);
+    object.insert("traced", run.traced);
+    object.insert("wallMs", toMs(run.wallNs));
+    object.insert("timeToFirstResultMs", run.firstResultNs >= 0 ? QJsonValue(toMs(run.firstResultNs)) : QJsonValue());
+    object.insert("maxDeliveryGapMs", toMs(run.maxGapNs));
+    object.insert("filesPerSecond", double(totals.files) / seconds);
+    if (run.mode == SearchMode::FileContent) {
+        object.insert("bytesPerSecond", double(totals.bytes) / seconds);
+    }
+    object.insert("results", run.results);
+    object.insert("matchedFiles", run.matchedFiles);
+    object.insert("expectedFiles", expected);
+    object.insert("fromIndex", run.fromIndex);
+    object.insert("peakRssKb", run.peakRssKb);
+    object.insert("stages", run.stages);
+    return object;
+}
+
+QJsonObject summarize(const std::vector<Run> &runs, SearchMode mode, bool cold, int threads, bool traced,
+                      const TreeGenerator::Totals &totals)
+{
+    std::vector<qint64> wall;
+    std::vector<qint64> firstResult;
+    std::vector<qint64> gaps;
+    qint64 peakRss = 0;
+    bool correct = true;
+    int fromIndex = 0;
+    const qint64 expected = mode == SearchMode::FileContent ? totals.contentMatches : totals.nameMatches;
+    for (const Run &run : runs) {
+        if (run.mode != mode || run.cold != cold || run.threads != threads || run.traced != traced) {
+            continue;
+        }
+        wall.push_back(run.wallNs);
+        if (run.firstResultNs >= 0) {
+            firstResult.push_back(run.firstResultNs);
+        }
+        gaps.push_back(run.maxGapNs);
+        peakRss = qMax(peakRss, run.peakRssKb);
+        correct = correct && run.matchedFiles == expected;
+        fromIndex += run.fromIndex ? 1 : 0;
+    }
+    if (wall.empty()) {
+        return QJsonObject();
+    }
+
+    const double medianSeconds = percentile(wall, 0.5) / 1e9;
+    QJsonObject object;
+    object.insert("mode", modeName(mode));
+    object.insert("cache", cold ? "cold" : "warm");
+    object.insert("threads", threads);
+    object.insert("traced", traced);
+    object.insert("runs", int(wall.size()));
+    object.insert("wallMs", QJsonObject{{"p50", toMs(percentile(wall, 0.5))}, {"p90", toMs(percentile(wall, 0.9))},
+                                        {"p99", toMs(percentile(wall, 0.99))}, {"max", toMs(percentile(wall, 1.0))}});
+    object.insert("timeToFirstResultMs", QJsonObject{{"p50", toMs(percentile(firstResult, 0.5))},
+                                                     {"p99", toMs(percentile(firstResult, 0.99))}});
+    object.insert("maxDeliveryGapMs", QJsonObject{{"p50", toMs(percentile(gaps, 0.5))}, {"p99", toMs(percentile(gaps, 0.99))}});
+    object.insert("filesPerSecond", double(totals.files) / medianSeconds);
+    if (mode == SearchMode::FileContent) {
+        object.insert("bytesPerSecond", double(totals.bytes) / medianSeconds);
+    }
+    object.insert("peakRssKb", peakRss);
+    object.insert("fromIndex", fromIndex);   // Runs answered by an index
+    object.insert("correct", correct);     // Every run found exactly the files the generator planted
+    return object;
+}
+
+// Median wall time per thread count against the first count given, for each mode and
+// cache state, untraced. Also printed to stderr as a table to paste into a commit message.
+QJsonArray scaling(const std::vector<Run> &runs, const std::vector<int> &threadCounts, const std::vector<SearchMode> &modes)
+{
+    QJsonArray rows;
+    std::fprintf(stderr, "boba-bench: %-8s %-8s %-7s %12s %8s\n", "mode", "cache", "threads", "p50 ms", "speedup");
+    for (SearchMode mode : modes) {
+        for (bool cold : {true, false}) {
+            double baselineNs = 0;
+            for (int threads : threadCounts) {
+                std::vector<qint64> wall;
+                for (const Run &run : runs) {
+                    if (run.mode == mode && run.cold == cold && run.threads == threads && !run.traced) {
+                        wall.push_back(run.wallNs);
+                    }
+                }
+                if (wall.empty()) {
+                    continue;
+                }
+                const double medianNs = percentile(wall, 0.5);
+                if (baselineNs == 0) {
+                    baselineNs = medianNs;
+                }
+                const double speedup = medianNs > 0 ? baselineNs / medianNs : 0;
+                rows.append(QJsonObject{{"mode", modeName(mode)}, {"cache", cold ? "cold" : "warm"}, {"threads", threads},
+                                        {"wallMsP50", toMs(medianNs)}, {"speedup", speedup}});
+                std::fprintf(stderr, "boba-bench: %-8s %-8s %-7d %12.1f %8.2f\n", modeName(mode), cold ? "cold" : "warm",
+                             threads, toMs(medianNs), speedup);
+            }
+        }
+    }
+    return rows;
+}
+
+int fail(const QString &message)
+{
+    std::fprintf(stderr, "boba-bench: %s\n", qPrintable(message));
+    return 2;
+}
+
+}
+
+// Generates a synthetic tree, or reuses the one from an earlier run with the
+// same shape, and times name and content searches for NEEDLE in it, cold and
+// warm. Prints one JSON document: the shape and seed, every run, and per mode
+// and cache state percentiles of wall time, time to first result and the
+// longest stall between deliveries, throughput at the median, peak RSS, and
+// whether the results matched what the generator planted. With --threads the
+// whole set is repeated for each traversal thread count, and a scaling table
+// gives the median speedup over the first count. With --trace the warm runs are repeated while recording
+// a SearchTrace timeline, which shows what tracing costs. Runs of two
+// commits on the same machine and tree compare directly.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("boba-bench");
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks Boba searches on a generated tree.");
+    parser.addHelpOption();
+    const QCommandLineOption treeOption("tree", "Where the tree is generated.", "dir",
+                                        QDir::tempPath() + "/boba-bench-tree");
+    const QCommandLineOption shapeOption("shape", "Preset: balanced, deep, wide or flat.", "name", "balanced");
+    const QCommandLineOption depthOption("depth", "Directory levels.", "n");
+    const QCommandLineOption fanoutOption("fanout", "Subdirectories per directory.", "n");
+    const QCommandLineOption filesOption("files", "Files per directory.", "n");
+    const QCommandLineOption minSizeOption("min-size", "Smallest file, in bytes.", "bytes");
+    const QCommandLineOption maxSizeOption("max-size", "Largest file, in bytes.", "bytes");
+    const QCommandLineOption binaryOption("binary-ratio", "Fraction of binary files.", "ratio");
+    const QCommandLineOption matchOption("match-ratio", "Fraction of files that match.", "ratio");
+    const QCommandLineOption seedOption("seed", "Generator seed.", "n", "1");
+    const QCommandLineOption runsOption("runs", "Runs per mode and cache state.", "n", "5");
+    const QCommandLineOption modesOption("modes", "Comma-separated: name, content.", "list", "name,content");
+    const QCommandLineOption noColdOption("no-cold", "Skip cold cache runs.");
+    const QCommandLineOption indexOption("index", "Let searches use the indexes instead of always walking.");
+    const QCommandLineOption threadsOption("threads", "Comma-separated traversal thread counts to sweep, 0 is tuned.",
+                                           "list", "0");
+    const QCommandLineOption traceOption("trace", "Repeat the warm runs with tracing on, the last trace is written here.",
+                                         "file");
+    const QCommandLineOption labelOption("label", "Stored with the results, a commit id for example.", "text");
+    const QCommandLineOption outputOption({"o", "output"}, "Write the JSON here instead of stdout.", "file");
+    parser.addOptions({treeOption, shapeOption, depthOption, fanoutOption, filesOption, minSizeOption, maxSizeOption,
+                       binaryOption, matchOption, seedOption, runsOption, modesOption, noColdOption, indexOption,
+                       threadsOption, traceOption, labelOption, outputOption});
+    parser.process(app);
+
+    TreeGenerator::Shape shape;
+    if (!TreeGenerator::shapeFor(parser.value(shapeOption), &shape)) {
+        return fail("unknown --shape " + parser.value(shapeOption));
+    }
+    bool ok = true;
+    auto integer = [&](const QCommandLineOption &option, auto *value) {
+        if (parser.isSet(option)) {
+            bool valid = false;
+            *value = parser.value(option).toLongLong(&valid);
+            ok = ok && valid && *value >= 0;
+        }
+    };
+    auto ratio = [&](const QCommandLineOption &option, double *value) {
+        if (parser.isSet(option)) {
+            bool valid = false;
+            *value = parser.value(option).toDouble(&valid);
+            ok = ok && valid && *value >= 0 && *value <= 1;
+        }
+    };
+    integer(depthOption, &shape.depth);
+    integer(fanoutOption, &shape.fanout);
+    integer(filesOption, &shape.filesPerDirectory);
+    integer(minSizeOption, &shape.minFileSize);
+    integer(maxSizeOption, &shape.maxFileSize);
+    ratio(binaryOption, &shape.binaryRatio);
+    ratio(matchOption, &shape.matchRatio);
+    bool seedValid = false;
+    shape.seed = parser.value(seedOption).toULongLong(&seedValid);
+    ok = ok && seedValid;
+    // Has a default, so unlike the shape overrides it is always read
+    bool runsValid = false;
+    const int runs = parser.value(runsOption).toInt(&runsValid);
+    ok = ok && runsValid;
+    if (!ok || runs < 1) {
+        return fail("numbers and ratios must be non-negative, ratios at most 1, see --help");
+    }
+
+    std::vector<SearchMode> modes;
+    for (const QString &mode : parser.value(modesOption).split(',', Qt::SkipEmptyParts)) {
+        if (mode == "name") {
+            modes.push_back(SearchMode::FileName);
+        } else if (mode == "content") {
+            modes.push_back(SearchMode::FileContent);
+        } else {
+            return fail("unknown mode " + mode);
+        }
+    }
+
+    // More threads than cores run as many as there are cores
+    std::vector<int> threadCounts;
+    for (const QString &count : parser.value(threadsOption).split(',', Qt::SkipEmptyParts)) {
+        bool valid = false;
+        const int threads = count.toInt(&valid);
+        if (!valid || threads < 0) {
+            return fail("bad thread count " + count);
+        }
+        threadCounts.push_back(threads);
+    }
+    if (threadCounts.empty()) {
+        return fail("no thread counts in --threads");
+    }
+
+    const QString root = QDir::cleanPath(QDir(parser.value(treeOption)).absolutePath());
+    TreeGenerator generator(shape);
+    std::fprintf(stderr, "boba-bench: preparing %s\n", qPrintable(root));
+    if (!generator.generate(root)) {
+        return fail(generator.errorString());
+    }
+    const TreeGenerator::Totals &totals = generator.totals();
+
+    SearchOptions options;
+    options.useIndex = parser.isSet(indexOption);
+    options.useContentIndex = parser.isSet(indexOption);
+    options.maxFileSizeBytes = qMax(options.maxFileSizeBytes, shape.maxFileSize);
+
+    // One manager for every run, as in the GUI: tuners and caches learned in
+    // earlier runs carry over, cold and warm differ in what the kernel has cached.
+    // Indexes are built up front and never watched, nothing runs between searches.
+    SearchManager manager(nullptr, IndexManager::OnDemand);
+    if (options.useIndex) {
+        for (SearchMode mode : modes) {
+            std::fprintf(stderr, "boba-bench: indexing %s\n", modeName(mode));
+            const bool built = mode == SearchMode::FileContent
+                ? manager.indexManager()->build(ContentIndexKind, root, options.maxFileSizeBytes)
+                : manager.indexManager()->build(FileNameIndexKind, root, 0);
+            if (!built) {
+                return fail(QString("cannot build the %1 index of %2").arg(modeName(mode), root));
+            }
+        }
+    }
+
+    // Cold runs first, each after an eviction; then one untimed search warms the caches
+    std::vector<Run> results;
+    QString coldMethod = "skipped";
+    for (int threads : threadCounts) {
+        for (SearchMode mode : modes) {
+            if (!parser.isSet(noColdOption)) {
+                for (int i = 0; i < runs; ++i) {
+                    coldMethod = evictCaches(root);
+                    results.push_back(runSearch(manager, mode, true, threads, root, options));
+                }
+            }
+            runSearch(manager, mode, false, threads, root, options);
+            for (int i = 0; i < runs; ++i) {
+                results.push_back(runSearch(manager, mode, false, threads, root, options));
+            }
+            if (parser.isSet(traceOption)) {
+                for (int i = 0; i < runs; ++i) {
+                    results.push_back(runSearch(manager, mode, false, threads, root, options, parser.value(traceOption)));
+                }
+            }
+        }
+    }
+
+    QJsonArray runArray;
+    for (const Run &run : results) {
+        runArray.append(runToJson(run, totals));
+    }
+    QJsonArray summary;
+    for (int threads : threadCounts) {
+        for (SearchMode mode : modes) {
+            for (bool cold : {true, false}) {
+                for (bool traced : {false, true}) {
+                    const QJsonObject object = summarize(results, mode, cold, threads, traced, totals);
+                    if (!object.isEmpty()) {
+                        summary.append(object);
+                    }
+                }
+            }
+        }
+    }
+
+    QJsonObject report;
+    report.insert("label", parser.value(labelOption));
+    report.insert("qtVersion", qVersion());
+    report.insert("idealThreadCount", QThread::idealThreadCount());
+    report.insert("tree", QJsonObject{{"root", root}, {"shape", shape.toJson()}, {"totals", totals.toJson()}});
+    report.insert("index", options.useIndex);
+    report.insert("coldMethod", coldMethod);
+    report.insert("summary", summary);
+    if (threadCounts.size() > 1) {
+        report.insert("scaling", scaling(results, threadCounts, modes));
+    }
+    report.insert("runs", runArray);
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            return fail("cannot write " + parser.value(outputOption));
+        }
+    } else {
+        std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+    return 0;
+}
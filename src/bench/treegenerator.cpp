@@ -0,0 +1,270 @@
+#include "treegenerator.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <cstring>
+
+namespace {
+
+const char *const WORDS[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not",
+    "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were", "their",
+    "return", "const", "void", "include", "struct", "static", "if", "else", "while", "int", "char", "size", "buffer", "value", "index", "count",
+    "search", "result", "file", "path", "directory", "thread", "queue", "match", "pattern", "line", "read", "open", "close", "error",
+};
+const int WORD_COUNT = int(sizeof(WORDS) / sizeof(WORDS[0]));
+
+}
+
+QJsonObject TreeGenerator::Shape::toJson() const
+{
+    QJsonObject object;
+    object.insert("depth", depth);
+    object.insert("fanout", fanout);
+    object.insert("filesPerDirectory", filesPerDirectory);
+    object.insert("minFileSize", minFileSize);
+    object.insert("maxFileSize", maxFileSize);
+    object.insert("binaryRatio", binaryRatio);
+    object.insert("matchRatio", matchRatio);
+    object.insert("seed", QString::number(seed));     // JSON numbers lose 64-bit precision
+    return object;
+}
+
+QJsonObject TreeGenerator::Totals::toJson() const
+{
+    QJsonObject object;
+    object.insert("directories", directories);
+    object.insert("files", files);
+    object.insert("bytes", bytes);
+    object.insert("nameMatches", nameMatches);
+    object.insert("contentMatches", contentMatches);
+    return object;
+}
+
+TreeGenerator::Totals TreeGenerator::Totals::fromJson(const QJsonObject &object)
+{
+    Totals totals;
+    totals.directories = object.value("directories").toInteger();
+    totals.files = object.value("files").toInteger();
+    totals.bytes = object.value("bytes").toInteger();
+    totals.nameMatches = object.value("nameMatches").toInteger();
+    totals.contentMatches = object.value("contentMatches").toInteger();
+    return totals;
+}
+
+TreeGenerator::TreeGenerator(const Shape &shape)
+    : m_shape(shape)
+    , m_state(shape.seed)
+{
+}
+
+bool TreeGenerator::generate(const QString &root)
+{
+    m_totals = Totals();
+    m_state = m_shape.seed;
+    const QString manifestPath = root + "/" + MANIFEST;
+
+    // A tree of the same shape is the same tree, it only needs writing once
+    QFile manifest(manifestPath);
+    if (manifest.open(QIODevice::ReadOnly)) {
+        const QJsonObject object = QJsonDocument::fromJson(manifest.readAll()).object();
+        manifest.close();
+        if (object.value("shape").toObject() == m_shape.toJson()) {
+            m_totals = Totals::fromJson(object.value("totals").toObject());
+            return true;
+        }
+    }
+
+    // Only ever delete what was generated here before
+    QDir dir(root);
+    if (dir.exists()) {
+        if (!manifest.exists() && !dir.isEmpty()) {
+            m_errorString = QString("%1 exists and is not a benchmark tree").arg(root);
+            return false;
+        }
+        if (!dir.removeRecursively()) {
+            m_errorString = QString("Cannot remove the old tree at %1").arg(root);
+            return false;
+        }
+    }
+    if (!QDir().mkpath(root)) {
+        m_errorString = QString("Cannot create %1").arg(root);
+        return false;
+    }
+
+    m_totals.directories = 1;
+    if (!writeDirectory(root, 0)) {
+        return false;
+    }
+
+    // Written last, an interrupted run leaves no manifest and is redone
+    QJsonObject object;
+    object.insert("shape", m_shape.toJson());
+    object.insert("totals", m_totals.toJson());
+    QSaveFile file(manifestPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(object).toJson()) < 0 || !file.commit()) {
+        m_errorString = QString("Cannot write %1").arg(manifestPath);
+        return false;
+    }
+    return true;
+}
+
+const TreeGenerator::Totals &TreeGenerator::totals() const
+{
+    return m_totals;
+}
+
+const QString &TreeGenerator::errorString() const
+{
+    return m_errorString;
+}
+
+bool TreeGenerator::shapeFor(const QString &name, Shape *shape)
+{
+    if (name == "balanced") {
+        shape->depth = 4;
+        shape->fanout = 8;
+        shape->filesPerDirectory = 16;
+    } else if (name == "deep") {
+        shape->depth = 12;
+        shape->fanout = 2;
+        shape->filesPerDirectory = 8;
+    } else if (name == "wide") {
+        shape->depth = 2;
+        shape->fanout = 64;
+        shape->filesPerDirectory = 16;
+    } else if (name == "flat") {
+        shape->depth = 0;
+        shape->fanout = 0;
+        shape->filesPerDirectory = 50000;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool TreeGenerator::writeDirectory(const QString &path, int level)
+{
+    for (int i = 0; i < m_shape.filesPerDirectory; ++i) {
+        const bool binary = chance(m_shape.binaryRatio);
+        const bool nameMatch = chance(m_shape.matchRatio);
+        const bool contentMatch = !binary && chance(m_shape.matchRatio);
+        const qint64 size = fileSize();
+        const QString name = QString("file%1%2.%3").arg(i, 5, 10, QLatin1Char('0'))
+                                 .arg(nameMatch ? QString("_") + NEEDLE : QString())
+                                 .arg(binary ? "bin" : "txt");
+        if (!writeFile(path + "/" + name, size, binary, contentMatch)) {
+            return false;
+        }
+        m_totals.files++;
+        m_totals.bytes += m_buffer.size();
+        m_totals.nameMatches += nameMatch ? 1 : 0;
+        m_totals.contentMatches += contentMatch ? 1 : 0;
+    }
+
+    if (level >= m_shape.depth) {
+        return true;
+    }
+    for (int i = 0; i < m_shape.fanout; ++i) {
+        const QString child = path + QString("/dir%1").arg(i, 3, 10, QLatin1Char('0'));
+        if (!QDir().mkdir(child)) {
+            m_errorString = QString("Cannot create %1").arg(child);
+            return false;
+        }
+        m_totals.directories++;
+        if (!writeDirectory(child, level + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TreeGenerator::writeFile(const QString &path, qint64 size, bool binary, bool match)
+{
+    const int needleLength = int(std::strlen(NEEDLE));
+    if (match) {
+        size = qMax<qint64>(size, needleLength + 2);
+    }
+
+    m_buffer.clear();
+    m_buffer.reserve(size);
+    if (binary) {
+        while (m_buffer.size() < size) {
+            quint64 bits = next();
+            for (int i = 0; i < 8 && m_buffer.size() < size; ++i, bits >>= 8) {
+                m_buffer.append(char(bits));
+            }
+        }
+        for (qint64 i = 0; i < size; i += 64) {
+            m_buffer[i] = '\0';         // Sniffed as binary however the bytes fell
+        }
+    } else {
+        int wordsOnLine = 0;
+        int lineLength = 10 + int(below(6));
+        while (m_buffer.size() < size) {
+            if (wordsOnLine == lineLength) {
+                m_buffer.append('\n');
+                wordsOnLine = 0;
+                lineLength = 10 + int(below(6));
+            } else if (wordsOnLine > 0) {
+                m_buffer.append(' ');
+            }
+            m_buffer.append(WORDS[below(WORD_COUNT)]);
+            wordsOnLine++;
+        }
+        m_buffer.truncate(size);
+        if (match) {
+            // Set apart by spaces so whole-word searches find it too
+            const qint64 offset = qint64(below(quint64(size - needleLength - 1))) + 1;
+            m_buffer[offset - 1] = ' ';
+            std::memcpy(m_buffer.data() + offset, NEEDLE, needleLength);
+            if (offset + needleLength < size) {
+                m_buffer[offset + needleLength] = ' ';
+            }
+        }
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(m_buffer) != m_buffer.size()) {
+        m_errorString = QString("Cannot write %1").arg(path);
+        return false;
+    }
+    return true;
+}
+
+quint64 TreeGenerator::next()
+{
+    // SplitMix64, the same sequence everywhere
+    quint64 z = (m_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+quint64 TreeGenerator::below(quint64 bound)
+{
+    return bound > 0 ? next() % bound : 0;
+}
+
+bool TreeGenerator::chance(double probability)
+{
+    return double(next() >> 11) < probability * double(quint64(1) << 53);
+}
+
+qint64 TreeGenerator::fileSize()
+{
+    // An octave at random, then a size within it, so small files are as common
+    // as in real trees without going through floating point logarithms
+    const qint64 minimum = qMax<qint64>(1, m_shape.minFileSize);
+    const qint64 maximum = qMax(minimum, m_shape.maxFileSize);
+    int octaves = 0;
+    while ((minimum << (octaves + 1)) <= maximum) {
+        octaves++;
+    }
+    const qint64 low = minimum << below(quint64(octaves) + 1);
+    const qint64 high = qMin(maximum, 2 * low);
+    return low + qint64(below(quint64(high - low) + 1));
+}
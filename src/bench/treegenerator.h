@@ -0,0 +1,74 @@
+#ifndef TREEGENERATOR_H
+#define TREEGENERATOR_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QtGlobal>
+
+// Writes a synthetic directory tree for benchmarks. The same shape and seed
+// always give the same tree, byte for byte, on every platform: randomness
+// comes from a fixed generator and is only ever turned into integers here,
+// never through the standard distributions, whose output differs between
+// libraries. Text files are lines of common words; some of them contain
+// NEEDLE, and some file names carry it too, so name and content searches
+// both have results to find. Binary files are random bytes with NULs.
+class TreeGenerator
+{
+public:
+    struct Shape
+    {
+        int depth = 4;                  // Directory levels below the root
+        int fanout = 8;                 // Subdirectories per directory
+        int filesPerDirectory = 16;
+        qint64 minFileSize = 256;       // Sizes are log-uniform in between
+        qint64 maxFileSize = 64 * 1024;
+        double binaryRatio = 0.1;       // Of all files
+        double matchRatio = 0.05;       // Of text files containing NEEDLE, and of names containing it
+        quint64 seed = 1;
+
+        QJsonObject toJson() const;
+    };
+
+    struct Totals
+    {
+        qint64 directories = 0;
+        qint64 files = 0;
+        qint64 bytes = 0;
+        qint64 nameMatches = 0;
+        qint64 contentMatches = 0;      // Files, not lines
+
+        QJsonObject toJson() const;
+        static Totals fromJson(const QJsonObject &object);
+    };
+
+    static constexpr const char *NEEDLE = "bobaneedle";
+    static constexpr const char *MANIFEST = "bench-tree.json";
+
+    explicit TreeGenerator(const Shape &shape);
+
+    // Reuses a tree at root whose manifest has this shape, otherwise
+    // replaces root with a new one. False with errorString() on failure.
+    bool generate(const QString &root);
+    const Totals &totals() const;
+    const QString &errorString() const;
+
+    // Presets for --shape
+    static bool shapeFor(const QString &name, Shape *shape);
+
+private:
+    bool writeDirectory(const QString &path, int level);
+    bool writeFile(const QString &path, qint64 size, bool binary, bool match);
+    quint64 next();
+    quint64 below(quint64 bound);
+    bool chance(double probability);
+    qint64 fileSize();
+
+    Shape m_shape;
+    Totals m_totals;
+    QString m_errorString;
+    quint64 m_state;
+    QByteArray m_buffer;
+};
+
+#endif // TREEGENERATOR_H
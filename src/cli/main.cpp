@@ -0,0 +1,215 @@
+#include "../search/searchmanager.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QRegularExpression>
+#include <cstdio>
+
+namespace {
+
+const char *typeName(DirScanner::EntryType type)
+{
+    switch (type) {
+    case DirScanner::File:
+        return "file";
+    case DirScanner::Directory:
+        return "dir";
+    case DirScanner::SymLink:
+        return "symlink";
+    case DirScanner::Other:
+        return "other";
+    default:
+        return "unknown";
+    }
+}
+
+void appendJson(QByteArray &out, const SearchResult &result, SearchMode mode)
+{
+    QJsonObject object;
+    object.insert("path", result.fullPath);
+    object.insert("type", typeName(result.type));
+    if (result.hasMetadata) {
+        object.insert("size", result.fileSize);
+        object.insert("mtime", result.modifiedMSecs);
+    }
+    if (mode == SearchMode::FileContent) {
+        object.insert("line", result.lineNumber);
+        object.insert("text", result.matchedLine);
+    }
+    if (result.term >= 0) {
+        object.insert("term", result.term);
+    }
+    out += QJsonDocument(object).toJson(QJsonDocument::Compact);
+    out += '\n';
+}
+
+bool parseReadOrder(const QString &text, SearchPipeline::ReadOrder *order)
+{
+    if (text == "auto") {
+        *order = SearchPipeline::Auto;
+    } else if (text == "discovery") {
+        *order = SearchPipeline::Discovery;
+    } else if (text == "physical") {
+        *order = SearchPipeline::Physical;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int fail(const QString &message)
+{
+    std::fprintf(stderr, "boba-search: %s\n", qPrintable(message));
+    return 2;
+}
+
+}
+
+// Streams the results of one search to stdout as the engine delivers them.
+// Nothing is kept once written, so memory stays bounded by the result ring
+// however many results there are; a slow reader on the other end of the pipe
+// holds up delivery, and the workers wait for the ring to drain.
+// Exits 0 when something was found, 1 when not and 2 on errors, like grep.
+// Only the cached index of the root is opened; indexes are neither watched
+// nor built here, the GUI keeps them current.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Boba");     // Shares the GUI's index cache
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Searches file names or contents below a directory.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("pattern", "What to search for.");
+    parser.addPositionalArgument("root", "Directory to search, the current one by default.", "[root]");
+
+    const QCommandLineOption contentOption({"c", "content"}, "Search file contents instead of names.");
+    const QCommandLineOption regexOption({"E", "regex"}, "Pattern is a regular expression.");
+    const QCommandLineOption globOption({"g", "glob"}, "Pattern is a glob.");
+    const QCommandLineOption termsOption({"t", "terms"}, "Pattern is a list of terms separated by spaces or commas, any of which matches.");
+    const QCommandLineOption caseOption({"s", "case-sensitive"}, "Match case.");
+    const QCommandLineOption wordOption({"w", "word"}, "Match whole words only.");
+    const QCommandLineOption binaryOption("binary", "Search binary files too.");
+    const QCommandLineOption noIgnoreOption("no-ignore", "Do not skip what .gitignore and .bobaignore files ignore.");
+    const QCommandLineOption excludeOption({"x", "exclude"}, "Ignore paths matching pattern, in .gitignore syntax. Repeatable.", "pattern");
+    const QCommandLineOption maxSizeOption("max-size", "Skip files larger than this many bytes in content searches.", "bytes");
+    const QCommandLineOption noIndexOption("no-index", "Always walk the tree, never answer from the file name index.");
+    const QCommandLineOption contentIndexOption("content-index", "Narrow content searches down with the content index.");
+    const QCommandLineOption readOrderOption("read-order", "Order of content reads: auto, discovery or physical.", "order", "auto");
+    const QCommandLineOption nullOption({"0", "null"}, "Print paths separated by NUL instead of JSON lines.");
+    const QCommandLineOption statsOption("stats", "Write per-stage counters and latencies as JSON to file when done, - for stderr.", "file");
+    const QCommandLineOption traceOption("trace", "Record a timeline of every search thread to file, as Chrome trace-event JSON.", "file");
+    const QCommandLineOption verboseOption({"v", "verbose"}, "Log what the engine does to stderr.");
+    parser.addOptions({contentOption, regexOption, globOption, termsOption, caseOption, wordOption, binaryOption,
+                       noIgnoreOption, excludeOption, maxSizeOption, noIndexOption, contentIndexOption,
+                       readOrderOption, nullOption, statsOption, traceOption, verboseOption});
+    parser.process(app);
+
+    if (!parser.isSet(verboseOption)) {
+        QLoggingCategory::setFilterRules("*.debug=false");
+    }
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty() || arguments.size() > 2) {
+        return fail("expected a pattern and at most one root, see --help");
+    }
+    const QString searchText = arguments.at(0);
+    const QFileInfo root(arguments.size() > 1 ? arguments.at(1) : QDir::currentPath());
+    if (!root.isDir()) {
+        return fail(QString("not a directory: %1").arg(root.filePath()));
+    }
+    const QString rootPath = QDir::cleanPath(root.absoluteFilePath());
+
+    SearchOptions options;
+    options.mode = parser.isSet(contentOption) ? SearchMode::FileContent : SearchMode::FileName;
+    options.caseSensitive = parser.isSet(caseOption);
+    options.wholeWord = parser.isSet(wordOption);
+    options.searchBinaryFiles = parser.isSet(binaryOption);
+    options.useIgnoreRules = !parser.isSet(noIgnoreOption);
+    options.excludePatterns += parser.values(excludeOption);
+    options.useIndex = !parser.isSet(noIndexOption);
+    options.useContentIndex = parser.isSet(contentIndexOption);
+    if (parser.isSet(maxSizeOption)) {
+        bool ok = false;
+        options.maxFileSizeBytes = parser.value(maxSizeOption).toLongLong(&ok);
+        if (!ok || options.maxFileSizeBytes < 0) {
+            return fail("--max-size takes a number of bytes");
+        }
+    }
+    if (!parseReadOrder(parser.value(readOrderOption), &options.readOrder)) {
+        return fail("--read-order is one of auto, discovery or physical");
+    }
+
+    if (int(parser.isSet(regexOption)) + int(parser.isSet(globOption)) + int(parser.isSet(termsOption)) > 1) {
+        return fail("--regex, --glob and --terms exclude each other");
+    }
+    if (parser.isSet(regexOption)) {
+        options.syntax = SearchPattern::Regex;
+    } else if (parser.isSet(globOption)) {
+        options.syntax = SearchPattern::Glob;
+    } else if (parser.isSet(termsOption)) {
+        options.syntax = SearchPattern::Terms;
+    }
+
+    // Same checks as the search box
+    if (options.syntax == SearchPattern::Terms) {
+        options.terms = searchText.split(QRegularExpression("[\\s,]+"), Qt::SkipEmptyParts);
+        if (options.terms.isEmpty()) {
+            return fail("no terms to search for");
+        }
+    } else {
+        const SearchPattern pattern(searchText, options.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive,
+                                    options.wholeWord, options.syntax);
+        if (!pattern.isValid()) {
+            return fail("invalid pattern: " + pattern.errorString());
+        }
+    }
+
+    const bool nullSeparated = parser.isSet(nullOption);
+    SearchManager manager(nullptr, IndexManager::OnDemand);
+    if (parser.isSet(traceOption)) {
+        manager.setTracePath(parser.value(traceOption));
+    }
+    QString lastPath;       // Content hits of one file come in a row, -0 prints it once
+    QByteArray out;
+
+    QObject::connect(&manager, &SearchManager::resultsFound, &app, [&](const QList<SearchResult> &results) {
+        out.clear();
+        for (const SearchResult &result : results) {
+            if (!nullSeparated) {
+                appendJson(out, result, options.mode);
+            } else if (result.fullPath != lastPath) {
+                out += QFile::encodeName(result.fullPath);
+                out += '\0';
+                lastPath = result.fullPath;
+            }
+        }
+        std::fwrite(out.constData(), 1, size_t(out.size()), stdout);
+        std::fflush(stdout);
+    });
+    const QString statsPath = parser.value(statsOption);
+    QObject::connect(&manager, &SearchManager::searchCompleted, &app, [&](int totalResults) {
+        if (!statsPath.isEmpty()) {
+            const QByteArray json = QJsonDocument(manager.statsJson()).toJson();
+            QFile file(statsPath);
+            const bool opened = statsPath == "-" ? file.open(stderr, QIODevice::WriteOnly) : file.open(QIODevice::WriteOnly);
+            if (!opened || file.write(json) != json.size()) {
+                QCoreApplication::exit(fail("cannot write " + statsPath));
+                return;
+            }
+        }
+        QCoreApplication::exit(totalResults > 0 ? 0 : 1);
+    });
+    QObject::connect(&manager, &SearchManager::searchCancelled, &app, []() {
+        QCoreApplication::exit(2);
+    });
+
+    manager.startSearch(searchText, rootPath, options);
+    return app.exec();
+}
@@ -0,0 +1,834 @@
+#include "contentindex.h"
+#include "../search/filesniffer.h"
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <algorithm>
+
+namespace {
+
+// Spilled posting lists of one segment, sorted by key
+struct SegmentEntry
+{
+    quint32 key;
+    quint32 count;
+    quint32 firstId;
+    quint32 lastId;
+    quint64 offset;
+    quint64 size;
+};
+
+const int MAX_QUERY_TRIGRAMS = 8;
+
+quint64 alignTo8(quint64 value)
+{
+    return (value + 7) & ~quint64(7);
+}
+
+void appendVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+int varintLength(quint32 value)
+{
+    int length = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+quint32 readVarint(const uchar *&data, const uchar *end)
+{
+    quint32 value = 0;
+    int shift = 0;
+    while (data < end) {
+        uchar byte = *data++;
+        value |= quint32(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    return value;
+}
+
+quint32 trigramKey(const char *bytes)
+{
+    return (quint32(uchar(bytes[0])) << 16) | (quint32(uchar(bytes[1])) << 8) | quint32(uchar(bytes[2]));
+}
+
+bool isAscii(const QByteArray &data)
+{
+    for (char c : data) {
+        if (uchar(c) >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Case-folds text the same way QString::contains(..., Qt::CaseInsensitive) compares it
+QByteArray foldContent(const QByteArray &data)
+{
+    if (isAscii(data)) {
+        return data.toLower();
+    }
+    return QString::fromUtf8(data).toCaseFolded().toUtf8();
+}
+
+void collectTrigrams(const QByteArray &folded, std::vector<quint32> &keys)
+{
+    keys.clear();
+    keys.reserve(folded.size());
+    for (qsizetype i = 0; i + 3 <= folded.size(); ++i) {
+        keys.push_back(trigramKey(folded.constData() + i));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+}
+
+
+
+ContentIndex::ContentIndex(const QString &indexPath)
+    : m_file(indexPath)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_files(nullptr)
+    , m_dirs(nullptr)
+    , m_names(nullptr)
+    , m_trigrams(nullptr)
+    , m_postings(nullptr)
+{
+}
+
+ContentIndex::~ContentIndex()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+    }
+    m_file.close();
+}
+
+std::shared_ptr<ContentIndex> ContentIndex::open(const QString &indexPath)
+{
+    std::shared_ptr<ContentIndex> index(new ContentIndex(indexPath));
+    if (!index->map()) {
+        return nullptr;
+    }
+    return index;
+}
+
+bool ContentIndex::map()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(ContentIndexHeader))) {
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        qDebug() << "Failed to map content index" << m_file.fileName();
+        return false;
+    }
+
+    m_header = reinterpret_cast<const ContentIndexHeader *>(m_data);
+    const quint64 size = quint64(m_size);
+    const ContentIndexHeader &h = *m_header;
+    if (h.magic != Magic || h.version != Version || h.dirCount == 0) {
+        return false;
+    }
+    if (h.filesOffset > size || h.dirsOffset > size || h.namesOffset > size || h.trigramsOffset > size
+        || h.postingsOffset > size
+        || quint64(h.fileCount) * sizeof(ContentIndexFile) > size - h.filesOffset
+        || quint64(h.dirCount) * sizeof(ContentIndexDir) > size - h.dirsOffset
+        || h.namesSize > size - h.namesOffset
+        || quint64(h.trigramCount) * sizeof(ContentIndexTrigram) > size - h.trigramsOffset
+        || h.postingsSize > size - h.postingsOffset) {
+        qDebug() << "Corrupt content index" << m_file.fileName();
+        return false;
+    }
+
+    m_files = reinterpret_cast<const ContentIndexFile *>(m_data + h.filesOffset);
+    m_dirs = reinterpret_cast<const ContentIndexDir *>(m_data + h.dirsOffset);
+    m_names = reinterpret_cast<const char *>(m_data + h.namesOffset);
+    m_trigrams = reinterpret_cast<const ContentIndexTrigram *>(m_data + h.trigramsOffset);
+    m_postings = m_data + h.postingsOffset;
+
+    for (quint32 i = 0; i < h.trigramCount; ++i) {
+        if (m_trigrams[i].offset > h.postingsSize || m_trigrams[i].size > h.postingsSize - m_trigrams[i].offset) {
+            qDebug() << "Corrupt content index postings" << m_file.fileName();
+            return false;
+        }
+    }
+
+    // Lookups descend through subtree ends and file ranges without checking them,
+    // so every directory has to nest in pre-order within its parent, files included
+    std::vector<quint32> ancestors;
+    for (quint32 id = 0; id < h.dirCount; ++id) {
+        const ContentIndexDir &dir = m_dirs[id];
+        if (quint64(dir.pathOffset) + dir.pathLength > h.namesSize
+            || dir.subtreeDirEnd <= id || dir.subtreeDirEnd > h.dirCount
+            || dir.firstFile > dir.ownFileEnd || dir.ownFileEnd > dir.subtreeFileEnd || dir.subtreeFileEnd > h.fileCount) {
+            qDebug() << "Corrupt content index directories" << m_file.fileName();
+            return false;
+        }
+
+        while (!ancestors.empty() && m_dirs[ancestors.back()].subtreeDirEnd <= id) {
+            ancestors.pop_back();
+        }
+        if (id == 0 ? dir.subtreeDirEnd != h.dirCount : ancestors.empty()) {
+            qDebug() << "Corrupt content index directories" << m_file.fileName();
+            return false;
+        }
+        if (id > 0) {
+            const ContentIndexDir &parent = m_dirs[ancestors.back()];
+            if (dir.subtreeDirEnd > parent.subtreeDirEnd
+                || dir.firstFile < parent.ownFileEnd || dir.subtreeFileEnd > parent.subtreeFileEnd) {
+                qDebug() << "Corrupt content index directories" << m_file.fileName();
+                return false;
+            }
+        }
+        ancestors.push_back(id);
+    }
+    for (quint32 id = 0; id < h.fileCount; ++id) {
+        const ContentIndexFile &file = m_files[id];
+        if (quint64(file.nameOffset) + file.nameLength > h.namesSize || file.dirId >= h.dirCount) {
+            qDebug() << "Corrupt content index files" << m_file.fileName();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QString ContentIndex::indexPath() const
+{
+    return m_file.fileName();
+}
+
+QString ContentIndex::rootPath() const
+{
+    // The root directory stores its absolute path
+    const ContentIndexDir &root = m_dirs[0];
+    return QString::fromUtf8(m_names + root.pathOffset, root.pathLength);
+}
+
+QDateTime ContentIndex::builtAt() const
+{
+    return QDateTime::fromMSecsSinceEpoch(m_header->builtAtMSecs);
+}
+
+quint32 ContentIndex::fileCount() const
+{
+    return m_header->fileCount;
+}
+
+qint64 ContentIndex::maxFileSize() const
+{
+    return m_header->maxFileSize;
+}
+
+quint32 ContentIndex::findDir(const QString &path) const
+{
+    const QString cleanPath = QDir::cleanPath(path);
+    const QString root = rootPath();
+    if (cleanPath == root) {
+        return 0;
+    }
+
+    const QString prefix = root.endsWith('/') ? root : root + '/';
+    if (!cleanPath.startsWith(prefix)) {
+        return InvalidId;
+    }
+
+    // Descend through the pre-order table, skipping over sibling subtrees
+    const QByteArray relative = cleanPath.mid(prefix.length()).toUtf8();
+    quint32 current = 0;
+    for (;;) {
+        quint32 child = current + 1;
+        const quint32 end = m_dirs[current].subtreeDirEnd;
+        for (; child < end; child = m_dirs[child].subtreeDirEnd) {
+            const QByteArray childPath = QByteArray::fromRawData(m_names + m_dirs[child].pathOffset,
+                                                                 m_dirs[child].pathLength);
+            if (relative == childPath) {
+                return child;
+            }
+            if (relative.startsWith(childPath) && relative.at(childPath.size()) == '/') {
+                break;
+            }
+        }
+        if (child >= end) {
+            return InvalidId;
+        }
+        current = child;
+    }
+}
+
+QString ContentIndex::dirPath(quint32 dirId) const
+{
+    if (dirId == 0) {
+        return rootPath();
+    }
+
+    const ContentIndexDir &dir = m_dirs[dirId];
+    QString root = rootPath();
+    if (!root.endsWith('/')) {
+        root += '/';
+    }
+    return root + QString::fromUtf8(m_names + dir.pathOffset, dir.pathLength);
+}
+
+QString ContentIndex::filePath(quint32 fileId) const
+{
+    const ContentIndexFile &file = m_files[fileId];
+    return dirPath(file.dirId) + '/' + QString::fromUtf8(m_names + file.nameOffset, file.nameLength);
+}
+
+QStringList ContentIndex::candidates(const QStringList &texts, quint32 dirId, qint64 maxFileSize, bool includeBinary,
+                                     const std::function<bool()> &shouldStop, bool verifyTimestamps) const
+{
+    QStringList paths;
+    if (dirId >= m_header->dirCount) {
+        return paths;
+    }
+
+    // A file holding any of the texts can match. Their postings are merged first,
+    // so flags and timestamps are checked once however many texts there are.
+    const quint32 first = m_dirs[dirId].firstFile;
+    const quint32 last = m_dirs[dirId].subtreeFileEnd;
+    std::vector<bool> isCandidate(last - first, texts.isEmpty());
+    for (const QString &text : texts) {
+        markCandidates(text, first, last, isCandidate);
+    }
+
+    // Files the index could not cover are always searched
+    for (quint32 id = first; id < last; ++id) {
+        if ((m_files[id].flags & Unindexed) && m_files[id].size <= maxFileSize) {
+            isCandidate[id - first] = true;
+        }
+    }
+
+    // Searches skip binaries unless told otherwise, no need to hand them over
+    for (quint32 id = first; id < last; ++id) {
+        if (!includeBinary && (m_files[id].flags & Binary)) {
+            isCandidate[id - first] = false;
+        }
+    }
+
+    for (quint32 id = first; id < last; ++id) {
+        if (isCandidate[id - first]) {
+            paths.append(filePath(id));
+        }
+    }
+
+    if (verifyTimestamps) {
+        collectChangedFiles(dirId, isCandidate, paths, shouldStop);
+    }
+    return paths;
+}
+
+QStringList ContentIndex::changedFiles(quint32 dirId, const std::function<bool()> &shouldStop) const
+{
+    QStringList paths;
+    if (dirId >= m_header->dirCount) {
+        return paths;
+    }
+
+    const std::vector<bool> isCandidate(m_dirs[dirId].subtreeFileEnd - m_dirs[dirId].firstFile, false);
+    collectChangedFiles(dirId, isCandidate, paths, shouldStop);
+    return paths;
+}
+
+void ContentIndex::markCandidates(const QString &text, quint32 first, quint32 last, std::vector<bool> &isCandidate) const
+{
+    std::vector<quint32> keys;
+    collectTrigrams(text.toCaseFolded().toUtf8(), keys);
+
+    if (keys.empty()) {
+        // Too short to prune anything
+        std::fill(isCandidate.begin(), isCandidate.end(), true);
+        return;
+    }
+
+    std::vector<const ContentIndexTrigram *> lists;
+    for (quint32 key : keys) {
+        const ContentIndexTrigram *trigram = findTrigram(key);
+        if (!trigram) {
+            return;
+        }
+        lists.push_back(trigram);
+    }
+
+    // Intersecting the rarest lists is enough to stay a superset
+    std::sort(lists.begin(), lists.end(), [](const ContentIndexTrigram *a, const ContentIndexTrigram *b) {
+        return a->count < b->count;
+    });
+    if (lists.size() > size_t(MAX_QUERY_TRIGRAMS)) {
+        lists.resize(MAX_QUERY_TRIGRAMS);
+    }
+
+    std::vector<quint32> ids = decodePostings(lists[0], first, last);
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+        std::vector<quint32> other = decodePostings(lists[i], first, last);
+        std::vector<quint32> merged;
+        std::set_intersection(ids.begin(), ids.end(), other.begin(), other.end(), std::back_inserter(merged));
+        ids.swap(merged);
+    }
+
+    for (quint32 id : ids) {
+        isCandidate[id - first] = true;
+    }
+}
+
+const ContentIndexTrigram *ContentIndex::findTrigram(quint32 key) const
+{
+    const ContentIndexTrigram *begin = m_trigrams;
+    const ContentIndexTrigram *end = m_trigrams + m_header->trigramCount;
+    const ContentIndexTrigram *it = std::lower_bound(begin, end, key, [](const ContentIndexTrigram &t, quint32 k) {
+        return t.key < k;
+    });
+    return (it != end && it->key == key) ? it : nullptr;
+}
+
+std::vector<quint32> ContentIndex::decodePostings(const ContentIndexTrigram *trigram, quint32 first, quint32 last) const
+{
+    std::vector<quint32> ids;
+    const uchar *data = m_postings + trigram->offset;
+    const uchar *end = data + trigram->size;
+
+    quint32 id = 0;
+    for (quint32 i = 0; i < trigram->count && data < end; ++i) {
+        id += readVarint(data, end);
+        if (id >= last) {
+            break;
+        }
+        if (id >= first) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+void ContentIndex::collectChangedFiles(quint32 dirId, const std::vector<bool> &isCandidate,
+                                       QStringList &paths, const std::function<bool()> &shouldStop) const
+{
+    const quint32 first = m_dirs[dirId].firstFile;
+    const quint32 dirEnd = m_dirs[dirId].subtreeDirEnd;
+
+    for (quint32 d = dirId; d < dirEnd; ++d) {
+        if (shouldStop()) {
+            return;
+        }
+
+        const ContentIndexDir &dir = m_dirs[d];
+        const QString path = dirPath(d);
+
+        // Modified files no longer match their postings
+        for (quint32 id = dir.firstFile; id < dir.ownFileEnd; ++id) {
+            if (isCandidate[id - first]) {
+                continue;
+            }
+            QFileInfo fileInfo(filePath(id));
+            if (fileInfo.exists()
+                && (fileInfo.size() != m_files[id].size
+                    || fileInfo.lastModified().toMSecsSinceEpoch() != m_files[id].mtimeMSecs)) {
+                paths.append(fileInfo.absoluteFilePath());
+            }
+        }
+
+        // Unchanged directories cannot have gained entries
+        QFileInfo dirInfo(path);
+        if (!dirInfo.exists() || dirInfo.lastModified().toMSecsSinceEpoch() == dir.mtimeMSecs) {
+            continue;
+        }
+
+        QSet<QString> known;
+        for (quint32 id = dir.firstFile; id < dir.ownFileEnd; ++id) {
+            known.insert(QString::fromUtf8(m_names + m_files[id].nameOffset, m_files[id].nameLength));
+        }
+        for (quint32 child = d + 1; child < dir.subtreeDirEnd; child = m_dirs[child].subtreeDirEnd) {
+            known.insert(QFileInfo(dirPath(child)).fileName());
+        }
+
+        QDir qdir(path);
+        const QFileInfoList entries = qdir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+        for (const QFileInfo &entry : entries) {
+            if (known.contains(entry.fileName())) {
+                continue;
+            }
+            if (entry.isFile()) {
+                paths.append(entry.absoluteFilePath());
+            } else if (entry.isDir()) {
+                // A new subdirectory, everything below it is new
+                QDirIterator it(entry.absoluteFilePath(), QDir::Files | QDir::Hidden | QDir::System, QDirIterator::Subdirectories);
+                while (it.hasNext() && !shouldStop()) {
+                    paths.append(it.next());
+                }
+            }
+        }
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// Content index writer
+ContentIndexWriter::ContentIndexWriter(const QString &rootPath, const QString &indexPath, qint64 maxFileSize)
+    : m_rootPath(QDir::cleanPath(rootPath))
+    , m_indexPath(indexPath)
+    , m_maxFileSize(maxFileSize)
+    , m_postingBytes(0)
+    , m_stopped(false)
+{
+}
+
+ContentIndexWriter::~ContentIndexWriter()
+{
+    for (const QString &segment : m_segments) {
+        QFile::remove(segment);
+    }
+}
+
+bool ContentIndexWriter::build(const std::function<bool()> &shouldStop)
+{
+    walk(m_rootPath, QString(), shouldStop);
+    if (m_stopped) {
+        return false;
+    }
+
+    // The root stores its absolute path instead of an empty relative one
+    m_dirs[0].pathOffset = quint32(m_names.size());
+    m_dirs[0].pathLength = quint32(m_rootPath.toUtf8().size());
+    m_names.append(m_rootPath.toUtf8());
+
+    return flushSegment() && writeIndex();
+}
+
+quint32 ContentIndexWriter::fileCount() const
+{
+    return quint32(m_files.size());
+}
+
+void ContentIndexWriter::walk(const QString &dirPath, const QString &relativePath, const std::function<bool()> &shouldStop)
+{
+    if (shouldStop()) {
+        m_stopped = true;
+        return;
+    }
+
+    const quint32 dirId = quint32(m_dirs.size());
+    const QByteArray relativeName = relativePath.toUtf8();
+
+    ContentIndexDir dir;
+    dir.pathOffset = quint32(m_names.size());
+    dir.pathLength = quint32(relativeName.size());
+    dir.firstFile = quint32(m_files.size());
+    dir.ownFileEnd = dir.firstFile;
+    dir.subtreeFileEnd = dir.firstFile;
+    dir.subtreeDirEnd = dirId + 1;
+    dir.mtimeMSecs = QFileInfo(dirPath).lastModified().toMSecsSinceEpoch();
+    m_dirs.push_back(dir);
+    m_names.append(relativeName);
+
+    QDir qdir(dirPath);
+    const QFileInfoList entries = qdir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+
+    // Files first so each directory's own files stay contiguous
+    QFileInfoList subdirs;
+    for (const QFileInfo &fileInfo : entries) {
+        if (fileInfo.isDir()) {
+            if (!fileInfo.isSymLink()) {
+                subdirs.append(fileInfo);
+            }
+            continue;
+        }
+        if (shouldStop()) {
+            m_stopped = true;
+            return;
+        }
+
+        const QByteArray name = fileInfo.fileName().toUtf8();
+        ContentIndexFile file;
+        file.nameOffset = quint32(m_names.size());
+        file.nameLength = quint32(name.size());
+        file.dirId = dirId;
+        file.flags = 0;
+        file.size = fileInfo.size();
+        file.mtimeMSecs = fileInfo.lastModified().toMSecsSinceEpoch();
+        m_names.append(name);
+
+        const quint32 fileId = quint32(m_files.size());
+        indexFile(fileId, fileInfo.absoluteFilePath(), file);
+        m_files.push_back(file);
+
+        if (m_postingBytes > MEMORY_BUDGET && !flushSegment()) {
+            m_stopped = true;
+            return;
+        }
+    }
+    m_dirs[dirId].ownFileEnd = quint32(m_files.size());
+
+    for (const QFileInfo &subdir : subdirs) {
+        const QString childRelative = relativePath.isEmpty() ? subdir.fileName() : relativePath + '/' + subdir.fileName();
+        walk(subdir.absoluteFilePath(), childRelative, shouldStop);
+        if (m_stopped) {
+            return;
+        }
+    }
+
+    m_dirs[dirId].subtreeFileEnd = quint32(m_files.size());
+    m_dirs[dirId].subtreeDirEnd = quint32(m_dirs.size());
+}
+
+void ContentIndexWriter::indexFile(quint32 fileId, const QString &filePath, ContentIndexFile &file)
+{
+    if (file.size > m_maxFileSize) {
+        file.flags |= ContentIndex::Unindexed;
+        return;
+    }
+
+    QFile input(filePath);
+    if (!input.open(QIODevice::ReadOnly)) {
+        file.flags |= ContentIndex::Unindexed;
+        return;
+    }
+
+    // Indexed as the matcher sees it: text converted to UTF-8, binaries as they are
+    const QByteArray data = input.readAll();
+    const FileSniffer::Encoding encoding = FileSniffer::sniff(data.constData(), data.size());
+    if (encoding == FileSniffer::Binary) {
+        file.flags |= ContentIndex::Binary;
+        collectTrigrams(foldContent(data), m_keys);
+    } else {
+        collectTrigrams(foldContent(FileSniffer::toUtf8(data.constData(), data.size(), encoding)), m_keys);
+    }
+    for (quint32 key : m_keys) {
+        addPosting(key, fileId);
+    }
+}
+
+void ContentIndexWriter::addPosting(quint32 key, quint32 fileId)
+{
+    auto inserted = m_postings.try_emplace(key);
+    Posting &posting = inserted.first->second;
+    if (inserted.second) {
+        posting.firstId = fileId;
+        m_postingBytes += 64;   // Rough per-list overhead
+    }
+
+    // Lists start with an absolute id, deltas follow
+    const quint32 delta = posting.count == 0 ? fileId : fileId - posting.lastId;
+    const qsizetype before = posting.bytes.size();
+    appendVarint(posting.bytes, delta);
+    m_postingBytes += posting.bytes.size() - before;
+    posting.lastId = fileId;
+    posting.count++;
+}
+
+bool ContentIndexWriter::flushSegment()
+{
+    if (m_postings.empty()) {
+        return true;
+    }
+
+    std::vector<quint32> keys;
+    keys.reserve(m_postings.size());
+    for (const auto &posting : m_postings) {
+        keys.push_back(posting.first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<SegmentEntry> entries;
+    entries.reserve(keys.size());
+    quint64 offset = 0;
+    for (quint32 key : keys) {
+        const Posting &posting = m_postings[key];
+        entries.push_back({key, posting.count, posting.firstId, posting.lastId, offset, quint64(posting.bytes.size())});
+        offset += posting.bytes.size();
+    }
+
+    const QString segmentPath = QString("%1.seg%2").arg(m_indexPath).arg(m_segments.size());
+    QFile segment(segmentPath);
+    if (!segment.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Cannot write index segment" << segmentPath;
+        return false;
+    }
+
+    const quint64 entryCount = entries.size();
+    segment.write(reinterpret_cast<const char *>(&entryCount), sizeof(entryCount));
+    segment.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(SegmentEntry));
+    for (quint32 key : keys) {
+        segment.write(m_postings[key].bytes);
+    }
+    segment.close();
+
+    m_segments.append(segmentPath);
+    m_postings.clear();
+    m_postingBytes = 0;
+    return true;
+}
+
+bool ContentIndexWriter::writeIndex()
+{
+    // Map every segment and gather its lists by key. Segments cover
+    // increasing file id ranges, so lists are concatenated in segment order.
+    struct MappedSegment
+    {
+        std::unique_ptr<QFile> file;
+        const uchar *data = nullptr;
+        const SegmentEntry *entries = nullptr;
+        quint64 entryCount = 0;
+        quint64 dataOffset = 0;
+    };
+    struct ListRef
+    {
+        quint32 key;
+        quint32 segment;
+        const SegmentEntry *entry;
+    };
+
+    std::vector<MappedSegment> segments;
+    std::vector<ListRef> refs;
+    for (const QString &segmentPath : m_segments) {
+        MappedSegment mapped;
+        mapped.file.reset(new QFile(segmentPath));
+        if (!mapped.file->open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        mapped.data = mapped.file->map(0, mapped.file->size());
+        if (!mapped.data) {
+            return false;
+        }
+        mapped.entryCount = *reinterpret_cast<const quint64 *>(mapped.data);
+        mapped.entries = reinterpret_cast<const SegmentEntry *>(mapped.data + sizeof(quint64));
+        mapped.dataOffset = sizeof(quint64) + mapped.entryCount * sizeof(SegmentEntry);
+        for (quint64 i = 0; i < mapped.entryCount; ++i) {
+            refs.push_back({mapped.entries[i].key, quint32(segments.size()), &mapped.entries[i]});
+        }
+        segments.push_back(std::move(mapped));
+    }
+
+    std::stable_sort(refs.begin(), refs.end(), [](const ListRef &a, const ListRef &b) {
+        return a.key < b.key;
+    });
+
+    // Size every merged list up front so the table can precede the postings
+    std::vector<ContentIndexTrigram> trigrams;
+    quint64 postingsSize = 0;
+    for (size_t i = 0; i < refs.size();) {
+        ContentIndexTrigram trigram = {refs[i].key, 0, postingsSize, 0, refs[i].entry->firstId};
+        quint32 previousLast = 0;
+        for (; i < refs.size() && refs[i].key == trigram.key; ++i) {
+            const SegmentEntry *entry = refs[i].entry;
+            quint64 size = entry->size;
+            if (trigram.count > 0) {
+                size = size - varintLength(entry->firstId) + varintLength(entry->firstId - previousLast);
+            }
+            trigram.size += quint32(size);
+            trigram.count += entry->count;
+            previousLast = entry->lastId;
+        }
+        postingsSize += trigram.size;
+        trigrams.push_back(trigram);
+    }
+
+    ContentIndexHeader header;
+    header.magic = ContentIndex::Magic;
+    header.version = ContentIndex::Version;
+    header.fileCount = quint32(m_files.size());
+    header.dirCount = quint32(m_dirs.size());
+    header.trigramCount = quint32(trigrams.size());
+    header.reserved = 0;
+    header.filesOffset = alignTo8(sizeof(ContentIndexHeader));
+    header.dirsOffset = header.filesOffset + quint64(m_files.size()) * sizeof(ContentIndexFile);
+    header.namesOffset = header.dirsOffset + quint64(m_dirs.size()) * sizeof(ContentIndexDir);
+    header.namesSize = quint64(m_names.size());
+    header.trigramsOffset = alignTo8(header.namesOffset + header.namesSize);
+    header.postingsOffset = header.trigramsOffset + quint64(trigrams.size()) * sizeof(ContentIndexTrigram);
+    header.postingsSize = postingsSize;
+    header.maxFileSize = m_maxFileSize;
+    header.builtAtMSecs = QDateTime::currentMSecsSinceEpoch();
+
+    QSaveFile file(m_indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write content index" << m_indexPath;
+        return false;
+    }
+
+    const QByteArray padding(8, '\0');
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding.constData(), header.filesOffset - sizeof(header));
+    file.write(reinterpret_cast<const char *>(m_files.data()), m_files.size() * sizeof(ContentIndexFile));
+    file.write(reinterpret_cast<const char *>(m_dirs.data()), m_dirs.size() * sizeof(ContentIndexDir));
+    file.write(m_names);
+    file.write(padding.constData(), header.trigramsOffset - header.namesOffset - header.namesSize);
+    file.write(reinterpret_cast<const char *>(trigrams.data()), trigrams.size() * sizeof(ContentIndexTrigram));
+
+    QByteArray rebased;
+    for (size_t i = 0; i < refs.size();) {
+        const quint32 key = refs[i].key;
+        bool firstList = true;
+        quint32 previousLast = 0;
+        for (; i < refs.size() && refs[i].key == key; ++i) {
+            const MappedSegment &segment = segments[refs[i].segment];
+            const SegmentEntry *entry = refs[i].entry;
+            const uchar *data = segment.data + segment.dataOffset + entry->offset;
+            const uchar *end = data + entry->size;
+
+            if (!firstList) {
+                // Rebase the leading absolute id onto the previous segment's last id
+                readVarint(data, end);
+                rebased.clear();
+                appendVarint(rebased, entry->firstId - previousLast);
+                file.write(rebased);
+            }
+            file.write(reinterpret_cast<const char *>(data), end - data);
+            firstList = false;
+            previousLast = entry->lastId;
+        }
+    }
+
+    if (!file.commit()) {
+        qDebug() << "Failed to commit content index" << m_indexPath;
+        return false;
+    }
+
+    qDebug() << "Wrote content index for" << m_rootPath << ":" << m_files.size() << "files,"
+             << trigrams.size() << "trigrams," << postingsSize << "posting bytes";
+    return true;
+}
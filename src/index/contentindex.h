@@ -0,0 +1,172 @@
+#ifndef CONTENTINDEX_H
+#define CONTENTINDEX_H
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QStringList>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// On-disk layout of a content index. Like the filename index, sections are
+// in native byte order and 8-byte aligned so they can be read in place.
+// Posting lists are delta-encoded file ids stored as LEB128 varints.
+struct ContentIndexHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 fileCount;
+    quint32 dirCount;
+    quint32 trigramCount;
+    quint32 reserved;
+    quint64 filesOffset;
+    quint64 dirsOffset;
+    quint64 namesOffset;
+    quint64 namesSize;
+    quint64 trigramsOffset;
+    quint64 postingsOffset;
+    quint64 postingsSize;
+    qint64 maxFileSize;
+    qint64 builtAtMSecs;
+};
+
+struct ContentIndexFile
+{
+    quint32 nameOffset;
+    quint32 nameLength;
+    quint32 dirId;
+    quint32 flags;
+    qint64 size;
+    qint64 mtimeMSecs;
+};
+
+// Directories are stored in pre-order; their files are contiguous and
+// followed by the files of their subdirectories.
+struct ContentIndexDir
+{
+    quint32 pathOffset;     // Path relative to the root ("" for the root)
+    quint32 pathLength;
+    quint32 firstFile;
+    quint32 ownFileEnd;
+    quint32 subtreeFileEnd;
+    quint32 subtreeDirEnd;
+    qint64 mtimeMSecs;
+};
+
+struct ContentIndexTrigram
+{
+    quint32 key;
+    quint32 count;
+    quint64 offset;         // Byte offset into the postings section
+    quint32 size;           // Encoded size in bytes
+    quint32 firstId;
+};
+
+
+
+// Read-only view of a memory-mapped content index.
+class ContentIndex
+{
+public:
+    enum FileFlag : quint32
+    {
+        Unindexed = 0x1,    // Unreadable or over the size limit, must always be searched
+        Binary = 0x2,       // Indexed by its raw bytes, text is indexed as UTF-8
+    };
+
+    static constexpr quint32 Magic = 0x43424f42;   // "BOBC"
+    static constexpr quint32 Version = 2;
+    static constexpr quint32 InvalidId = 0xffffffff;
+
+    static std::shared_ptr<ContentIndex> open(const QString &indexPath);
+    ~ContentIndex();
+
+    QString indexPath() const;
+    QString rootPath() const;
+    QDateTime builtAt() const;
+    quint32 fileCount() const;
+    qint64 maxFileSize() const;
+
+    quint32 findDir(const QString &path) const;
+    QString dirPath(quint32 dirId) const;
+    QString filePath(quint32 fileId) const;
+
+    // Returns the absolute paths of every file below dirId that may contain
+    // any of texts (case-insensitively), every file when texts is empty. With
+    // verifyTimestamps, files changed or created since the index was built are
+    // included by checking file and directory timestamps. Binary files are
+    // left out unless includeBinary.
+    QStringList candidates(const QStringList &texts, quint32 dirId, qint64 maxFileSize, bool includeBinary,
+                           const std::function<bool()> &shouldStop, bool verifyTimestamps = true) const;
+    // Returns the files below dirId changed or created since the index was built
+    QStringList changedFiles(quint32 dirId, const std::function<bool()> &shouldStop) const;
+
+private:
+    ContentIndex(const QString &indexPath);
+    bool map();
+    const ContentIndexTrigram *findTrigram(quint32 key) const;
+    std::vector<quint32> decodePostings(const ContentIndexTrigram *trigram, quint32 first, quint32 last) const;
+    // Sets isCandidate for the files from first on that may contain text
+    void markCandidates(const QString &text, quint32 first, quint32 last, std::vector<bool> &isCandidate) const;
+    void collectChangedFiles(quint32 dirId, const std::vector<bool> &isCandidate,
+                             QStringList &paths, const std::function<bool()> &shouldStop) const;
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    const ContentIndexHeader *m_header;
+    const ContentIndexFile *m_files;
+    const ContentIndexDir *m_dirs;
+    const char *m_names;
+    const ContentIndexTrigram *m_trigrams;
+    const uchar *m_postings;
+};
+
+
+
+// Reads every file below a root and writes a content index for it.
+// Posting lists are spilled to segment files whenever they exceed the
+// memory budget and merged when the index is written.
+class ContentIndexWriter
+{
+public:
+    ContentIndexWriter(const QString &rootPath, const QString &indexPath, qint64 maxFileSize);
+    ~ContentIndexWriter();
+
+    bool build(const std::function<bool()> &shouldStop);
+    quint32 fileCount() const;
+
+private:
+    struct Posting
+    {
+        QByteArray bytes;
+        quint32 count = 0;
+        quint32 firstId = 0;
+        quint32 lastId = 0;
+    };
+
+    void walk(const QString &dirPath, const QString &relativePath, const std::function<bool()> &shouldStop);
+    void indexFile(quint32 fileId, const QString &filePath, ContentIndexFile &file);
+    void addPosting(quint32 key, quint32 fileId);
+    bool flushSegment();
+    bool writeIndex();
+
+    static constexpr qint64 MEMORY_BUDGET = 256 * 1024 * 1024;
+
+    QString m_rootPath;
+    QString m_indexPath;
+    qint64 m_maxFileSize;
+    std::vector<ContentIndexFile> m_files;
+    std::vector<ContentIndexDir> m_dirs;
+    QByteArray m_names;
+    std::unordered_map<quint32, Posting> m_postings;
+    qint64 m_postingBytes;
+    QStringList m_segments;
+    std::vector<quint32> m_keys;
+    bool m_stopped;
+};
+
+#endif // CONTENTINDEX_H
@@ -0,0 +1,454 @@
+#include "filenameindex.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace {
+
+quint64 alignTo8(quint64 value)
+{
+    return (value + 7) & ~quint64(7);
+}
+
+// Collects the distinct trigram keys of a case-folded UTF-8 string
+void collectTrigrams(const QByteArray &folded, std::vector<quint32> &keys)
+{
+    keys.clear();
+    for (qsizetype i = 0; i + 3 <= folded.size(); ++i) {
+        keys.push_back(FileNameIndex::trigramKey(folded.constData() + i));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+}
+
+
+
+FileNameIndex::FileNameIndex(const QString &indexPath)
+    : m_file(indexPath)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_entries(nullptr)
+    , m_names(nullptr)
+    , m_trigrams(nullptr)
+    , m_postings(nullptr)
+{
+}
+
+FileNameIndex::~FileNameIndex()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+    }
+    m_file.close();
+}
+
+std::shared_ptr<FileNameIndex> FileNameIndex::open(const QString &indexPath)
+{
+    std::shared_ptr<FileNameIndex> index(new FileNameIndex(indexPath));
+    if (!index->map()) {
+        return nullptr;
+    }
+    return index;
+}
+
+bool FileNameIndex::map()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(FileNameIndexHeader))) {
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        qDebug() << "Failed to map index" << m_file.fileName();
+        return false;
+    }
+
+    // Validate the header before trusting any offsets
+    m_header = reinterpret_cast<const FileNameIndexHeader *>(m_data);
+    const quint64 size = quint64(m_size);
+    const FileNameIndexHeader &h = *m_header;
+    if (h.magic != Magic || h.version != Version || h.entryCount == 0) {
+        return false;
+    }
+    if (h.entriesOffset > size || h.namesOffset > size || h.trigramsOffset > size || h.postingsOffset > size
+        || quint64(h.entryCount) * sizeof(FileNameIndexEntry) > size - h.entriesOffset
+        || h.namesSize > size - h.namesOffset
+        || quint64(h.trigramCount) * sizeof(FileNameIndexTrigram) > size - h.trigramsOffset) {
+        qDebug() << "Corrupt index" << m_file.fileName();
+        return false;
+    }
+
+    m_entries = reinterpret_cast<const FileNameIndexEntry *>(m_data + h.entriesOffset);
+    m_names = reinterpret_cast<const char *>(m_data + h.namesOffset);
+    m_trigrams = reinterpret_cast<const FileNameIndexTrigram *>(m_data + h.trigramsOffset);
+    m_postings = reinterpret_cast<const quint32 *>(m_data + h.postingsOffset);
+
+    const quint64 postingCapacity = (size - h.postingsOffset) / sizeof(quint32);
+    for (quint32 i = 0; i < h.trigramCount; ++i) {
+        if (m_trigrams[i].offset > postingCapacity || m_trigrams[i].count > postingCapacity - m_trigrams[i].offset) {
+            qDebug() << "Corrupt index postings" << m_file.fileName();
+            return false;
+        }
+    }
+
+    // Lookups follow names, parents and subtree ends without checking them,
+    // so every entry has to lie within the file and nest in pre-order
+    for (quint32 id = 0; id < h.entryCount; ++id) {
+        const FileNameIndexEntry &entry = m_entries[id];
+        if (quint64(entry.nameOffset) + entry.nameLength > h.namesSize
+            || entry.subtreeEnd <= id || entry.subtreeEnd > h.entryCount) {
+            qDebug() << "Corrupt index entries" << m_file.fileName();
+            return false;
+        }
+        if (id == 0) {
+            continue;
+        }
+        const FileNameIndexEntry &parent = m_entries[entry.parent < id ? entry.parent : 0];
+        if (entry.parent >= id || parent.subtreeEnd < entry.subtreeEnd || !(parent.flags & Directory)) {
+            qDebug() << "Corrupt index entries" << m_file.fileName();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QString FileNameIndex::indexPath() const
+{
+    return m_file.fileName();
+}
+
+QString FileNameIndex::rootPath() const
+{
+    return QString::fromUtf8(name(0));
+}
+
+QDateTime FileNameIndex::builtAt() const
+{
+    return QDateTime::fromMSecsSinceEpoch(m_header->builtAtMSecs);
+}
+
+quint32 FileNameIndex::entryCount() const
+{
+    return m_header->entryCount;
+}
+
+quint32 FileNameIndex::findPath(const QString &path) const
+{
+    const QString cleanPath = QDir::cleanPath(path);
+    const QString root = rootPath();
+    if (cleanPath == root) {
+        return 0;
+    }
+
+    const QString prefix = root.endsWith('/') ? root : root + '/';
+    if (!cleanPath.startsWith(prefix)) {
+        return InvalidId;
+    }
+
+    // Resolve one component at a time, skipping over sibling subtrees
+    quint32 current = 0;
+    const QStringList components = cleanPath.mid(prefix.length()).split('/', Qt::SkipEmptyParts);
+    for (const QString &component : components) {
+        const QByteArray wanted = component.toUtf8();
+        quint32 child = current + 1;
+        const quint32 end = m_entries[current].subtreeEnd;
+        while (child < end && name(child) != wanted) {
+            child = m_entries[child].subtreeEnd;
+        }
+        if (child >= end) {
+            return InvalidId;
+        }
+        current = child;
+    }
+
+    return current;
+}
+
+QByteArray FileNameIndex::name(quint32 id) const
+{
+    // Points into the mapping, no copy is made
+    const FileNameIndexEntry &entry = m_entries[id];
+    return QByteArray::fromRawData(m_names + entry.nameOffset, entry.nameLength);
+}
+
+QString FileNameIndex::filePath(quint32 id) const
+{
+    QStringList components;
+    while (id != 0) {
+        components.prepend(QString::fromUtf8(name(id)));
+        id = m_entries[id].parent;
+    }
+
+    QString path = rootPath();
+    for (const QString &component : components) {
+        if (!path.endsWith('/')) {
+            path += '/';
+        }
+        path += component;
+    }
+    return path;
+}
+
+bool FileNameIndex::isDir(quint32 id) const
+{
+    return m_entries[id].flags & Directory;
+}
+
+quint32 FileNameIndex::subtreeEnd(quint32 id) const
+{
+    return m_entries[id].subtreeEnd;
+}
+
+void FileNameIndex::forEachCandidate(const QString &text, quint32 scope,
+                                     const std::function<bool(quint32)> &visitor) const
+{
+    if (scope >= m_header->entryCount) {
+        return;
+    }
+
+    const quint32 first = scope + 1;
+    const quint32 last = m_entries[scope].subtreeEnd;
+
+    // Too short to use trigrams - every entry in scope is a candidate
+    std::vector<quint32> keys;
+    collectTrigrams(text.toCaseFolded().toUtf8(), keys);
+    if (keys.empty()) {
+        for (quint32 id = first; id < last; ++id) {
+            if (!visitor(id)) {
+                return;
+            }
+        }
+        return;
+    }
+
+    std::vector<const FileNameIndexTrigram *> lists;
+    lists.reserve(keys.size());
+    for (quint32 key : keys) {
+        const FileNameIndexTrigram *trigram = findTrigram(key);
+        if (!trigram) {
+            return;   // A required trigram never occurs
+        }
+        lists.push_back(trigram);
+    }
+
+    // Drive the intersection from the shortest posting list
+    std::sort(lists.begin(), lists.end(), [](const FileNameIndexTrigram *a, const FileNameIndexTrigram *b) {
+        return a->count < b->count;
+    });
+
+    const quint32 *driverBegin = m_postings + lists[0]->offset;
+    const quint32 *driverEnd = driverBegin + lists[0]->count;
+    const quint32 *it = std::lower_bound(driverBegin, driverEnd, first);
+
+    std::vector<const quint32 *> cursors(lists.size());
+    for (size_t i = 1; i < lists.size(); ++i) {
+        cursors[i] = m_postings + lists[i]->offset;
+    }
+
+    for (; it != driverEnd && *it < last; ++it) {
+        const quint32 id = *it;
+        bool inAll = true;
+        for (size_t i = 1; i < lists.size() && inAll; ++i) {
+            const quint32 *end = m_postings + lists[i]->offset + lists[i]->count;
+            cursors[i] = std::lower_bound(cursors[i], end, id);
+            inAll = cursors[i] != end && *cursors[i] == id;
+        }
+        if (inAll && !visitor(id)) {
+            return;
+        }
+    }
+}
+
+quint32 FileNameIndex::trigramKey(const char *bytes)
+{
+    return (quint32(uchar(bytes[0])) << 16) | (quint32(uchar(bytes[1])) << 8) | quint32(uchar(bytes[2]));
+}
+
+const FileNameIndexTrigram *FileNameIndex::findTrigram(quint32 key) const
+{
+    const FileNameIndexTrigram *begin = m_trigrams;
+    const FileNameIndexTrigram *end = m_trigrams + m_header->trigramCount;
+    const FileNameIndexTrigram *it = std::lower_bound(begin, end, key, [](const FileNameIndexTrigram &t, quint32 k) {
+        return t.key < k;
+    });
+    return (it != end && it->key == key) ? it : nullptr;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// Index writer
+FileNameIndexWriter::FileNameIndexWriter(const QString &rootPath)
+    : m_rootPath(QDir::cleanPath(rootPath))
+    , m_stopped(false)
+{
+}
+
+bool FileNameIndexWriter::build(const std::function<bool()> &shouldStop)
+{
+    m_entries.clear();
+    m_names.clear();
+    m_postings.clear();
+    m_stopped = false;
+
+    addEntry(0, m_rootPath.toUtf8(), FileNameIndex::Directory);
+    walk(m_rootPath, 0, shouldStop);
+    m_entries[0].subtreeEnd = quint32(m_entries.size());
+
+    return !m_stopped;
+}
+
+quint32 FileNameIndexWriter::entryCount() const
+{
+    return quint32(m_entries.size());
+}
+
+quint32 FileNameIndexWriter::addEntry(quint32 parent, const QByteArray &name, quint8 flags)
+{
+    const quint32 id = quint32(m_entries.size());
+
+    FileNameIndexEntry entry;
+    entry.parent = parent;
+    entry.subtreeEnd = id + 1;
+    entry.nameOffset = quint32(m_names.size());
+    entry.nameLength = quint16(qMin<qsizetype>(name.size(), 0xffff));
+    entry.flags = flags;
+    entry.reserved = 0;
+    m_entries.push_back(entry);
+    m_names.append(name.constData(), entry.nameLength);
+
+    // The root's name is its path and is never matched against
+    if (id != 0) {
+        collectTrigrams(QString::fromUtf8(name).toCaseFolded().toUtf8(), m_keys);
+        for (quint32 key : m_keys) {
+            m_postings[key].push_back(id);
+        }
+    }
+
+    return id;
+}
+
+void FileNameIndexWriter::walk(const QString &dirPath, quint32 dirId, const std::function<bool()> &shouldStop)
+{
+    if (shouldStop()) {
+        m_stopped = true;
+        return;
+    }
+
+    QDir dir(dirPath);
+    const QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+
+    for (const QFileInfo &fileInfo : entries) {
+        quint8 flags = 0;
+        if (fileInfo.isSymLink()) {
+            flags |= FileNameIndex::SymLink;
+        }
+        if (fileInfo.isDir()) {
+            flags |= FileNameIndex::Directory;
+        }
+
+        const quint32 id = addEntry(dirId, fileInfo.fileName().toUtf8(), flags);
+
+        // Entries are stored in pre-order, so descend right away. Symlinked
+        // directories are recorded but not followed to avoid cycles.
+        if ((flags & FileNameIndex::Directory) && !(flags & FileNameIndex::SymLink)) {
+            walk(fileInfo.absoluteFilePath(), id, shouldStop);
+            if (m_stopped) {
+                return;
+            }
+        }
+        m_entries[id].subtreeEnd = quint32(m_entries.size());
+    }
+}
+
+bool FileNameIndexWriter::write(const QString &indexPath)
+{
+    if (m_entries.empty() || m_stopped) {
+        return false;
+    }
+
+    std::vector<quint32> keys;
+    keys.reserve(m_postings.size());
+    quint64 postingCount = 0;
+    for (const auto &posting : m_postings) {
+        keys.push_back(posting.first);
+        postingCount += posting.second.size();
+    }
+    std::sort(keys.begin(), keys.end());
+
+    FileNameIndexHeader header;
+    header.magic = FileNameIndex::Magic;
+    header.version = FileNameIndex::Version;
+    header.entryCount = quint32(m_entries.size());
+    header.trigramCount = quint32(keys.size());
+    header.entriesOffset = alignTo8(sizeof(FileNameIndexHeader));
+    header.namesOffset = header.entriesOffset + quint64(m_entries.size()) * sizeof(FileNameIndexEntry);
+    header.namesSize = quint64(m_names.size());
+    header.trigramsOffset = alignTo8(header.namesOffset + header.namesSize);
+    header.postingsOffset = header.trigramsOffset + quint64(keys.size()) * sizeof(FileNameIndexTrigram);
+    header.builtAtMSecs = QDateTime::currentMSecsSinceEpoch();
+
+    std::vector<FileNameIndexTrigram> trigrams;
+    trigrams.reserve(keys.size());
+    quint64 offset = 0;
+    for (quint32 key : keys) {
+        const std::vector<quint32> &ids = m_postings[key];
+        trigrams.push_back({key, quint32(ids.size()), offset});
+        offset += ids.size();
+    }
+
+    QSaveFile file(indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write index" << indexPath;
+        return false;
+    }
+
+    const QByteArray padding(8, '\0');
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding.constData(), header.entriesOffset - sizeof(header));
+    file.write(reinterpret_cast<const char *>(m_entries.data()), m_entries.size() * sizeof(FileNameIndexEntry));
+    file.write(m_names);
+    file.write(padding.constData(), header.trigramsOffset - header.namesOffset - header.namesSize);
+    file.write(reinterpret_cast<const char *>(trigrams.data()), trigrams.size() * sizeof(FileNameIndexTrigram));
+    for (quint32 key : keys) {
+        const std::vector<quint32> &ids = m_postings[key];
+        file.write(reinterpret_cast<const char *>(ids.data()), ids.size() * sizeof(quint32));
+    }
+
+    if (!file.commit()) {
+        qDebug() << "Failed to commit index" << indexPath;
+        return false;
+    }
+
+    qDebug() << "Wrote index for" << m_rootPath << ":" << m_entries.size() << "entries," << postingCount << "postings";
+    return true;
+}
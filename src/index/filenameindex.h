@@ -0,0 +1,124 @@
+#ifndef FILENAMEINDEX_H
+#define FILENAMEINDEX_H
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// On-disk layout of a filename index. Sections are stored in native byte
+// order and 8-byte aligned so the mapped file can be read in place.
+struct FileNameIndexHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 entryCount;
+    quint32 trigramCount;
+    quint64 entriesOffset;
+    quint64 namesOffset;
+    quint64 namesSize;
+    quint64 trigramsOffset;
+    quint64 postingsOffset;
+    qint64 builtAtMSecs;
+};
+
+struct FileNameIndexEntry
+{
+    quint32 parent;         // Entry id of the containing directory
+    quint32 subtreeEnd;     // One past the last descendant (entries are in pre-order)
+    quint32 nameOffset;     // Offset into the names section (UTF-8, not terminated)
+    quint16 nameLength;
+    quint8 flags;
+    quint8 reserved;
+};
+
+struct FileNameIndexTrigram
+{
+    quint32 key;            // Three case-folded UTF-8 bytes
+    quint32 count;
+    quint64 offset;         // Index of the first posting in the postings section
+};
+
+
+
+// Read-only view of a memory-mapped filename index.
+// Entry 0 is the indexed root and stores its absolute path as its name.
+class FileNameIndex
+{
+public:
+    enum EntryFlag : quint8
+    {
+        Directory = 0x1,
+        SymLink = 0x2,
+    };
+
+    static constexpr quint32 Magic = 0x49424f42;   // "BOBI"
+    static constexpr quint32 Version = 1;
+    static constexpr quint32 InvalidId = 0xffffffff;
+
+    static std::shared_ptr<FileNameIndex> open(const QString &indexPath);
+    ~FileNameIndex();
+
+    QString indexPath() const;
+    QString rootPath() const;
+    QDateTime builtAt() const;
+    quint32 entryCount() const;
+
+    quint32 findPath(const QString &path) const;
+    QByteArray name(quint32 id) const;
+    QString filePath(quint32 id) const;
+    bool isDir(quint32 id) const;
+    quint32 subtreeEnd(quint32 id) const;
+
+    // Visits every entry strictly below scope whose name may contain text
+    // (case-insensitively). Candidates still need to be verified by the caller.
+    // Returning false from the visitor stops the scan.
+    void forEachCandidate(const QString &text, quint32 scope,
+                          const std::function<bool(quint32)> &visitor) const;
+
+    static quint32 trigramKey(const char *bytes);
+
+private:
+    FileNameIndex(const QString &indexPath);
+    bool map();
+    const FileNameIndexTrigram *findTrigram(quint32 key) const;
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    const FileNameIndexHeader *m_header;
+    const FileNameIndexEntry *m_entries;
+    const char *m_names;
+    const FileNameIndexTrigram *m_trigrams;
+    const quint32 *m_postings;
+};
+
+
+
+// Walks a directory tree and writes a filename index for it.
+class FileNameIndexWriter
+{
+public:
+    explicit FileNameIndexWriter(const QString &rootPath);
+
+    bool build(const std::function<bool()> &shouldStop);
+    bool write(const QString &indexPath);
+    quint32 entryCount() const;
+
+private:
+    quint32 addEntry(quint32 parent, const QByteArray &name, quint8 flags);
+    void walk(const QString &dirPath, quint32 dirId, const std::function<bool()> &shouldStop);
+
+    QString m_rootPath;
+    std::vector<FileNameIndexEntry> m_entries;
+    QByteArray m_names;
+    std::unordered_map<quint32, std::vector<quint32>> m_postings;
+    std::vector<quint32> m_keys;
+    bool m_stopped;
+};
+
+#endif // FILENAMEINDEX_H
@@ -0,0 +1,232 @@
+#include "indexdelta.h"
+#include "filenameindex.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <algorithm>
+
+namespace {
+
+bool isUnder(const QString &path, const QString &dirPath)
+{
+    return path == dirPath || path.startsWith(dirPath.endsWith('/') ? dirPath : dirPath + '/');
+}
+
+}
+
+
+
+int FileNameIndexDelta::size() const
+{
+    return int(m_removed.size()) + m_added.size();
+}
+
+bool FileNameIndexDelta::isRemoved(quint32 id) const
+{
+    auto it = std::upper_bound(m_removed.begin(), m_removed.end(), id, [](quint32 value, const std::pair<quint32, quint32> &range) {
+        return value < range.first;
+    });
+    if (it == m_removed.begin()) {
+        return false;
+    }
+    --it;
+    return id < it->second;
+}
+
+const QHash<QString, bool> &FileNameIndexDelta::addedPaths() const
+{
+    return m_added;
+}
+
+void FileNameIndexDelta::apply(const FileNameIndex &index, const IndexChange &change)
+{
+    switch (change.kind) {
+    case IndexChange::Created:
+        addPath(index, change.path, change.isDir);
+        break;
+    case IndexChange::Removed:
+        removePath(index, change.path);
+        break;
+    case IndexChange::DirectoryRescan:
+        rescanDirectory(index, change.path);
+        break;
+    case IndexChange::Modified:
+        break;   // Names are unaffected
+    }
+}
+
+void FileNameIndexDelta::addPath(const FileNameIndex &index, const QString &path, bool isDir)
+{
+    quint32 id = index.findPath(path);
+    if (id != FileNameIndex::InvalidId && !isRemoved(id)) {
+        return;   // Still indexed
+    }
+    m_added.insert(path, isDir);
+}
+
+void FileNameIndexDelta::removePath(const FileNameIndex &index, const QString &path)
+{
+    for (auto it = m_added.begin(); it != m_added.end();) {
+        if (isUnder(it.key(), path)) {
+            it = m_added.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    quint32 id = index.findPath(path);
+    if (id != FileNameIndex::InvalidId && id != 0) {
+        removeRange(id, index.subtreeEnd(id));
+    }
+}
+
+void FileNameIndexDelta::rescanDirectory(const FileNameIndex &index, const QString &dirPath)
+{
+    QDir dir(dirPath);
+    if (!dir.exists()) {
+        removePath(index, dirPath);
+        return;
+    }
+
+    const QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+    QSet<QString> present;
+    for (const QFileInfo &entry : entries) {
+        present.insert(entry.fileName());
+        addPath(index, entry.absoluteFilePath(), entry.isDir());
+
+        // A directory moved in keeps its own timestamp, so take its whole tree
+        if (entry.isDir() && !entry.isSymLink() && m_added.contains(entry.absoluteFilePath())) {
+            QDirIterator it(entry.absoluteFilePath(), QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                            QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                it.next();
+                m_added.insert(it.filePath(), it.fileInfo().isDir());
+            }
+        }
+    }
+
+    // Indexed children that are gone
+    quint32 dirId = index.findPath(dirPath);
+    if (dirId != FileNameIndex::InvalidId && !isRemoved(dirId)) {
+        for (quint32 child = dirId + 1; child < index.subtreeEnd(dirId); child = index.subtreeEnd(child)) {
+            const QString name = QString::fromUtf8(index.name(child));
+            if (!present.contains(name) && !isRemoved(child)) {
+                removeRange(child, index.subtreeEnd(child));
+            }
+        }
+    }
+
+    // Added children that are gone
+    for (auto it = m_added.begin(); it != m_added.end();) {
+        QFileInfo added(it.key());
+        if (added.absolutePath() == dir.absolutePath() && !present.contains(added.fileName())) {
+            it = m_added.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileNameIndexDelta::removeRange(quint32 begin, quint32 end)
+{
+    // Ranges are whole subtrees, so they either nest or are disjoint
+    if (isRemoved(begin)) {
+        return;
+    }
+
+    auto first = std::lower_bound(m_removed.begin(), m_removed.end(), begin, [](const std::pair<quint32, quint32> &range, quint32 value) {
+        return range.first < value;
+    });
+    auto last = first;
+    while (last != m_removed.end() && last->first < end) {
+        ++last;
+    }
+    first = m_removed.erase(first, last);
+    m_removed.insert(first, std::make_pair(begin, end));
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// Content index delta
+ContentIndexDelta::ContentIndexDelta()
+    : m_verifyTimestamps(false)
+    , m_rescans(0)
+{
+}
+
+int ContentIndexDelta::size() const
+{
+    return m_dirty.size();
+}
+
+const QSet<QString> &ContentIndexDelta::dirtyFiles() const
+{
+    return m_dirty;
+}
+
+bool ContentIndexDelta::verifyTimestamps() const
+{
+    return m_verifyTimestamps;
+}
+
+int ContentIndexDelta::rescans() const
+{
+    return m_rescans;
+}
+
+void ContentIndexDelta::apply(const IndexChange &change)
+{
+    switch (change.kind) {
+    case IndexChange::Created:
+    case IndexChange::Modified:
+        if (!change.isDir) {
+            m_dirty.insert(change.path);
+        }
+        break;
+    case IndexChange::Removed:
+        for (auto it = m_dirty.begin(); it != m_dirty.end();) {
+            if (isUnder(*it, change.path)) {
+                it = m_dirty.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        break;
+    case IndexChange::DirectoryRescan:
+        // Directory timestamps do not reveal modified file contents
+        m_verifyTimestamps = true;
+        m_rescans++;
+        break;
+    }
+}
+
+void ContentIndexDelta::markDirty(const QStringList &paths)
+{
+    for (const QString &path : paths) {
+        m_dirty.insert(path);
+    }
+}
+
+void ContentIndexDelta::setVerifyTimestamps(bool verify)
+{
+    m_verifyTimestamps = verify;
+}
@@ -0,0 +1,76 @@
+#ifndef INDEXDELTA_H
+#define INDEXDELTA_H
+
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <utility>
+#include <vector>
+
+class FileNameIndex;
+class ContentIndex;
+
+// A single file system change reported by the watcher
+struct IndexChange
+{
+    enum Kind
+    {
+        Created,
+        Removed,
+        Modified,
+        DirectoryRescan,    // Events were lost, reconcile this directory by listing it
+    };
+
+    Kind kind;
+    QString path;
+    bool isDir;
+};
+
+
+
+// Changes applied on top of a filename index since it was built.
+// Deltas are copied on write: searches hold an immutable snapshot.
+class FileNameIndexDelta
+{
+public:
+    int size() const;
+    bool isRemoved(quint32 id) const;
+    const QHash<QString, bool> &addedPaths() const;
+
+    void apply(const FileNameIndex &index, const IndexChange &change);
+
+private:
+    void addPath(const FileNameIndex &index, const QString &path, bool isDir);
+    void removePath(const FileNameIndex &index, const QString &path);
+    void rescanDirectory(const FileNameIndex &index, const QString &dirPath);
+    void removeRange(quint32 begin, quint32 end);
+
+    std::vector<std::pair<quint32, quint32>> m_removed;   // Sorted, disjoint [begin, end) id ranges
+    QHash<QString, bool> m_added;                         // Paths missing from the index -> isDir
+};
+
+
+
+// Changes applied on top of a content index since it was built
+class ContentIndexDelta
+{
+public:
+    ContentIndexDelta();
+
+    int size() const;
+    const QSet<QString> &dirtyFiles() const;
+    bool verifyTimestamps() const;
+    int rescans() const;
+
+    void apply(const IndexChange &change);
+    void markDirty(const QStringList &paths);
+    void setVerifyTimestamps(bool verify);
+
+private:
+    QSet<QString> m_dirty;      // Created or modified since the build, searched unconditionally
+    bool m_verifyTimestamps;    // Events were lost, compare file timestamps at query time
+    int m_rescans;              // Directory rescans applied, a sweep only vouches for the ones before it
+};
+
+#endif // INDEXDELTA_H
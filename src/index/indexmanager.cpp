@@ -0,0 +1,575 @@
+#include "indexmanager.h"
+#include "indexwatcher.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QMetaObject>
+
+IndexBuildTask::IndexBuildTask(IndexKind kind, const QString &rootPath, const QString &indexPath,
+                               qint64 maxFileSize, IndexManager *manager)
+    : m_kind(kind), m_rootPath(rootPath), m_indexPath(indexPath), m_maxFileSize(maxFileSize), m_manager(manager)
+{
+    setAutoDelete(true);
+}
+
+void IndexBuildTask::run()
+{
+    const bool ok = IndexManager::writeIndex(m_kind, m_rootPath, m_indexPath, m_maxFileSize,
+                                             [this]() { return m_manager->shuttingDown(); });
+
+    if (m_manager->shuttingDown()) {
+        return;
+    }
+
+    QMetaObject::invokeMethod(m_manager, "onBuildFinished", Qt::QueuedConnection,
+                              Q_ARG(int, int(m_kind)), Q_ARG(QString, m_rootPath),
+                              Q_ARG(QString, m_indexPath), Q_ARG(bool, ok));
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// Index Manager
+IndexManager::IndexManager(QObject *parent, Mode mode)
+    : QObject(parent)
+    , m_mode(mode)
+    , m_buildPool(nullptr)
+    , m_watcherThread(nullptr)
+    , m_watcher(nullptr)
+    , m_shuttingDown(0)
+{
+    m_indexDirectory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/index";
+    QDir().mkpath(m_indexDirectory);
+
+    // Builds are I/O bound and should not compete with interactive searches
+    m_buildPool = new QThreadPool(this);
+    m_buildPool->setMaxThreadCount(1);
+
+    // Indexes of other roots are none of a one-shot search's business
+    if (m_mode == OnDemand) {
+        return;
+    }
+
+    // File system events keep the indexes current between rebuilds
+    m_watcherThread = new QThread(this);
+    m_watcher = new IndexWatcher(this);
+    m_watcher->moveToThread(m_watcherThread);
+    connect(m_watcherThread, &QThread::finished, m_watcher, &QObject::deleteLater);
+    m_watcherThread->start(QThread::LowPriority);
+    QMetaObject::invokeMethod(m_watcher, "start", Qt::QueuedConnection);
+
+    loadExistingIndexes();
+}
+
+IndexManager::~IndexManager()
+{
+    m_shuttingDown = 1;
+    m_buildPool->clear();
+    m_buildPool->waitForDone();
+
+    if (m_watcher) {
+        QMetaObject::invokeMethod(m_watcher, "stop", Qt::BlockingQueuedConnection);
+        m_watcherThread->quit();
+        m_watcherThread->wait();
+    }
+}
+
+namespace {
+
+bool coversPath(const QString &root, const QString &path)
+{
+    return path == root || path.startsWith(root.endsWith('/') ? root : root + '/');
+}
+
+}
+
+std::shared_ptr<const FileNameIndex> IndexManager::fileNameIndexFor(const QString &path, quint32 *scope,
+                                                                    std::shared_ptr<const FileNameIndexDelta> *delta)
+{
+    const QString cleanPath = QDir::cleanPath(path);
+    loadIndexesCovering(cleanPath);
+    std::shared_ptr<const FileNameIndex> best;
+    std::shared_ptr<const FileNameIndexDelta> bestDelta;
+    {
+        // Prefer the deepest indexed root that contains path
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_fileNameIndexes.cbegin(); it != m_fileNameIndexes.cend(); ++it) {
+            if (coversPath(it.key(), cleanPath) && (!best || it.key().length() > best->rootPath().length())) {
+                best = it.value();
+                bestDelta = m_fileNameDeltas.value(it.key());
+            }
+        }
+    }
+
+    if (!best) {
+        return nullptr;
+    }
+
+    if (delta) {
+        *delta = bestDelta;
+    }
+
+    quint32 id = best->findPath(cleanPath);
+    if (id == FileNameIndex::InvalidId || (bestDelta && bestDelta->isRemoved(id))) {
+        // Directory was created after the index was built
+        scheduleBuild(best->rootPath());
+        return nullptr;
+    }
+
+    // Watched indexes are kept current by their delta
+    if (!bestDelta && best->builtAt().secsTo(QDateTime::currentDateTime()) > REFRESH_AFTER_SECS) {
+        scheduleBuild(best->rootPath());
+    }
+
+    if (scope) {
+        *scope = id;
+    }
+    return best;
+}
+
+std::shared_ptr<const ContentIndex> IndexManager::contentIndexFor(const QString &path, quint32 *dirId,
+                                                                  std::shared_ptr<const ContentIndexDelta> *delta)
+{
+    const QString cleanPath = QDir::cleanPath(path);
+    loadIndexesCovering(cleanPath);
+    std::shared_ptr<const ContentIndex> best;
+    std::shared_ptr<const ContentIndexDelta> bestDelta;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_contentIndexes.cbegin(); it != m_contentIndexes.cend(); ++it) {
+            if (coversPath(it.key(), cleanPath) && (!best || it.key().length() > best->rootPath().length())) {
+                best = it.value();
+                bestDelta = m_contentDeltas.value(it.key());
+            }
+        }
+    }
+
+    if (!best) {
+        return nullptr;
+    }
+
+    if (delta) {
+        *delta = bestDelta;
+    }
+
+    // Changed files are picked up at query time, so the index is never
+    // refreshed by age - rebuilding reads the whole tree
+    quint32 id = best->findDir(cleanPath);
+    if (id == ContentIndex::InvalidId) {
+        return nullptr;
+    }
+
+    if (dirId) {
+        *dirId = id;
+    }
+    return best;
+}
+
+void IndexManager::scheduleBuild(const QString &rootPath)
+{
+    startBuild(FileNameIndexKind, rootPath, 0);
+}
+
+void IndexManager::scheduleContentBuild(const QString &rootPath, qint64 maxFileSize)
+{
+    startBuild(ContentIndexKind, rootPath, maxFileSize);
+}
+
+bool IndexManager::build(IndexKind kind, const QString &rootPath, qint64 maxFileSize)
+{
+    const QString cleanRoot = QDir::cleanPath(rootPath);
+    const QString key = buildKey(kind, cleanRoot);
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_shuttingDown.loadAcquire() || m_building.contains(key)) {
+            return false;
+        }
+        m_building.insert(key);
+        if (m_watchedRoots.contains(cleanRoot)) {
+            m_buildJournals.insert(key, QList<IndexChange>());
+        }
+    }
+
+    const QString indexPath = indexPathFor(kind, cleanRoot);
+    const bool ok = writeIndex(kind, cleanRoot, indexPath, maxFileSize, [this]() { return shuttingDown(); });
+    onBuildFinished(int(kind), cleanRoot, indexPath, ok);
+
+    QMutexLocker locker(&m_mutex);
+    return ok && (kind == FileNameIndexKind ? m_fileNameIndexes.contains(cleanRoot) : m_contentIndexes.contains(cleanRoot));
+}
+
+bool IndexManager::writeIndex(IndexKind kind, const QString &rootPath, const QString &indexPath, qint64 maxFileSize,
+                              const std::function<bool()> &shouldStop)
+{
+    if (kind == FileNameIndexKind) {
+        qDebug() << "Building filename index for" << rootPath;
+        FileNameIndexWriter writer(rootPath);
+        return writer.build(shouldStop) && writer.write(indexPath);
+    }
+    qDebug() << "Building content index for" << rootPath;
+    ContentIndexWriter writer(rootPath, indexPath, maxFileSize);
+    return writer.build(shouldStop);
+}
+
+void IndexManager::startBuild(IndexKind kind, const QString &rootPath, qint64 maxFileSize)
+{
+    // Nothing would be left running to finish a background build
+    if (m_mode == OnDemand) {
+        return;
+    }
+
+    const QString cleanRoot = QDir::cleanPath(rootPath);
+    {
+        QMutexLocker locker(&m_mutex);
+        const QString key = buildKey(kind, cleanRoot);
+        if (m_shuttingDown.loadAcquire() || m_building.contains(key)) {
+            return;
+        }
+        m_building.insert(key);
+
+        // Changes made during the walk may or may not be seen by it, replay them afterwards
+        if (m_watchedRoots.contains(cleanRoot)) {
+            m_buildJournals.insert(key, QList<IndexChange>());
+        }
+    }
+
+    m_buildPool->start(new IndexBuildTask(kind, cleanRoot, indexPathFor(kind, cleanRoot), maxFileSize, this));
+}
+
+bool IndexManager::isBuilding(const QString &rootPath) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_building.contains(buildKey(FileNameIndexKind, QDir::cleanPath(rootPath)));
+}
+
+bool IndexManager::shuttingDown() const
+{
+    return m_shuttingDown.loadAcquire() != 0;
+}
+
+QString IndexManager::indexDirectory() const
+{
+    return m_indexDirectory;
+}
+
+void IndexManager::onBuildFinished(int kind, const QString &rootPath, const QString &indexPath, bool ok)
+{
+    bool watched = false;
+    if (kind == ContentIndexKind) {
+        std::shared_ptr<const ContentIndex> index = ok ? ContentIndex::open(indexPath) : nullptr;
+        {
+            QMutexLocker locker(&m_mutex);
+            const QString key = buildKey(ContentIndexKind, rootPath);
+            const QList<IndexChange> journal = m_buildJournals.take(key);
+            m_building.remove(key);
+            watched = m_watchedRoots.contains(rootPath);
+            if (index) {
+                m_contentIndexes.insert(rootPath, index);
+                if (watched) {
+                    std::shared_ptr<ContentIndexDelta> delta = std::make_shared<ContentIndexDelta>();
+                    for (const IndexChange &change : journal) {
+                        delta->apply(change);
+                    }
+                    m_contentDeltas.insert(rootPath, delta);
+                }
+            }
+        }
+        if (!index) {
+            qDebug() << "Failed to build content index for" << rootPath;
+            return;
+        }
+        qDebug() << "Content index ready for" << rootPath << "with" << index->fileCount() << "files";
+        if (!watched) {
+            watchRoot(rootPath, index->builtAt().toMSecsSinceEpoch());
+        }
+        emit contentIndexBuilt(rootPath, int(index->fileCount()));
+        return;
+    }
+
+    std::shared_ptr<const FileNameIndex> index = ok ? FileNameIndex::open(indexPath) : nullptr;
+    {
+        // Searches still holding the old mapping keep it alive until they finish
+        QMutexLocker locker(&m_mutex);
+        const QString key = buildKey(FileNameIndexKind, rootPath);
+        const QList<IndexChange> journal = m_buildJournals.take(key);
+        m_building.remove(key);
+        watched = m_watchedRoots.contains(rootPath);
+        if (index) {
+            m_fileNameIndexes.insert(rootPath, index);
+            if (watched) {
+                std::shared_ptr<FileNameIndexDelta> delta = std::make_shared<FileNameIndexDelta>();
+                for (const IndexChange &change : journal) {
+                    delta->apply(*index, change);
+                }
+                m_fileNameDeltas.insert(rootPath, delta);
+            }
+        }
+    }
+    if (!index) {
+        qDebug() << "Failed to build filename index for" << rootPath;
+        return;
+    }
+    qDebug() << "Filename index ready for" << rootPath << "with" << index->entryCount() << "entries";
+    if (!watched) {
+        watchRoot(rootPath, index->builtAt().toMSecsSinceEpoch());
+    }
+    emit indexBuilt(rootPath, int(index->entryCount()));
+}
+
+void IndexManager::onRootWatched(const QString &rootPath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_watchedRoots.insert(rootPath);
+    if (m_fileNameIndexes.contains(rootPath)) {
+        m_fileNameDeltas.insert(rootPath, std::make_shared<FileNameIndexDelta>());
+    }
+    if (m_contentIndexes.contains(rootPath)) {
+        // Until the first sweep completes, file timestamps are checked per query
+        std::shared_ptr<ContentIndexDelta> delta = std::make_shared<ContentIndexDelta>();
+        delta->setVerifyTimestamps(true);
+        m_contentDeltas.insert(rootPath, delta);
+    }
+}
+
+void IndexManager::onRootUnwatched(const QString &rootPath)
+{
+    // Without a delta searches fall back to timestamp checks and periodic rebuilds
+    QMutexLocker locker(&m_mutex);
+    m_watchedRoots.remove(rootPath);
+    m_fileNameDeltas.remove(rootPath);
+    m_contentDeltas.remove(rootPath);
+}
+
+void IndexManager::applyChanges(const QString &rootPath, const QList<IndexChange> &changes)
+{
+    std::shared_ptr<const FileNameIndex> fileNameIndex;
+    std::shared_ptr<const FileNameIndexDelta> fileNameDelta;
+    std::shared_ptr<const ContentIndex> contentIndex;
+    std::shared_ptr<const ContentIndexDelta> contentDelta;
+    {
+        QMutexLocker locker(&m_mutex);
+        fileNameIndex = m_fileNameIndexes.value(rootPath);
+        fileNameDelta = m_fileNameDeltas.value(rootPath);
+        contentIndex = m_contentIndexes.value(rootPath);
+        contentDelta = m_contentDeltas.value(rootPath);
+        for (auto it = m_buildJournals.begin(); it != m_buildJournals.end(); ++it) {
+            if (it.key().endsWith(':' + rootPath)) {
+                it.value().append(changes);
+            }
+        }
+    }
+
+    // Copy on write, searches keep using the snapshot they started with
+    std::shared_ptr<FileNameIndexDelta> nextFileNameDelta;
+    if (fileNameIndex && fileNameDelta) {
+        nextFileNameDelta = std::make_shared<FileNameIndexDelta>(*fileNameDelta);
+        for (const IndexChange &change : changes) {
+            nextFileNameDelta->apply(*fileNameIndex, change);
+        }
+    }
+
+    std::shared_ptr<ContentIndexDelta> nextContentDelta;
+    if (contentIndex && contentDelta) {
+        nextContentDelta = std::make_shared<ContentIndexDelta>(*contentDelta);
+        for (const IndexChange &change : changes) {
+            nextContentDelta->apply(change);
+        }
+    }
+
+    {
+        // Skip indexes swapped by a rebuild meanwhile, its journal replays these changes
+        QMutexLocker locker(&m_mutex);
+        if (nextFileNameDelta && m_fileNameIndexes.value(rootPath) == fileNameIndex) {
+            m_fileNameDeltas.insert(rootPath, nextFileNameDelta);
+        }
+        if (nextContentDelta && m_contentIndexes.value(rootPath) == contentIndex) {
+            m_contentDeltas.insert(rootPath, nextContentDelta);
+        }
+    }
+
+    // Fold large deltas back into a fresh index
+    if (nextFileNameDelta && nextFileNameDelta->size() > qMax<qint64>(MIN_REBUILD_DELTA, qint64(fileNameIndex->entryCount()) * REBUILD_DELTA_PERCENT / 100)) {
+        QMetaObject::invokeMethod(this, [this, rootPath]() { scheduleBuild(rootPath); }, Qt::QueuedConnection);
+    }
+    if (nextContentDelta && nextContentDelta->size() > qMax<qint64>(MIN_REBUILD_DELTA, qint64(contentIndex->fileCount()) * REBUILD_DELTA_PERCENT / 100)) {
+        QMetaObject::invokeMethod(this, [this, rootPath, maxFileSize = contentIndex->maxFileSize()]() {
+            scheduleContentBuild(rootPath, maxFileSize);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void IndexManager::scheduleContentSweep(const QString &rootPath)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (shuttingDown() || !m_contentIndexes.contains(rootPath)) {
+            return;
+        }
+        if (m_sweeping.contains(rootPath)) {
+            m_sweepsPending.insert(rootPath);
+            return;
+        }
+        m_sweeping.insert(rootPath);
+    }
+    m_buildPool->start([this, rootPath]() { sweepContentIndex(rootPath); });
+}
+
+void IndexManager::sweepContentIndex(const QString &rootPath)
+{
+    std::shared_ptr<const ContentIndex> index;
+    int rescans = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        index = m_contentIndexes.value(rootPath);
+        if (std::shared_ptr<const ContentIndexDelta> delta = m_contentDeltas.value(rootPath)) {
+            rescans = delta->rescans();
+        }
+    }
+
+    const QStringList changed = index ? index->changedFiles(0, [this]() { return shuttingDown(); }) : QStringList();
+
+    bool again = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        std::shared_ptr<const ContentIndexDelta> current = m_contentDeltas.value(rootPath);
+        if (index && current && m_contentIndexes.value(rootPath) == index && !shuttingDown()) {
+            std::shared_ptr<ContentIndexDelta> next = std::make_shared<ContentIndexDelta>(*current);
+            next->markDirty(changed);
+            // Events lost while the sweep ran may have missed it, those wait for the next one
+            if (current->rescans() == rescans) {
+                next->setVerifyTimestamps(false);
+            }
+            m_contentDeltas.insert(rootPath, next);
+            qDebug() << "Content index sweep of" << rootPath << "found" << changed.size() << "changed files";
+        }
+        m_sweeping.remove(rootPath);
+        again = m_sweepsPending.remove(rootPath);
+    }
+    if (again) {
+        scheduleContentSweep(rootPath);
+    }
+}
+
+void IndexManager::watchRoot(const QString &rootPath, qint64 sinceMSecs)
+{
+    if (!m_watcher) {
+        return;
+    }
+    QMetaObject::invokeMethod(m_watcher, "watchRoot", Qt::QueuedConnection,
+                              Q_ARG(QString, rootPath), Q_ARG(qint64, sinceMSecs));
+}
+
+void IndexManager::loadExistingIndexes()
+{
+    QDir dir(m_indexDirectory);
+
+    // Leftover segments of an interrupted content build
+    for (const QString &fileName : dir.entryList(QStringList() << "*.seg*", QDir::Files)) {
+        dir.remove(fileName);
+    }
+
+    for (const QString &fileName : dir.entryList(QStringList() << "*.bfi", QDir::Files)) {
+        std::shared_ptr<const FileNameIndex> index = FileNameIndex::open(dir.filePath(fileName));
+        if (index) {
+            m_fileNameIndexes.insert(index->rootPath(), index);
+        } else {
+            qDebug() << "Discarding unreadable index" << fileName;
+            dir.remove(fileName);
+        }
+    }
+
+    for (const QString &fileName : dir.entryList(QStringList() << "*.bci", QDir::Files)) {
+        std::shared_ptr<const ContentIndex> index = ContentIndex::open(dir.filePath(fileName));
+        if (index) {
+            m_contentIndexes.insert(index->rootPath(), index);
+        } else {
+            qDebug() << "Discarding unreadable content index" << fileName;
+            dir.remove(fileName);
+        }
+    }
+
+    // Catch up on whatever changed while we were not running
+    QHash<QString, qint64> roots;
+    for (auto it = m_fileNameIndexes.cbegin(); it != m_fileNameIndexes.cend(); ++it) {
+        roots.insert(it.key(), it.value()->builtAt().toMSecsSinceEpoch());
+    }
+    for (auto it = m_contentIndexes.cbegin(); it != m_contentIndexes.cend(); ++it) {
+        const qint64 builtAt = it.value()->builtAt().toMSecsSinceEpoch();
+        roots.insert(it.key(), roots.contains(it.key()) ? qMin(roots.value(it.key()), builtAt) : builtAt);
+    }
+    for (auto it = roots.cbegin(); it != roots.cend(); ++it) {
+        watchRoot(it.key(), it.value());
+    }
+}
+
+void IndexManager::loadIndexesCovering(const QString &path)
+{
+    if (m_mode != OnDemand) {
+        return;     // All of them are loaded up front
+    }
+
+    // An index of path or of any directory above it may cover it, each is looked for once
+    QString root = path;
+    for (;;) {
+        bool probed;
+        {
+            QMutexLocker locker(&m_mutex);
+            probed = m_probedRoots.contains(root);
+            m_probedRoots.insert(root);
+        }
+        if (!probed) {
+            // Unreadable files are left alone, the GUI rebuilds them
+            const QString fileNamePath = indexPathFor(FileNameIndexKind, root);
+            std::shared_ptr<const FileNameIndex> fileNameIndex = QFile::exists(fileNamePath) ? FileNameIndex::open(fileNamePath) : nullptr;
+            const QString contentPath = indexPathFor(ContentIndexKind, root);
+            std::shared_ptr<const ContentIndex> contentIndex = QFile::exists(contentPath) ? ContentIndex::open(contentPath) : nullptr;
+
+            QMutexLocker locker(&m_mutex);
+            if (fileNameIndex && fileNameIndex->rootPath() == root && !m_fileNameIndexes.contains(root)) {
+                m_fileNameIndexes.insert(root, fileNameIndex);
+            }
+            if (contentIndex && contentIndex->rootPath() == root && !m_contentIndexes.contains(root)) {
+                m_contentIndexes.insert(root, contentIndex);
+            }
+        }
+
+        const QString parent = QFileInfo(root).path();
+        if (parent == root || parent.isEmpty()) {
+            break;
+        }
+        root = parent;
+    }
+}
+
+QString IndexManager::indexPathFor(IndexKind kind, const QString &rootPath) const
+{
+    QByteArray hash = QCryptographicHash::hash(rootPath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_indexDirectory + "/" + QString::fromLatin1(hash) + (kind == ContentIndexKind ? ".bci" : ".bfi");
+}
+
+QString IndexManager::buildKey(IndexKind kind, const QString &rootPath)
+{
+    return QString::number(int(kind)) + ':' + rootPath;
+}
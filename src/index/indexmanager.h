@@ -0,0 +1,136 @@
+#ifndef INDEXMANAGER_H
+#define INDEXMANAGER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <memory>
+#include "filenameindex.h"
+#include "contentindex.h"
+#include "indexdelta.h"
+
+class IndexWatcher;
+
+class IndexManager;
+
+enum IndexKind
+{
+    FileNameIndexKind,
+    ContentIndexKind,
+};
+
+// Background task that (re)builds one index of one root
+class IndexBuildTask : public QRunnable
+{
+public:
+    IndexBuildTask(IndexKind kind, const QString &rootPath, const QString &indexPath,
+                   qint64 maxFileSize, IndexManager *manager);
+    void run() override;
+
+private:
+    IndexKind m_kind;
+    QString m_rootPath;
+    QString m_indexPath;
+    qint64 m_maxFileSize;
+    IndexManager *m_manager;
+};
+
+
+
+
+
+
+
+// Owns the on-disk indexes and decides which root can be answered from them
+class IndexManager : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mode
+    {
+        // Loads every cached index up front, keeps them current with a watcher
+        // thread and (re)builds them in the background after walks
+        Watching,
+        // For one-shot tools: opens the cached index of a root only when a
+        // search asks for it, never watches and only builds through build()
+        OnDemand,
+    };
+
+    explicit IndexManager(QObject *parent = nullptr, Mode mode = Watching);
+    ~IndexManager();
+
+    // Returns the index covering path, with scope set to the entry id of path.
+    // delta receives the changes seen since the build, or null if the root is not watched.
+    std::shared_ptr<const FileNameIndex> fileNameIndexFor(const QString &path, quint32 *scope,
+                                                          std::shared_ptr<const FileNameIndexDelta> *delta = nullptr);
+    // Returns the content index covering path, with dirId set to the directory of path
+    std::shared_ptr<const ContentIndex> contentIndexFor(const QString &path, quint32 *dirId,
+                                                        std::shared_ptr<const ContentIndexDelta> *delta = nullptr);
+
+    // Called by the watcher thread
+    void onRootWatched(const QString &rootPath);
+    void onRootUnwatched(const QString &rootPath);
+    void applyChanges(const QString &rootPath, const QList<IndexChange> &changes);
+    // Compares the content index with the files on the build pool, then stops timestamp checks
+    void scheduleContentSweep(const QString &rootPath);
+
+    void scheduleBuild(const QString &rootPath);
+    void scheduleContentBuild(const QString &rootPath, qint64 maxFileSize);
+    // Builds on the calling thread and returns once the index is in use
+    bool build(IndexKind kind, const QString &rootPath, qint64 maxFileSize);
+    static bool writeIndex(IndexKind kind, const QString &rootPath, const QString &indexPath, qint64 maxFileSize,
+                           const std::function<bool()> &shouldStop);
+    bool isBuilding(const QString &rootPath) const;
+    bool shuttingDown() const;
+    QString indexDirectory() const;
+
+signals:
+    void indexBuilt(const QString &rootPath, int entryCount);
+    void contentIndexBuilt(const QString &rootPath, int fileCount);
+
+private slots:
+    void onBuildFinished(int kind, const QString &rootPath, const QString &indexPath, bool ok);
+
+private:
+    friend class IndexBuildTask;
+
+    void startBuild(IndexKind kind, const QString &rootPath, qint64 maxFileSize);
+    void loadExistingIndexes();
+    void loadIndexesCovering(const QString &path);
+    void sweepContentIndex(const QString &rootPath);
+    QString indexPathFor(IndexKind kind, const QString &rootPath) const;
+    static QString buildKey(IndexKind kind, const QString &rootPath);
+
+    void watchRoot(const QString &rootPath, qint64 sinceMSecs);
+
+    // Unwatched indexes older than this are refreshed in the background after use
+    static constexpr qint64 REFRESH_AFTER_SECS = 15 * 60;
+    // Deltas larger than this share of the index trigger a rebuild
+    static constexpr int REBUILD_DELTA_PERCENT = 2;
+    static constexpr int MIN_REBUILD_DELTA = 10000;
+
+    const Mode m_mode;
+    mutable QMutex m_mutex;
+    QString m_indexDirectory;
+    QHash<QString, std::shared_ptr<const FileNameIndex>> m_fileNameIndexes;
+    QHash<QString, std::shared_ptr<const ContentIndex>> m_contentIndexes;
+    QHash<QString, std::shared_ptr<const FileNameIndexDelta>> m_fileNameDeltas;
+    QHash<QString, std::shared_ptr<const ContentIndexDelta>> m_contentDeltas;
+    QHash<QString, QList<IndexChange>> m_buildJournals;  // Changes seen while a rebuild runs
+    QSet<QString> m_watchedRoots;
+    QSet<QString> m_building;
+    QSet<QString> m_sweeping;           // Content sweeps queued or running
+    QSet<QString> m_sweepsPending;      // Asked for again meanwhile, run once the current one is done
+    QSet<QString> m_probedRoots;        // OnDemand roots whose cached indexes were looked for
+    QThreadPool *m_buildPool;
+    QThread *m_watcherThread;       // Null when not watching
+    IndexWatcher *m_watcher;
+    QAtomicInt m_shuttingDown;
+};
+
+#endif // INDEXMANAGER_H
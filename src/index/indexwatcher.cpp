@@ -0,0 +1,541 @@
+#include "indexwatcher.h"
+#include "indexmanager.h"
+#include "../search/dirscanner.h"
+#include <QDebug>
+#include <QFile>
+#include <QDateTime>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#endif
+
+namespace {
+
+bool isUnder(const QString &path, const QString &dirPath)
+{
+    return path == dirPath || path.startsWith(dirPath.endsWith('/') ? dirPath : dirPath + '/');
+}
+
+#ifdef Q_OS_LINUX
+const uint32_t INOTIFY_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY
+                              | IN_CLOSE_WRITE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+const uint64_t FANOTIFY_MASK = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_MODIFY | FAN_ONDIR;
+#endif
+
+}
+
+IndexWatcher::IndexWatcher(IndexManager *manager)
+    : QObject(nullptr)
+    , m_manager(manager)
+    , m_inotifyFd(-1)
+    , m_fanotifyFd(-1)
+    , m_notifier(nullptr)
+    , m_flushTimer(nullptr)
+    , m_lastReadMSecs(0)
+    , m_watchLimitReached(false)
+{
+}
+
+IndexWatcher::~IndexWatcher()
+{
+    closeBackend();
+}
+
+QString IndexWatcher::backendName() const
+{
+    if (m_fanotifyFd >= 0) {
+        return "fanotify";
+    }
+    if (m_inotifyFd >= 0) {
+        return "inotify";
+    }
+    return "none";
+}
+
+void IndexWatcher::start()
+{
+    // Created here so the timer and notifier belong to the watcher thread
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(FLUSH_INTERVAL_MS);
+    connect(m_flushTimer, &QTimer::timeout, this, &IndexWatcher::flushChanges);
+
+    if (!initFanotify() && !initInotify()) {
+        qDebug() << "No file system notification backend, indexes will be refreshed periodically";
+        return;
+    }
+    m_lastReadMSecs = QDateTime::currentMSecsSinceEpoch();
+    qDebug() << "Index watcher using" << backendName();
+}
+
+void IndexWatcher::stop()
+{
+    if (m_flushTimer) {
+        m_flushTimer->stop();
+    }
+    closeBackend();
+    m_roots.clear();
+}
+
+void IndexWatcher::watchRoot(const QString &rootPath, qint64 sinceMSecs)
+{
+    if (m_roots.contains(rootPath) || backendName() == "none") {
+        return;
+    }
+
+    if (m_fanotifyFd >= 0 && !markRoot(rootPath)) {
+        // Not permitted on this file system, move every root over to inotify
+        qDebug() << "fanotify unavailable for" << rootPath << "- switching to inotify";
+        const QStringList roots = m_roots;
+        closeBackend();
+        m_roots.clear();
+        if (!initInotify()) {
+            return;
+        }
+        for (const QString &root : roots) {
+            watchRoot(root, m_lastReadMSecs);
+        }
+    }
+
+    // Directories changed since the index was built are reconciled by listing them.
+    // inotify needs the walk to place its watches, fanotify only for an older index.
+    const bool recent = sinceMSecs > 0 && QDateTime::currentMSecsSinceEpoch() - sinceMSecs < RECENT_INDEX_MSECS;
+    const bool walk = m_inotifyFd >= 0 || (sinceMSecs > 0 && !recent);
+    QStringList rescans;
+    if (walk && !walkTree(rootPath, sinceMSecs, false, rescans)) {
+        qDebug() << "Watch limit reached, not watching" << rootPath;
+        removeWatchTree(rootPath);
+        return;
+    }
+    if (m_manager->shuttingDown()) {
+        return;
+    }
+
+    m_roots.append(rootPath);
+    m_manager->onRootWatched(rootPath);
+
+    for (const QString &dirPath : rescans) {
+        queueChange(IndexChange::DirectoryRescan, dirPath, true);
+    }
+    flushChanges();
+
+    // Content changes cannot be seen in directory timestamps, compare files once
+    m_manager->scheduleContentSweep(rootPath);
+    qDebug() << "Watching" << rootPath << "with" << backendName() << "," << rescans.size() << "directories rescanned";
+}
+
+bool IndexWatcher::initFanotify()
+{
+#ifdef Q_OS_LINUX
+    m_fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE);
+    if (m_fanotifyFd < 0) {
+        return false;   // Needs CAP_SYS_ADMIN
+    }
+    m_notifier = new QSocketNotifier(m_fanotifyFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &IndexWatcher::onFanotifyActivated);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IndexWatcher::initInotify()
+{
+#ifdef Q_OS_LINUX
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0) {
+        return false;
+    }
+    m_notifier = new QSocketNotifier(m_inotifyFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &IndexWatcher::onInotifyActivated);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IndexWatcher::closeBackend()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+#ifdef Q_OS_LINUX
+    if (m_inotifyFd >= 0) {
+        ::close(m_inotifyFd);
+        m_inotifyFd = -1;
+    }
+    if (m_fanotifyFd >= 0) {
+        ::close(m_fanotifyFd);
+        m_fanotifyFd = -1;
+    }
+    for (int fd : std::as_const(m_rootFds)) {
+        ::close(fd);
+    }
+#endif
+    m_rootFds.clear();
+    m_watchPaths.clear();
+    m_pathWatches.clear();
+}
+
+bool IndexWatcher::markRoot(const QString &rootPath)
+{
+#ifdef Q_OS_LINUX
+    const QByteArray path = QFile::encodeName(rootPath);
+    if (fanotify_mark(m_fanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, AT_FDCWD, path.constData()) < 0) {
+        return false;
+    }
+    int rootFd = ::open(path.constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd >= 0) {
+        m_rootFds.insert(rootPath, rootFd);
+    }
+    return rootFd >= 0;
+#else
+    Q_UNUSED(rootPath);
+    return false;
+#endif
+}
+
+bool IndexWatcher::walkTree(const QString &rootPath, qint64 sinceMSecs, bool reportCreated, QStringList &rescans)
+{
+    // Directories still to list; a stack instead of recursion, trees can be
+    // deeper than the watcher thread's stack
+    std::vector<QString> pending;
+    pending.push_back(rootPath);
+    DirScanner scanner;
+    DirScanner::Entry entry;
+    DirScanner::Metadata metadata;
+    while (!pending.empty()) {
+        // Shutting down waits for this thread, nothing walked now would be used
+        if (m_manager->shuttingDown()) {
+            return true;
+        }
+        const QString dirPath = std::move(pending.back());
+        pending.pop_back();
+
+#ifdef Q_OS_LINUX
+        if (m_inotifyFd >= 0) {
+            int wd = inotify_add_watch(m_inotifyFd, QFile::encodeName(dirPath).constData(), INOTIFY_MASK);
+            if (wd < 0) {
+                if (errno == ENOSPC) {
+                    m_watchLimitReached = true;
+                    return false;
+                }
+                continue;   // Unreadable directory, nothing to watch below it
+            }
+            m_watchPaths.insert(wd, dirPath);
+            m_pathWatches.insert(dirPath, wd);
+        }
+#endif
+
+        if (sinceMSecs > 0 && DirScanner::pathMetadata(dirPath, false, metadata)
+            && metadata.mtimeMSecs >= sinceMSecs - MTIME_SLACK_MSECS) {
+            rescans.append(dirPath);
+        }
+
+        DirHandle handle;
+        handle.path = dirPath;
+        if (!scanner.open(handle)) {
+            continue;
+        }
+        while (scanner.next(entry)) {
+            // Symlinks are reported as what they point to but never followed
+            const DirScanner::EntryType type = scanner.resolveType(entry, false);
+            if (reportCreated) {
+                const bool isDir = type == DirScanner::Directory
+                                   || (type == DirScanner::SymLink && scanner.resolveType(entry, true) == DirScanner::Directory);
+                queueChange(IndexChange::Created, scanner.childPath(entry), isDir);
+            }
+            if (type == DirScanner::Directory) {
+                pending.push_back(scanner.childPath(entry));
+            }
+        }
+        scanner.close();
+    }
+    return true;
+}
+
+void IndexWatcher::removeWatchTree(const QString &dirPath)
+{
+    for (auto it = m_pathWatches.begin(); it != m_pathWatches.end();) {
+        // Keep watches that another watched root still relies on
+        bool shared = false;
+        for (const QString &root : std::as_const(m_roots)) {
+            if (!isUnder(dirPath, root) && isUnder(it.key(), root)) {
+                shared = true;
+            }
+        }
+        if (isUnder(it.key(), dirPath) && !shared) {
+#ifdef Q_OS_LINUX
+            inotify_rm_watch(m_inotifyFd, it.value());
+#endif
+            m_watchPaths.remove(it.value());
+            it = m_pathWatches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void IndexWatcher::queueChange(IndexChange::Kind kind, const QString &path, bool isDir)
+{
+    if (kind == IndexChange::Modified) {
+        if (m_pendingModified.contains(path)) {
+            return;   // Writers often emit many modify events per file
+        }
+        m_pendingModified.insert(path);
+    }
+
+    m_pending.append({kind, path, isDir});
+
+    if (m_pending.size() >= MAX_PENDING_CHANGES) {
+        flushChanges();
+    } else if (m_flushTimer && !m_flushTimer->isActive()) {
+        m_flushTimer->start();
+    }
+}
+
+void IndexWatcher::flushChanges()
+{
+    if (m_flushTimer) {
+        m_flushTimer->stop();
+    }
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    QList<IndexChange> changes;
+    changes.swap(m_pending);
+    m_pendingModified.clear();
+
+    // Nested roots each get the changes below them
+    for (const QString &root : std::as_const(m_roots)) {
+        QList<IndexChange> rootChanges;
+        for (const IndexChange &change : std::as_const(changes)) {
+            if (isUnder(change.path, root)) {
+                rootChanges.append(change);
+            }
+        }
+        if (!rootChanges.isEmpty()) {
+            m_manager->applyChanges(root, rootChanges);
+        }
+    }
+}
+
+void IndexWatcher::reconcile(qint64 sinceMSecs)
+{
+    // The kernel dropped events. Rescan every directory touched since the
+    // last complete read; walking again also watches directories we missed.
+    flushChanges();
+    qDebug() << "Event queue overflow, rescanning directories changed since" << QDateTime::fromMSecsSinceEpoch(sinceMSecs);
+
+    const QStringList roots = m_roots;
+    for (const QString &root : roots) {
+        QStringList rescans;
+        if (!walkTree(root, sinceMSecs, false, rescans)) {
+            qDebug() << "Watch limit reached, no longer watching" << root;
+            m_roots.removeAll(root);
+            removeWatchTree(root);
+            m_manager->onRootUnwatched(root);
+            continue;
+        }
+        for (const QString &dirPath : std::as_const(rescans)) {
+            queueChange(IndexChange::DirectoryRescan, dirPath, true);
+        }
+    }
+    flushChanges();
+
+    // The rescans turned on timestamp checks for every query, a sweep turns them off again
+    for (const QString &root : std::as_const(m_roots)) {
+        m_manager->scheduleContentSweep(root);
+    }
+}
+
+void IndexWatcher::onInotifyActivated()
+{
+#ifdef Q_OS_LINUX
+    const qint64 readStart = QDateTime::currentMSecsSinceEpoch();
+    bool overflow = false;
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    forever {
+        ssize_t length = ::read(m_inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + length;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+
+            const QString dirPath = m_watchPaths.value(event->wd);
+            if (dirPath.isEmpty()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                m_watchPaths.remove(event->wd);
+                if (m_pathWatches.value(dirPath) == event->wd) {
+                    m_pathWatches.remove(dirPath);
+                }
+                continue;
+            }
+            if (event->len == 0) {
+                continue;   // Event about the watched directory itself
+            }
+
+            const QString path = dirPath + '/' + QFile::decodeName(event->name);
+            const bool isDir = event->mask & IN_ISDIR;
+
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                queueChange(IndexChange::Created, path, isDir);
+                QStringList unused;
+                if (isDir && !walkTree(path, 0, true, unused)) {
+                    reconcile(m_lastReadMSecs);
+                }
+            }
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                queueChange(IndexChange::Removed, path, isDir);
+                if (isDir) {
+                    removeWatchTree(path);
+                }
+            }
+            if (event->mask & (IN_MODIFY | IN_CLOSE_WRITE)) {
+                queueChange(IndexChange::Modified, path, false);
+            }
+        }
+    }
+
+    if (overflow) {
+        reconcile(m_lastReadMSecs);
+    }
+    m_lastReadMSecs = readStart;
+#endif
+}
+
+void IndexWatcher::onFanotifyActivated()
+{
+#ifdef Q_OS_LINUX
+    const qint64 readStart = QDateTime::currentMSecsSinceEpoch();
+    bool overflow = false;
+    bool unresolvable = false;
+    alignas(struct fanotify_event_metadata) char buffer[64 * 1024];
+
+    forever {
+        ssize_t length = ::read(m_fanotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        const struct fanotify_event_metadata *meta = reinterpret_cast<const struct fanotify_event_metadata *>(buffer);
+        for (; FAN_EVENT_OK(meta, length); meta = FAN_EVENT_NEXT(meta, length)) {
+            if (meta->vers != FANOTIFY_METADATA_VERSION) {
+                break;
+            }
+            if (meta->fd >= 0) {
+                ::close(meta->fd);
+            }
+            if (meta->mask & FAN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if (meta->event_len < sizeof(*meta) + sizeof(struct fanotify_event_info_fid)) {
+                continue;
+            }
+
+            const struct fanotify_event_info_fid *fid = reinterpret_cast<const struct fanotify_event_info_fid *>(meta + 1);
+            if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+
+            struct file_handle *handle = reinterpret_cast<struct file_handle *>(const_cast<unsigned char *>(fid->handle));
+            const char *name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+            const QString dirPath = resolveFanotifyDir(handle);
+            if (dirPath.isEmpty()) {
+                unresolvable = unresolvable || errno == EPERM;
+                continue;
+            }
+
+            const QString path = std::strcmp(name, ".") == 0 ? dirPath : dirPath + '/' + QFile::decodeName(name);
+            bool watched = false;
+            for (const QString &root : std::as_const(m_roots)) {
+                watched = watched || isUnder(path, root);
+            }
+            if (!watched) {
+                continue;
+            }
+
+            const bool isDir = meta->mask & FAN_ONDIR;
+            if (meta->mask & (FAN_CREATE | FAN_MOVED_TO)) {
+                queueChange(IndexChange::Created, path, isDir);
+                QStringList unused;
+                if (isDir) {
+                    walkTree(path, 0, true, unused);
+                }
+            }
+            if (meta->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+                queueChange(IndexChange::Removed, path, isDir);
+            }
+            if (meta->mask & FAN_MODIFY) {
+                queueChange(IndexChange::Modified, path, false);
+            }
+        }
+    }
+
+    if (unresolvable) {
+        // Handles cannot be opened without CAP_DAC_READ_SEARCH
+        qDebug() << "Cannot resolve fanotify handles - switching to inotify";
+        const QStringList roots = m_roots;
+        const qint64 since = m_lastReadMSecs;
+        closeBackend();
+        m_roots.clear();
+        if (initInotify()) {
+            for (const QString &root : roots) {
+                watchRoot(root, since);
+            }
+        }
+        return;
+    }
+
+    if (overflow) {
+        reconcile(m_lastReadMSecs);
+    }
+    m_lastReadMSecs = readStart;
+#endif
+}
+
+QString IndexWatcher::resolveFanotifyDir(void *handle)
+{
+#ifdef Q_OS_LINUX
+    for (int rootFd : std::as_const(m_rootFds)) {
+        int fd = open_by_handle_at(rootFd, static_cast<struct file_handle *>(handle), O_PATH | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        char target[4096];
+        ssize_t length = ::readlink(QByteArray("/proc/self/fd/" + QByteArray::number(fd)).constData(), target, sizeof(target) - 1);
+        ::close(fd);
+        if (length <= 0) {
+            continue;
+        }
+
+        const QString path = QFile::decodeName(QByteArray(target, int(length)));
+        if (path.endsWith(" (deleted)")) {
+            return QString();
+        }
+        return path;
+    }
+#else
+    Q_UNUSED(handle);
+#endif
+    return QString();
+}
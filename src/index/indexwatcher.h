@@ -0,0 +1,72 @@
+#ifndef INDEXWATCHER_H
+#define INDEXWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QSocketNotifier>
+#include <QTimer>
+#include "indexdelta.h"
+
+class IndexManager;
+
+// Keeps indexes current by listening to file system events. Lives on its
+// own thread; events are coalesced into batches and handed to the
+// IndexManager, which folds them into the index deltas.
+// fanotify is used when the process may mark whole file systems,
+// inotify (one watch per directory) otherwise.
+class IndexWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IndexWatcher(IndexManager *manager);
+    ~IndexWatcher();
+
+    QString backendName() const;
+
+public slots:
+    void start();
+    void stop();
+    void watchRoot(const QString &rootPath, qint64 sinceMSecs);
+
+private slots:
+    void onInotifyActivated();
+    void onFanotifyActivated();
+    void flushChanges();
+
+private:
+    bool initFanotify();
+    bool initInotify();
+    void closeBackend();
+    bool markRoot(const QString &rootPath);
+    bool walkTree(const QString &rootPath, qint64 sinceMSecs, bool reportCreated, QStringList &rescans);
+    void removeWatchTree(const QString &dirPath);
+    void queueChange(IndexChange::Kind kind, const QString &path, bool isDir);
+    void reconcile(qint64 sinceMSecs);
+    QString resolveFanotifyDir(void *handle);
+
+    // Directories modified up to this long before the reference time are rescanned too
+    static constexpr qint64 MTIME_SLACK_MSECS = 2000;
+    // fanotify sees everything from the moment a root is marked; an index
+    // built this recently is not walked for changes made before that
+    static constexpr qint64 RECENT_INDEX_MSECS = 60 * 1000;
+    static constexpr int FLUSH_INTERVAL_MS = 500;
+    static constexpr int MAX_PENDING_CHANGES = 4096;
+
+    IndexManager *m_manager;
+    int m_inotifyFd;
+    int m_fanotifyFd;
+    QSocketNotifier *m_notifier;
+    QTimer *m_flushTimer;
+    QStringList m_roots;
+    QHash<QString, int> m_rootFds;          // O_PATH descriptors for resolving fanotify handles
+    QHash<int, QString> m_watchPaths;       // inotify watch descriptor -> directory
+    QHash<QString, int> m_pathWatches;
+    QList<IndexChange> m_pending;
+    QSet<QString> m_pendingModified;
+    qint64 m_lastReadMSecs;
+    bool m_watchLimitReached;
+};
+
+#endif // INDEXWATCHER_H
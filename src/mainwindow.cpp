@@ -13,6 +13,7 @@
 #include <QDesktopServices>
 #include <QSplitter>
 #include <QMessageBox>
+#include <QRegularExpression>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -23,6 +24,11 @@ MainWindow::MainWindow(QWidget *parent)
     , searchProxyModel(nullptr)
     , searchResultsModel(nullptr)
     , isSearching(false)
+    , stagesLabel(nullptr)
+    , statsDock(nullptr)
+    , statsWidget(nullptr)
+    , liveSearchTimer(nullptr)
+    , liveSearch(true)
 {
     ui->setupUi(this);
     init();
@@ -369,75 +375,20 @@ void MainWindow::onDetailsWidgetCloseRequested()
 
 void MainWindow::onSearchResultsFound(const QList<SearchResult> &results)
 {
-    for (const SearchResult &result : results)
-    {
-        QList<QStandardItem*> rowItems;
-        if (currentSearchOptions.mode == SearchMode::FileName) {
-            // Filename search result
-            QStandardItem *nameItem = new QStandardItem(result.icon, result.fileName);
-            nameItem->setData(result.fullPath, Qt::UserRole);
-            nameItem->setEditable(false);
-            rowItems << nameItem;
-
-            // Location
-            QFileInfo fileInfo(result.fullPath);
-            QString location = fileInfo.absolutePath();
-            QString searchRoot = ui->addressBar->text();
-            if (location.startsWith(searchRoot)) {
-                location = location.mid(searchRoot.length());
-                if (location.startsWith('/') || location.startsWith('\\'))
-                    location = location.mid(1);
-                if (location.isEmpty())
-                    location = ".";
-            }
-            rowItems << new QStandardItem(location);
-
-            // Size
-            QString sizeText = result.isDirectory ? "" : formatFileSize(result.fileSize);
-            rowItems << new QStandardItem(sizeText);
-
-            // Type
-            rowItems << new QStandardItem(result.fileType);
-
-            // Modified
-            rowItems << new QStandardItem(result.lastModified);
-
-        } else {
-            // Content search result
-            QStandardItem *nameItem = new QStandardItem(result.icon, result.fileName);
-            nameItem->setData(result.fullPath, Qt::UserRole);
-            nameItem->setEditable(false);
-            rowItems << nameItem;
-
-            // Line number
-            rowItems << new QStandardItem(QString::number(result.lineNumber));
-
-            // Matched line
-            QStandardItem *matchItem = new QStandardItem(result.matchedLine);
-            matchItem->setToolTip(result.matchedLine); // Full text in tooltip
-            rowItems << matchItem;
-
-            // Size
-            rowItems << new QStandardItem(formatFileSize(result.fileSize));
-
-            // Modified
-            rowItems << new QStandardItem(result.lastModified);
-        }
-
-        // Make all items non-editable
-        for (QStandardItem *item : rowItems) {
-            item->setEditable(false);
-        }
-
-        searchResultsModel->appendRow(rowItems);
-    }
+    // One row insertion per batch, cells are only formatted when painted
+    searchResultsModel->appendResults(results);
 }
 
 void MainWindow::onSearchCompleted(int totalResults)
 {
     QString message = QString("Found %1 result%2").arg(totalResults).arg(totalResults == 1 ? "" : "s");
+    const int ignored = searchManager->ignoredEntries();
+    if (ignored > 0) {
+        message += QString(", skipped %1 ignored entr%2").arg(ignored).arg(ignored == 1 ? "y" : "ies");
+    }
     ui->statusbar->showMessage(message, 10000);
     ui->searchButton->setText("Search");
+    statsWidget->setStats(searchManager->statsJson());
 }
 
 void MainWindow::onSearchCancelled()
@@ -445,12 +396,44 @@ void MainWindow::onSearchCancelled()
     QString message = QString("Search cancelled");
     ui->statusbar->showMessage(message, 5000);
     ui->searchButton->setText("Search");
+    statsWidget->setStats(searchManager->statsJson());
 }
 
 void MainWindow::onSearchProgress(int filesProcessed, int directoriesProcessed)
 {
     QString message = QString("Searching... %1 files, %2 folders").arg(filesProcessed).arg(directoriesProcessed);
     ui->statusbar->showMessage(message, 0);
+    if (statsDock->isVisible()) {
+        statsWidget->setStats(searchManager->statsJson());
+    }
+}
+
+void MainWindow::onSearchStagesChanged(const SearchStages &stages)
+{
+    QString text = QString("Walk %1").arg(stages.traversalThreads);
+    QStringList details;
+    for (const DeviceStage &device : stages.devices) {
+        text += QString(", read %1 x%2%3").arg(device.name).arg(device.readers).arg(device.sorted ? " sorted" : "");
+        details.append(QString("%1: %2 readers%3, %4 ms per file, %5/s").arg(device.name).arg(device.readers)
+                           .arg(device.sorted ? " in disk order" : "")
+                           .arg(device.latencyUs / 1000.0, 0, 'f', 2)
+                           .arg(SearchResultModel::formatFileSize(qint64(device.bytesPerSecond))));
+    }
+    if (stages.matchThreads > 0) {
+        text += QString(", match %1").arg(stages.matchThreads);
+    }
+    stagesLabel->setText(text);
+    stagesLabel->setToolTip(details.join('\n'));
+}
+
+void MainWindow::onToggleSearchStats()
+{
+    if (statsDock->isVisible()) {
+        statsDock->hide();
+        return;
+    }
+    statsWidget->setStats(searchManager->statsJson());
+    statsDock->show();
 }
 
 void MainWindow::onSearchButtonClicked()
@@ -501,9 +484,35 @@ void MainWindow::onClearButtonClicked()
 
 void MainWindow::onSearchPromptReturnPressed()
 {
+    // In live mode Enter runs the pending query right away instead of stopping the search
+    if (liveSearch) {
+        liveSearchTimer->stop();
+        onLiveSearchTimeout();
+        return;
+    }
     onSearchButtonClicked();
 }
 
+void MainWindow::onSearchPromptTextChanged(const QString &text)
+{
+    Q_UNUSED(text);
+    if (liveSearch) {
+        liveSearchTimer->start();   // Restarted by every keystroke
+    }
+}
+
+void MainWindow::onLiveSearchTimeout()
+{
+    const QString searchText = ui->searchPrompt->text().trimmed();
+    if (searchText.isEmpty()) {
+        if (isSearching) {
+            clearSearch();
+        }
+        return;
+    }
+    startSearch(searchText, true);
+}
+
 void MainWindow::onSearchModeComboCurrentIndexChanged(int index)
 {
     switch (index) {
@@ -521,33 +530,108 @@ void MainWindow::onSearchModeComboCurrentIndexChanged(int index)
         break;
     }
 
+    // The content index and binary files option only apply to content searches
+    ui->contentIndexCheck->setVisible(currentSearchOptions.mode == SearchMode::FileContent);
+    ui->binaryFilesCheck->setVisible(currentSearchOptions.mode == SearchMode::FileContent);
+
     // If we're currently searching, clear the search
     if (isSearching) {
         clearSearch();
     }
 }
 
+void MainWindow::onSyntaxComboCurrentIndexChanged(int index)
+{
+    switch (index) {
+    case 1:
+        currentSearchOptions.syntax = SearchPattern::Regex;
+        break;
+    case 2:
+        currentSearchOptions.syntax = SearchPattern::Glob;
+        break;
+    case 3:
+        currentSearchOptions.syntax = SearchPattern::Terms;
+        break;
+    default:
+        currentSearchOptions.syntax = SearchPattern::Literal;
+        break;
+    }
 
-void MainWindow::startSearch(const QString &searchText)
+    // Globs match whole names, the word check does not apply
+    ui->wholeWordCheck->setEnabled(currentSearchOptions.syntax != SearchPattern::Glob);
+}
+
+void MainWindow::onCaseSensitiveCheckToggled(bool checked)
 {
-    // Cancel any ongoing search
-    if (searchManager && searchManager->isSearching()) {
-        searchManager->stopSearch();
+    currentSearchOptions.caseSensitive = checked;
+}
+
+void MainWindow::onWholeWordCheckToggled(bool checked)
+{
+    currentSearchOptions.wholeWord = checked;
+}
+
+void MainWindow::onContentIndexCheckToggled(bool checked)
+{
+    currentSearchOptions.useContentIndex = checked;
+}
+
+void MainWindow::onBinaryFilesCheckToggled(bool checked)
+{
+    currentSearchOptions.searchBinaryFiles = checked;
+}
+
+void MainWindow::onIgnoreRulesCheckToggled(bool checked)
+{
+    currentSearchOptions.useIgnoreRules = checked;
+}
+
+void MainWindow::onLiveSearchCheckToggled(bool checked)
+{
+    liveSearch = checked;
+    if (!liveSearch) {
+        liveSearchTimer->stop();
     }
+}
 
+
+void MainWindow::startSearch(const QString &searchText, bool live)
+{
+    // Terms are separated by spaces or commas
+    if (currentSearchOptions.syntax == SearchPattern::Terms) {
+        currentSearchOptions.terms = searchText.split(QRegularExpression("[\\s,]+"), Qt::SkipEmptyParts);
+    } else {
+        currentSearchOptions.terms.clear();
+
+        // Reject regexes that do not compile before touching the results view
+        const SearchPattern pattern(searchText, currentSearchOptions.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive,
+                                    currentSearchOptions.wholeWord, currentSearchOptions.syntax);
+        if (!pattern.isValid()) {
+            // Half-typed patterns are normal while typing, no dialog for those
+            if (live) {
+                ui->statusbar->showMessage("Invalid pattern: " + pattern.errorString(), 0);
+            } else {
+                QMessageBox::warning(this, "Invalid Pattern", "The search pattern is not valid:\n" + pattern.errorString());
+            }
+            return;
+        }
+    }
+
+    // A query that narrows down the completed one filters its results instead of walking the tree again
+    if (isSearching && searchManager->canRefine(searchText, ui->addressBar->text(), currentSearchOptions)) {
+        searchManager->refineSearch(searchText, searchResultsModel->takeRows());
+        ui->searchButton->setText("Stop");
+        ui->statusbar->showMessage("Refining results...", 0);
+        return;
+    }
+
+    // A running search is replaced by the new one, results and progress of the old one are dropped
     if (!isSearching) {
         // First time searching - setup UI
         savedFolderViewRoot = ui->folderView->rootIndex();
 
         // Setup model columns based on search mode
-        searchResultsModel->clear();
-        if (currentSearchOptions.mode == SearchMode::FileName) {
-            searchResultsModel->setHorizontalHeaderLabels(
-                QStringList() << "Name" << "Location" << "Size" << "Type" << "Modified");
-        } else {
-            searchResultsModel->setHorizontalHeaderLabels(
-                QStringList() << "Name" << "Line" << "Match" << "Size" << "Modified");
-        }
+        searchResultsModel->reset(currentSearchOptions.mode, currentSearchOptions.terms, ui->addressBar->text());
 
         // Switch to search results model
         ui->folderView->setModel(searchResultsModel);
@@ -572,17 +656,8 @@ void MainWindow::startSearch(const QString &searchText)
             ui->folderView->setColumnWidth(4, 120);
         }
     } else {
-        // Already searching - just clear results
-        searchResultsModel->clear();
-
-        // Setup headers
-        if (currentSearchOptions.mode == SearchMode::FileName) {
-            searchResultsModel->setHorizontalHeaderLabels(
-                QStringList() << "Name" << "Location" << "Size" << "Type" << "Modified");
-        } else {
-            searchResultsModel->setHorizontalHeaderLabels(
-                QStringList() << "Name" << "Line" << "Match" << "Size" << "Modified");
-        }
+        // Already searching - just clear results and set up the columns
+        searchResultsModel->reset(currentSearchOptions.mode, currentSearchOptions.terms, ui->addressBar->text());
 
         // Show message
         ui->statusbar->showMessage("Restarting search...", 0);
@@ -603,7 +678,6 @@ void MainWindow::clearSearch()
     if (isSearching) {
         if (searchResultsModel) {
             searchResultsModel->clear();
-            searchResultsModel->removeRows(0, searchResultsModel->rowCount());
         }
 
         // Restore original view
@@ -682,9 +756,17 @@ void MainWindow::init()
     connect(ui->clearButton, &QPushButton::clicked, this, &MainWindow::onClearButtonClicked);
     connect(ui->folderView, &QTableView::customContextMenuRequested, this, &MainWindow::onFolderViewContextMenuRequested);
     connect(ui->searchModeCombo, &QComboBox::currentIndexChanged, this, &MainWindow::onSearchModeComboCurrentIndexChanged);
+    connect(ui->syntaxCombo, &QComboBox::currentIndexChanged, this, &MainWindow::onSyntaxComboCurrentIndexChanged);
+    connect(ui->caseSensitiveCheck, &QCheckBox::toggled, this, &MainWindow::onCaseSensitiveCheckToggled);
+    connect(ui->wholeWordCheck, &QCheckBox::toggled, this, &MainWindow::onWholeWordCheckToggled);
+    connect(ui->contentIndexCheck, &QCheckBox::toggled, this, &MainWindow::onContentIndexCheckToggled);
+    connect(ui->binaryFilesCheck, &QCheckBox::toggled, this, &MainWindow::onBinaryFilesCheckToggled);
+    connect(ui->ignoreRulesCheck, &QCheckBox::toggled, this, &MainWindow::onIgnoreRulesCheckToggled);
+    connect(ui->liveSearchCheck, &QCheckBox::toggled, this, &MainWindow::onLiveSearchCheckToggled);
     connect(ui->searchButton, &QPushButton::clicked, this, &MainWindow::onSearchButtonClicked);
     connect(ui->clearButton, &QPushButton::clicked, this, &MainWindow::onClearButtonClicked);
     connect(ui->searchPrompt, &QLineEdit::returnPressed, this, &MainWindow::onSearchPromptReturnPressed);
+    connect(ui->searchPrompt, &QLineEdit::textChanged, this, &MainWindow::onSearchPromptTextChanged);
 
     // Shortcut for creating new folder
     QShortcut *newFolderShortcut = new QShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_N), this);
@@ -721,17 +803,47 @@ void MainWindow::setupSearch()
     searchManager = new SearchManager(this);
 
     // Create search results model
-    searchResultsModel = new QStandardItemModel(this);
-    searchResultsModel->setHorizontalHeaderLabels(QStringList() << "Name" << "Size" << "Type" << "Date Modified");
+    searchResultsModel = new SearchResultModel(&iconCache, this);
+
+    // Typing restarts the countdown, the search runs once it pauses
+    liveSearchTimer = new QTimer(this);
+    liveSearchTimer->setSingleShot(true);
+    liveSearchTimer->setInterval(LIVE_SEARCH_DELAYMS);
+    connect(liveSearchTimer, &QTimer::timeout, this, &MainWindow::onLiveSearchTimeout);
 
     // Set default search mode
     ui->searchModeCombo->setCurrentIndex(0);
+    ui->syntaxCombo->setCurrentIndex(0);
+    ui->caseSensitiveCheck->setChecked(currentSearchOptions.caseSensitive);
+    ui->wholeWordCheck->setChecked(currentSearchOptions.wholeWord);
+    ui->contentIndexCheck->setChecked(currentSearchOptions.useContentIndex);
+    ui->contentIndexCheck->setVisible(false);
+    ui->binaryFilesCheck->setChecked(currentSearchOptions.searchBinaryFiles);
+    ui->binaryFilesCheck->setVisible(false);
+    ui->ignoreRulesCheck->setChecked(currentSearchOptions.useIgnoreRules);
+    ui->liveSearchCheck->setChecked(liveSearch);
 
     // Connect search signals
     connect(searchManager, &SearchManager::resultsFound, this, &MainWindow::onSearchResultsFound);
     connect(searchManager, &SearchManager::searchCompleted, this, &MainWindow::onSearchCompleted);
     connect(searchManager, &SearchManager::searchCancelled, this, &MainWindow::onSearchCancelled);
     connect(searchManager, &SearchManager::searchProgress, this, &MainWindow::onSearchProgress);
+
+    // Threads per search stage, details per device in the tooltip
+    stagesLabel = new QLabel(this);
+    ui->statusbar->addPermanentWidget(stagesLabel);
+    connect(searchManager, &SearchManager::stagesChanged, this, &MainWindow::onSearchStagesChanged);
+
+    // Per-stage counters and latencies, refreshed with the progress while shown
+    statsWidget = new SearchStatsWidget(this);
+    statsDock = new QDockWidget("Search Statistics", this);
+    statsDock->setObjectName("searchStatsDock");
+    statsDock->setWidget(statsWidget);
+    addDockWidget(Qt::BottomDockWidgetArea, statsDock);
+    statsDock->hide();
+    connect(statsWidget, &SearchStatsWidget::closeRequested, statsDock, &QDockWidget::hide);
+    QShortcut *statsShortcut = new QShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_I), this);
+    connect(statsShortcut, &QShortcut::activated, this, &MainWindow::onToggleSearchStats);
 }
 
 
@@ -796,20 +908,3 @@ QModelIndex MainWindow::mapFromSourceModel(const QModelIndex &sourceIndex)
 {
     return treeProxyModel->mapFromSource(sourceIndex);
 }
-
-QString MainWindow::formatFileSize(qint64 size)
-{
-    const qint64 kb = 1024;
-    const qint64 mb = kb * 1024;
-    const qint64 gb = mb * 1024;
-
-    if (size >= gb) {
-        return QString::number(size / gb, 'f', 1) + " GB";
-    } else if (size >= mb) {
-        return QString::number(size / mb, 'f', 1) + " MB";
-    } else if (size >= kb) {
-        return QString::number(size / kb, 'f', 1) + " KB";
-    } else {
-        return QString::number(size) + " bytes";
-    }
-}
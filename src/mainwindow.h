@@ -2,13 +2,17 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QDockWidget>
+#include <QLabel>
 #include <QFileSystemModel>
 #include <QStack>
 #include <QPoint>
-#include <QStandardItemModel>
 #include <QTime>
+#include <QTimer>
 #include "widgets/filedetailswidget.h"
+#include "widgets/searchstatswidget.h"
 #include "models/directoryfilterproxymodel.h"
+#include "models/searchresultmodel.h"
 #include "search/searchmanager.h"
 
 QT_BEGIN_NAMESPACE
@@ -46,15 +50,25 @@ private slots:
     void onDetailsWidgetCloseRequested();
 
     // Search-related slots
-    // void on_searchPrompt_textChanged(const QString &text);
+    void onSearchPromptTextChanged(const QString &text);
+    void onLiveSearchTimeout();
     void onSearchResultsFound(const QList<SearchResult> &results);
     void onSearchCompleted(int totalResults);
     void onSearchCancelled();
     void onSearchProgress(int fileProcessed, int directoriesProcessed);
+    void onSearchStagesChanged(const SearchStages &stages);
+    void onToggleSearchStats();
     void clearSearch();
     void onSearchButtonClicked();
     void onSearchPromptReturnPressed();
     void onSearchModeComboCurrentIndexChanged(int index);
+    void onSyntaxComboCurrentIndexChanged(int index);
+    void onCaseSensitiveCheckToggled(bool checked);
+    void onWholeWordCheckToggled(bool checked);
+    void onContentIndexCheckToggled(bool checked);
+    void onBinaryFilesCheckToggled(bool checked);
+    void onIgnoreRulesCheckToggled(bool checked);
+    void onLiveSearchCheckToggled(bool checked);
 
 private:
     void init();
@@ -64,8 +78,7 @@ private:
     void showFileDetails(const QModelIndex &index);
     QModelIndex mapToSourceModel(const QModelIndex &proxyIndex);
     QModelIndex mapFromSourceModel(const QModelIndex &sourceIndex);
-    void startSearch(const QString &searchText);
-    QString formatFileSize(qint64 size);
+    void startSearch(const QString &searchText, bool live = false);
 
     Ui::MainWindow *ui;
     QFileSystemModel model;
@@ -81,10 +94,19 @@ private:
     // Search-related
     SearchManager *searchManager;
     QSortFilterProxyModel *searchProxyModel;
-    QStandardItemModel *searchResultsModel;
+    SearchResultModel *searchResultsModel;
+    FileIconCache iconCache;        // Shared by all search results, one lookup per kind of file
     bool isSearching;
     QModelIndex savedFolderViewRoot;
     SearchOptions currentSearchOptions;
+    QLabel *stagesLabel;            // Concurrency the search stages settled on
+    QDockWidget *statsDock;         // Where the time of the last search went, Ctrl+Shift+I
+    SearchStatsWidget *statsWidget;
+
+    // Search as you type, once typing pauses
+    QTimer *liveSearchTimer;
+    bool liveSearch;
+    const int LIVE_SEARCH_DELAYMS = 250;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,51 @@
+#include "fileiconcache.h"
+#include <QFileInfo>
+
+QIcon FileIconCache::icon(const QString &filePath, DirScanner::EntryType type)
+{
+    if (type == DirScanner::Directory) {
+        if (m_folderIcon.isNull()) {
+            m_folderIcon = m_iconProvider.icon(QFileIconProvider::Folder);
+        }
+        return m_folderIcon;
+    }
+
+    // Dot files and names without a suffix all look the same
+    const qsizetype nameStart = filePath.lastIndexOf('/') + 1;
+    const qsizetype dot = filePath.lastIndexOf('.');
+    if (type != DirScanner::File || dot <= nameStart) {
+        if (m_genericFileIcon.isNull()) {
+            m_genericFileIcon = m_iconProvider.icon(QFileIconProvider::File);
+        }
+        return m_genericFileIcon;
+    }
+
+    const QStringView suffix = QStringView(filePath).mid(dot + 1);
+    const auto it = m_bySuffix.constFind(suffix.toString().toLower());
+    if (it != m_bySuffix.constEnd()) {
+        return *it;
+    }
+    return fileIcon(filePath, suffix);
+}
+
+QIcon FileIconCache::fileIcon(const QString &filePath, QStringView suffix)
+{
+    // By name only, reading the file to sniff its type is what this avoids
+    const QMimeType mimeType = m_mimeDatabase.mimeTypeForFile(filePath, QMimeDatabase::MatchExtension);
+    QIcon icon = m_byMimeType.value(mimeType.name());
+    if (icon.isNull()) {
+        if (QIcon::hasThemeIcon(mimeType.iconName())) {
+            icon = QIcon::fromTheme(mimeType.iconName());
+        } else if (QIcon::hasThemeIcon(mimeType.genericIconName())) {
+            icon = QIcon::fromTheme(mimeType.genericIconName());
+        } else {
+            // No icon theme (Windows, macOS), the platform picks one for the first file of this kind
+            icon = m_iconProvider.icon(QFileInfo(filePath));
+        }
+        if (!mimeType.isDefault()) {
+            m_byMimeType.insert(mimeType.name(), icon);
+        }
+    }
+    m_bySuffix.insert(suffix.toString().toLower(), icon);
+    return icon;
+}
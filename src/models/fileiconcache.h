@@ -0,0 +1,30 @@
+#ifndef FILEICONCACHE_H
+#define FILEICONCACHE_H
+
+#include <QFileIconProvider>
+#include <QHash>
+#include <QIcon>
+#include <QMimeDatabase>
+#include <QString>
+#include "../search/dirscanner.h"
+
+// Icons for file lists, looked up once per kind of file instead of once per
+// file. Keyed by suffix, and suffixes of the same MIME type share an icon.
+// Only used from the GUI thread.
+class FileIconCache
+{
+public:
+    QIcon icon(const QString &filePath, DirScanner::EntryType type);
+
+private:
+    QIcon fileIcon(const QString &filePath, QStringView suffix);
+
+    QFileIconProvider m_iconProvider;
+    QMimeDatabase m_mimeDatabase;
+    QIcon m_folderIcon;
+    QIcon m_genericFileIcon;
+    QHash<QString, QIcon> m_bySuffix;
+    QHash<QString, QIcon> m_byMimeType;
+};
+
+#endif // FILEICONCACHE_H
@@ -0,0 +1,213 @@
+#include "searchresultmodel.h"
+#include <QDateTime>
+#include <QFileInfo>
+
+SearchResultModel::SearchResultModel(FileIconCache *iconCache, QObject *parent)
+    : QAbstractTableModel(parent)
+    , m_iconCache(iconCache)
+    , m_rows(std::make_shared<SearchResultSet>())
+{
+    m_columns = {Name, Location, Size, Type, Modified};
+}
+
+void SearchResultModel::reset(SearchMode mode, const QStringList &terms, const QString &searchRoot)
+{
+    beginResetModel();
+    m_searchRoot = searchRoot;
+    m_terms = terms;
+    if (mode == SearchMode::FileName) {
+        m_columns = {Name, Location, Size, Type, Modified};
+    } else {
+        m_columns = {Name, Line, Match, Size, Modified};
+    }
+    if (!terms.isEmpty()) {
+        m_columns.append(Term);
+    }
+    clearRows();
+    endResetModel();
+    emit headerDataChanged(Qt::Horizontal, 0, int(m_columns.size()) - 1);
+}
+
+void SearchResultModel::clear()
+{
+    beginResetModel();
+    clearRows();
+    endResetModel();
+}
+
+std::shared_ptr<const SearchResultSet> SearchResultModel::takeRows()
+{
+    beginResetModel();
+    std::shared_ptr<const SearchResultSet> rows = std::move(m_rows);
+    clearRows();
+    endResetModel();
+    return rows;
+}
+
+void SearchResultModel::clearRows()
+{
+    // The old set goes in one piece, however many rows it held
+    m_rows = std::make_shared<SearchResultSet>();
+}
+
+void SearchResultModel::appendResults(const QList<SearchResult> &results)
+{
+    if (results.isEmpty()) {
+        return;
+    }
+
+    const int first = rowCount();
+    beginInsertRows(QModelIndex(), first, first + int(results.size()) - 1);
+    for (const SearchResult &result : results) {
+        m_rows->append(result);
+    }
+    endInsertRows();
+}
+
+QString SearchResultModel::filePath(int row) const
+{
+    if (row < 0 || row >= rowCount()) {
+        return QString();
+    }
+    return m_rows->filePath(row);
+}
+
+int SearchResultModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_rows->size();
+}
+
+int SearchResultModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : int(m_columns.size());
+}
+
+QVariant SearchResultModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount() || index.column() >= m_columns.size()) {
+        return QVariant();
+    }
+
+    const int row = index.row();
+    const Column column = m_columns.at(index.column());
+    switch (role) {
+    case Qt::DisplayRole:
+        return displayText(row, column);
+    case Qt::DecorationRole:
+        if (column == Name) {
+            return m_iconCache->icon(filePath(row), m_rows->type(row));
+        }
+        break;
+    case Qt::ToolTipRole:
+        if (column == Match) {
+            return m_rows->snippet(row).toString();    // Full text, the column may cut it off
+        }
+        break;
+    case Qt::UserRole:
+        if (column == Name) {
+            return filePath(row);
+        }
+        break;
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+QVariant SearchResultModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole || section < 0 || section >= m_columns.size()) {
+        return QVariant();
+    }
+
+    switch (m_columns.at(section)) {
+    case Name:
+        return QStringLiteral("Name");
+    case Location:
+        return QStringLiteral("Location");
+    case Line:
+        return QStringLiteral("Line");
+    case Match:
+        return QStringLiteral("Match");
+    case Size:
+        return QStringLiteral("Size");
+    case Type:
+        return QStringLiteral("Type");
+    case Modified:
+        return QStringLiteral("Modified");
+    case Term:
+        return QStringLiteral("Term");
+    }
+    return QVariant();
+}
+
+QString SearchResultModel::displayText(int row, Column column) const
+{
+    const DirScanner::EntryType type = m_rows->type(row);
+    const bool hasMetadata = m_rows->hasMetadata(row);
+    switch (column) {
+    case Name:
+        return m_rows->name(row).toString();
+    case Location:
+        return location(row);
+    case Line:
+        return QString::number(m_rows->lineNumber(row));
+    case Match:
+        return m_rows->snippet(row).toString();
+    case Size:
+        return hasMetadata && type != DirScanner::Directory ? formatFileSize(m_rows->fileSize(row)) : QString();
+    case Type: {
+        if (type == DirScanner::Directory) {
+            return QStringLiteral("Folder");
+        } else if (type == DirScanner::File) {
+            const QString suffix = QFileInfo(m_rows->name(row).toString()).suffix().toUpper();
+            return suffix.isEmpty() ? QStringLiteral("File") : suffix + " File";
+        } else if (type == DirScanner::SymLink) {
+            return QStringLiteral("Shortcut");     // Could not be followed
+        }
+        return QStringLiteral("Unknown");
+    }
+    case Modified:
+        return hasMetadata ? QDateTime::fromMSecsSinceEpoch(m_rows->modifiedMSecs(row)).toString("yyyy-MM-dd hh:mm:ss")
+                           : QString();
+    case Term:
+        return m_terms.value(m_rows->term(row));
+    }
+    return QString();
+}
+
+QString SearchResultModel::location(int row) const
+{
+    // Parent directory relative to the search root, "." for the root itself
+    QString directory = m_rows->directoryPath(row);
+    if (directory.size() > 1) {
+        directory.chop(1);
+    }
+    if (directory.startsWith(m_searchRoot)) {
+        directory = directory.mid(m_searchRoot.length());
+        if (directory.startsWith('/') || directory.startsWith('\\')) {
+            directory = directory.mid(1);
+        }
+        if (directory.isEmpty()) {
+            directory = ".";
+        }
+    }
+    return directory;
+}
+
+QString SearchResultModel::formatFileSize(qint64 size)
+{
+    const qint64 kb = 1024;
+    const qint64 mb = kb * 1024;
+    const qint64 gb = mb * 1024;
+
+    if (size >= gb) {
+        return QString::number(double(size) / gb, 'f', 1) + " GB";
+    } else if (size >= mb) {
+        return QString::number(double(size) / mb, 'f', 1) + " MB";
+    } else if (size >= kb) {
+        return QString::number(double(size) / kb, 'f', 1) + " KB";
+    } else {
+        return QString::number(size) + " bytes";
+    }
+}
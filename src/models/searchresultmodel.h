@@ -0,0 +1,64 @@
+#ifndef SEARCHRESULTMODEL_H
+#define SEARCHRESULTMODEL_H
+
+#include <QAbstractTableModel>
+#include <QStringList>
+#include <memory>
+#include "../search/searchmanager.h"
+#include "../search/searchresultset.h"
+#include "fileiconcache.h"
+
+// Search results as a table. Rows live in a compact SearchResultSet, so
+// hundreds of thousands of hits stay small and arrive with a single row
+// insertion per batch. Display strings, sizes, dates and icons are only
+// produced in data(), for the rows being painted.
+class SearchResultModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    // The icon cache is shared with the rest of the window and must outlive the model
+    explicit SearchResultModel(FileIconCache *iconCache, QObject *parent = nullptr);
+
+    // Drops all rows and sets up the columns for a new search. A Term column
+    // is shown when there are terms, results refer to them by index.
+    void reset(SearchMode mode, const QStringList &terms, const QString &searchRoot);
+    void clear();
+    // Empties the model and hands its rows over, for refining them elsewhere
+    std::shared_ptr<const SearchResultSet> takeRows();
+    void appendResults(const QList<SearchResult> &results);
+
+    QString filePath(int row) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    static QString formatFileSize(qint64 size);
+
+private:
+    enum Column
+    {
+        Name,
+        Location,
+        Line,
+        Match,
+        Size,
+        Type,
+        Modified,
+        Term,
+    };
+
+    void clearRows();
+    QString displayText(int row, Column column) const;
+    QString location(int row) const;
+
+    FileIconCache *m_iconCache;
+    QList<Column> m_columns;
+    QString m_searchRoot;
+    QStringList m_terms;
+    std::shared_ptr<SearchResultSet> m_rows;
+};
+
+#endif // SEARCHRESULTMODEL_H
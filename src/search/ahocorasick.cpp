@@ -0,0 +1,279 @@
+#include "ahocorasick.h"
+#include <QtAlgorithms>
+#include <algorithm>
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define BOBA_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline char foldAscii(char byte)
+{
+    return (byte >= 'A' && byte <= 'Z') ? char(byte + ('a' - 'A')) : byte;
+}
+
+}
+
+AhoCorasick::AhoCorasick(const QStringList &terms, Qt::CaseSensitivity caseSensitivity)
+    : m_foldCase(caseSensitivity == Qt::CaseInsensitive)
+    , m_termCount(int(terms.size()))
+    , m_maxLength(0)
+    , m_classCount(1)
+    , m_skip(false)
+    , m_highStartBytes(false)
+{
+    for (int term = 0; term < int(terms.size()); ++term) {
+        if (terms[term].isEmpty()) {
+            continue;
+        }
+        addPattern(terms[term].toUtf8(), term);
+        if (m_foldCase) {
+            addPattern(terms[term].toLower().toUtf8(), term);
+            addPattern(terms[term].toUpper().toUtf8(), term);
+        }
+    }
+    build();
+}
+
+int AhoCorasick::termCount() const
+{
+    return m_termCount;
+}
+
+qsizetype AhoCorasick::maxTermLength() const
+{
+    return m_maxLength;
+}
+
+void AhoCorasick::addPattern(const QByteArray &bytes, int term)
+{
+    QByteArray folded = bytes;
+    if (m_foldCase) {
+        for (char &byte : folded) {
+            byte = foldAscii(byte);
+        }
+    }
+
+    // Case forms of ASCII terms fold to the same bytes
+    for (size_t i = m_patterns.size(); i-- > 0 && m_patterns[i].term == term;) {
+        if (m_patternBytes[i] == folded) {
+            return;
+        }
+    }
+
+    m_patterns.push_back({term, folded.size()});
+    m_patternBytes.push_back(folded);
+    m_maxLength = qMax(m_maxLength, folded.size());
+}
+
+void AhoCorasick::build()
+{
+    // Bytes no term contains share class 0
+    std::fill(m_byteClasses, m_byteClasses + 256, 0);
+    for (const QByteArray &bytes : m_patternBytes) {
+        for (char byte : bytes) {
+            if (m_byteClasses[uchar(byte)] == 0) {
+                m_byteClasses[uchar(byte)] = uchar(m_classCount++);
+            }
+        }
+    }
+    if (m_foldCase) {
+        for (int byte = 'A'; byte <= 'Z'; ++byte) {
+            m_byteClasses[byte] = m_byteClasses[byte + ('a' - 'A')];
+        }
+    }
+    const size_t classCount = size_t(m_classCount);
+
+    // Trie of all patterns
+    m_transitions.assign(classCount, -1);
+    m_output.assign(1, -1);
+    m_outputLink.assign(1, -1);
+    for (size_t i = 0; i < m_patterns.size(); ++i) {
+        qint32 state = 0;
+        for (char byte : m_patternBytes[i]) {
+            const size_t slot = size_t(state) * classCount + m_byteClasses[uchar(byte)];
+            if (m_transitions[slot] < 0) {
+                const qint32 next = qint32(m_output.size());
+                m_transitions[slot] = next;
+                m_transitions.resize(m_transitions.size() + classCount, -1);
+                m_output.push_back(-1);
+                m_outputLink.push_back(-1);
+            }
+            state = m_transitions[slot];
+        }
+        // The first of identical terms reports the hit
+        if (m_output[state] < 0) {
+            m_output[state] = qint32(i);
+        }
+    }
+
+    // Failure links breadth-first, completing the trie into a DFA
+    std::vector<qint32> failure(m_output.size(), 0);
+    std::vector<qint32> queue;
+    for (size_t byteClass = 0; byteClass < classCount; ++byteClass) {
+        const qint32 next = m_transitions[byteClass];
+        if (next < 0) {
+            m_transitions[byteClass] = 0;
+        } else {
+            queue.push_back(next);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const qint32 state = queue[head];
+        const qint32 fallback = failure[state];
+        m_outputLink[state] = m_output[fallback] >= 0 ? fallback : m_outputLink[fallback];
+
+        for (size_t byteClass = 0; byteClass < classCount; ++byteClass) {
+            const size_t slot = size_t(state) * classCount + byteClass;
+            const qint32 fallbackNext = m_transitions[size_t(fallback) * classCount + byteClass];
+            if (m_transitions[slot] < 0) {
+                m_transitions[slot] = fallbackNext;
+            } else {
+                failure[m_transitions[slot]] = fallbackNext;
+                queue.push_back(m_transitions[slot]);
+            }
+        }
+    }
+
+    // Bytes that can start a term, as nibble lookup tables for the SIMD skip
+    std::fill(m_startBytes, m_startBytes + 256, false);
+    std::fill(m_lowNibbles, m_lowNibbles + 16, 0);
+    for (int nibble = 0; nibble < 16; ++nibble) {
+        m_highNibbles[nibble] = nibble < 8 ? uchar(1 << nibble) : 0;
+    }
+    for (const QByteArray &bytes : m_patternBytes) {
+        const uchar first = uchar(bytes.at(0));
+        m_startBytes[first] = true;
+        if (m_foldCase && first >= 'a' && first <= 'z') {
+            m_startBytes[first - ('a' - 'A')] = true;
+        }
+    }
+    int startByteCount = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+        if (!m_startBytes[byte]) {
+            continue;
+        }
+        startByteCount++;
+        if (byte < 0x80) {
+            m_lowNibbles[byte & 0x0f] |= uchar(1 << (byte >> 4));
+        } else {
+            m_highStartBytes = true;
+        }
+    }
+    m_skip = startByteCount > 0 && startByteCount <= MAX_SKIP_BYTES;
+
+    m_patternBytes.clear();
+    m_patternBytes.shrink_to_fit();
+}
+
+bool AhoCorasick::find(const uchar *data, qsizetype size, qsizetype from,
+                       const std::function<bool(const Hit &)> &accept, Hit &hit) const
+{
+    if (m_patterns.empty()) {
+        return false;
+    }
+
+    const size_t classCount = size_t(m_classCount);
+    qint32 state = 0;
+    qsizetype i = from;
+    while (i < size) {
+        if (state == 0 && m_skip) {
+            i = skip(data, size, i);
+            if (i >= size) {
+                break;
+            }
+        }
+        state = m_transitions[size_t(state) * classCount + m_byteClasses[data[i]]];
+        ++i;
+
+        // Every term ending here, longest first
+        for (qint32 s = m_output[state] >= 0 ? state : m_outputLink[state]; s >= 0; s = m_outputLink[s]) {
+            const Pattern &pattern = m_patterns[m_output[s]];
+            hit = {i - pattern.length, i, pattern.term};
+            if (!accept || accept(hit)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+qsizetype AhoCorasick::skip(const uchar *data, qsizetype size, qsizetype from) const
+{
+#ifdef BOBA_X86_SIMD
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    static const bool hasSsse3 = __builtin_cpu_supports("ssse3");
+    if (hasAvx2) {
+        return skipAvx2(data, size, from);
+    }
+    if (hasSsse3) {
+        return skipSsse3(data, size, from);
+    }
+#endif
+    return skipScalar(data, size, from);
+}
+
+qsizetype AhoCorasick::skipScalar(const uchar *data, qsizetype size, qsizetype from) const
+{
+    while (from < size && !m_startBytes[data[from]]) {
+        ++from;
+    }
+    return from;
+}
+
+#ifdef BOBA_X86_SIMD
+// A byte is a start byte when the bit of its high nibble is set in the entry of
+// its low nibble. Exact for ASCII, non-ASCII bytes are all candidates if any is.
+__attribute__((target("ssse3")))
+qsizetype AhoCorasick::skipSsse3(const uchar *data, qsizetype size, qsizetype from) const
+{
+    const __m128i lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_lowNibbles));
+    const __m128i highTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m_highNibbles));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+
+    qsizetype i = from;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i lowBits = _mm_shuffle_epi8(lowTable, _mm_and_si128(block, nibbleMask));
+        const __m128i highBits = _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi16(block, 4), nibbleMask));
+        const __m128i none = _mm_cmpeq_epi8(_mm_and_si128(lowBits, highBits), _mm_setzero_si128());
+
+        quint32 mask = ~quint32(_mm_movemask_epi8(none)) & 0xffff;
+        if (m_highStartBytes) {
+            mask |= quint32(_mm_movemask_epi8(block));
+        }
+        if (mask) {
+            return i + qCountTrailingZeroBits(mask);
+        }
+    }
+    return skipScalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+qsizetype AhoCorasick::skipAvx2(const uchar *data, qsizetype size, qsizetype from) const
+{
+    // The shuffle looks up within each 128-bit lane, so both lanes get the tables
+    const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m_lowNibbles)));
+    const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m_highNibbles)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+
+    qsizetype i = from;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i lowBits = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(block, nibbleMask));
+        const __m256i highBits = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibbleMask));
+        const __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(lowBits, highBits), _mm256_setzero_si256());
+
+        quint32 mask = ~quint32(_mm256_movemask_epi8(none));
+        if (m_highStartBytes) {
+            mask |= quint32(_mm256_movemask_epi8(block));
+        }
+        if (mask) {
+            return i + qCountTrailingZeroBits(mask);
+        }
+    }
+    return skipSsse3(data, size, i);
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef AHOCORASICK_H
+#define AHOCORASICK_H
+
+#include <QStringList>
+#include <functional>
+#include <vector>
+
+// Aho-Corasick automaton finding any of many terms in one pass over UTF-8
+// bytes. Built once per search and only read afterwards, so every worker
+// shares it. Transitions form a dense table over the bytes the terms use.
+// While no term is partially matched the scan skips ahead to the next byte
+// that can start one, 16 or 32 bytes at a time when few bytes can.
+class AhoCorasick
+{
+public:
+    struct Hit
+    {
+        qsizetype start;
+        qsizetype end;
+        int term;           // Index into the term list
+    };
+
+    // Case-insensitive matching folds ASCII and adds the lower and upper case forms of other terms
+    AhoCorasick(const QStringList &terms, Qt::CaseSensitivity caseSensitivity);
+
+    int termCount() const;
+    qsizetype maxTermLength() const;    // In bytes
+
+    // First hit starting at or after from, in order of where hits end, that accept
+    // agrees to (any if accept is empty)
+    bool find(const uchar *data, qsizetype size, qsizetype from,
+              const std::function<bool(const Hit &)> &accept, Hit &hit) const;
+
+private:
+    struct Pattern
+    {
+        int term;
+        qsizetype length;
+    };
+
+    void addPattern(const QByteArray &bytes, int term);
+    void build();
+    qsizetype skip(const uchar *data, qsizetype size, qsizetype from) const;
+    qsizetype skipScalar(const uchar *data, qsizetype size, qsizetype from) const;
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+    qsizetype skipSsse3(const uchar *data, qsizetype size, qsizetype from) const;
+    qsizetype skipAvx2(const uchar *data, qsizetype size, qsizetype from) const;
+#endif
+
+    // Skipping only pays off while start bytes are rare
+    static constexpr int MAX_SKIP_BYTES = 16;
+
+    bool m_foldCase;
+    int m_termCount;
+    std::vector<Pattern> m_patterns;
+    std::vector<QByteArray> m_patternBytes;     // Only needed while building
+    qsizetype m_maxLength;
+
+    uchar m_byteClasses[256];       // 0 for bytes no term contains
+    int m_classCount;
+    std::vector<qint32> m_transitions;
+    std::vector<qint32> m_output;       // Pattern ending at each state, or -1
+    std::vector<qint32> m_outputLink;   // Closest suffix state with an output, or -1
+
+    bool m_startBytes[256];
+    bool m_skip;
+    bool m_highStartBytes;          // Some term starts with a non-ASCII byte
+    uchar m_lowNibbles[16];         // Start byte tables for the nibble lookup
+    uchar m_highNibbles[16];
+};
+
+#endif // AHOCORASICK_H
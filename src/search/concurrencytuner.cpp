@@ -0,0 +1,82 @@
+#include "concurrencytuner.h"
+
+ConcurrencyTuner::ConcurrencyTuner(int initial, int minimum, int maximum)
+    : m_minimum(qMax(1, minimum))
+    , m_maximum(qMax(m_minimum, maximum))
+{
+    reset(initial);
+}
+
+int ConcurrencyTuner::limit() const
+{
+    return m_limit;
+}
+
+void ConcurrencyTuner::reset(int limit)
+{
+    m_limit = qBound(m_minimum, limit, m_maximum);
+    m_direction = 1;
+    m_window.invalidate();
+    m_operations = 0;
+    m_units = 0;
+    m_latencyNs = 0;
+    m_rate = 0;
+    m_meanLatencyNs = 0;
+}
+
+bool ConcurrencyTuner::record(int operations, qint64 units, qint64 latencyNs)
+{
+    if (!m_window.isValid()) {
+        m_window.start();
+    }
+    m_operations += operations;
+    m_units += units;
+    m_latencyNs += latencyNs;
+
+    // A window needs enough operations for every slot to have turned over
+    const qint64 elapsedNs = m_window.nsecsElapsed();
+    if (elapsedNs < WINDOW_NS || m_operations < 2 * m_limit) {
+        return false;
+    }
+
+    const double rate = double(m_units) * 1e9 / double(elapsedNs);
+    const qint64 latency = m_latencyNs / m_operations;
+    m_window.restart();
+    m_operations = 0;
+    m_units = 0;
+    m_latencyNs = 0;
+
+    if (m_rate > 0) {
+        if (rate < m_rate * (1 - RATE_TOLERANCE)) {
+            m_direction = -m_direction;     // The last step hurt, undo it
+        } else if (rate <= m_rate * (1 + RATE_TOLERANCE) && latency > m_meanLatencyNs * LATENCY_GROWTH) {
+            m_direction = -1;               // Saturated, more only waits longer
+        }
+    }
+    m_rate = rate;
+    m_meanLatencyNs = latency;
+
+    // Keep exploring from the bounds instead of pushing against them
+    if ((m_direction > 0 && m_limit == m_maximum) || (m_direction < 0 && m_limit == m_minimum)) {
+        m_direction = -m_direction;
+    }
+
+    // Grow by a quarter, shrink more carefully
+    const int step = m_direction > 0 ? qMax(1, m_limit / 4) : qMax(1, m_limit / 8);
+    const int limit = qBound(m_minimum, m_limit + m_direction * step, m_maximum);
+    if (limit == m_limit) {
+        return false;
+    }
+    m_limit = limit;
+    return true;
+}
+
+double ConcurrencyTuner::unitsPerSecond() const
+{
+    return m_rate;
+}
+
+qint64 ConcurrencyTuner::meanLatencyNs() const
+{
+    return m_meanLatencyNs;
+}
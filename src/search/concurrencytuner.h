@@ -0,0 +1,49 @@
+#ifndef CONCURRENCYTUNER_H
+#define CONCURRENCYTUNER_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+// Picks how many operations a stage keeps in flight by hill climbing on
+// what it measures. Work is recorded in windows of a quarter second; after
+// each window the limit moves one step, in the same direction while that
+// raised throughput and back once it stopped helping. Throughput that
+// stays flat while latency grows means the device is only queueing the
+// extra work, so the limit comes down. Not thread-safe, callers serialize.
+class ConcurrencyTuner
+{
+public:
+    ConcurrencyTuner(int initial, int minimum, int maximum);
+
+    int limit() const;
+    // Starts over from limit, for a new kind of device
+    void reset(int limit);
+
+    // Adds finished operations, the units of work they did (bytes, entries)
+    // and their summed latency. Returns true when this moved the limit.
+    bool record(int operations, qint64 units, qint64 latencyNs);
+
+    // Of the last complete window
+    double unitsPerSecond() const;
+    qint64 meanLatencyNs() const;
+
+private:
+    static constexpr qint64 WINDOW_NS = 250 * 1000 * 1000;
+    static constexpr double RATE_TOLERANCE = 0.1;       // Smaller changes count as noise
+    static constexpr double LATENCY_GROWTH = 1.25;
+
+    int m_limit;
+    int m_minimum;
+    int m_maximum;
+    int m_direction;
+
+    QElapsedTimer m_window;
+    int m_operations;
+    qint64 m_units;
+    qint64 m_latencyNs;
+
+    double m_rate;
+    qint64 m_meanLatencyNs;
+};
+
+#endif // CONCURRENCYTUNER_H
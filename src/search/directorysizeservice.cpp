@@ -0,0 +1,244 @@
+#include "directorysizeservice.h"
+#include "searchtrace.h"
+#include <QDebug>
+#include <QMetaObject>
+#include <QThread>
+
+DirectorySizeService::DirectorySizeService(QObject *parent)
+    : QObject(parent)
+    , m_traversal(nullptr)
+    , m_generation(0)
+    , m_walkGeneration(0)
+    , m_openDirHandles(0)
+    , m_bytes(0)
+    , m_allocatedBytes(0)
+    , m_files(0)
+    , m_directories(0)
+    , m_walkKey{0, 0, 0}
+    , m_pendingKey{0, 0, 0}
+    , m_walkPending(false)
+    , m_progressTimer(nullptr)
+{
+    m_clock.start();
+
+    m_progressTimer = new QTimer(this);
+    m_progressTimer->setInterval(PROGRESS_INTERVAL_MS);
+    connect(m_progressTimer, &QTimer::timeout, this, &DirectorySizeService::onProgressTimer);
+}
+
+DirectorySizeService::~DirectorySizeService()
+{
+    // A cancelled walk drains without scanning, then the threads go
+    cancel();
+    delete m_traversal;
+}
+
+void DirectorySizeService::request(const QString &path)
+{
+    DirScanner::Metadata metadata;
+    if (!DirScanner::pathMetadata(path, true, metadata) || metadata.type != DirScanner::Directory) {
+        cancel();
+        return;
+    }
+    const CacheKey key{metadata.device, metadata.inode, metadata.mtimeMSecs};
+
+    // Unchanged since it was last added up
+    auto cached = m_cache.constFind(key);
+    if (cached != m_cache.constEnd() && m_clock.elapsed() - cached->storedMSecs < CACHE_TTL_MSECS) {
+        cancel();
+        emit sizeChanged(path, cached->size);
+        return;
+    }
+
+    // Already on it
+    if (m_traversal && m_traversal->isBusy() && !m_walkPending
+        && m_walkGeneration.load(std::memory_order_acquire) == m_generation.load(std::memory_order_acquire)
+        && m_walkPath == path) {
+        return;
+    }
+
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    if (!m_traversal) {
+        const int threads = qBound(1, QThread::idealThreadCount(), MAX_TRAVERSAL_THREADS);
+        m_traversal = new TraversalScheduler(threads);
+        qDebug() << "DirectorySizeService initialized with" << threads << "traversal threads";
+    }
+
+    // A cancelled walk may still be draining, this one starts as soon as it is over
+    m_pendingPath = path;
+    m_pendingKey = key;
+    m_walkPending = true;
+    if (!m_traversal->isBusy()) {
+        startPendingWalk();
+    }
+}
+
+void DirectorySizeService::cancel()
+{
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    m_walkPending = false;
+    m_progressTimer->stop();
+}
+
+void DirectorySizeService::startPendingWalk()
+{
+    if (!m_walkPending) {
+        return;
+    }
+    m_walkPending = false;
+
+    // Not busy anymore, this only waits for the threads to park
+    m_traversal->waitForDone();
+
+    m_bytes.store(0, std::memory_order_relaxed);
+    m_allocatedBytes.store(0, std::memory_order_relaxed);
+    m_files.store(0, std::memory_order_relaxed);
+    m_directories.store(0, std::memory_order_relaxed);
+    m_linkedInodes.clear();
+
+    // The root's own blocks, its entries count theirs as they are listed
+    DirScanner::Metadata metadata;
+    if (DirScanner::pathMetadata(m_pendingPath, true, metadata)) {
+        m_allocatedBytes.store(metadata.allocatedBytes, std::memory_order_relaxed);
+    }
+
+    m_walkPath = m_pendingPath;
+    m_walkKey = m_pendingKey;
+    m_walkGeneration.store(m_generation.load(std::memory_order_acquire), std::memory_order_release);
+    m_progressTimer->start();
+
+    DirHandle root;
+    root.path = m_pendingPath;
+    m_traversal->start(this, root);
+}
+
+void DirectorySizeService::processDirectory(int workerIndex, DirHandle &dir)
+{
+    SearchTrace::Span span("size scan", "entries");
+
+    // Subdirectories of a cancelled walk are closed without being scanned
+    const int generation = m_walkGeneration.load(std::memory_order_acquire);
+    DirScanner scanner;
+    const bool opened = generation == m_generation.load(std::memory_order_acquire) && scanner.open(dir);
+    if (dir.fd >= 0) {
+        if (!opened) {
+            DirScanner::closeHandle(dir);
+        }
+        releaseDirHandle();
+        dir.fd = -1;
+    }
+    if (!opened) {
+        return;
+    }
+
+    // Added up here and published once per directory, the totals are shared by all threads
+    qint64 bytes = 0;
+    qint64 allocatedBytes = 0;
+    qint64 files = 0;
+    qint64 directories = 0;
+    int entryCount = 0;
+
+    // Every entry needs a stat for its size, which also tells its type
+    DirScanner::Entry entry;
+    DirScanner::Metadata metadata;
+    while (scanner.next(entry)) {
+        entryCount++;
+        if ((entryCount & 255) == 0 && generation != m_generation.load(std::memory_order_acquire)) {
+            break;
+        }
+        if (!scanner.metadata(entry, false, metadata)) {
+            continue;   // Gone since it was listed
+        }
+
+        // Like du -x, mount points are not crossed
+        if (metadata.type == DirScanner::Directory && metadata.device != m_walkKey.device) {
+            continue;
+        }
+        // A file reached through several links counts for the first one
+        if (metadata.type != DirScanner::Directory && metadata.linkCount > 1) {
+            QMutexLocker locker(&m_linksMutex);
+            const QPair<quint64, quint64> inode(metadata.device, metadata.inode);
+            if (m_linkedInodes.contains(inode)) {
+                continue;
+            }
+            m_linkedInodes.insert(inode);
+        }
+        allocatedBytes += metadata.allocatedBytes;
+
+        if (metadata.type == DirScanner::Directory) {
+            directories++;
+            const bool openDescriptor = reserveDirHandle();
+            DirHandle child = scanner.childHandle(entry, openDescriptor);
+            if (openDescriptor && child.fd < 0) {
+                releaseDirHandle();
+            }
+            m_traversal->push(workerIndex, child);
+        } else {
+            files++;
+            bytes += metadata.size;
+        }
+    }
+    span.setArg(entryCount);
+
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    m_allocatedBytes.fetch_add(allocatedBytes, std::memory_order_relaxed);
+    m_files.fetch_add(files, std::memory_order_relaxed);
+    m_directories.fetch_add(directories, std::memory_order_relaxed);
+}
+
+void DirectorySizeService::traversalFinished()
+{
+    // No walk starts before this one is over, so m_walkGeneration is still this walk's
+    const int generation = m_walkGeneration.load(std::memory_order_acquire);
+    QMetaObject::invokeMethod(this, [this, generation]() { walkFinished(generation); }, Qt::QueuedConnection);
+}
+
+void DirectorySizeService::walkFinished(int generation)
+{
+    // Only a walk that ran to the end is worth keeping
+    if (generation == m_generation.load(std::memory_order_acquire)) {
+        m_progressTimer->stop();
+        DirectorySize size = currentTotals();
+        size.complete = true;
+        if (m_cache.size() >= MAX_CACHE_ENTRIES) {
+            m_cache.clear();
+        }
+        m_cache.insert(m_walkKey, CacheEntry{size, m_clock.elapsed()});
+        emit sizeChanged(m_walkPath, size);
+    }
+
+    // A walk may be waiting for the threads
+    startPendingWalk();
+}
+
+void DirectorySizeService::onProgressTimer()
+{
+    if (m_walkGeneration.load(std::memory_order_acquire) != m_generation.load(std::memory_order_acquire)) {
+        return;
+    }
+    emit sizeChanged(m_walkPath, currentTotals());
+}
+
+DirectorySize DirectorySizeService::currentTotals() const
+{
+    DirectorySize size;
+    size.bytes = m_bytes.load(std::memory_order_relaxed);
+    size.allocatedBytes = m_allocatedBytes.load(std::memory_order_relaxed);
+    size.files = m_files.load(std::memory_order_relaxed);
+    size.directories = m_directories.load(std::memory_order_relaxed);
+    return size;
+}
+
+bool DirectorySizeService::reserveDirHandle()
+{
+    if (m_openDirHandles.fetch_add(1, std::memory_order_acquire) >= MAX_OPEN_DIR_HANDLES) {
+        m_openDirHandles.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+void DirectorySizeService::releaseDirHandle()
+{
+    m_openDirHandles.fetch_sub(1, std::memory_order_release);
+}
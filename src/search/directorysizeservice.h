@@ -0,0 +1,110 @@
+#ifndef DIRECTORYSIZESERVICE_H
+#define DIRECTORYSIZESERVICE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QTimer>
+#include <atomic>
+#include "dirscanner.h"
+#include "traversalscheduler.h"
+
+struct DirectorySize
+{
+    qint64 bytes = 0;               // Apparent size of the files
+    qint64 allocatedBytes = 0;      // Blocks on disk, directories included
+    qint64 files = 0;
+    qint64 directories = 0;
+    bool complete = false;          // Else a running total
+};
+
+
+
+// Adds up everything below a directory, the way du -x does, on traversal
+// threads of its own so it never waits behind a search. Totals stream out
+// while the walk runs. Only one directory is walked at a time, asking for
+// another cancels it. Symlinks are counted, not followed, a file with
+// several hard links is counted once, and file systems mounted below the
+// directory are left out. Lives on the GUI thread.
+class DirectorySizeService : public QObject, public TraversalJob
+{
+    Q_OBJECT
+public:
+    explicit DirectorySizeService(QObject *parent = nullptr);
+    ~DirectorySizeService();
+
+    // Answers right away from the cache, else starts walking path
+    void request(const QString &path);
+    void cancel();
+
+    void processDirectory(int workerIndex, DirHandle &dir) override;
+    void traversalFinished() override;
+
+signals:
+    void sizeChanged(const QString &path, const DirectorySize &size);
+
+private slots:
+    void onProgressTimer();
+
+private:
+    struct CacheKey
+    {
+        quint64 device;
+        quint64 inode;
+        qint64 mtimeMSecs;
+        bool operator==(const CacheKey &other) const
+        {
+            return device == other.device && inode == other.inode && mtimeMSecs == other.mtimeMSecs;
+        }
+    };
+    friend size_t qHash(const CacheKey &key, size_t seed)
+    {
+        return qHashMulti(seed, key.device, key.inode, key.mtimeMSecs);
+    }
+
+    struct CacheEntry
+    {
+        DirectorySize size;
+        qint64 storedMSecs;
+    };
+
+    void startPendingWalk();
+    void walkFinished(int generation);
+    DirectorySize currentTotals() const;
+    bool reserveDirHandle();
+    void releaseDirHandle();
+
+    static constexpr int MAX_TRAVERSAL_THREADS = 16;
+    static constexpr int MAX_OPEN_DIR_HANDLES = 256;
+    static constexpr int MAX_CACHE_ENTRIES = 1024;
+    // A root's mtime misses changes further down, so totals are redone after a while
+    static constexpr qint64 CACHE_TTL_MSECS = 60 * 1000;
+    static constexpr int PROGRESS_INTERVAL_MS = 150;
+
+    TraversalScheduler *m_traversal;        // Created on first use
+    std::atomic<int> m_generation;          // Bumped by every request and cancel
+    std::atomic<int> m_walkGeneration;      // Of the walk on the threads
+    std::atomic<int> m_openDirHandles;
+
+    // Totals of the running walk
+    std::atomic<qint64> m_bytes;
+    std::atomic<qint64> m_allocatedBytes;
+    std::atomic<qint64> m_files;
+    std::atomic<qint64> m_directories;
+
+    QString m_walkPath;
+    CacheKey m_walkKey;                     // Its device is the one file system walked
+    QMutex m_linksMutex;
+    QSet<QPair<quint64, quint64>> m_linkedInodes;     // Device and inode of files with several links counted so far
+    QString m_pendingPath;
+    CacheKey m_pendingKey;
+    bool m_walkPending;
+
+    QHash<CacheKey, CacheEntry> m_cache;
+    QElapsedTimer m_clock;
+    QTimer *m_progressTimer;
+};
+
+#endif // DIRECTORYSIZESERVICE_H
@@ -0,0 +1,262 @@
+#include "dirscanner.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <cstddef>
+#include <cstring>
+#endif
+
+namespace {
+
+#ifdef Q_OS_LINUX
+// Layout returned by the getdents64 system call
+struct LinuxDirent64
+{
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+DirScanner::EntryType typeFromDType(unsigned char type)
+{
+    switch (type) {
+    case DT_REG:
+        return DirScanner::File;
+    case DT_DIR:
+        return DirScanner::Directory;
+    case DT_LNK:
+        return DirScanner::SymLink;
+    case DT_UNKNOWN:
+        return DirScanner::Unknown;
+    default:
+        return DirScanner::Other;
+    }
+}
+
+DirScanner::EntryType typeFromMode(mode_t mode)
+{
+    if (S_ISREG(mode)) {
+        return DirScanner::File;
+    } else if (S_ISDIR(mode)) {
+        return DirScanner::Directory;
+    } else if (S_ISLNK(mode)) {
+        return DirScanner::SymLink;
+    }
+    return DirScanner::Other;
+}
+
+bool statMetadata(int dirFd, const char *name, bool followSymLinks, DirScanner::Metadata &result)
+{
+    struct stat st;
+    if (fstatat(dirFd, name, &st, followSymLinks ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+        return false;
+    }
+    result.type = typeFromMode(st.st_mode);
+    result.size = st.st_size;
+    result.mtimeMSecs = qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+    result.device = st.st_dev;
+    result.inode = st.st_ino;
+    result.allocatedBytes = qint64(st.st_blocks) * 512;
+    result.linkCount = st.st_nlink;
+    return true;
+}
+#endif
+
+}
+
+DirScanner::DirScanner()
+    : m_fd(-1)
+    , m_bufferLength(0)
+    , m_bufferPos(0)
+    , m_atEnd(true)
+    , m_nameIndex(0)
+{
+}
+
+DirScanner::~DirScanner()
+{
+    close();
+}
+
+bool DirScanner::open(const DirHandle &handle)
+{
+    close();
+    m_path = handle.path;
+    m_bufferLength = 0;
+    m_bufferPos = 0;
+    m_atEnd = false;
+
+#ifdef Q_OS_LINUX
+    m_fd = handle.fd;
+    if (m_fd < 0) {
+        m_fd = ::open(QFile::encodeName(m_path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (m_fd < 0) {
+        m_atEnd = true;
+        return false;
+    }
+    if (m_buffer.size() < BUFFER_SIZE) {
+        m_buffer.resize(BUFFER_SIZE);
+    }
+    return true;
+#else
+    QDir dir(m_path);
+    if (!dir.exists() || !dir.isReadable()) {
+        m_atEnd = true;
+        return false;
+    }
+    m_names = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+    m_nameIndex = 0;
+    return true;
+#endif
+}
+
+void DirScanner::close()
+{
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+    m_fd = -1;
+    m_atEnd = true;
+    m_names.clear();
+}
+
+const QString &DirScanner::path() const
+{
+    return m_path;
+}
+
+bool DirScanner::next(Entry &entry)
+{
+#ifdef Q_OS_LINUX
+    while (!m_atEnd) {
+        if (m_bufferPos >= m_bufferLength) {
+            long length = syscall(SYS_getdents64, m_fd, m_buffer.data(), m_buffer.size());
+            if (length <= 0) {
+                m_atEnd = true;
+                return false;
+            }
+            m_bufferLength = int(length);
+            m_bufferPos = 0;
+        }
+
+        const LinuxDirent64 *dirent = reinterpret_cast<const LinuxDirent64 *>(m_buffer.constData() + m_bufferPos);
+        m_bufferPos += dirent->d_reclen;
+
+        const char *name = dirent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        entry.name = name;
+        entry.nameLength = int(std::strlen(name));
+        entry.type = typeFromDType(dirent->d_type);
+        entry.inode = dirent->d_ino;
+        return true;
+    }
+    return false;
+#else
+    if (m_nameIndex >= m_names.size()) {
+        m_atEnd = true;
+        return false;
+    }
+    m_currentName = QFile::encodeName(m_names.at(m_nameIndex++));
+    entry.name = m_currentName.constData();
+    entry.nameLength = int(m_currentName.size());
+    entry.type = Unknown;
+    entry.inode = 0;
+    return true;
+#endif
+}
+
+DirScanner::EntryType DirScanner::resolveType(const Entry &entry, bool followSymLinks) const
+{
+    if (entry.type != Unknown && !(followSymLinks && entry.type == SymLink)) {
+        return entry.type;
+    }
+
+    Metadata result;
+    if (!metadata(entry, followSymLinks, result)) {
+        return entry.type == SymLink ? SymLink : Other;
+    }
+    return result.type;
+}
+
+bool DirScanner::metadata(const Entry &entry, bool followSymLinks, Metadata &result) const
+{
+#ifdef Q_OS_LINUX
+    return statMetadata(m_fd, entry.name, followSymLinks, result);
+#else
+    return pathMetadata(childPath(entry), followSymLinks, result);
+#endif
+}
+
+bool DirScanner::pathMetadata(const QString &path, bool followSymLinks, Metadata &result)
+{
+#ifdef Q_OS_LINUX
+    return statMetadata(AT_FDCWD, QFile::encodeName(path).constData(), followSymLinks, result);
+#else
+    QFileInfo fileInfo(path);
+    if (!followSymLinks && fileInfo.isSymLink()) {
+        result.type = SymLink;
+    } else if (!fileInfo.exists()) {
+        return false;
+    } else if (fileInfo.isDir()) {
+        result.type = Directory;
+    } else if (fileInfo.isFile()) {
+        result.type = File;
+    } else {
+        result.type = Other;
+    }
+    result.size = fileInfo.size();
+    result.mtimeMSecs = fileInfo.lastModified().toMSecsSinceEpoch();
+    result.device = 0;
+    result.inode = 0;
+    result.allocatedBytes = result.size;
+    result.linkCount = 1;
+    return true;
+#endif
+}
+
+DirHandle DirScanner::childHandle(const Entry &entry, bool openDescriptor) const
+{
+    DirHandle handle;
+    handle.path = childPath(entry);
+#ifdef Q_OS_LINUX
+    if (openDescriptor) {
+        // O_NOFOLLOW keeps a directory swapped for a symlink meanwhile from being entered
+        handle.fd = ::openat(m_fd, entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+#else
+    Q_UNUSED(openDescriptor);
+#endif
+    return handle;
+}
+
+QString DirScanner::childPath(const Entry &entry) const
+{
+    const QString name = QFile::decodeName(QByteArray::fromRawData(entry.name, entry.nameLength));
+    return m_path.endsWith('/') ? m_path + name : m_path + '/' + name;
+}
+
+void DirScanner::closeHandle(DirHandle &handle)
+{
+#ifdef Q_OS_LINUX
+    if (handle.fd >= 0) {
+        ::close(handle.fd);
+    }
+#endif
+    handle.fd = -1;
+}
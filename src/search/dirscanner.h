@@ -0,0 +1,98 @@
+#ifndef DIRSCANNER_H
+#define DIRSCANNER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QStringList>
+#include <memory>
+
+class IgnoreScope;
+
+// A directory waiting to be scanned. fd is a descriptor opened relative to
+// the parent while it was being scanned, or -1 when the directory has to be
+// opened by path. The scanner that adopts the handle owns the descriptor.
+struct DirHandle
+{
+    QString path;
+    int fd = -1;
+    std::shared_ptr<const IgnoreScope> ignoreScope;     // Inherited ignore rules, null when not ignoring
+};
+
+
+
+// Lists one directory at a time without sorting or stat'ing its entries.
+// On Linux entries are read in getdents64 batches from a directory
+// descriptor and every further lookup (type, metadata, opening children)
+// is made relative to it with fstatat/openat. Elsewhere it falls back to
+// an unsorted QDir listing.
+class DirScanner
+{
+public:
+    enum EntryType
+    {
+        Unknown,        // File system does not report d_type, call resolveType()
+        File,
+        Directory,
+        SymLink,
+        Other,          // Fifos, sockets and devices
+    };
+
+    struct Entry
+    {
+        const char *name;   // Valid until the next call to next()
+        int nameLength;
+        EntryType type;
+        quint64 inode;
+    };
+
+    struct Metadata
+    {
+        EntryType type;
+        qint64 size;
+        qint64 mtimeMSecs;
+        quint64 device;
+        quint64 inode;
+        qint64 allocatedBytes;      // Blocks on disk, the size where unknown
+        quint64 linkCount;          // Hard links to the inode, 1 where unknown
+    };
+
+    DirScanner();
+    ~DirScanner();
+
+    bool open(const DirHandle &handle);
+    void close();
+    const QString &path() const;
+
+    bool next(Entry &entry);
+
+    // Only these need a stat, and only for the entry asked about
+    EntryType resolveType(const Entry &entry, bool followSymLinks) const;
+    bool metadata(const Entry &entry, bool followSymLinks, Metadata &result) const;
+    static bool pathMetadata(const QString &path, bool followSymLinks, Metadata &result);
+
+    // Opens a subdirectory relative to this one for a later scan.
+    // Returns a handle without a descriptor when that is not possible.
+    DirHandle childHandle(const Entry &entry, bool openDescriptor) const;
+    QString childPath(const Entry &entry) const;
+
+    static void closeHandle(DirHandle &handle);
+
+private:
+    Q_DISABLE_COPY(DirScanner)
+
+    static constexpr int BUFFER_SIZE = 32 * 1024;
+
+    QString m_path;
+    int m_fd;
+    QByteArray m_buffer;
+    int m_bufferLength;
+    int m_bufferPos;
+    bool m_atEnd;
+
+    // Fallback listing
+    QStringList m_names;
+    QByteArray m_currentName;
+    int m_nameIndex;
+};
+
+#endif // DIRSCANNER_H
@@ -0,0 +1,184 @@
+#include "filesniffer.h"
+#include "searchtrace.h"
+#include <QString>
+#include <QStringDecoder>
+
+namespace {
+
+// Control bytes that turn up in text: backspace, tab, line and page breaks, escape
+inline bool isTextControl(uchar byte)
+{
+    return (byte >= 0x08 && byte <= 0x0d) || byte == 0x1b;
+}
+
+// Length of the valid UTF-8 sequence starting at bytes, 0 if the data ends
+// inside one, -1 if it is not valid
+qsizetype utf8SequenceLength(const uchar *bytes, qsizetype available)
+{
+    const uchar lead = bytes[0];
+    qsizetype length;
+    uchar secondMin = 0x80;
+    uchar secondMax = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        if (lead == 0xe0) {
+            secondMin = 0xa0;       // Overlong
+        } else if (lead == 0xed) {
+            secondMax = 0x9f;       // Surrogates
+        }
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        if (lead == 0xf0) {
+            secondMin = 0x90;
+        } else if (lead == 0xf4) {
+            secondMax = 0x8f;       // Above U+10FFFF
+        }
+    } else {
+        return -1;
+    }
+
+    for (qsizetype i = 1; i < length; ++i) {
+        if (i >= available) {
+            return 0;
+        }
+        const uchar min = i == 1 ? secondMin : 0x80;
+        const uchar max = i == 1 ? secondMax : 0xbf;
+        if (bytes[i] < min || bytes[i] > max) {
+            return -1;
+        }
+    }
+    return length;
+}
+
+}
+
+FileSniffer::Encoding FileSniffer::sniff(const char *data, qsizetype size)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    size = qMin(size, SNIFF_BYTES);
+
+    // A byte order mark settles it
+    if (size >= 2 && bytes[0] == 0xff && bytes[1] == 0xfe) {
+        return Utf16LE;
+    }
+    if (size >= 2 && bytes[0] == 0xfe && bytes[1] == 0xff) {
+        return Utf16BE;
+    }
+
+    qsizetype evenZeros = 0;
+    qsizetype oddZeros = 0;
+    qsizetype controls = 0;
+    qsizetype sequences = 0;    // Valid multi-byte UTF-8 sequences
+    qsizetype invalid = 0;
+    qsizetype i = 0;
+    while (i < size) {
+        const uchar byte = bytes[i];
+        if (byte < 0x80) {
+            if (byte == 0) {
+                (i & 1 ? oddZeros : evenZeros)++;
+            } else if (byte < 0x20 && !isTextControl(byte)) {
+                controls++;
+            }
+            ++i;
+            continue;
+        }
+
+        const qsizetype length = utf8SequenceLength(bytes + i, size - i);
+        if (length == 0) {
+            break;      // Cut off by the end of the block
+        }
+        if (length < 0) {
+            invalid++;
+            ++i;
+        } else {
+            sequences++;
+            i += length;
+        }
+    }
+
+    // Mostly ASCII text in UTF-16 has a zero in every other byte, on one side only
+    const qsizetype pairs = size / 2;
+    if (oddZeros > pairs / 2 && evenZeros <= pairs / 16) {
+        return Utf16LE;
+    }
+    if (evenZeros > pairs / 2 && oddZeros <= pairs / 16) {
+        return Utf16BE;
+    }
+    if (evenZeros + oddZeros > 0 || controls * 10 > size) {
+        return Binary;
+    }
+
+    // A few broken sequences in UTF-8 text are left to the decoder
+    if (invalid == 0 || sequences > invalid) {
+        return Utf8;
+    }
+    // Latin-1 text has accented letters here and there, compressed data everywhere
+    return invalid * 4 > size ? Binary : Latin1;
+}
+
+QByteArray FileSniffer::toUtf8(const char *data, qsizetype size, Encoding encoding)
+{
+    switch (encoding) {
+    case Utf16LE:
+    case Utf16BE: {
+        // The decoder drops the byte order mark
+        QStringDecoder decoder(encoding == Utf16LE ? QStringConverter::Utf16LE : QStringConverter::Utf16BE);
+        const QString text = decoder.decode(QByteArrayView(data, size));
+        return text.toUtf8();
+    }
+    case Latin1:
+        return QString::fromLatin1(data, size).toUtf8();
+    case Utf8:
+        return QByteArray(data + utf8BomLength(data, size), size - utf8BomLength(data, size));
+    case Unknown:
+    case Binary:
+        break;
+    }
+    return QByteArray(data, size);
+}
+
+qsizetype FileSniffer::utf8BomLength(const char *data, qsizetype size)
+{
+    return (size >= 3 && uchar(data[0]) == 0xef && uchar(data[1]) == 0xbb && uchar(data[2]) == 0xbf) ? 3 : 0;
+}
+
+
+
+FileSniffer::Encoding EncodingCache::lookup(quint64 device, quint64 inode, qint64 mtimeMSecs) const
+{
+    Shard &cacheShard = shard(inode);
+    SearchTrace::waitForLock(cacheShard.mutex, "lock encoding cache");
+    QMutexLocker locker(&cacheShard.mutex);
+    const auto it = cacheShard.entries.constFind({device, inode});
+    if (it == cacheShard.entries.constEnd() || it->mtimeMSecs != mtimeMSecs) {
+        return FileSniffer::Unknown;
+    }
+    return it->encoding;
+}
+
+void EncodingCache::insert(quint64 device, quint64 inode, qint64 mtimeMSecs, FileSniffer::Encoding encoding)
+{
+    Shard &cacheShard = shard(inode);
+    const Key key = {device, inode};
+    SearchTrace::waitForLock(cacheShard.mutex, "lock encoding cache");
+    QMutexLocker locker(&cacheShard.mutex);
+    if (cacheShard.entries.size() >= MAX_ENTRIES_PER_SHARD && !cacheShard.entries.contains(key)) {
+        cacheShard.entries.clear();
+    }
+    cacheShard.entries.insert(key, {mtimeMSecs, encoding});
+}
+
+void EncodingCache::clear()
+{
+    for (Shard &cacheShard : m_shards) {
+        QMutexLocker locker(&cacheShard.mutex);
+        cacheShard.entries.clear();
+    }
+}
+
+EncodingCache::Shard &EncodingCache::shard(quint64 inode) const
+{
+    return m_shards[inode % SHARD_COUNT];
+}
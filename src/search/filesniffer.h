@@ -0,0 +1,81 @@
+#ifndef FILESNIFFER_H
+#define FILESNIFFER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+// Tells text files from binary ones by their first block, and which of the
+// common encodings the text is in. Matching runs on UTF-8, so UTF-16 and
+// Latin-1 files are converted before they are searched.
+class FileSniffer
+{
+public:
+    enum Encoding
+    {
+        Unknown,        // Not sniffed yet
+        Utf8,           // Includes plain ASCII
+        Utf16LE,
+        Utf16BE,
+        Latin1,         // Text that is not valid UTF-8
+        Binary,
+    };
+
+    // Only this much of a file is looked at
+    static constexpr qsizetype SNIFF_BYTES = 8 * 1024;
+
+    static Encoding sniff(const char *data, qsizetype size);
+
+    // UTF-8 text of data without a byte order mark, binary data is copied as it is
+    static QByteArray toUtf8(const char *data, qsizetype size, Encoding encoding);
+
+    // Length of a UTF-8 byte order mark at the start of data, if any
+    static qsizetype utf8BomLength(const char *data, qsizetype size);
+};
+
+
+
+// Encodings of files sniffed so far, kept across searches so that repeated
+// searches skip binaries without opening them. Keyed by (device, inode) and
+// only trusted while the modification time is unchanged. Thread-safe, the
+// locks are split across shards so workers rarely wait for each other.
+class EncodingCache
+{
+public:
+    // Returns Unknown if the file was not sniffed or changed since
+    FileSniffer::Encoding lookup(quint64 device, quint64 inode, qint64 mtimeMSecs) const;
+    void insert(quint64 device, quint64 inode, qint64 mtimeMSecs, FileSniffer::Encoding encoding);
+    void clear();
+
+private:
+    struct Key
+    {
+        quint64 device;
+        quint64 inode;
+
+        bool operator==(const Key &other) const { return device == other.device && inode == other.inode; }
+        friend size_t qHash(const Key &key, size_t seed) { return qHashMulti(seed, key.device, key.inode); }
+    };
+
+    struct Entry
+    {
+        qint64 mtimeMSecs;
+        FileSniffer::Encoding encoding;
+    };
+
+    struct Shard
+    {
+        QMutex mutex;
+        QHash<Key, Entry> entries;
+    };
+
+    Shard &shard(quint64 inode) const;
+
+    static constexpr int SHARD_COUNT = 16;
+    // A full shard is emptied rather than evicted entry by entry, sniffing again is cheap
+    static constexpr qsizetype MAX_ENTRIES_PER_SHARD = 64 * 1024;
+
+    mutable Shard m_shards[SHARD_COUNT];
+};
+
+#endif // FILESNIFFER_H
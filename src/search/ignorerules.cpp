@@ -0,0 +1,433 @@
+#include "ignorerules.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Matches the bracket expression at p against ch and moves p past it.
+// Returns false if p does not start a complete expression.
+bool matchBracket(const char *&p, const char *end, uchar ch, bool &matched)
+{
+    const char *q = p + 1;
+    bool negated = false;
+    if (q < end && (*q == '!' || *q == '^')) {
+        negated = true;
+        ++q;
+    }
+
+    bool found = false;
+    bool first = true;      // A leading ']' is literal
+    while (q < end && (*q != ']' || first)) {
+        first = false;
+        uchar lo = uchar(*q);
+        if (lo == '\\' && q + 1 < end) {
+            lo = uchar(*++q);
+        }
+        ++q;
+        uchar hi = lo;
+        if (q + 1 < end && *q == '-' && q[1] != ']') {
+            hi = uchar(*++q);
+            if (hi == '\\' && q + 1 < end) {
+                hi = uchar(*++q);
+            }
+            ++q;
+        }
+        if (ch >= lo && ch <= hi) {
+            found = true;
+        }
+    }
+    if (q >= end) {
+        return false;
+    }
+
+    p = q + 1;
+    matched = found != negated;
+    return true;
+}
+
+bool matchGlob(const char *patternStart, const char *p, const char *patternEnd, const char *t, const char *textEnd)
+{
+    while (p < patternEnd) {
+        if (*p == '*') {
+            // "**" as a whole component spans any number of directories
+            const bool componentStart = p == patternStart || p[-1] == '/';
+            if (componentStart && p + 1 < patternEnd && p[1] == '*' && (p + 2 == patternEnd || p[2] == '/')) {
+                if (p + 2 == patternEnd) {
+                    return true;
+                }
+                for (const char *s = t;;) {
+                    if (matchGlob(patternStart, p + 3, patternEnd, s, textEnd)) {
+                        return true;
+                    }
+                    const char *slash = static_cast<const char *>(std::memchr(s, '/', size_t(textEnd - s)));
+                    if (!slash) {
+                        return false;
+                    }
+                    s = slash + 1;
+                }
+            }
+
+            while (p < patternEnd && *p == '*') {
+                ++p;
+            }
+            for (const char *s = t;; ++s) {
+                if (matchGlob(patternStart, p, patternEnd, s, textEnd)) {
+                    return true;
+                }
+                if (s == textEnd || *s == '/') {
+                    return false;
+                }
+            }
+        }
+
+        if (t == textEnd) {
+            return false;
+        }
+        if (*p == '?') {
+            if (*t == '/') {
+                return false;
+            }
+            ++p;
+            ++t;
+            continue;
+        }
+        if (*p == '[') {
+            const char *next = p;
+            bool matched = false;
+            if (matchBracket(next, patternEnd, uchar(*t), matched)) {
+                if (!matched || *t == '/') {
+                    return false;
+                }
+                p = next;
+                ++t;
+                continue;
+            }
+            // An unclosed '[' is literal
+        }
+
+        char ch = *p;
+        if (ch == '\\' && p + 1 < patternEnd) {
+            ch = *++p;
+        }
+        if (*t != ch) {
+            return false;
+        }
+        ++p;
+        ++t;
+    }
+    return t == textEnd;
+}
+
+bool hasGlobChars(const char *begin, const char *end)
+{
+    return std::any_of(begin, end, [](char ch) { return ch == '*' || ch == '?' || ch == '[' || ch == '\\'; });
+}
+
+}
+
+std::shared_ptr<const IgnoreRuleSet> IgnoreRuleSet::parse(const QByteArray &contents)
+{
+    std::shared_ptr<IgnoreRuleSet> ruleSet = std::make_shared<IgnoreRuleSet>();
+
+    for (QByteArray line : contents.split('\n')) {
+        if (line.endsWith('\r')) {
+            line.chop(1);
+        }
+        // Trailing spaces do not count unless escaped
+        while (line.endsWith(' ') && !line.endsWith("\\ ")) {
+            line.chop(1);
+        }
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+
+        Rule rule;
+        rule.negated = line.startsWith('!');
+        if (rule.negated || line.startsWith("\\!") || line.startsWith("\\#")) {
+            line.remove(0, 1);
+        }
+        rule.directoryOnly = line.endsWith('/');
+        if (rule.directoryOnly) {
+            line.chop(1);
+        }
+        rule.anchored = line.contains('/');
+        if (line.startsWith('/')) {
+            line.remove(0, 1);
+        }
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const char *begin = line.constData();
+        const char *end = begin + line.size();
+        if (!hasGlobChars(begin, end)) {
+            rule.kind = Literal;
+        } else if (!rule.anchored && line.startsWith('*') && !hasGlobChars(begin + 1, end)) {
+            rule.kind = Suffix;
+            line.remove(0, 1);
+        } else {
+            rule.kind = Glob;
+        }
+        rule.pattern = line;
+        ruleSet->m_rules.push_back(rule);
+    }
+
+    return ruleSet;
+}
+
+bool IgnoreRuleSet::isEmpty() const
+{
+    return m_rules.empty();
+}
+
+IgnoreRuleSet::Verdict IgnoreRuleSet::match(const char *dirPath, qsizetype dirLength, const char *name, qsizetype nameLength,
+                                            bool isDirectory) const
+{
+    QByteArray path;    // Built the first time an anchored pattern needs it
+
+    for (auto it = m_rules.rbegin(); it != m_rules.rend(); ++it) {
+        const Rule &rule = *it;
+        if (rule.directoryOnly && !isDirectory) {
+            continue;
+        }
+
+        const char *text = name;
+        qsizetype length = nameLength;
+        if (rule.anchored) {
+            if (path.isEmpty()) {
+                path.reserve(dirLength + nameLength);
+                path.append(dirPath, dirLength);
+                path.append(name, nameLength);
+            }
+            text = path.constData();
+            length = path.size();
+        }
+
+        const QByteArray &pattern = rule.pattern;
+        bool matched = false;
+        switch (rule.kind) {
+        case Literal:
+            matched = length == pattern.size() && std::memcmp(text, pattern.constData(), size_t(length)) == 0;
+            break;
+        case Suffix:
+            matched = length >= pattern.size()
+                      && std::memcmp(text + length - pattern.size(), pattern.constData(), size_t(pattern.size())) == 0;
+            break;
+        case Glob:
+            matched = matchGlob(pattern.constData(), pattern.constData(), pattern.constData() + pattern.size(),
+                                text, text + length);
+            break;
+        }
+        if (matched) {
+            return rule.negated ? Included : Ignored;
+        }
+    }
+    return NoMatch;
+}
+
+
+
+std::shared_ptr<const IgnoreScope> IgnoreScope::withRules(std::shared_ptr<const IgnoreRuleSet> rules) const
+{
+    std::shared_ptr<IgnoreScope> scope = std::make_shared<IgnoreScope>(*this);
+    scope->m_layers = std::make_shared<const Layer>(Layer{std::move(rules), m_relativePath.size(), m_layers});
+    return scope;
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreScope::child(const char *name, qsizetype length) const
+{
+    std::shared_ptr<IgnoreScope> scope = std::make_shared<IgnoreScope>(*this);
+    scope->m_relativePath.append(name, length);
+    scope->m_relativePath.append('/');
+    return scope;
+}
+
+bool IgnoreScope::isIgnored(const char *name, qsizetype length, bool isDirectory) const
+{
+    for (const Layer *layer = m_layers.get(); layer; layer = layer->parent.get()) {
+        const IgnoreRuleSet::Verdict verdict = layer->rules->match(m_relativePath.constData() + layer->baseLength,
+                                                                   m_relativePath.size() - layer->baseLength,
+                                                                   name, length, isDirectory);
+        if (verdict != IgnoreRuleSet::NoMatch) {
+            return verdict == IgnoreRuleSet::Ignored;
+        }
+    }
+    return false;
+}
+
+
+
+const char *const IgnoreRuleCache::IGNORE_FILE_NAMES[] = {".gitignore", ".bobaignore"};
+
+std::shared_ptr<const IgnoreScope> IgnoreRuleCache::rootScope(const QString &rootPath, const QStringList &excludePatterns)
+{
+    std::shared_ptr<const IgnoreScope> scope = std::make_shared<const IgnoreScope>();
+    if (!excludePatterns.isEmpty()) {
+        scope = scope->withRules(IgnoreRuleSet::parse(excludePatterns.join('\n').toUtf8()));
+    }
+
+    // Inside a git repository the ignore files above the root apply as well
+    QDir dir(QFileInfo(rootPath).absoluteFilePath());
+    QStringList components;
+    while (!QFileInfo::exists(dir.filePath(".git"))) {
+        const QString name = dir.dirName();
+        if (!dir.cdUp()) {
+            return scope;
+        }
+        components.prepend(name);
+    }
+
+    scope = addIgnoreFile(scope, dir.filePath(".git/info/exclude"));
+    for (const QString &component : components) {
+        for (const char *fileName : IGNORE_FILE_NAMES) {
+            scope = addIgnoreFile(scope, dir.filePath(QString::fromLatin1(fileName)));
+        }
+        const QByteArray encoded = QFile::encodeName(component);
+        scope = scope->child(encoded.constData(), encoded.size());
+        dir.cd(component);
+    }
+    return scope;
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreRuleCache::addIgnoreFiles(std::shared_ptr<const IgnoreScope> scope, const DirScanner &scanner)
+{
+    for (const char *fileName : IGNORE_FILE_NAMES) {
+        const DirScanner::Entry entry = {fileName, int(std::strlen(fileName)), DirScanner::Unknown, 0};
+        DirScanner::Metadata metadata;
+        if (!scanner.metadata(entry, true, metadata)) {
+            continue;
+        }
+        std::shared_ptr<const IgnoreRuleSet> rules = load(scanner.childPath(entry), metadata);
+        if (rules && !rules->isEmpty()) {
+            scope = scope->withRules(std::move(rules));
+        }
+    }
+    return scope;
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreRuleCache::addIgnoreFile(std::shared_ptr<const IgnoreScope> scope, const QString &path)
+{
+    DirScanner::Metadata metadata;
+    if (!DirScanner::pathMetadata(path, true, metadata)) {
+        return scope;
+    }
+    std::shared_ptr<const IgnoreRuleSet> rules = load(path, metadata);
+    if (rules && !rules->isEmpty()) {
+        scope = scope->withRules(std::move(rules));
+    }
+    return scope;
+}
+
+std::shared_ptr<const IgnoreRuleSet> IgnoreRuleCache::load(const QString &path, const DirScanner::Metadata &metadata)
+{
+    if (metadata.type != DirScanner::File || metadata.size > MAX_IGNORE_FILE_SIZE) {
+        return nullptr;
+    }
+
+    const Key key = {metadata.device, metadata.inode};
+    const bool cacheable = metadata.inode != 0;
+    if (cacheable) {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_entries.constFind(key);
+        if (it != m_entries.constEnd() && it->size == metadata.size && it->mtimeMSecs == metadata.mtimeMSecs) {
+            return it->rules;
+        }
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    std::shared_ptr<const IgnoreRuleSet> rules = IgnoreRuleSet::parse(file.read(MAX_IGNORE_FILE_SIZE));
+
+    if (cacheable) {
+        QMutexLocker locker(&m_mutex);
+        if (m_entries.size() >= MAX_ENTRIES) {
+            m_entries.clear();
+        }
+        m_entries.insert(key, {metadata.size, metadata.mtimeMSecs, rules});
+    }
+    return rules;
+}
+
+void IgnoreRuleCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+}
+
+
+
+
+IgnoreFilter::IgnoreFilter(IgnoreRuleCache &cache, const QString &rootPath, const QStringList &excludePatterns)
+    : m_cache(cache)
+    , m_rootPath(QDir::cleanPath(rootPath))
+{
+    m_scopes.insert(m_rootPath, scopeInside(m_cache.rootScope(m_rootPath, excludePatterns), m_rootPath));
+}
+
+bool IgnoreFilter::isIgnored(const QString &path, bool isDirectory)
+{
+    const std::shared_ptr<const IgnoreScope> scope = scopeOf(parentPath(path));
+    if (!scope) {
+        return true;
+    }
+    const QByteArray name = QFile::encodeName(path.mid(path.lastIndexOf('/') + 1));
+    return scope->isIgnored(name.constData(), name.size(), isDirectory);
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreFilter::scopeOf(const QString &dirPath)
+{
+    const auto known = m_scopes.constFind(dirPath);
+    if (known != m_scopes.constEnd()) {
+        return *known;
+    }
+
+    // Up to the nearest directory seen before, the root at the latest
+    QStringList pending;
+    QString current = dirPath;
+    while (!m_scopes.contains(current)) {
+        if (current.length() <= m_rootPath.length()) {
+            return m_scopes.value(m_rootPath);      // Not below the root after all
+        }
+        pending.prepend(current);
+        current = parentPath(current);
+    }
+
+    // Then back down, a directory the walk would prune hides everything below it
+    std::shared_ptr<const IgnoreScope> scope = m_scopes.value(current);
+    for (const QString &path : pending) {
+        if (scope) {
+            const QByteArray name = QFile::encodeName(path.mid(path.lastIndexOf('/') + 1));
+            if (scope->isIgnored(name.constData(), name.size(), true)) {
+                scope = nullptr;
+            } else {
+                scope = scopeInside(scope->child(name.constData(), name.size()), path);
+            }
+        }
+        m_scopes.insert(path, scope);
+    }
+    return scope;
+}
+
+std::shared_ptr<const IgnoreScope> IgnoreFilter::scopeInside(std::shared_ptr<const IgnoreScope> scope, const QString &dirPath)
+{
+    // The directory's own ignore files, looked up relative to it like a walk does
+    DirHandle handle;
+    handle.path = dirPath;
+    if (!m_scanner.open(handle)) {
+        return scope;
+    }
+    scope = m_cache.addIgnoreFiles(std::move(scope), m_scanner);
+    m_scanner.close();
+    return scope;
+}
+
+QString IgnoreFilter::parentPath(const QString &path)
+{
+    const qsizetype slash = path.lastIndexOf('/');
+    return slash > 0 ? path.left(slash) : QStringLiteral("/");
+}
@@ -0,0 +1,163 @@
+#ifndef IGNORERULES_H
+#define IGNORERULES_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <memory>
+#include <vector>
+#include "dirscanner.h"
+
+// The patterns of one ignore file, in .gitignore syntax. Blank lines and
+// '#' comments are skipped, '!' re-includes, a trailing '/' only matches
+// directories and a '/' anywhere else anchors the pattern to the directory
+// of the file. '*', '?' and [...] match within a path component, '**'
+// across components. Plain names and "*.ext" patterns, the bulk of most
+// ignore files, are compared without the glob matcher.
+class IgnoreRuleSet
+{
+public:
+    enum Verdict
+    {
+        NoMatch,
+        Ignored,
+        Included,       // Re-included by a negated pattern
+    };
+
+    static std::shared_ptr<const IgnoreRuleSet> parse(const QByteArray &contents);
+
+    bool isEmpty() const;
+
+    // dirPath is the directory of the entry relative to the ignore file's,
+    // empty or ending with '/'. The last matching pattern decides.
+    Verdict match(const char *dirPath, qsizetype dirLength, const char *name, qsizetype nameLength,
+                  bool isDirectory) const;
+
+private:
+    enum Kind
+    {
+        Literal,
+        Suffix,         // "*" followed by a literal
+        Glob,
+    };
+
+    struct Rule
+    {
+        QByteArray pattern;     // Without the '!', anchoring and trailing '/', the '*' of a Suffix
+        Kind kind;
+        bool negated;
+        bool directoryOnly;
+        bool anchored;          // Matched against the whole relative path instead of the name
+    };
+
+    std::vector<Rule> m_rules;
+};
+
+
+
+// Ignore rules in effect inside one directory. Every ignore file on the way
+// down from the search root adds a layer, and nearer layers take precedence.
+// Immutable, so subdirectories share their parent's layers.
+class IgnoreScope
+{
+public:
+    IgnoreScope() = default;
+
+    // Same directory with the rules of another ignore file on top
+    std::shared_ptr<const IgnoreScope> withRules(std::shared_ptr<const IgnoreRuleSet> rules) const;
+    // Scope a subdirectory inherits before its own ignore files are read
+    std::shared_ptr<const IgnoreScope> child(const char *name, qsizetype length) const;
+
+    bool isIgnored(const char *name, qsizetype length, bool isDirectory) const;
+
+private:
+    struct Layer
+    {
+        std::shared_ptr<const IgnoreRuleSet> rules;
+        qsizetype baseLength;       // Length of the relative path of the ignore file's directory
+        std::shared_ptr<const Layer> parent;
+    };
+
+    std::shared_ptr<const Layer> m_layers;
+    QByteArray m_relativePath;      // Empty or ending with '/'
+};
+
+
+
+// Compiled ignore files, kept across searches. Keyed by (device, inode) of
+// the file and only trusted while its size and modification time are
+// unchanged. Thread-safe.
+class IgnoreRuleCache
+{
+public:
+    // Names of the ignore files read in every directory, later ones take precedence
+    static const char *const IGNORE_FILE_NAMES[];
+
+    // Scope of the search root: the exclude patterns below everything else, then the
+    // ignore files of the enclosing git repository down to (not including) the root
+    std::shared_ptr<const IgnoreScope> rootScope(const QString &rootPath, const QStringList &excludePatterns);
+
+    // Adds the ignore files found in the directory being scanned
+    std::shared_ptr<const IgnoreScope> addIgnoreFiles(std::shared_ptr<const IgnoreScope> scope, const DirScanner &scanner);
+
+    void clear();
+
+private:
+    struct Key
+    {
+        quint64 device;
+        quint64 inode;
+
+        bool operator==(const Key &other) const { return device == other.device && inode == other.inode; }
+        friend size_t qHash(const Key &key, size_t seed) { return qHashMulti(seed, key.device, key.inode); }
+    };
+
+    struct Entry
+    {
+        qint64 size;
+        qint64 mtimeMSecs;
+        std::shared_ptr<const IgnoreRuleSet> rules;
+    };
+
+    std::shared_ptr<const IgnoreRuleSet> load(const QString &path, const DirScanner::Metadata &metadata);
+    std::shared_ptr<const IgnoreScope> addIgnoreFile(std::shared_ptr<const IgnoreScope> scope, const QString &path);
+
+    // Ignore files are tiny and rare, larger ones are not worth holding on to
+    static constexpr qint64 MAX_IGNORE_FILE_SIZE = 1024 * 1024;
+    static constexpr qsizetype MAX_ENTRIES = 16 * 1024;
+
+    QMutex m_mutex;
+    QHash<Key, Entry> m_entries;
+};
+
+
+
+// Tells for single paths below a search root whether a walk from the root
+// would have pruned them, for searches answered from an index. The scope of
+// a directory is built once, from the ignore files on the way down to it,
+// and kept while the filter lives. Not thread-safe, one per worker.
+class IgnoreFilter
+{
+public:
+    IgnoreFilter(IgnoreRuleCache &cache, const QString &rootPath, const QStringList &excludePatterns);
+
+    // path is below the root; ignored when it or a directory above it is
+    bool isIgnored(const QString &path, bool isDirectory);
+
+private:
+    // Rules in effect inside dirPath, null when the directory is ignored
+    std::shared_ptr<const IgnoreScope> scopeOf(const QString &dirPath);
+    std::shared_ptr<const IgnoreScope> scopeInside(std::shared_ptr<const IgnoreScope> scope, const QString &dirPath);
+    static QString parentPath(const QString &path);
+
+    Q_DISABLE_COPY(IgnoreFilter)
+
+    IgnoreRuleCache &m_cache;
+    QString m_rootPath;
+    QHash<QString, std::shared_ptr<const IgnoreScope>> m_scopes;
+    DirScanner m_scanner;       // Reused, it keeps a listing buffer
+};
+
+#endif // IGNORERULES_H
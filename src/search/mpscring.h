@@ -0,0 +1,107 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded multi-producer, single-consumer ring (after Vyukov's bounded queue).
+// Producers claim a slot with one compare-and-swap on the tail and publish it
+// through the slot's sequence number; the consumer never writes anything a
+// producer reads except that sequence. A full ring refuses the push instead
+// of growing, so the caller decides whether to wait or drop.
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity = 1024)
+        : m_capacity(roundUpToPowerOfTwo(capacity)), m_mask(m_capacity - 1), m_slots(new Slot[m_capacity]),
+          m_tail(0), m_head(0)
+    {
+        for (size_t i = 0; i < m_capacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+    // Any thread. value is only moved from when the push succeeds.
+    bool tryPush(T &value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = m_slots[position & m_mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;   // Full, the consumer has not freed this slot yet
+            } else {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only
+    bool tryPop(T &value)
+    {
+        Slot &slot = m_slots[m_head & m_mask];
+        const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (intptr_t(sequence) - intptr_t(m_head + 1) < 0) {
+            return false;
+        }
+        value = std::move(slot.value);
+        slot.value = T();
+        slot.sequence.store(m_head + m_capacity, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+    // Consumer only. A push that has claimed its slot but not published it yet counts as empty.
+    bool isEmpty() const
+    {
+        const Slot &slot = m_slots[m_head & m_mask];
+        return intptr_t(slot.sequence.load(std::memory_order_acquire)) - intptr_t(m_head + 1) < 0;
+    }
+
+    // Consumer only
+    void clear()
+    {
+        T discarded;
+        while (tryPop(discarded)) {
+        }
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+        while (result < value) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // Producers contend on the tail, keep the consumer's head off their cache line
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) size_t m_head;
+};
+
+#endif // MPSCRING_H
@@ -0,0 +1,119 @@
+#include "patharena.h"
+#include <QHashFunctions>
+#include <cstring>
+
+PathArena::PathArena()
+{
+    clear();
+}
+
+PathArena::NodeId PathArena::directory(QStringView path)
+{
+    if (path == m_lastDirectory) {
+        return m_lastNode;
+    }
+
+    // "/a/b/" is "" -> "a" -> "b", the empty first component stands for the leading '/'
+    NodeId node = ROOT;
+    qsizetype start = 0;
+    while (start < path.size()) {
+        qsizetype end = path.indexOf('/', start);
+        if (end < 0) {
+            end = path.size();
+        }
+        if (end > start || start == 0) {
+            node = child(node, path.mid(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    m_lastDirectory = path.toString();
+    m_lastNode = node;
+    return node;
+}
+
+PathArena::Slice PathArena::addName(QStringView name)
+{
+    const Slice slice = {quint32(m_chars.size()), quint32(name.size())};
+    m_chars.insert(m_chars.end(), name.utf16(), name.utf16() + name.size());
+    return slice;
+}
+
+QString PathArena::directoryPath(NodeId node) const
+{
+    qsizetype length = 0;
+    for (NodeId n = node; n != ROOT; n = m_nodes[n].parent) {
+        length += m_nodes[n].name.length + 1;
+    }
+
+    // Filled in from the end, walking up from the node
+    QString path(length, Qt::Uninitialized);
+    QChar *out = path.data() + length;
+    for (NodeId n = node; n != ROOT; n = m_nodes[n].parent) {
+        *--out = '/';
+        const Slice &slice = m_nodes[n].name;
+        out -= slice.length;
+        std::memcpy(out, m_chars.data() + slice.offset, slice.length * sizeof(char16_t));
+    }
+    return path;
+}
+
+QString PathArena::filePath(NodeId directory, Slice name) const
+{
+    return directoryPath(directory) + this->name(name);
+}
+
+QStringView PathArena::name(Slice slice) const
+{
+    return QStringView(m_chars.data() + slice.offset, qsizetype(slice.length));
+}
+
+void PathArena::clear()
+{
+    // Swapping with empty vectors hands the memory back
+    std::vector<char16_t>().swap(m_chars);
+    std::vector<Node>().swap(m_nodes);
+    std::vector<quint32>(64, EMPTY_BUCKET).swap(m_buckets);
+    m_nodes.push_back({ROOT, {0, 0}});
+    m_lastDirectory = QString();
+    m_lastNode = ROOT;
+}
+
+PathArena::NodeId PathArena::child(NodeId parent, QStringView name)
+{
+    const size_t mask = m_buckets.size() - 1;
+    size_t bucket = hashOf(parent, name) & mask;
+    while (m_buckets[bucket] != EMPTY_BUCKET) {
+        const NodeId id = m_buckets[bucket] - 1;
+        if (m_nodes[id].parent == parent && this->name(m_nodes[id].name) == name) {
+            return id;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    const NodeId id = NodeId(m_nodes.size());
+    m_nodes.push_back({parent, addName(name)});
+    m_buckets[bucket] = id + 1;
+    if (m_nodes.size() * 2 > m_buckets.size()) {
+        growBuckets();
+    }
+    return id;
+}
+
+size_t PathArena::hashOf(NodeId parent, QStringView name)
+{
+    return qHash(name, size_t(parent) * 0x9e3779b97f4a7c15ULL);
+}
+
+void PathArena::growBuckets()
+{
+    std::vector<quint32>(m_buckets.size() * 2, EMPTY_BUCKET).swap(m_buckets);
+    const size_t mask = m_buckets.size() - 1;
+    for (NodeId id = ROOT + 1; id < m_nodes.size(); ++id) {
+        size_t bucket = hashOf(m_nodes[id].parent, name(m_nodes[id].name)) & mask;
+        while (m_buckets[bucket] != EMPTY_BUCKET) {
+            bucket = (bucket + 1) & mask;
+        }
+        m_buckets[bucket] = id + 1;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef PATHARENA_H
+#define PATHARENA_H
+
+#include <QString>
+#include <QStringView>
+#include <vector>
+
+// Paths of one search, stored as a tree of interned directory nodes. Each
+// directory keeps only its own name and a link to its parent, so a prefix
+// shared by thousands of results is stored once, and file names are slices
+// of the same character buffer. Everything lives in a few flat vectors of
+// plain values, so clear() frees a fixed number of blocks however many
+// paths were added.
+class PathArena
+{
+public:
+    using NodeId = quint32;
+
+    struct Slice
+    {
+        quint32 offset;
+        quint32 length;
+    };
+
+    PathArena();
+
+    // Node of a directory path ending with '/', interning every component on the way
+    NodeId directory(QStringView path);
+    Slice addName(QStringView name);
+
+    // With a trailing '/'
+    QString directoryPath(NodeId node) const;
+    QString filePath(NodeId directory, Slice name) const;
+    QStringView name(Slice slice) const;
+
+    void clear();
+
+private:
+    struct Node
+    {
+        NodeId parent;
+        Slice name;
+    };
+
+    static constexpr NodeId ROOT = 0;
+    static constexpr quint32 EMPTY_BUCKET = 0;   // Buckets hold node id + 1
+
+    NodeId child(NodeId parent, QStringView name);
+    static size_t hashOf(NodeId parent, QStringView name);
+    void growBuckets();
+
+    std::vector<char16_t> m_chars;
+    std::vector<Node> m_nodes;
+    std::vector<quint32> m_buckets;     // Open addressing, power of two size
+
+    // Results arrive grouped by directory, most lookups hit the last one
+    QString m_lastDirectory;
+    NodeId m_lastNode;
+};
+
+#endif // PATHARENA_H
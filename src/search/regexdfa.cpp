@@ -0,0 +1,1274 @@
+#include "regexdfa.h"
+#include <QList>
+#include <algorithm>
+
+namespace {
+
+struct CodePointRange
+{
+    char32_t lo;
+    char32_t hi;
+};
+
+using CodePointSet = std::vector<CodePointRange>;
+
+const char32_t MAX_CODE_POINT = 0x10FFFF;
+
+// Highest repetition count accepted in {n,m}
+const int MAX_REPEAT = 1000;
+
+inline bool isWordByte(uchar byte)
+{
+    const uchar lower = byte | 0x20;
+    return (lower >= 'a' && lower <= 'z') || (byte >= '0' && byte <= '9') || byte == '_' || byte >= 0x80;
+}
+
+void normalize(CodePointSet &set)
+{
+    std::sort(set.begin(), set.end(), [](const CodePointRange &a, const CodePointRange &b) { return a.lo < b.lo; });
+    CodePointSet merged;
+    for (const CodePointRange &range : set) {
+        if (!merged.empty() && range.lo <= merged.back().hi + 1) {
+            merged.back().hi = qMax(merged.back().hi, range.hi);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    set.swap(merged);
+}
+
+CodePointSet complement(const CodePointSet &set)
+{
+    CodePointSet result;
+    char32_t next = 0;
+    for (const CodePointRange &range : set) {
+        if (range.lo > next) {
+            result.push_back({next, range.lo - 1});
+        }
+        next = range.hi + 1;
+    }
+    if (next <= MAX_CODE_POINT) {
+        result.push_back({next, MAX_CODE_POINT});
+    }
+    return result;
+}
+
+// Nothing matches across lines
+void removeNewline(CodePointSet &set)
+{
+    CodePointSet result;
+    for (const CodePointRange &range : set) {
+        if (range.lo <= '\n' && range.hi >= '\n') {
+            if (range.lo < '\n') {
+                result.push_back({range.lo, '\n' - 1});
+            }
+            if (range.hi > '\n') {
+                result.push_back({'\n' + 1, range.hi});
+            }
+        } else {
+            result.push_back(range);
+        }
+    }
+    set.swap(result);
+}
+
+void addCaseVariants(CodePointSet &set)
+{
+    CodePointSet variants;
+    for (const CodePointRange &range : set) {
+        // Ranges this wide are not written with case in mind
+        if (range.hi - range.lo > 0xffff) {
+            continue;
+        }
+        for (char32_t ch = range.lo; ; ++ch) {
+            for (char32_t variant : {QChar::toLower(ch), QChar::toUpper(ch), QChar::toCaseFolded(ch)}) {
+                if (variant != ch) {
+                    variants.push_back({variant, variant});
+                }
+            }
+            if (ch == range.hi) {
+                break;
+            }
+        }
+    }
+    set.insert(set.end(), variants.begin(), variants.end());
+    normalize(set);
+}
+
+CodePointSet digitSet()
+{
+    return {{'0', '9'}};
+}
+
+CodePointSet wordSet()
+{
+    return {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}, {0x80, MAX_CODE_POINT}};
+}
+
+CodePointSet spaceSet()
+{
+    return {{'\t', '\r'}, {' ', ' '}};
+}
+
+int encodeUtf8(char32_t ch, uchar *bytes)
+{
+    if (ch < 0x80) {
+        bytes[0] = uchar(ch);
+        return 1;
+    }
+    if (ch < 0x800) {
+        bytes[0] = uchar(0xc0 | (ch >> 6));
+        bytes[1] = uchar(0x80 | (ch & 0x3f));
+        return 2;
+    }
+    if (ch < 0x10000) {
+        bytes[0] = uchar(0xe0 | (ch >> 12));
+        bytes[1] = uchar(0x80 | ((ch >> 6) & 0x3f));
+        bytes[2] = uchar(0x80 | (ch & 0x3f));
+        return 3;
+    }
+    bytes[0] = uchar(0xf0 | (ch >> 18));
+    bytes[1] = uchar(0x80 | ((ch >> 12) & 0x3f));
+    bytes[2] = uchar(0x80 | ((ch >> 6) & 0x3f));
+    bytes[3] = uchar(0x80 | (ch & 0x3f));
+    return 4;
+}
+
+using ByteSequence = std::vector<std::pair<uchar, uchar>>;
+
+// Splits a code point range into sequences of byte ranges matching exactly its UTF-8 encodings
+void appendUtf8Sequences(char32_t lo, char32_t hi, std::vector<ByteSequence> &sequences)
+{
+    if (lo <= 0xdfff && hi >= 0xd800) {
+        if (lo < 0xd800) {
+            appendUtf8Sequences(lo, 0xd7ff, sequences);
+        }
+        if (hi > 0xdfff) {
+            appendUtf8Sequences(0xe000, hi, sequences);
+        }
+        return;
+    }
+
+    // Same encoded length on both ends
+    for (char32_t max : {char32_t(0x7f), char32_t(0x7ff), char32_t(0xffff)}) {
+        if (lo <= max && hi > max) {
+            appendUtf8Sequences(lo, max, sequences);
+            appendUtf8Sequences(max + 1, hi, sequences);
+            return;
+        }
+    }
+
+    uchar loBytes[4];
+    uchar hiBytes[4];
+    const int length = encodeUtf8(lo, loBytes);
+
+    // Same leading bytes, or the trailing bytes span their full range
+    for (int i = 1; i < length; ++i) {
+        const char32_t mask = (char32_t(1) << (6 * i)) - 1;
+        if ((lo & ~mask) != (hi & ~mask)) {
+            if ((lo & mask) != 0) {
+                appendUtf8Sequences(lo, lo | mask, sequences);
+                appendUtf8Sequences((lo | mask) + 1, hi, sequences);
+                return;
+            }
+            if ((hi & mask) != mask) {
+                appendUtf8Sequences(lo, (hi & ~mask) - 1, sequences);
+                appendUtf8Sequences(hi & ~mask, hi, sequences);
+                return;
+            }
+        }
+    }
+
+    encodeUtf8(hi, hiBytes);
+    ByteSequence sequence;
+    for (int i = 0; i < length; ++i) {
+        sequence.push_back({loBytes[i], hiBytes[i]});
+    }
+    sequences.push_back(sequence);
+}
+
+}
+
+
+
+class RegexProgram::Compiler
+{
+public:
+    struct Node
+    {
+        enum Type
+        {
+            Empty,
+            Set,
+            Concat,
+            Alternate,
+            Repeat,
+            Assert,
+        };
+
+        Type type = Empty;
+        CodePointSet set;
+        bool isLiteral = false;     // Set written as one character
+        char32_t literal = 0;
+        std::vector<std::unique_ptr<Node>> children;
+        int min = 0;
+        int max = 0;                // -1 for unbounded
+        Op assertion = Match;
+    };
+    using NodePtr = std::unique_ptr<Node>;
+
+    Compiler(const QString &pattern, Qt::CaseSensitivity caseSensitivity)
+        : m_pattern(pattern.toUcs4())
+        , m_pos(0)
+        , m_foldCase(caseSensitivity == Qt::CaseInsensitive)
+    {
+    }
+
+    const QString &error() const
+    {
+        return m_error;
+    }
+
+    NodePtr parseRegex()
+    {
+        NodePtr root = parseAlternate();
+        if (root && m_pos < m_pattern.size()) {
+            fail(QStringLiteral("Unmatched )"));
+            return nullptr;
+        }
+        return root;
+    }
+
+    NodePtr parseGlob()
+    {
+        std::vector<NodePtr> items;
+        while (m_pos < m_pattern.size()) {
+            const char32_t ch = m_pattern[m_pos++];
+            if (ch == '*') {
+                while (m_pos < m_pattern.size() && m_pattern[m_pos] == '*') {
+                    m_pos++;
+                }
+                items.push_back(makeRepeat(makeAny(), 0, -1));
+            } else if (ch == '?') {
+                items.push_back(makeAny());
+            } else if (ch == '[' && m_pattern.indexOf(']', m_pos + 1) > m_pos) {
+                items.push_back(parseGlobClass());
+            } else if (ch == '\\' && m_pos < m_pattern.size()) {
+                items.push_back(makeLiteral(m_pattern[m_pos++]));
+            } else {
+                items.push_back(makeLiteral(ch));
+            }
+        }
+        return makeConcat(std::move(items));
+    }
+
+    static NodePtr wrapWholeWord(NodePtr node)
+    {
+        std::vector<NodePtr> items;
+        items.push_back(makeAssert(NotAfterWord));
+        items.push_back(std::move(node));
+        items.push_back(makeAssert(NotBeforeWord));
+        return makeConcat(std::move(items));
+    }
+
+    // The longest run of literal characters a match must contain
+    static QString requiredLiteral(const Node &node)
+    {
+        if (node.isLiteral) {
+            return QString::fromUcs4(&node.literal, 1);
+        }
+        if (node.type != Node::Concat) {
+            return QString();
+        }
+
+        QString best;
+        QString run;
+        for (const NodePtr &child : node.children) {
+            if (child->isLiteral) {
+                run += QString::fromUcs4(&child->literal, 1);
+            } else if (child->type != Node::Assert) {
+                // Zero-width steps keep the run going, anything else ends it
+                if (run.size() > best.size()) {
+                    best = run;
+                }
+                run.clear();
+            }
+        }
+        return run.size() > best.size() ? run : best;
+    }
+
+    void emitProgram(const Node &root, RegexProgram &program)
+    {
+        const Fragment fragment = emit(root, program);
+        const int match = add(program, Match);
+        if (!m_error.isEmpty()) {
+            return;
+        }
+        patch(program, fragment.holes, match);
+        program.m_start = fragment.start;
+    }
+
+private:
+    struct Fragment
+    {
+        int start;
+        std::vector<int> holes;     // Instruction index * 2, +1 for out1
+    };
+
+    void fail(const QString &message)
+    {
+        if (m_error.isEmpty()) {
+            m_error = message;
+        }
+    }
+
+    bool failed() const
+    {
+        return !m_error.isEmpty();
+    }
+
+    bool atEnd() const
+    {
+        return m_pos >= m_pattern.size();
+    }
+
+    static NodePtr makeSet(CodePointSet set)
+    {
+        NodePtr node(new Node);
+        node->type = Node::Set;
+        node->set = std::move(set);
+        return node;
+    }
+
+    NodePtr makeLiteral(char32_t ch) const
+    {
+        CodePointSet set = {{ch, ch}};
+        if (m_foldCase) {
+            addCaseVariants(set);
+        }
+        removeNewline(set);
+        NodePtr node = makeSet(std::move(set));
+        node->isLiteral = ch != '\n';
+        node->literal = ch;
+        return node;
+    }
+
+    static NodePtr makeAny()
+    {
+        CodePointSet set = {{0, MAX_CODE_POINT}};
+        removeNewline(set);
+        return makeSet(std::move(set));
+    }
+
+    static NodePtr makeAssert(Op assertion)
+    {
+        NodePtr node(new Node);
+        node->type = Node::Assert;
+        node->assertion = assertion;
+        return node;
+    }
+
+    static NodePtr makeRepeat(NodePtr child, int min, int max)
+    {
+        NodePtr node(new Node);
+        node->type = Node::Repeat;
+        node->min = min;
+        node->max = max;
+        node->children.push_back(std::move(child));
+        return node;
+    }
+
+    static NodePtr makeConcat(std::vector<NodePtr> items)
+    {
+        if (items.size() == 1) {
+            return std::move(items.front());
+        }
+        NodePtr node(new Node);
+        node->type = items.empty() ? Node::Empty : Node::Concat;
+        node->children = std::move(items);
+        return node;
+    }
+
+    NodePtr parseAlternate()
+    {
+        std::vector<NodePtr> branches;
+        branches.push_back(parseConcat());
+        while (!failed() && !atEnd() && m_pattern[m_pos] == '|') {
+            m_pos++;
+            branches.push_back(parseConcat());
+        }
+        if (failed()) {
+            return nullptr;
+        }
+        if (branches.size() == 1) {
+            return std::move(branches.front());
+        }
+        NodePtr node(new Node);
+        node->type = Node::Alternate;
+        node->children = std::move(branches);
+        return node;
+    }
+
+    NodePtr parseConcat()
+    {
+        std::vector<NodePtr> items;
+        while (!atEnd() && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')') {
+            NodePtr atom = parseAtom();
+            if (!atom) {
+                return nullptr;
+            }
+            atom = parseQuantifiers(std::move(atom));
+            if (!atom) {
+                return nullptr;
+            }
+            items.push_back(std::move(atom));
+        }
+        return makeConcat(std::move(items));
+    }
+
+    NodePtr parseAtom()
+    {
+        const char32_t ch = m_pattern[m_pos++];
+        switch (ch) {
+        case '(': {
+            if (!atEnd() && m_pattern[m_pos] == '?') {
+                if (!parseGroupPrefix()) {
+                    return nullptr;
+                }
+            }
+            NodePtr inner = parseAlternate();
+            if (!inner) {
+                return nullptr;
+            }
+            if (atEnd() || m_pattern[m_pos] != ')') {
+                fail(QStringLiteral("Missing )"));
+                return nullptr;
+            }
+            m_pos++;
+            return inner;
+        }
+        case '[':
+            return parseClass();
+        case '.':
+            return makeAny();
+        case '^':
+            return makeAssert(LineStart);
+        case '$':
+            return makeAssert(LineEnd);
+        case '*':
+        case '+':
+        case '?':
+            fail(QStringLiteral("Nothing to repeat before %1").arg(QChar(char16_t(ch))));
+            return nullptr;
+        case '\\':
+            return parseEscape();
+        default:
+            return makeLiteral(ch);
+        }
+    }
+
+    // (?:...) and named groups, everything else after "(?" needs more than a DFA
+    bool parseGroupPrefix()
+    {
+        m_pos++;
+        if (!atEnd() && m_pattern[m_pos] == ':') {
+            m_pos++;
+            return true;
+        }
+        if (!atEnd() && m_pattern[m_pos] == 'P') {
+            m_pos++;
+        }
+        if (!atEnd() && m_pattern[m_pos] == '<' && m_pos + 1 < m_pattern.size()
+            && m_pattern[m_pos + 1] != '=' && m_pattern[m_pos + 1] != '!') {
+            const qsizetype close = m_pattern.indexOf('>', m_pos);
+            if (close < 0) {
+                fail(QStringLiteral("Missing > after group name"));
+                return false;
+            }
+            m_pos = close + 1;
+            return true;
+        }
+        if (!atEnd() && (m_pattern[m_pos] == '=' || m_pattern[m_pos] == '!' || m_pattern[m_pos] == '<')) {
+            fail(QStringLiteral("Lookahead and lookbehind are not supported"));
+        } else {
+            fail(QStringLiteral("Unsupported group syntax"));
+        }
+        return false;
+    }
+
+    NodePtr parseQuantifiers(NodePtr atom)
+    {
+        while (!atEnd()) {
+            int min = 0;
+            int max = 0;
+            const char32_t ch = m_pattern[m_pos];
+            if (ch == '*') {
+                min = 0;
+                max = -1;
+                m_pos++;
+            } else if (ch == '+') {
+                min = 1;
+                max = -1;
+                m_pos++;
+            } else if (ch == '?') {
+                min = 0;
+                max = 1;
+                m_pos++;
+            } else if (ch != '{' || !parseCounts(min, max)) {
+                break;
+            }
+
+            // Lazy and possessive forms find the same lines
+            if (!atEnd() && (m_pattern[m_pos] == '?' || m_pattern[m_pos] == '+')) {
+                m_pos++;
+            }
+            if (min > MAX_REPEAT || max > MAX_REPEAT) {
+                fail(QStringLiteral("Repetition counts above %1 are not supported").arg(MAX_REPEAT));
+                return nullptr;
+            }
+            if (max >= 0 && max < min) {
+                fail(QStringLiteral("Invalid repetition count"));
+                return nullptr;
+            }
+            atom = makeRepeat(std::move(atom), min, max);
+        }
+        return atom;
+    }
+
+    // {n}, {n,} or {n,m}, anything else leaves the brace as a literal
+    bool parseCounts(int &min, int &max)
+    {
+        qsizetype pos = m_pos + 1;
+        auto readNumber = [&](int &value) {
+            const qsizetype start = pos;
+            qint64 number = 0;
+            while (pos < m_pattern.size() && m_pattern[pos] >= '0' && m_pattern[pos] <= '9') {
+                number = qMin<qint64>(number * 10 + (m_pattern[pos] - '0'), MAX_REPEAT + 1);
+                pos++;
+            }
+            value = int(number);
+            return pos > start;
+        };
+
+        if (!readNumber(min)) {
+            return false;
+        }
+        max = min;
+        if (pos < m_pattern.size() && m_pattern[pos] == ',') {
+            pos++;
+            if (!readNumber(max)) {
+                max = -1;
+            }
+        }
+        if (pos >= m_pattern.size() || m_pattern[pos] != '}') {
+            return false;
+        }
+        m_pos = pos + 1;
+        return true;
+    }
+
+    NodePtr parseEscape()
+    {
+        if (atEnd()) {
+            fail(QStringLiteral("Pattern ends with a backslash"));
+            return nullptr;
+        }
+        const char32_t ch = m_pattern[m_pos++];
+        if (ch == 'b') {
+            return makeAssert(WordBoundary);
+        }
+        if (ch == 'B') {
+            return makeAssert(NotWordBoundary);
+        }
+        if (ch >= '1' && ch <= '9') {
+            fail(QStringLiteral("Backreferences are not supported"));
+            return nullptr;
+        }
+
+        CodePointSet set;
+        if (escapeSet(ch, set)) {
+            removeNewline(set);
+            return makeSet(std::move(set));
+        }
+        char32_t literal;
+        if (!escapeLiteral(ch, literal)) {
+            return nullptr;
+        }
+        return makeLiteral(literal);
+    }
+
+    // \d \w \s and their negations
+    static bool escapeSet(char32_t ch, CodePointSet &set)
+    {
+        CodePointSet escaped;
+        switch (ch) {
+        case 'd':
+            escaped = digitSet();
+            break;
+        case 'D':
+            escaped = complement(digitSet());
+            break;
+        case 'w':
+            escaped = wordSet();
+            break;
+        case 'W':
+            escaped = complement(wordSet());
+            break;
+        case 's':
+            escaped = spaceSet();
+            break;
+        case 'S':
+            escaped = complement(spaceSet());
+            break;
+        default:
+            return false;
+        }
+        set.insert(set.end(), escaped.begin(), escaped.end());
+        return true;
+    }
+
+    bool escapeLiteral(char32_t ch, char32_t &literal)
+    {
+        switch (ch) {
+        case 't':
+            literal = '\t';
+            return true;
+        case 'n':
+            literal = '\n';
+            return true;
+        case 'r':
+            literal = '\r';
+            return true;
+        case 'f':
+            literal = '\f';
+            return true;
+        case 'v':
+            literal = '\v';
+            return true;
+        case 'x':
+            return parseHex(literal);
+        default:
+            break;
+        }
+        if (ch < 0x80 && !QChar::isLetterOrNumber(ch)) {
+            literal = ch;
+            return true;
+        }
+        fail(QStringLiteral("Unsupported escape \\%1").arg(QString::fromUcs4(&ch, 1)));
+        return false;
+    }
+
+    // \xHH or \x{H...}
+    bool parseHex(char32_t &value)
+    {
+        const bool braced = !atEnd() && m_pattern[m_pos] == '{';
+        if (braced) {
+            m_pos++;
+        }
+        value = 0;
+        int digits = 0;
+        while (!atEnd() && (braced || digits < 2)) {
+            const char32_t ch = m_pattern[m_pos];
+            int digit = -1;
+            if (ch >= '0' && ch <= '9') {
+                digit = int(ch - '0');
+            } else if (ch < 0x80 && (ch | 0x20) >= 'a' && (ch | 0x20) <= 'f') {
+                digit = int((ch | 0x20) - 'a' + 10);
+            }
+            if (digit < 0) {
+                break;
+            }
+            value = value * 16 + char32_t(digit);
+            if (value > MAX_CODE_POINT) {
+                break;
+            }
+            m_pos++;
+            digits++;
+        }
+        if (braced) {
+            if (atEnd() || m_pattern[m_pos] != '}') {
+                digits = 0;
+            } else {
+                m_pos++;
+            }
+        }
+        if (digits == 0 || value > MAX_CODE_POINT) {
+            fail(QStringLiteral("Invalid \\x escape"));
+            return false;
+        }
+        return true;
+    }
+
+    NodePtr parseClass()
+    {
+        bool negate = false;
+        if (!atEnd() && m_pattern[m_pos] == '^') {
+            negate = true;
+            m_pos++;
+        }
+
+        CodePointSet set;
+        bool first = true;
+        for (;;) {
+            if (atEnd()) {
+                fail(QStringLiteral("Missing ]"));
+                return nullptr;
+            }
+            char32_t ch = m_pattern[m_pos++];
+            if (ch == ']' && !first) {
+                break;
+            }
+            first = false;
+
+            if (ch == '[' && !atEnd() && m_pattern[m_pos] == ':') {
+                if (!parsePosixClass(set)) {
+                    return nullptr;
+                }
+                continue;
+            }
+
+            char32_t lo = ch;
+            if (ch == '\\') {
+                if (atEnd()) {
+                    fail(QStringLiteral("Missing ]"));
+                    return nullptr;
+                }
+                ch = m_pattern[m_pos++];
+                if (escapeSet(ch, set)) {
+                    continue;
+                }
+                if (ch == 'b') {
+                    lo = '\b';
+                } else if (!escapeLiteral(ch, lo)) {
+                    return nullptr;
+                }
+            }
+
+            char32_t hi = lo;
+            if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']') {
+                m_pos++;
+                hi = m_pattern[m_pos++];
+                if (hi == '\\') {
+                    if (atEnd() || !escapeLiteral(m_pattern[m_pos++], hi)) {
+                        fail(QStringLiteral("Invalid class range"));
+                        return nullptr;
+                    }
+                }
+                if (hi < lo) {
+                    fail(QStringLiteral("Invalid class range"));
+                    return nullptr;
+                }
+            }
+            set.push_back({lo, hi});
+        }
+
+        if (m_foldCase) {
+            addCaseVariants(set);
+        }
+        normalize(set);
+        if (negate) {
+            set = complement(set);
+        }
+        removeNewline(set);
+        return makeSet(std::move(set));
+    }
+
+    bool parsePosixClass(CodePointSet &set)
+    {
+        const qsizetype close = m_pattern.indexOf(':', m_pos + 1);
+        if (close < 0 || close + 1 >= m_pattern.size() || m_pattern[close + 1] != ']') {
+            fail(QStringLiteral("Invalid character class"));
+            return false;
+        }
+        const QString name = QString::fromUcs4(reinterpret_cast<const char32_t *>(m_pattern.constData()) + m_pos + 1, close - m_pos - 1);
+        m_pos = close + 2;
+
+        if (name == QLatin1String("alpha")) {
+            set.insert(set.end(), {{'A', 'Z'}, {'a', 'z'}});
+        } else if (name == QLatin1String("digit")) {
+            set.push_back({'0', '9'});
+        } else if (name == QLatin1String("alnum")) {
+            set.insert(set.end(), {{'0', '9'}, {'A', 'Z'}, {'a', 'z'}});
+        } else if (name == QLatin1String("upper")) {
+            set.push_back({'A', 'Z'});
+        } else if (name == QLatin1String("lower")) {
+            set.push_back({'a', 'z'});
+        } else if (name == QLatin1String("space")) {
+            set.insert(set.end(), {{'\t', '\r'}, {' ', ' '}});
+        } else if (name == QLatin1String("xdigit")) {
+            set.insert(set.end(), {{'0', '9'}, {'A', 'F'}, {'a', 'f'}});
+        } else if (name == QLatin1String("punct")) {
+            set.insert(set.end(), {{'!', '/'}, {':', '@'}, {'[', '`'}, {'{', '~'}});
+        } else if (name == QLatin1String("word")) {
+            const CodePointSet word = wordSet();
+            set.insert(set.end(), word.begin(), word.end());
+        } else {
+            fail(QStringLiteral("Unknown character class [:%1:]").arg(name));
+            return false;
+        }
+        return true;
+    }
+
+    NodePtr parseGlobClass()
+    {
+        bool negate = false;
+        if (m_pattern[m_pos] == '!' || m_pattern[m_pos] == '^') {
+            negate = true;
+            m_pos++;
+        }
+
+        CodePointSet set;
+        bool first = true;
+        while (!atEnd()) {
+            char32_t lo = m_pattern[m_pos++];
+            if (lo == ']' && !first) {
+                break;
+            }
+            first = false;
+            if (lo == '\\' && !atEnd()) {
+                lo = m_pattern[m_pos++];
+            }
+            char32_t hi = lo;
+            if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']') {
+                hi = m_pattern[m_pos + 1];
+                m_pos += 2;
+            }
+            if (hi >= lo) {
+                set.push_back({lo, hi});
+            }
+        }
+
+        if (m_foldCase) {
+            addCaseVariants(set);
+        }
+        normalize(set);
+        if (negate) {
+            set = complement(set);
+        }
+        removeNewline(set);
+        return makeSet(std::move(set));
+    }
+
+    int add(RegexProgram &program, Op op, uchar lo = 0, uchar hi = 0)
+    {
+        if (program.m_instructions.size() >= size_t(MAX_INSTRUCTIONS)) {
+            fail(QStringLiteral("Pattern is too large"));
+            return 0;
+        }
+        program.m_instructions.push_back({op, lo, hi, -1, -1});
+        return int(program.m_instructions.size()) - 1;
+    }
+
+    static void patch(RegexProgram &program, const std::vector<int> &holes, int target)
+    {
+        if (program.m_instructions.empty()) {
+            return;
+        }
+        for (int hole : holes) {
+            Instruction &instruction = program.m_instructions[hole / 2];
+            (hole % 2 ? instruction.out1 : instruction.out) = target;
+        }
+    }
+
+    // Chains fragments one after the other
+    static void append(RegexProgram &program, Fragment &chain, bool &empty, Fragment next)
+    {
+        if (empty) {
+            chain = std::move(next);
+            empty = false;
+            return;
+        }
+        patch(program, chain.holes, next.start);
+        chain.holes = std::move(next.holes);
+    }
+
+    // Chains fragments as alternatives
+    Fragment alternate(RegexProgram &program, std::vector<Fragment> &branches)
+    {
+        Fragment result = branches.back();
+        for (size_t i = branches.size() - 1; i-- > 0;) {
+            const int split = add(program, Split);
+            if (failed()) {
+                return result;
+            }
+            program.m_instructions[split].out = branches[i].start;
+            program.m_instructions[split].out1 = result.start;
+            result.start = split;
+            result.holes.insert(result.holes.end(), branches[i].holes.begin(), branches[i].holes.end());
+        }
+        return result;
+    }
+
+    Fragment emit(const Node &node, RegexProgram &program)
+    {
+        if (failed()) {
+            return {0, {}};
+        }
+
+        switch (node.type) {
+        case Node::Empty: {
+            const int nop = add(program, Split);
+            return {nop, {nop * 2}};
+        }
+
+        case Node::Assert: {
+            const int assertion = add(program, node.assertion);
+            if (node.assertion == LineStart) {
+                program.m_usesLineStart = true;
+            } else if (node.assertion != LineEnd) {
+                program.m_usesWordFlag = true;
+            }
+            return {assertion, {assertion * 2}};
+        }
+
+        case Node::Set: {
+            std::vector<ByteSequence> sequences;
+            for (const CodePointRange &range : node.set) {
+                appendUtf8Sequences(range.lo, range.hi, sequences);
+            }
+            if (sequences.empty()) {
+                // Never matches, a split going nowhere
+                return {add(program, Split), {}};
+            }
+
+            std::vector<Fragment> branches;
+            for (const ByteSequence &sequence : sequences) {
+                const int first = add(program, ByteRange, sequence[0].first, sequence[0].second);
+                int last = first;
+                for (size_t i = 1; i < sequence.size() && !failed(); ++i) {
+                    const int next = add(program, ByteRange, sequence[i].first, sequence[i].second);
+                    program.m_instructions[last].out = next;
+                    last = next;
+                }
+                branches.push_back({first, {last * 2}});
+            }
+            return alternate(program, branches);
+        }
+
+        case Node::Concat: {
+            Fragment chain{0, {}};
+            bool empty = true;
+            for (const NodePtr &child : node.children) {
+                append(program, chain, empty, emit(*child, program));
+            }
+            return chain;
+        }
+
+        case Node::Alternate: {
+            std::vector<Fragment> branches;
+            for (const NodePtr &child : node.children) {
+                branches.push_back(emit(*child, program));
+            }
+            return alternate(program, branches);
+        }
+
+        case Node::Repeat: {
+            const Node &child = *node.children.front();
+            Fragment chain{0, {}};
+            bool empty = true;
+            for (int i = 0; i < node.min && !failed(); ++i) {
+                append(program, chain, empty, emit(child, program));
+            }
+
+            if (node.max < 0) {
+                const int loop = add(program, Split);
+                const Fragment body = emit(child, program);
+                if (failed()) {
+                    return chain;
+                }
+                program.m_instructions[loop].out = body.start;
+                patch(program, body.holes, loop);
+                append(program, chain, empty, {loop, {loop * 2 + 1}});
+            } else {
+                for (int i = node.min; i < node.max && !failed(); ++i) {
+                    const int optional = add(program, Split);
+                    Fragment body = emit(child, program);
+                    if (failed()) {
+                        return chain;
+                    }
+                    program.m_instructions[optional].out = body.start;
+                    body.holes.push_back(optional * 2 + 1);
+                    append(program, chain, empty, {optional, std::move(body.holes)});
+                }
+            }
+
+            if (empty) {
+                const int nop = add(program, Split);
+                return {nop, {nop * 2}};
+            }
+            return chain;
+        }
+        }
+        return {0, {}};
+    }
+
+    QList<uint> m_pattern;
+    qsizetype m_pos;
+    bool m_foldCase;
+    QString m_error;
+};
+
+
+
+std::shared_ptr<const RegexProgram> RegexProgram::compile(const QString &pattern, Syntax syntax,
+                                                          Qt::CaseSensitivity caseSensitivity, bool wholeWord,
+                                                          QString *errorString)
+{
+    Compiler compiler(pattern, caseSensitivity);
+    Compiler::NodePtr root = syntax == Glob ? compiler.parseGlob() : compiler.parseRegex();
+
+    std::shared_ptr<RegexProgram> program(new RegexProgram);
+    if (root) {
+        program->m_requiredLiteral = Compiler::requiredLiteral(*root);
+
+        // Globs match whole names, the word check only applies to regexes
+        if (wholeWord && syntax == Regex) {
+            root = Compiler::wrapWholeWord(std::move(root));
+        }
+        compiler.emitProgram(*root, *program);
+    }
+
+    if (!compiler.error().isEmpty()) {
+        if (errorString) {
+            *errorString = compiler.error();
+        }
+        return nullptr;
+    }
+
+    program->computeByteClasses();
+    return program;
+}
+
+const QString &RegexProgram::requiredLiteral() const
+{
+    return m_requiredLiteral;
+}
+
+void RegexProgram::computeByteClasses()
+{
+    bool boundary[257] = {};
+    auto mark = [&](int lo, int hi) {
+        boundary[lo] = true;
+        boundary[hi + 1] = true;
+    };
+
+    // Newlines and word bytes are looked at by the zero-width steps
+    mark('\n', '\n');
+    mark('0', '9');
+    mark('A', 'Z');
+    mark('_', '_');
+    mark('a', 'z');
+    mark(0x80, 0xff);
+    for (const Instruction &instruction : m_instructions) {
+        if (instruction.op == ByteRange) {
+            mark(instruction.lo, instruction.hi);
+        }
+    }
+
+    int byteClass = -1;
+    for (int byte = 0; byte < 256; ++byte) {
+        if (byte == 0 || boundary[byte]) {
+            m_classBytes[++byteClass] = uchar(byte);
+        }
+        m_byteClasses[byte] = uchar(byteClass);
+    }
+    m_classCount = byteClass + 1;
+}
+
+
+
+LazyDfa::LazyDfa(std::shared_ptr<const RegexProgram> program, bool anchored)
+    : m_program(std::move(program))
+    , m_anchored(anchored)
+    , m_flagMask(0)
+    , m_start(-1)
+    , m_cacheBytes(0)
+    , m_generation(0)
+{
+    // States only differ by flags the program looks at
+    if (m_program->m_usesLineStart) {
+        m_flagMask |= AtLineStart;
+    }
+    if (m_program->m_usesWordFlag) {
+        m_flagMask |= AfterWord;
+    }
+    m_visited.assign(m_program->m_instructions.size(), 0);
+}
+
+qsizetype LazyDfa::find(const uchar *data, qsizetype size)
+{
+    const uchar *byteClasses = m_program->m_byteClasses;
+
+    // Transitions hold the row of the next state, no multiply on the dependent load chain
+    qint32 row = startState() * m_program->m_classCount;
+    const qint32 *transitions = m_transitions.data();
+    for (qsizetype i = 0; i < size; ++i) {
+        const int byteClass = byteClasses[data[i]];
+        qint32 transition = transitions[row + byteClass];
+        if (transition < 0) {
+            transition = computeTransition(row / m_program->m_classCount, byteClass);
+            transitions = m_transitions.data();
+        }
+        if (transition & (MATCHED | DEAD)) {
+            return (transition & MATCHED) ? i : -1;
+        }
+        row = transition >> STATE_SHIFT;
+    }
+    return matchAtEnd(row / m_program->m_classCount) ? size : -1;
+}
+
+bool LazyDfa::matches(const uchar *data, qsizetype size)
+{
+    return find(data, size) >= 0;
+}
+
+int LazyDfa::startState()
+{
+    if (m_start < 0) {
+        std::vector<int> pcs = {m_program->m_start};
+        m_start = addState(pcs, AtLineStart);
+    }
+    return m_start;
+}
+
+int LazyDfa::addState(std::vector<int> &pcs, quint8 flags)
+{
+    flags &= m_flagMask;
+    QByteArray key(reinterpret_cast<const char *>(pcs.data()), qsizetype(pcs.size() * sizeof(int)));
+    key.append(char(flags));
+
+    const auto it = m_stateIds.constFind(key);
+    if (it != m_stateIds.constEnd()) {
+        return it.value();
+    }
+
+    const int id = int(m_states.size());
+    const size_t classCount = size_t(m_program->m_classCount);
+    m_states.push_back({std::move(pcs), flags, -1});
+    m_transitions.resize(m_transitions.size() + classCount, -1);
+    m_stateIds.insert(key, id);
+    m_cacheBytes += 2 * key.size() + qsizetype(classCount * sizeof(qint32) + sizeof(State));
+    return id;
+}
+
+qint32 LazyDfa::computeTransition(int state, int byteClass)
+{
+    const RegexProgram &program = *m_program;
+    const uchar byte = program.m_classBytes[byteClass];
+
+    // Copied, a flush below drops every state
+    const std::vector<int> pcs = m_states[state].pcs;
+    const quint8 flags = m_states[state].flags;
+
+    std::vector<int> consumers;
+    const bool matched = closure(pcs, flags, byte == '\n', isWordByte(byte), consumers) && !m_anchored;
+
+    const bool flushed = m_cacheBytes > MAX_CACHE_BYTES;
+    if (flushed) {
+        clearCache();
+    }
+
+    int next;
+    if (byte == '\n' && !m_anchored) {
+        // Every line starts over
+        next = startState();
+    } else {
+        std::vector<int> nextPcs;
+        for (int pc : consumers) {
+            const RegexProgram::Instruction &instruction = program.m_instructions[pc];
+            if (byte >= instruction.lo && byte <= instruction.hi) {
+                nextPcs.push_back(instruction.out);
+            }
+        }
+        if (!m_anchored) {
+            nextPcs.push_back(program.m_start);
+        }
+        std::sort(nextPcs.begin(), nextPcs.end());
+        nextPcs.erase(std::unique(nextPcs.begin(), nextPcs.end()), nextPcs.end());
+        next = addState(nextPcs, isWordByte(byte) ? AfterWord : 0);
+    }
+
+    const qint32 transition = (qint32(next * program.m_classCount) << STATE_SHIFT) | (matched ? MATCHED : 0)
+                              | (m_states[next].pcs.empty() ? DEAD : 0);
+    if (!flushed) {
+        m_transitions[size_t(state) * size_t(program.m_classCount) + byteClass] = transition;
+    }
+    return transition;
+}
+
+bool LazyDfa::matchAtEnd(int state)
+{
+    if (m_states[state].matchAtEnd < 0) {
+        std::vector<int> consumers;
+        const bool matched = closure(m_states[state].pcs, m_states[state].flags, true, false, consumers);
+        m_states[state].matchAtEnd = matched ? 1 : 0;
+    }
+    return m_states[state].matchAtEnd > 0;
+}
+
+bool LazyDfa::closure(const std::vector<int> &pcs, quint8 flags, bool nextIsLineEnd, bool nextIsWord,
+                      std::vector<int> &consumers)
+{
+    if (++m_generation == 0) {
+        std::fill(m_visited.begin(), m_visited.end(), 0);
+        m_generation = 1;
+    }
+
+    bool matched = false;
+    m_stack.assign(pcs.rbegin(), pcs.rend());
+    while (!m_stack.empty()) {
+        const int pc = m_stack.back();
+        m_stack.pop_back();
+        if (pc < 0 || m_visited[pc] == m_generation) {
+            continue;
+        }
+        m_visited[pc] = m_generation;
+
+        const RegexProgram::Instruction &instruction = m_program->m_instructions[pc];
+        const bool afterWord = flags & AfterWord;
+        bool follow = false;
+        switch (instruction.op) {
+        case RegexProgram::ByteRange:
+            consumers.push_back(pc);
+            break;
+        case RegexProgram::Split:
+            m_stack.push_back(instruction.out1);
+            m_stack.push_back(instruction.out);
+            break;
+        case RegexProgram::Match:
+            matched = true;
+            break;
+        case RegexProgram::LineStart:
+            follow = flags & AtLineStart;
+            break;
+        case RegexProgram::LineEnd:
+            follow = nextIsLineEnd;
+            break;
+        case RegexProgram::WordBoundary:
+            follow = afterWord != nextIsWord;
+            break;
+        case RegexProgram::NotWordBoundary:
+            follow = afterWord == nextIsWord;
+            break;
+        case RegexProgram::NotAfterWord:
+            follow = !afterWord;
+            break;
+        case RegexProgram::NotBeforeWord:
+            follow = !nextIsWord;
+            break;
+        }
+        if (follow) {
+            m_stack.push_back(instruction.out);
+        }
+    }
+    return matched;
+}
+
+void LazyDfa::clearCache()
+{
+    m_states.clear();
+    m_transitions.clear();
+    m_stateIds.clear();
+    m_start = -1;
+    m_cacheBytes = 0;
+}
@@ -0,0 +1,138 @@
+#ifndef REGEXDFA_H
+#define REGEXDFA_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <memory>
+#include <vector>
+
+// A regex or glob compiled to an NFA over UTF-8 bytes. Immutable once
+// compiled, shared by every LazyDfa running it.
+//
+// Regexes support literals, escapes (\d \w \s and their negations, \b \B,
+// \t \n \r \xHH \x{...}), classes, '.', ^ and $ (line anchors), groups,
+// alternation and the * + ? {n,m} quantifiers. Backreferences and
+// lookaround would need backtracking and are rejected.
+// Globs support * ? [...] [!...] and backslash escapes.
+// Lines are matched on their own, nothing matches across a '\n'.
+// Non-ASCII characters count as word characters for \w and \b.
+class RegexProgram
+{
+public:
+    enum Syntax
+    {
+        Regex,
+        Glob,
+    };
+
+    // Returns nullptr and sets errorString if the pattern is invalid
+    static std::shared_ptr<const RegexProgram> compile(const QString &pattern, Syntax syntax,
+                                                       Qt::CaseSensitivity caseSensitivity, bool wholeWord,
+                                                       QString *errorString);
+
+    // A literal every match contains, empty if there is none
+    const QString &requiredLiteral() const;
+
+private:
+    friend class LazyDfa;
+    class Compiler;
+
+    enum Op
+    {
+        ByteRange,          // Consume one byte in [lo, hi]
+        Split,              // Continue at out and out1 (-1 for none)
+        Match,
+        LineStart,          // Zero-width assertions
+        LineEnd,
+        WordBoundary,
+        NotWordBoundary,
+        NotAfterWord,
+        NotBeforeWord,
+    };
+
+    struct Instruction
+    {
+        Op op;
+        uchar lo;
+        uchar hi;
+        int out;
+        int out1;
+    };
+
+    RegexProgram() = default;
+    void computeByteClasses();
+
+    std::vector<Instruction> m_instructions;
+    int m_start = 0;
+    uchar m_byteClasses[256];           // Bytes no instruction tells apart share a class
+    uchar m_classBytes[256];            // A byte of each class
+    int m_classCount = 0;
+    bool m_usesLineStart = false;
+    bool m_usesWordFlag = false;
+    QString m_requiredLiteral;
+
+    static constexpr int MAX_INSTRUCTIONS = 100000;
+};
+
+
+
+// Runs a RegexProgram in time linear in the input, building the DFA states
+// it actually visits on demand. Once the states outgrow the cache it is
+// flushed and rebuilt from the current state, so memory stays bounded.
+// Not thread-safe, every thread keeps its own.
+class LazyDfa
+{
+public:
+    // Anchored DFAs only accept the whole text, others any part of a line
+    LazyDfa(std::shared_ptr<const RegexProgram> program, bool anchored);
+
+    // Offset where the first match ends, or -1. The end of data counts as the end of a line.
+    qsizetype find(const uchar *data, qsizetype size);
+    bool matches(const uchar *data, qsizetype size);
+
+private:
+    struct State
+    {
+        std::vector<int> pcs;   // Program positions before following zero-width steps
+        quint8 flags;
+        qint8 matchAtEnd;       // -1 until computed
+    };
+
+    enum Flag
+    {
+        AtLineStart = 1,
+        AfterWord = 2,
+    };
+
+    // Transitions pack the next state with whether a match ended before the byte
+    static constexpr qint32 MATCHED = 1;
+    static constexpr qint32 DEAD = 2;
+    static constexpr int STATE_SHIFT = 2;
+
+    int startState();
+    int addState(std::vector<int> &pcs, quint8 flags);
+    qint32 computeTransition(int state, int byteClass);
+    bool matchAtEnd(int state);
+    bool closure(const std::vector<int> &pcs, quint8 flags, bool nextIsLineEnd, bool nextIsWord,
+                 std::vector<int> &consumers);
+    void clearCache();
+
+    static constexpr qsizetype MAX_CACHE_BYTES = 2 * 1024 * 1024;
+
+    std::shared_ptr<const RegexProgram> m_program;
+    bool m_anchored;
+    quint8 m_flagMask;
+    std::vector<State> m_states;
+    std::vector<qint32> m_transitions;  // classCount per state, -1 until computed
+    QHash<QByteArray, int> m_stateIds;
+    int m_start;                        // -1 after a flush
+    qsizetype m_cacheBytes;
+
+    // Scratch space for closures
+    std::vector<int> m_stack;
+    std::vector<quint32> m_visited;
+    quint32 m_generation;
+};
+
+#endif // REGEXDFA_H
@@ -1,86 +1,141 @@
 #include "searchmanager.h"
+#include "searchresultset.h"
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QDirIterator>
 #include <QDir>
-#include <QFileIconProvider>
 #include <QFile>
-#include <QTextStream>
-#include <QDateTime>
 #include <QMetaObject>
+#include <QSet>
+#include <QThread>
 #include <QCoreApplication>
 #include <algorithm>
 #include <random>
 
-DirectorySearchWorker::DirectorySearchWorker(const QString &dirPath, const QString &searchText,
-                                             const SearchOptions &options, SearchManager *manager)
-    : m_dirPath(dirPath), m_searchText(searchText), m_options(options), m_manager(manager)
+DirectorySearchWorker::DirectorySearchWorker(int workerIndex, const QString &searchText,
+                                             const SearchOptions &options, SearchManager *manager, int generation)
+    : m_workerIndex(workerIndex), m_generation(generation), m_searchText(searchText), m_options(options), m_manager(manager)
+    , m_matcher(manager->searchPattern())
 {
-    setAutoDelete(true);
 }
 
-void DirectorySearchWorker::run()
+void DirectorySearchWorker::processDirectory(DirHandle &dir)
 {
-    // Check if worker shouldstop
-    if (m_manager->shouldStop()) {
-        m_manager->workerFinished();
-        return;
+    // Open the search dir, the scanner takes over a descriptor opened by the parent
+    SearchTrace::Span span("scan", "entries");
+    SearchStats &stats = m_manager->stats();
+    QElapsedTimer walkTimer;
+    walkTimer.start();
+    DirScanner scanner;
+    const bool opened = !m_manager->shouldStop(m_generation) && scanner.open(dir);
+    if (dir.fd >= 0) {
+        if (!opened) {
+            DirScanner::closeHandle(dir);
+        }
+        m_manager->releaseDirHandle();
+        dir.fd = -1;
     }
-
-    // Check if search dir is valid
-    QDir dir(m_dirPath);
-    if (!dir.exists() || !dir.isReadable()) {
-        m_manager->workerFinished();
+    if (!opened) {
         return;
     }
+    qint64 listNs = walkTimer.nsecsElapsed();   // Listing and name matching add up over the directory
+    qint64 matchNs = 0;
+    qint64 matchedBytes = 0;
+
+    // Ignore files found here apply to everything below
+    std::shared_ptr<const IgnoreScope> ignoreScope = dir.ignoreScope;
+    if (ignoreScope) {
+        ignoreScope = m_manager->ignoreRuleCache().addIgnoreFiles(std::move(ignoreScope), scanner);
+    }
+    int ignoredCount = 0;
 
-    // Get all entries (files AND subdirectories)
-    QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden, QDir::Name);
-
-
-    QFileIconProvider iconProvider;
     int processedCount = 0;
+    int entryCount = 0;
     QList<SearchResult> resultBatch;
     resultBatch.reserve(BATCH_SIZE);
 
-    // Iterate through all entries in the dir
-    for (const QFileInfo &fileInfo : entries) {        
-        if (m_manager->shouldStop()) {
+    // Iterate through all entries in the dir, unsorted and without stat'ing them
+    DirScanner::Entry entry;
+    for (;;) {
+        const qint64 listStart = walkTimer.nsecsElapsed();
+        const bool listed = scanner.next(entry);
+        listNs += walkTimer.nsecsElapsed() - listStart;
+        if (!listed || m_manager->shouldStop(m_generation)) {
             break;
         }
+        entryCount++;
+
+        // d_type is enough unless the file system does not report it
+        DirScanner::EntryType type = scanner.resolveType(entry, false);
+        if (type == DirScanner::Other) {
+            continue;   // Fifos, sockets and devices
+        }
+
+        // Ignored directories are pruned before they reach the queue
+        if (ignoreScope && ignoreScope->isIgnored(entry.name, entry.nameLength, type == DirScanner::Directory)) {
+            ignoredCount++;
+            continue;
+        }
 
         // Search in file name (No different between files/dirs)
         if (m_options.mode == SearchMode::FileName) {
-            QString fileName = fileInfo.fileName();
-            if (fileName.contains(m_searchText, Qt::CaseInsensitive)) {
-                SearchResult result = createSearchResult(fileInfo, 0, QString());
+            int term = -1;
+            const qint64 matchStart = walkTimer.nsecsElapsed();
+            const bool matched = m_matcher.matchesName(entry.name, entry.nameLength, &term);
+            matchNs += walkTimer.nsecsElapsed() - matchStart;
+            matchedBytes += entry.nameLength;
+            if (matched) {
+                // Only matches are stat'ed, relative to the open directory
+                DirScanner::Metadata metadata;
+                const qint64 statStart = walkTimer.nsecsElapsed();
+                const bool stated = scanner.metadata(entry, true, metadata);
+                stats.record(m_generation, SearchStats::Stat, walkTimer.nsecsElapsed() - statStart);
+                SearchResult result = createSearchResult(scanner.childPath(entry), type, stated ? &metadata : nullptr,
+                                                         0, QString());
+                result.term = term;
                 qDebug() << "Found 1 result";
                 resultBatch.append(result);
             }
         }
 
         // If entry is a directory, then add to queue
-        if (fileInfo.isDir()) {
-            m_manager->addDirectoryToQueue(fileInfo.absoluteFilePath());
+        if (type == DirScanner::Directory) {
+            // Open it relative to this one while the descriptor budget allows
+            const bool openDescriptor = m_manager->reserveDirHandle();
+            DirHandle child = scanner.childHandle(entry, openDescriptor);
+            if (openDescriptor && child.fd < 0) {
+                m_manager->releaseDirHandle();
+            }
+            if (ignoreScope) {
+                child.ignoreScope = ignoreScope->child(entry.name, entry.nameLength);
+            }
+            m_manager->addDirectoryToQueue(m_workerIndex, child);
         // Else entry is a file, then process
         }
         else {
             // Increment Processed file
             processedCount++;
 
-            // If search mode is File Content, then search
+            // If search mode is File Content, the pipeline reads and searches it while the walk goes on
             if (m_options.mode == SearchMode::FileContent) {
-                // Search in file content
-                searchInFile(fileInfo, resultBatch);
+                // Symlinked files are searched too, their size decides
+                DirScanner::Metadata metadata;
+                const qint64 statStart = walkTimer.nsecsElapsed();
+                const bool stated = scanner.metadata(entry, true, metadata);
+                stats.record(m_generation, SearchStats::Stat, walkTimer.nsecsElapsed() - statStart);
+                if (stated && metadata.type == DirScanner::File && metadata.size <= m_options.maxFileSizeBytes) {
+                    m_manager->submitFile(m_generation, scanner.childPath(entry), metadata);
+                }
             }
 
-            // Report progress every 25 files
+            // Report progress every 100 files
             if (processedCount % 100 == 0) {
-                m_manager->incrementCounters(25, 0);
+                m_manager->incrementCounters(m_generation, 100, 0);
             }
         }
 
         if (resultBatch.size() >= BATCH_SIZE) {
-            m_manager->reportResults(resultBatch);
+            m_manager->reportResults(m_generation, resultBatch);
             resultBatch.clear();
         }
     }
@@ -88,110 +143,474 @@ void DirectorySearchWorker::run()
     // Report remaining results
     if (resultBatch.length() % BATCH_SIZE != 0)
     {
-        m_manager->reportResults(resultBatch);
+        m_manager->reportResults(m_generation, resultBatch);
+    }
+
+    // Report remaining progress, and this directory whatever the number of files
+    m_manager->incrementCounters(m_generation, processedCount % 100, 1);
+    if (ignoredCount > 0) {
+        m_manager->addIgnoredEntries(m_generation, ignoredCount);
     }
 
-    // Report remaining progress
-    if (processedCount % 100 != 0) {
-        m_manager->incrementCounters(processedCount % 100, 1);
+    stats.record(m_generation, SearchStats::ReadDir, listNs, entryCount);
+    span.setArg(entryCount);
+    if (m_options.mode == SearchMode::FileName) {
+        stats.record(m_generation, SearchStats::Match, matchNs, matchedBytes);
     }
 
-    m_manager->workerFinished();
+    // Walk speed feeds the traversal tuner, a few directories at a time
+    m_walkedDirectories++;
+    m_walkedEntries += entryCount;
+    m_walkNs += walkTimer.nsecsElapsed();
+    if (m_walkedDirectories >= TUNE_DIRECTORIES) {
+        m_manager->recordTraversal(m_generation, m_walkedDirectories, m_walkedEntries, m_walkNs);
+        m_walkedDirectories = 0;
+        m_walkedEntries = 0;
+        m_walkNs = 0;
+    }
 }
 
-bool DirectorySearchWorker::searchInFile(const QFileInfo &fileInfo, QList<SearchResult> &results)
+int DirectorySearchWorker::generation() const
 {
-    if (fileInfo.size() > m_options.maxFileSizeBytes) {
+    return m_generation;
+}
+
+bool DirectorySearchWorker::searchInFile(const QString &filePath, const DirScanner::Metadata &metadata, QList<SearchResult> &results)
+{
+    // Read into the reused buffer and matched right away
+    FileContents contents;
+    contents.buffer.swap(m_readBuffer);
+    const bool found = readFile(filePath, metadata, contents) && matchFile(contents, results);
+    contents.close();
+    m_readBuffer.swap(contents.buffer);
+    return found;
+}
+
+bool DirectorySearchWorker::prepareRead(const QString &filePath, const DirScanner::Metadata &metadata, FileContents &contents)
+{
+    if (metadata.size > m_options.maxFileSizeBytes) {
+        return false;
+    }
+
+    // Binaries sniffed by an earlier search are skipped without opening them
+    FileSniffer::Encoding encoding = metadata.inode != 0
+        ? m_manager->encodingCache().lookup(metadata.device, metadata.inode, metadata.mtimeMSecs) : FileSniffer::Unknown;
+    if (encoding == FileSniffer::Binary && !m_options.searchBinaryFiles) {
+        return false;
+    }
+
+    contents.generation = m_generation;
+    contents.path = filePath;
+    contents.metadata = metadata;
+    contents.encoding = encoding;
+    contents.size = 0;
+    return true;
+}
+
+bool DirectorySearchWorker::finishRead(FileContents &contents)
+{
+    if (contents.size <= 0) {
+        return false;
+    }
+
+    const DirScanner::Metadata &metadata = contents.metadata;
+    if (contents.encoding == FileSniffer::Unknown) {
+        contents.encoding = FileSniffer::sniff(contents.data(), qMin<qint64>(contents.size, FileSniffer::SNIFF_BYTES));
+        if (metadata.inode != 0) {
+            m_manager->encodingCache().insert(metadata.device, metadata.inode, metadata.mtimeMSecs, contents.encoding);
+        }
+    }
+    return contents.encoding != FileSniffer::Binary || m_options.searchBinaryFiles;
+}
+
+bool DirectorySearchWorker::readFile(const QString &filePath, const DirScanner::Metadata &metadata, FileContents &contents)
+{
+    if (!prepareRead(filePath, metadata, contents)) {
         return false;
     }
 
-    QFile file(fileInfo.absoluteFilePath());
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    SearchTrace::Span span("read", "bytes");
+    SearchStats &stats = m_manager->stats();
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 fileSize = metadata.size;
+    contents.file.reset(new QFile(filePath));
+    if (!contents.file->open(QIODevice::ReadOnly)) {
+        contents.close();
+        return false;
+    }
+    stats.record(m_generation, SearchStats::Open, timer.nsecsElapsed());
+    timer.restart();
+
+    // Read, not mapped: a file cut short while it was matched would fault on the missing pages.
+    // A file that grew is cut at its listed size, one that shrank ends where the read does.
+    const qint64 capacity = qMax<qint64>(fileSize, 4096);
+    if (contents.buffer.size() < capacity) {
+        contents.buffer.resize(capacity);
+    }
+    // The rest is only read once the first block turns out to be worth searching
+    contents.size = contents.file->read(contents.buffer.data(), qMin<qint64>(capacity, FileSniffer::SNIFF_BYTES));
+    if (!finishRead(contents)) {
+        contents.close();
         return false;
     }
 
-    const int BUFFER_SIZE = 16384;  // 16KB buffer
-    QTextStream stream(&file);
-    stream.setEncoding(QStringConverter::Utf8);
+    if (contents.size == FileSniffer::SNIFF_BYTES) {
+        const qint64 rest = contents.file->read(contents.buffer.data() + contents.size, capacity - contents.size);
+        if (rest > 0) {
+            contents.size += rest;
+        }
+    }
+    contents.close();
+    stats.record(m_generation, SearchStats::Read, timer.nsecsElapsed(), contents.size);
+    span.setArg(contents.size);
+    return true;
+}
 
-    int lineNumber = 0;
-    bool foundAny = false;
-    int resultsInFile = 0;
+bool DirectorySearchWorker::matchFile(FileContents &contents, QList<SearchResult> &results)
+{
+    // Matching runs on UTF-8, other text encodings are converted first. Binaries are matched byte for byte.
+    QByteArray converted;
+    const char *text = contents.data();
+    qint64 textSize = contents.size;
+    const FileSniffer::Encoding encoding = contents.encoding;
+    if (encoding == FileSniffer::Utf16LE || encoding == FileSniffer::Utf16BE || encoding == FileSniffer::Latin1) {
+        converted = FileSniffer::toUtf8(text, textSize, encoding);
+        text = converted.constData();
+        textSize = converted.size();
+    } else if (encoding == FileSniffer::Utf8) {
+        const qsizetype bomLength = FileSniffer::utf8BomLength(text, textSize);
+        text += bomLength;
+        textSize -= bomLength;
+    }
+
+    // Lines and line numbers are only worked out around hits
     const int MAX_RESULTS_PER_FILE = 3;
+    QList<ContentMatch> matches;
+    SearchTrace::Span span("match", "bytes", textSize);
+    QElapsedTimer timer;
+    timer.start();
+    m_matcher.matchLines(text, textSize, MAX_RESULTS_PER_FILE, [this]() { return m_manager->shouldStop(m_generation); }, matches);
+    m_manager->stats().record(m_generation, SearchStats::Match, timer.nsecsElapsed(), textSize);
+
+    contents.close();
+
+    for (const ContentMatch &match : matches) {
+        QString trimmedLine = match.line.trimmed();
+
+        if (trimmedLine.length() > 150) {
+            int leading = 0;
+            while (leading < match.line.length() && match.line.at(leading).isSpace()) {
+                leading++;
+            }
+            int searchPos = match.column - leading;
+            if (searchPos > 50) {
+                trimmedLine = "..." + trimmedLine.mid(searchPos - 30, 120) + "...";
+            }
+            else {
+                trimmedLine = trimmedLine.left(150) + "...";
+            }
+        }
 
-    QString buffer;
-    buffer.reserve(BUFFER_SIZE * 2);
+        SearchResult result = createSearchResult(contents.path, contents.metadata.type, &contents.metadata,
+                                                 match.lineNumber, trimmedLine);
+        result.term = match.term;
+        results.append(result);
+        if (results.length() > BATCH_SIZE) {
+            m_manager->reportResults(m_generation, results);
+            results.clear();
+        }
+    }
 
-    while (!stream.atEnd() && !m_manager->shouldStop() && resultsInFile < MAX_RESULTS_PER_FILE) {        
-        QString chunk = stream.read(BUFFER_SIZE);
-        buffer += chunk;
+    return !matches.isEmpty();
+}
 
-        QStringList lines = buffer.split('\n');
-        buffer = lines.takeLast();
+SearchResult DirectorySearchWorker::createSearchResult(const QString &filePath, DirScanner::EntryType type,
+                                                       const DirScanner::Metadata *metadata, int lineNumber, const QString &matchedLine)
+{
+    SearchResult result;
+    result.fullPath = filePath;
+    result.nameOffset = int(filePath.lastIndexOf('/') + 1);
+    result.type = type;
+    if (metadata) {
+        result.type = metadata->type;
+        result.hasMetadata = true;
+        result.fileSize = metadata->size;
+        result.modifiedMSecs = metadata->mtimeMSecs;
+    }
+    result.lineNumber = lineNumber;
+    result.matchedLine = matchedLine;
+    return result;
+}
 
-        for (const QString &line : lines) {
-            lineNumber++;
 
-            if (line.contains(m_searchText, Qt::CaseInsensitive)) {
-                QString trimmedLine = line.trimmed();
 
-                if (trimmedLine.length() > 150) {
-                    int searchPos = trimmedLine.indexOf(m_searchText, 0, Qt::CaseInsensitive);
-                    if (searchPos > 50) {
-                        trimmedLine = "..." + trimmedLine.mid(searchPos - 30, 120) + "...";
-                    }
-                    else {
-                        trimmedLine = trimmedLine.left(150) + "...";
-                    }
-                }
+CandidateFileSearchWorker::CandidateFileSearchWorker(const QStringList &filePaths, const QString &searchText,
+                                                     const SearchOptions &options, SearchManager *manager, int generation)
+    : DirectorySearchWorker(-1, searchText, options, manager, generation), m_filePaths(filePaths)
+{
+    setAutoDelete(true);
+}
+
+void CandidateFileSearchWorker::run()
+{
+    QList<SearchResult> resultBatch;
+    int processedCount = 0;
+
+    for (const QString &filePath : m_filePaths) {
+        if (m_manager->shouldStop(m_generation)) {
+            break;
+        }
+
+        DirScanner::Metadata metadata;
+        if (DirScanner::pathMetadata(filePath, true, metadata) && metadata.type == DirScanner::File) {
+            searchInFile(filePath, metadata, resultBatch);
+            processedCount++;
+        }
+    }
+
+    if (!resultBatch.isEmpty()) {
+        m_manager->reportResults(m_generation, resultBatch);
+    }
+    m_manager->incrementCounters(m_generation, processedCount, 0);
+    m_manager->workerFinished(m_generation);
+}
+
 
-                SearchResult result = createSearchResult(fileInfo, lineNumber, trimmedLine);
-                results.append(result);
-                if (results.length() > BATCH_SIZE) {
-                    m_manager->reportResults(results);
-                    results.clear();
+
+ContentIndexSearchWorker::ContentIndexSearchWorker(std::shared_ptr<const ContentIndex> index, std::shared_ptr<const ContentIndexDelta> delta,
+                                                   quint32 dirId, const QString &searchText,
+                                                   const SearchOptions &options, SearchManager *manager, int generation)
+    : m_index(std::move(index)), m_delta(std::move(delta)), m_dirId(dirId), m_generation(generation)
+    , m_searchText(searchText), m_options(options), m_manager(manager)
+    , m_literals(manager->searchPattern()->requiredLiterals())
+{
+    setAutoDelete(true);
+}
+
+void ContentIndexSearchWorker::run()
+{
+    // A watched index knows its changed files, timestamps are only checked after lost events
+    const bool verifyTimestamps = !m_delta || m_delta->verifyTimestamps();
+
+    // The walk prunes ignored files, an index answer leaves them out the same way
+    std::unique_ptr<IgnoreFilter> ignoreFilter;
+    if (m_options.useIgnoreRules) {
+        ignoreFilter.reset(new IgnoreFilter(m_manager->ignoreRuleCache(), m_index->dirPath(m_dirId), m_options.excludePatterns));
+    }
+    int ignored = 0;
+
+    // A file holding any of the literals can match, the index merges their postings in one pass
+    QStringList candidates;
+    QSet<QString> known;
+    const QStringList found = m_index->candidates(m_literals, m_dirId, m_options.maxFileSizeBytes, m_options.searchBinaryFiles,
+                                                  [this]() { return m_manager->shouldStop(m_generation); }, verifyTimestamps);
+    for (const QString &path : found) {
+        if (!known.contains(path)) {
+            known.insert(path);
+            if (ignoreFilter && ignoreFilter->isIgnored(path, false)) {
+                ignored++;
+                continue;
+            }
+            candidates.append(path);
+        }
+    }
+
+    if (m_delta && !m_delta->dirtyFiles().isEmpty()) {
+        const QString scopePath = m_index->dirPath(m_dirId) + '/';
+        for (const QString &path : m_delta->dirtyFiles()) {
+            if (path.startsWith(scopePath) && !known.contains(path) && QFileInfo::exists(path)) {
+                if (ignoreFilter && ignoreFilter->isIgnored(path, false)) {
+                    ignored++;
+                    continue;
                 }
-                foundAny = true;
-                resultsInFile++;
-                if (resultsInFile >= MAX_RESULTS_PER_FILE) break;
+                candidates.append(path);
             }
         }
     }
+    m_manager->addIgnoredEntries(m_generation, ignored);
+    qDebug() << "Content index narrowed the search to" << candidates.size() << "of" << m_index->fileCount() << "files";
+
+    for (qsizetype i = 0; i < candidates.size() && !m_manager->shouldStop(m_generation); i += FILES_PER_TASK) {
+        m_manager->addCandidateFiles(m_generation, candidates.mid(i, FILES_PER_TASK));
+    }
+
+    m_manager->workerFinished(m_generation);
+}
 
-    file.close();
-    return foundAny;
+
+
+IndexSearchWorker::IndexSearchWorker(std::shared_ptr<const FileNameIndex> index, std::shared_ptr<const FileNameIndexDelta> delta,
+                                     quint32 scope, const QString &searchText,
+                                     const SearchOptions &options, SearchManager *manager, int generation)
+    : m_index(std::move(index)), m_delta(std::move(delta)), m_scope(scope), m_generation(generation)
+    , m_searchText(searchText), m_options(options), m_manager(manager)
+    , m_matcher(manager->searchPattern())
+{
+    setAutoDelete(true);
 }
 
-QString DirectorySearchWorker::getFileType(const QFileInfo &fileInfo)
+void IndexSearchWorker::run()
 {
-    if (fileInfo.isDir()) {
-        return "Folder";
-    } else if (fileInfo.isFile()) {
-        QString suffix = fileInfo.suffix().toUpper();
-        return suffix.isEmpty() ? "File" : suffix + " File";
-    } else if (fileInfo.isSymLink()) {
-        return "Shortcut";
-    } else {
-        return "Unknown";
+    QList<SearchResult> resultBatch;
+    resultBatch.reserve(BATCH_SIZE);
+    int candidates = 0;
+
+    // Names holding any of the literals can match, an entry may come up for several
+    QStringList literals = m_matcher.pattern().requiredLiterals();
+    if (literals.isEmpty()) {
+        literals.append(QString());
+    }
+    // The walk prunes ignored entries, an index answer leaves them out the same way
+    std::unique_ptr<IgnoreFilter> ignoreFilter;
+    if (m_options.useIgnoreRules) {
+        ignoreFilter.reset(new IgnoreFilter(m_manager->ignoreRuleCache(), m_index->filePath(m_scope), m_options.excludePatterns));
+    }
+    int ignored = 0;
+
+    QSet<quint32> visited;
+    for (const QString &literal : literals) {
+        m_index->forEachCandidate(literal, m_scope, [&](quint32 id) {
+            if (m_manager->shouldStop(m_generation)) {
+                return false;
+            }
+            if (m_delta && m_delta->isRemoved(id)) {
+                return true;
+            }
+            if (literals.size() > 1) {
+                if (visited.contains(id)) {
+                    return true;
+                }
+                visited.insert(id);
+            }
+            candidates++;
+
+            // Trigrams only narrow the candidates down, verify the real match
+            const QByteArray fileName = m_index->name(id);
+            int term = -1;
+            if (!m_matcher.matchesName(fileName.constData(), fileName.size(), &term)) {
+                return true;
+            }
+
+            const QString filePath = m_index->filePath(id);
+            if (ignoreFilter && ignoreFilter->isIgnored(filePath, m_index->isDir(id))) {
+                ignored++;
+                return true;
+            }
+
+            // Skip entries that were removed since the index was built
+            DirScanner::Metadata metadata;
+            if (!DirScanner::pathMetadata(filePath, true, metadata)) {
+                return true;
+            }
+
+            SearchResult result = DirectorySearchWorker::createSearchResult(filePath, metadata.type, &metadata, 0, QString());
+            result.term = term;
+            resultBatch.append(result);
+            if (resultBatch.size() >= BATCH_SIZE) {
+                m_manager->reportResults(m_generation, resultBatch);
+                resultBatch.clear();
+            }
+            return true;
+        });
     }
+
+    // Entries created since the build
+    int added = 0;
+    if (m_delta) {
+        const QString scopePath = m_index->filePath(m_scope) + '/';
+        const QHash<QString, bool> &addedPaths = m_delta->addedPaths();
+        for (auto it = addedPaths.cbegin(); it != addedPaths.cend() && !m_manager->shouldStop(m_generation); ++it) {
+            if (!it.key().startsWith(scopePath)) {
+                continue;
+            }
+            added++;
+            const QString &filePath = it.key();
+            int term = -1;
+            DirScanner::Metadata metadata;
+            if (!m_matcher.matchesName(filePath.mid(filePath.lastIndexOf('/') + 1), &term)) {
+                continue;
+            }
+            if (ignoreFilter && ignoreFilter->isIgnored(filePath, it.value())) {
+                ignored++;
+                continue;
+            }
+            if (!DirScanner::pathMetadata(filePath, true, metadata)) {
+                continue;
+            }
+            SearchResult result = DirectorySearchWorker::createSearchResult(filePath, metadata.type, &metadata, 0, QString());
+            result.term = term;
+            resultBatch.append(result);
+            if (resultBatch.size() >= BATCH_SIZE) {
+                m_manager->reportResults(m_generation, resultBatch);
+                resultBatch.clear();
+            }
+        }
+    }
+
+    if (!resultBatch.isEmpty()) {
+        m_manager->reportResults(m_generation, resultBatch);
+    }
+    m_manager->addIgnoredEntries(m_generation, ignored);
+
+    // Every entry below the scope counts as processed
+    int scanned = int(m_index->subtreeEnd(m_scope) - m_scope - 1) + added;
+    m_manager->incrementCounters(m_generation, scanned, 0);
+    qDebug() << "Index search checked" << candidates << "of" << scanned << "entries";
+
+    m_manager->workerFinished(m_generation);
 }
 
-SearchResult DirectorySearchWorker::createSearchResult(const QFileInfo &fileInfo, int lineNumber, const QString &matchedLine)
+
+
+RefineSearchWorker::RefineSearchWorker(std::shared_ptr<const SearchResultSet> previous, const QString &searchText,
+                                       const SearchOptions &options, SearchManager *manager, int generation)
+    : m_previous(std::move(previous)), m_generation(generation), m_searchText(searchText), m_options(options), m_manager(manager)
+    , m_matcher(manager->searchPattern())
 {
-    SearchResult result;
-    result.fileName = fileInfo.fileName();
-    result.fullPath = fileInfo.absoluteFilePath();
-    result.fileSize = fileInfo.size();
-    result.fileType = getFileType(fileInfo);
-    result.lastModified = fileInfo.lastModified().toString("yyyy-MM-dd hh:mm:ss");
-    result.isDirectory = fileInfo.isDir();
-    result.lineNumber = lineNumber;
-    result.matchedLine = matchedLine;
+    setAutoDelete(true);
+}
 
-    QFileIconProvider iconProvider;
-    result.icon = iconProvider.icon(fileInfo);
+void RefineSearchWorker::run()
+{
+    const int rowCount = m_previous ? m_previous->size() : 0;
+
+    if (m_options.mode == SearchMode::FileName) {
+        // The names are all there is to match
+        QList<SearchResult> resultBatch;
+        resultBatch.reserve(BATCH_SIZE);
+        for (int row = 0; row < rowCount && !m_manager->shouldStop(m_generation); ++row) {
+            if (!m_matcher.matchesName(m_previous->name(row).toString())) {
+                continue;
+            }
+            resultBatch.append(m_previous->at(row));
+            if (resultBatch.size() >= BATCH_SIZE) {
+                m_manager->reportResults(m_generation, resultBatch);
+                resultBatch.clear();
+            }
+        }
+        if (!resultBatch.isEmpty()) {
+            m_manager->reportResults(m_generation, resultBatch);
+        }
+        m_manager->incrementCounters(m_generation, rowCount, 0);
+    } else {
+        // A line holding the new query holds the old one, so only files that had hits can match.
+        // Lines beyond the ones kept per file may match now, the files are searched again.
+        QStringList filePaths;
+        QSet<QString> known;
+        for (int row = 0; row < rowCount && !m_manager->shouldStop(m_generation); ++row) {
+            const QString path = m_previous->filePath(row);
+            if (!known.contains(path)) {
+                known.insert(path);
+                filePaths.append(path);
+            }
+        }
+        for (qsizetype i = 0; i < filePaths.size() && !m_manager->shouldStop(m_generation); i += FILES_PER_TASK) {
+            m_manager->addCandidateFiles(m_generation, filePaths.mid(i, FILES_PER_TASK));
+        }
+    }
 
-    return result;
+    m_manager->workerFinished(m_generation);
 }
 
 
@@ -216,16 +635,33 @@ SearchResult DirectorySearchWorker::createSearchResult(const QFileInfo &fileInfo
 
 
 // Search Manager
-SearchManager::SearchManager(QObject *parent)
+SearchManager::SearchManager(QObject *parent, IndexManager::Mode indexMode)
     : QObject(parent)
-    , m_shouldStop(0)
+    , m_generation(0)
+    , m_running(false)
+    , m_lastCompleted(false)
     , m_filesProcessed(0)
     , m_directoriesProcessed(0)
+    , m_entriesIgnored(0)
     , m_resultsFound(0)
     , m_activeWorkers(0)
+    , m_openDirHandles(0)
     , m_threadPool(nullptr)
+    , m_traversal(nullptr)
+    , m_walkGeneration(0)
+    , m_pipeline(nullptr)
+    , m_walkPending(false)
+    , m_traversalTuner(nullptr)
     , m_progressTimer(nullptr)
+    , m_results(RESULT_RING_BATCHES)
+    , m_deliveryTimer(nullptr)
+    , m_finishPending(false)
+    , m_indexManager(nullptr)
+    , m_indexPending(false)
+    , m_answeredFromIndex(false)
 {
+    m_tracePath = qEnvironmentVariable("BOBA_TRACE");
+
     // Create thread pool
     m_threadPool = new QThreadPool(this);
 
@@ -234,24 +670,45 @@ SearchManager::SearchManager(QObject *parent)
     int threadCount = qMax(1, qMin(DEFAULT_THREAD_COUNT, QThread::idealThreadCount()));
     m_threadPool->setMaxThreadCount(threadCount);
 
+    // Directory walks run on long-lived threads that steal work from each other
+    int traversalThreadCount = qBound(1, QThread::idealThreadCount(), MAX_TRAVERSAL_THREADS);
+    m_traversal = new TraversalScheduler(traversalThreadCount);
+
+    // Content walks hand files to separate read and match stages
+    m_pipeline = new SearchPipeline(this, MAX_READ_THREADS, qMax(1, QThread::idealThreadCount()));
+
     // Progress timer for UI updates
     m_progressTimer = new QTimer(this);
     m_progressTimer->setInterval(300); // Update every 300ms
     connect(m_progressTimer, &QTimer::timeout, this, &SearchManager::onProgressTimer);
 
-    qDebug() << "SearchManager initialized with" << threadCount << "worker threads";
+    // Results reach the UI in frame-sized steps instead of one queued signal per batch
+    m_deliveryTimer = new QTimer(this);
+    m_deliveryTimer->setTimerType(Qt::PreciseTimer);
+    m_deliveryTimer->setInterval(DELIVERY_INTERVAL_MS);
+    connect(m_deliveryTimer, &QTimer::timeout, this, &SearchManager::onDeliveryTimer);
+
+    // On-disk indexes for instant FileName searches
+    m_indexManager = new IndexManager(this, indexMode);
+
+    qDebug() << "SearchManager initialized with" << traversalThreadCount << "traversal threads and"
+             << threadCount << "worker threads";
 }
 
 SearchManager::~SearchManager()
 {
     stopSearch();
 
-    // Wait for thread pool
+    // Cancelled workers notice quickly, but they have to be gone before the manager
     if (m_threadPool) {
         m_threadPool->clear();
         m_threadPool->waitForDone(5000);
     }
 
+    // The walk submits to the pipeline, so it goes first
+    delete m_traversal;
+    delete m_pipeline;
+
     if (m_progressTimer) {
         m_progressTimer->stop();
     }
@@ -260,72 +717,152 @@ SearchManager::~SearchManager()
 void SearchManager::startSearch(const QString &searchText, const QString &rootPath, const SearchOptions &options)
 {
     QMutexLocker locker(&m_mutex);
+    beginSearch(searchText, rootPath, options);
 
-    // Stop any existing search
-    if (isSearching()) {
-        stopSearch();
+    // Start the search asynchronously using Qt's event system, unless another one replaced it by then
+    const int generation = m_generation.loadAcquire();
+    QMetaObject::invokeMethod(this, [this, generation]() {
+        if (generation == m_generation.loadAcquire()) {
+            performSearch();
+        }
+    }, Qt::QueuedConnection);
+}
+
+bool SearchManager::canRefine(const QString &searchText, const QString &rootPath, const SearchOptions &options) const
+{
+    // Same scope, and nothing that changes what a file or name has to contain to match
+    if (!m_lastCompleted || rootPath != m_rootPath || options.mode != m_options.mode
+        || options.caseSensitive != m_options.caseSensitive || options.searchBinaryFiles != m_options.searchBinaryFiles
+        || options.maxFileSizeBytes != m_options.maxFileSizeBytes || options.useIgnoreRules != m_options.useIgnoreRules
+        || options.excludePatterns != m_options.excludePatterns) {
+        return false;
     }
 
-    // Update info to new search
+    // A literal holding the previous literal can only match where that did. Whole words
+    // do not nest that way ("foo" is not a word of "foobar"), regexes and globs not at all.
+    if (options.syntax != SearchPattern::Literal || m_options.syntax != SearchPattern::Literal
+        || options.wholeWord || m_options.wholeWord) {
+        return false;
+    }
+    return searchText.contains(m_searchText, options.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+}
+
+void SearchManager::refineSearch(const QString &searchText, std::shared_ptr<const SearchResultSet> previous)
+{
+    QMutexLocker locker(&m_mutex);
+    beginSearch(searchText, m_rootPath, m_options);
+
+    addWorker(m_generation.loadAcquire());
+    m_progressTimer->start();
+    m_deliveryTimer->start();
+    m_threadPool->start(new RefineSearchWorker(std::move(previous), searchText, m_options, this, m_generation.loadAcquire()));
+}
+
+int SearchManager::generation() const
+{
+    return m_generation.loadAcquire();
+}
+
+void SearchManager::beginSearch(const QString &searchText, const QString &rootPath, const SearchOptions &options)
+{
+    // Replace any existing search, without waiting for its workers
+    if (m_running) {
+        cancelSearch();
+    }
+
+    // Update info to new search, whatever the previous one still delivers is dropped
+    m_generation.fetchAndAddRelease(1);
+    m_running = true;
+    m_lastCompleted = false;
     m_searchText = searchText;
     m_rootPath = rootPath;
     m_options = options;
-    m_shouldStop = 0;
     m_filesProcessed = 0;
     m_directoriesProcessed = 0;
+    m_entriesIgnored = 0;
     m_resultsFound = 0;
-    m_activeWorkers = 0;
+    m_stats.reset(m_generation.loadAcquire());
+    if (!m_tracePath.isEmpty()) {
+        SearchTrace::start();
+    }
+    m_activeWorkers.storeRelease(quint64(quint32(m_generation.loadAcquire())) << 32);
+    m_indexPending = false;
+    m_answeredFromIndex = false;
+    m_finishPending = false;
+
+    // Compiled once, shared read-only by every worker
+    const Qt::CaseSensitivity caseSensitivity = options.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    if (options.syntax == SearchPattern::Terms) {
+        m_pattern = std::make_shared<const SearchPattern>(options.terms, caseSensitivity, options.wholeWord);
+    } else {
+        m_pattern = std::make_shared<const SearchPattern>(searchText, caseSensitivity, options.wholeWord, options.syntax);
+    }
+}
 
-    // Clear work queue
-    {
-        QMutexLocker queueLocker(&m_queueMutex);
-        m_workQueue.clear();
+void SearchManager::stopSearch()
+{
+    m_lastCompleted = false;
+    if (!m_running) {
+        return;
     }
+    cancelSearch();
+    writeTrace();
+    emit searchCancelled();
+}
 
-    // Start the search asynchronously using Qt's event system
-    QMetaObject::invokeMethod(this, "performSearch", Qt::QueuedConnection);
+bool SearchManager::isSearching() const
+{
+    return m_running;
 }
 
-void SearchManager::stopSearch()
+void SearchManager::cancelSearch()
 {
-    m_shouldStop = 1;
+    // Nothing waits for the workers: with a new generation they stop at their next check and
+    // whatever they still report is dropped. Remaining directories are drained without being scanned.
+    m_generation.fetchAndAddRelease(1);
+    m_running = false;
+    m_finishPending = false;
+    m_walkPending = false;
+    m_pendingRoot = DirHandle();
 
     if (m_threadPool) {
         m_threadPool->clear();              // Clear pending tasks
-        m_threadPool->waitForDone(2000);    // Wait for active tasks
     }
-
+    m_pipeline->clear();
     if (m_progressTimer) {
         m_progressTimer->stop();
     }
+    if (m_deliveryTimer) {
+        m_deliveryTimer->stop();
+    }
+    m_results.clear();
 }
 
-bool SearchManager::isSearching() const
+void SearchManager::reportResults(int generation, const QList<SearchResult> &results)
 {
-    bool hasActiveWorkers = m_activeWorkers.loadAcquire() > 0;
-    bool hasQueuedWork = false;
-
-    {
-        QMutexLocker queueLocker(&m_queueMutex);
-        hasQueuedWork = !m_workQueue.isEmpty();
+    if (results.isEmpty()) {
+        return;
     }
 
-    return hasActiveWorkers || hasQueuedWork ||
-           (m_threadPool && m_threadPool->activeThreadCount() > 0);
-}
-
-void SearchManager::reportResults(const QList<SearchResult> &results)
-{
-    QMutexLocker locker(&m_resultMutex);
-    if (!m_shouldStop.loadAcquire()) {
-        emit resultsFound(results);
-        int resultsCount = results.length();
-        m_resultsFound.fetchAndAddAcquire(resultsCount);
+    // A full ring means the UI is behind, waiting here keeps memory bounded
+    SearchTrace::Span span("report", "results", results.size());
+    QElapsedTimer timer;
+    timer.start();
+    ResultBatch batch = {generation, results};
+    while (!m_results.tryPush(batch)) {
+        if (shouldStop(generation)) {
+            return;
+        }
+        QThread::usleep(200);
     }
+    m_stats.record(generation, SearchStats::Emit, timer.nsecsElapsed(), results.size());
 }
 
-void SearchManager::incrementCounters(int files, int directories)
+void SearchManager::incrementCounters(int generation, int files, int directories)
 {
+    if (generation != m_generation.loadAcquire()) {
+        return;
+    }
     if (files > 0) {
         m_filesProcessed.fetchAndAddAcquire(files);
     }
@@ -334,112 +871,390 @@ void SearchManager::incrementCounters(int files, int directories)
     }
 }
 
-bool SearchManager::shouldStop() const
+bool SearchManager::shouldStop(int generation) const
 {
-    return m_shouldStop.loadAcquire() != 0;
+    return generation != m_generation.loadAcquire();
 }
 
-void SearchManager::workerFinished()
+bool SearchManager::addWorker(int generation)
 {
-    // Decrement active workers
-    int remaining = m_activeWorkers.fetchAndSubAcquire(1) - 1;
+    quint64 current = m_activeWorkers.loadAcquire();
+    do {
+        if (quint32(current >> 32) != quint32(generation)) {
+            return false;
+        }
+    } while (!m_activeWorkers.testAndSetOrdered(current, current + 1, current));
+    return true;
+}
 
-    // Try to start a new worker if there's more work
-    QString nextDir;
-    {
-        QMutexLocker queueLocker(&m_queueMutex);
-        if (!m_workQueue.isEmpty()) {
-            nextDir = m_workQueue.dequeue();
+void SearchManager::workerFinished(int generation, int count)
+{
+    // Workers of an earlier search no longer count, even if they finish while the next one starts
+    quint64 current = m_activeWorkers.loadAcquire();
+    do {
+        if (quint32(current >> 32) != quint32(generation) || quint32(current) < quint32(count)) {
+            return;
         }
+    } while (!m_activeWorkers.testAndSetOrdered(current, current - count, current));
+
+    // The traversal counts as one worker and so does every file in the pipeline, whoever finishes last ends the search
+    if (quint32(current) == quint32(count)) {
+        // A search started before this is delivered finishes on its own
+        QMetaObject::invokeMethod(this, [this, generation]() {
+            if (generation == m_generation.loadAcquire()) {
+                finishSearch();
+            }
+        }, Qt::QueuedConnection);
     }
+}
 
-    if (!nextDir.isEmpty() && !m_shouldStop.loadAcquire()) {
-        // Start a new worker for the next directory
-        DirectorySearchWorker *worker = new DirectorySearchWorker(
-            nextDir, m_searchText, m_options, this);
-        m_activeWorkers.fetchAndAddAcquire(1);
-        m_threadPool->start(worker);
-    } else if (remaining == 0) {
-        // No more workers and no more work - finish search
-        bool hasWork;
-        {
-            QMutexLocker queueLocker(&m_queueMutex);
-            hasWork = !m_workQueue.isEmpty();
-        }
+void SearchManager::processDirectory(int workerIndex, DirHandle &dir)
+{
+    m_directoryWorkers[workerIndex]->processDirectory(dir);
+}
 
-        if (!hasWork) {
-            QMetaObject::invokeMethod(this, "finishSearch", Qt::QueuedConnection);
-        }
-    }
+void SearchManager::traversalFinished()
+{
+    // No walk starts before this one is over, so m_walkGeneration is still this walk's
+    workerFinished(m_walkGeneration.loadAcquire());
+
+    // A walk may be waiting for the threads
+    QMetaObject::invokeMethod(this, &SearchManager::startPendingWalk, Qt::QueuedConnection);
 }
 
 void SearchManager::performSearch()
 {
     qDebug() << "Multi-threaded search started:" << m_searchText << "in" << m_rootPath;
 
+    // Callers check patterns up front, but never walk the tree with one that cannot match
+    if (!m_pattern->isValid()) {
+        qDebug() << "Invalid search pattern:" << m_pattern->errorString();
+        m_running = false;
+        emit searchCompleted(0);
+        return;
+    }
+
     try {
         m_progressTimer->start();
+        m_deliveryTimer->start();
         startInitialSearch();
     }
     catch (...) {
         qDebug() << "Exception in search manager";
-        emit searchCancelled();
-        m_progressTimer->stop();
+        stopSearch();
     }
 }
 
 void SearchManager::startInitialSearch()
 {
-    // Start initial workers - they will create more work as they discover subdirectories
-    DirectorySearchWorker *initialWorker = new DirectorySearchWorker(m_rootPath, m_searchText, m_options, this);
-    m_activeWorkers.fetchAndAddAcquire(1);
-    m_threadPool->start(initialWorker);
+    // Answer from the filename index when one covers the root
+    if (m_options.mode == SearchMode::FileName && m_options.useIndex) {
+        quint32 scope = 0;
+        std::shared_ptr<const FileNameIndexDelta> delta;
+        std::shared_ptr<const FileNameIndex> index = m_indexManager->fileNameIndexFor(m_rootPath, &scope, &delta);
+        if (index) {
+            IndexSearchWorker *indexWorker = new IndexSearchWorker(index, delta, scope, m_searchText, m_options, this,
+                                                                   m_generation.loadAcquire());
+            m_answeredFromIndex = true;
+            addWorker(m_generation.loadAcquire());
+            m_threadPool->start(indexWorker);
+            return;
+        }
+
+        // Fall back to walking the tree, and index it once the walk is done
+        m_indexPending = true;
+    }
+
+    // Only read the files the content index cannot rule out
+    if (m_options.mode == SearchMode::FileContent && m_options.useContentIndex) {
+        quint32 dirId = 0;
+        std::shared_ptr<const ContentIndexDelta> delta;
+        std::shared_ptr<const ContentIndex> index = m_indexManager->contentIndexFor(m_rootPath, &dirId, &delta);
+        if (index) {
+            ContentIndexSearchWorker *indexWorker = new ContentIndexSearchWorker(index, delta, dirId, m_searchText, m_options, this,
+                                                                                 m_generation.loadAcquire());
+            m_answeredFromIndex = true;
+            addWorker(m_generation.loadAcquire());
+            m_threadPool->start(indexWorker);
+            return;
+        }
+
+        m_indexPending = true;
+    }
+
+    DirHandle root;
+    root.path = m_rootPath;
+    if (m_options.useIgnoreRules) {
+        root.ignoreScope = m_ignoreRuleCache.rootScope(m_rootPath, m_options.excludePatterns);
+    }
+    addWorker(m_generation.loadAcquire());
+
+    // A cancelled walk may still be draining, this one starts as soon as it is over
+    m_pendingRoot = root;
+    m_walkPending = true;
+    if (!m_traversal->isBusy()) {
+        startPendingWalk();
+    }
 }
 
-void SearchManager::addDirectoryToQueue(const QString &dirPath)
+void SearchManager::startPendingWalk()
 {
-    if (m_shouldStop.loadAcquire()) {
+    if (!m_walkPending) {
         return;
     }
+    m_walkPending = false;
 
-    {
-        QMutexLocker queueLocker(&m_queueMutex);
-        m_workQueue.enqueue(dirPath);
-    }
+    // Not busy anymore, this only waits for the threads to park
+    m_traversal->waitForDone();
 
-    // Try to start a new worker if we have work and available threads
-    if (m_threadPool->activeThreadCount() < m_threadPool->maxThreadCount()) {
-        QString nextDir;
-        {
-            QMutexLocker queueLocker(&m_queueMutex);
-            if (!m_workQueue.isEmpty()) {
-                nextDir = m_workQueue.dequeue();
-            }
+    // One searcher per traversal thread, they create more work as they discover subdirectories
+    const int generation = m_generation.loadAcquire();
+    m_directoryWorkers.clear();
+    for (int i = 0; i < m_traversal->threadCount(); ++i) {
+        m_directoryWorkers.emplace_back(new DirectorySearchWorker(i, m_searchText, m_options, this, generation));
+    }
+    m_walkGeneration = generation;
+
+    // Start with as many traversal threads as the last walk on this device settled on, unless pinned
+    DirScanner::Metadata rootMetadata;
+    const quint64 device = DirScanner::pathMetadata(m_pendingRoot.path, true, rootMetadata) ? rootMetadata.device : 0;
+    if (m_options.traversalThreads > 0) {
+        QMutexLocker locker(&m_traversalTunerMutex);
+        m_traversalTuner = nullptr;
+        m_traversal->setActiveThreads(m_options.traversalThreads);
+    } else {
+        QMutexLocker locker(&m_traversalTunerMutex);
+        const int threads = m_traversal->threadCount();
+        auto tuner = m_traversalTuners.find(device);
+        if (tuner == m_traversalTuners.end()) {
+            tuner = m_traversalTuners.emplace(device, ConcurrencyTuner(threads, 1, threads)).first;
         }
+        m_traversalTuner = &tuner->second;
+        m_traversal->setActiveThreads(m_traversalTuner->limit());
+    }
+
+    // Files found by a content walk are read and matched by the pipeline
+    if (m_options.mode == SearchMode::FileContent) {
+        m_pipeline->begin(generation, m_options.readOrder, [this, generation]() {
+            return std::unique_ptr<DirectorySearchWorker>(new DirectorySearchWorker(-1, m_searchText, m_options, this, generation));
+        });
+    }
 
-        if (!nextDir.isEmpty()) {
-            DirectorySearchWorker *worker = new DirectorySearchWorker(
-                nextDir, m_searchText, m_options, this);
-            m_activeWorkers.fetchAndAddAcquire(1);
-            m_threadPool->start(worker);
+    DirHandle root = m_pendingRoot;
+    m_pendingRoot = DirHandle();
+    m_traversal->start(this, root);
+}
+
+void SearchManager::addDirectoryToQueue(int workerIndex, DirHandle dir)
+{
+    // Subdirectories of a cancelled walk are closed without being scanned
+    if (m_walkGeneration.loadAcquire() != m_generation.loadAcquire()) {
+        if (dir.fd >= 0) {
+            DirScanner::closeHandle(dir);
+            releaseDirHandle();
         }
+        return;
+    }
+
+    m_traversal->push(workerIndex, dir);
+}
+
+bool SearchManager::reserveDirHandle()
+{
+    if (m_openDirHandles.fetchAndAddAcquire(1) >= MAX_OPEN_DIR_HANDLES) {
+        m_openDirHandles.fetchAndSubRelease(1);
+        return false;
     }
+    return true;
+}
+
+void SearchManager::releaseDirHandle()
+{
+    m_openDirHandles.fetchAndSubRelease(1);
+}
+
+void SearchManager::addCandidateFiles(int generation, const QStringList &filePaths)
+{
+    // Checked and counted in one step, a search cancelled in between must not gain a worker.
+    // The lock keeps the next search from replacing the text and options being copied.
+    SearchTrace::waitForLock(m_mutex, "lock search");
+    QMutexLocker locker(&m_mutex);
+    if (filePaths.isEmpty() || !addWorker(generation)) {
+        return;
+    }
+
+    m_threadPool->start(new CandidateFileSearchWorker(filePaths, m_searchText, m_options, this, generation));
+}
+
+void SearchManager::submitFile(int generation, const QString &filePath, const DirScanner::Metadata &metadata)
+{
+    // Each file counts as a worker until it is matched, so the search cannot finish before
+    if (addWorker(generation)) {
+        m_pipeline->submit(generation, filePath, metadata);
+    }
+}
+
+void SearchManager::recordTraversal(int generation, int directories, qint64 entries, qint64 latencyNs)
+{
+    if (generation != m_walkGeneration.loadAcquire()) {
+        return;
+    }
+
+    // Entries listed per second is what more threads should raise
+    QMutexLocker locker(&m_traversalTunerMutex);
+    if (m_traversalTuner && m_traversalTuner->record(directories, entries, latencyNs)) {
+        m_traversal->setActiveThreads(m_traversalTuner->limit());
+    }
+}
+
+void SearchManager::addIgnoredEntries(int generation, int count)
+{
+    if (generation != m_generation.loadAcquire()) {
+        return;
+    }
+    m_entriesIgnored.fetchAndAddRelaxed(count);
+}
+
+int SearchManager::ignoredEntries() const
+{
+    return m_entriesIgnored.loadAcquire();
 }
 
 void SearchManager::finishSearch()
 {
+    // Everything found reaches the UI before the search counts as completed
+    if (!m_results.isEmpty()) {
+        m_finishPending = true;
+        return;
+    }
+    m_finishPending = false;
+    m_running = false;
     m_progressTimer->stop();
+    m_deliveryTimer->stop();
+
+    // Cancelled searches never get here, stopSearch() already reported them
+    m_lastCompleted = true;
+    writeTrace();
+    emit searchCompleted(m_resultsFound.loadAcquire());
+    qDebug() << "Search completed:" << m_resultsFound.loadAcquire() << "results";
+
+    if (m_indexPending) {
+        if (m_options.mode == SearchMode::FileContent) {
+            m_indexManager->scheduleContentBuild(m_rootPath, m_options.maxFileSizeBytes);
+        } else {
+            m_indexManager->scheduleBuild(m_rootPath);
+        }
+        m_indexPending = false;
+    }
+}
 
-    if (!m_shouldStop.loadAcquire()) {
-        emit searchCompleted(m_resultsFound.loadAcquire());
-        qDebug() << "Search completed:" << m_resultsFound.loadAcquire() << "results";
-    } else {
-        emit searchCancelled();
-        qDebug() << "Search cancelled";
+IndexManager *SearchManager::indexManager() const
+{
+    return m_indexManager;
+}
+
+EncodingCache &SearchManager::encodingCache()
+{
+    return m_encodingCache;
+}
+
+IgnoreRuleCache &SearchManager::ignoreRuleCache()
+{
+    return m_ignoreRuleCache;
+}
+
+SearchStats &SearchManager::stats()
+{
+    return m_stats;
+}
+
+void SearchManager::setTracePath(const QString &path)
+{
+    m_tracePath = path;
+}
+
+void SearchManager::writeTrace()
+{
+    if (m_tracePath.isEmpty() || !SearchTrace::isEnabled()) {
+        return;
+    }
+    if (!SearchTrace::write(m_tracePath)) {
+        qWarning() << "Could not write trace to" << m_tracePath;
     }
 }
 
+QJsonObject SearchManager::statsJson() const
+{
+    QJsonObject object;
+    object.insert("searchText", m_searchText);
+    object.insert("rootPath", m_rootPath);
+    object.insert("mode", m_options.mode == SearchMode::FileContent ? "content" : "name");
+    object.insert("running", m_running);
+    object.insert("answeredFromIndex", m_answeredFromIndex);
+    object.insert("filesProcessed", m_filesProcessed.loadAcquire());
+    object.insert("directoriesProcessed", m_directoriesProcessed.loadAcquire());
+    object.insert("results", m_resultsFound.loadAcquire());
+    object.insert("stages", m_stats.toJson());
+    return object;
+}
+
+std::shared_ptr<const SearchPattern> SearchManager::searchPattern() const
+{
+    return m_pattern;
+}
+
 void SearchManager::onProgressTimer()
 {
     emit searchProgress(m_filesProcessed.loadAcquire(), m_directoriesProcessed.loadAcquire());
+
+    // Stage settings only change a few times a second, the UI hears about changes only
+    SearchStages stages;
+    stages.traversalThreads = m_traversal->activeThreads();
+    if (m_options.mode == SearchMode::FileContent) {
+        stages.matchThreads = m_pipeline->matchThreads();
+        stages.devices = m_pipeline->deviceStages();
+    }
+    if (stages != m_stages) {
+        m_stages = stages;
+        emit stagesChanged(m_stages);
+    }
+}
+
+SearchStages SearchManager::stages() const
+{
+    return m_stages;
+}
+
+void SearchManager::onDeliveryTimer()
+{
+    // Insert for at most part of a frame, the rest waits for the next tick
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    const int generation = m_generation.loadAcquire();
+    QList<SearchResult> chunk;
+    ResultBatch batch;
+    bool drained = false;
+    while (elapsed.elapsed() < DELIVERY_BUDGET_MS) {
+        drained = !m_results.tryPop(batch);
+        if (!drained && batch.generation == generation) {
+            chunk.append(batch.results);
+        }
+        if (!chunk.isEmpty() && (drained || chunk.size() >= DELIVERY_CHUNK)) {
+            m_resultsFound.fetchAndAddRelaxed(int(chunk.size()));
+            emit resultsFound(chunk);
+            chunk.clear();
+        }
+        if (drained) {
+            break;
+        }
+    }
+    if (!chunk.isEmpty()) {
+        m_resultsFound.fetchAndAddRelaxed(int(chunk.size()));
+        emit resultsFound(chunk);
+    }
+
+    if (m_finishPending && m_results.isEmpty()) {
+        finishSearch();
+    }
 }
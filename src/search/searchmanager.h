@@ -8,9 +8,19 @@
 #include <QThreadPool>
 #include <QRunnable>
 #include <QTimer>
-#include <QWaitCondition>
-#include <QIcon>
-#include <QQueue>
+#include <map>
+#include <memory>
+#include <vector>
+#include "dirscanner.h"
+#include "filesniffer.h"
+#include "ignorerules.h"
+#include "mpscring.h"
+#include "searchpattern.h"
+#include "searchpipeline.h"
+#include "searchstats.h"
+#include "searchtrace.h"
+#include "traversalscheduler.h"
+#include "../index/indexmanager.h"
 
 enum SearchMode
 {
@@ -20,19 +30,25 @@ enum SearchMode
 
 
 
+// One hit, kept to the raw facts the worker already has. Icons, type names
+// and formatted dates are left to the UI, for the rows it actually shows.
 struct SearchResult
 {
-    QString fileName;
     QString fullPath;
-    qint64 fileSize;
-    QString fileType;
-    QString lastModified;
-    bool isDirectory;
-    QIcon icon;
+    int nameOffset = 0;             // File name starts here in fullPath
+    DirScanner::EntryType type = DirScanner::Unknown;  // d_type, or the target's type when stat'ed
+    bool hasMetadata = false;       // Whether fileSize and modifiedMSecs were stat'ed
+    qint64 fileSize = 0;
+    qint64 modifiedMSecs = 0;
 
     // For content search
     QString matchedLine;
-    int lineNumber;
+    int lineNumber = 0;
+
+    int term = -1;                  // Index into SearchOptions::terms for the Terms syntax
+
+    QStringView fileName() const { return QStringView(fullPath).mid(nameOffset); }
+    bool isDirectory() const { return type == DirScanner::Directory; }
 };
 
 
@@ -42,31 +58,150 @@ struct SearchOptions
 {
     SearchMode mode = SearchMode::FileName;
     qint64 maxFileSizeBytes = 10 * 1024 * 1024;
+    bool useIndex = true;           // Answer FileName searches from the on-disk index when possible
+    bool useContentIndex = false;   // Prune FileContent searches with a content index (built on first use)
+    bool caseSensitive = false;
+    bool wholeWord = false;         // Matches must not touch letters, digits or '_' on either side
+    bool searchBinaryFiles = false; // Match binary files byte for byte instead of skipping them
+    SearchPattern::Syntax syntax = SearchPattern::Literal;
+    bool useIgnoreRules = true;     // Prune what .gitignore/.bobaignore files and excludePatterns ignore
+    QStringList excludePatterns = {".git/", ".hg/", ".svn/"};   // Ignored everywhere, in .gitignore syntax
+    QStringList terms;              // Searched for at once by the Terms syntax, each file is read once
+    SearchPipeline::ReadOrder readOrder = SearchPipeline::Auto;    // FileContent reads, sorted by disk location on rotational disks
+    int traversalThreads = 0;       // Directory walk threads, at most one per core; 0 lets the tuner pick per device
 };
 
 
 
 
 class SearchManager;
+class SearchResultSet;
+
+// Searches the directories handed to one traversal thread
+class DirectorySearchWorker
+{
+public:
+    DirectorySearchWorker(int workerIndex, const QString &searchText,
+                          const SearchOptions &options, SearchManager *manager, int generation);
+    void processDirectory(DirHandle &dir);
+    int generation() const;
+
+    // The two halves of searchInFile(), for the read and match stages. readFile() leaves
+    // a text or searchable binary file in contents, read into its buffer.
+    bool readFile(const QString &filePath, const DirScanner::Metadata &metadata, FileContents &contents);
+    bool matchFile(FileContents &contents, QList<SearchResult> &results);
+
+    // readFile() for readers that fetch the bytes themselves: whether the file is worth
+    // reading at all, and once contents holds them, whether it is worth matching
+    bool prepareRead(const QString &filePath, const DirScanner::Metadata &metadata, FileContents &contents);
+    bool finishRead(FileContents &contents);
+
+    // metadata may be null when the entry could not be stat'ed, type is used then
+    static SearchResult createSearchResult(const QString &filePath, DirScanner::EntryType type,
+                                           const DirScanner::Metadata *metadata, int lineNumber, const QString &matchedLine);
+
+protected:
+    bool searchInFile(const QString &filePath, const DirScanner::Metadata &metadata, QList<SearchResult> &results);
+
+    int m_workerIndex;
+    int m_generation;           // Of the search this worker belongs to
+    QString m_searchText;
+    SearchOptions m_options;
+    SearchManager *m_manager;
+    PatternMatcher m_matcher;
+    QByteArray m_readBuffer;    // Reused for every file read by this worker
+    const int BATCH_SIZE = 15;
+
+    // Walked since last reported to the traversal tuner
+    int m_walkedDirectories = 0;
+    qint64 m_walkedEntries = 0;
+    qint64 m_walkNs = 0;
+    const int TUNE_DIRECTORIES = 32;
+};
+
+
+
+// Worker task searching the contents of an explicit list of files
+class CandidateFileSearchWorker : public QRunnable, public DirectorySearchWorker
+{
+public:
+    CandidateFileSearchWorker(const QStringList &filePaths, const QString &searchText,
+                              const SearchOptions &options, SearchManager *manager, int generation);
+    void run() override;
+
+private:
+    QStringList m_filePaths;
+};
+
+
+
+// Worker task answering a FileContent search from a content index.
+// It only narrows the files down and hands them to CandidateFileSearchWorkers.
+class ContentIndexSearchWorker : public QRunnable
+{
+public:
+    ContentIndexSearchWorker(std::shared_ptr<const ContentIndex> index, std::shared_ptr<const ContentIndexDelta> delta,
+                             quint32 dirId, const QString &searchText,
+                             const SearchOptions &options, SearchManager *manager, int generation);
+    void run() override;
+
+private:
+    std::shared_ptr<const ContentIndex> m_index;
+    std::shared_ptr<const ContentIndexDelta> m_delta;
+    quint32 m_dirId;
+    int m_generation;
+    QString m_searchText;
+    SearchOptions m_options;
+    SearchManager *m_manager;
+    QStringList m_literals;     // Of this search's pattern, the manager's may be replaced meanwhile
+    const int FILES_PER_TASK = 64;
+};
+
+
 
-// Worker task for searching a single directory
-class DirectorySearchWorker : public QRunnable
+// Worker task answering a FileName search from a filename index
+class IndexSearchWorker : public QRunnable
 {
 public:
-    DirectorySearchWorker(const QString &dirPath, const QString &searchText,
-                          const SearchOptions &options, SearchManager *manager);
+    IndexSearchWorker(std::shared_ptr<const FileNameIndex> index, std::shared_ptr<const FileNameIndexDelta> delta,
+                      quint32 scope, const QString &searchText,
+                      const SearchOptions &options, SearchManager *manager, int generation);
     void run() override;
 
 private:
-    bool searchInFile(const QFileInfo &fileInfo, QList<SearchResult> &results);
-    QString getFileType(const QFileInfo &fileInfo);
-    SearchResult createSearchResult(const QFileInfo &fileInfo, int lineNumber, const QString &matchedLine);
+    std::shared_ptr<const FileNameIndex> m_index;
+    std::shared_ptr<const FileNameIndexDelta> m_delta;
+    quint32 m_scope;
+    int m_generation;
+    QString m_searchText;
+    SearchOptions m_options;
+    SearchManager *m_manager;
+    PatternMatcher m_matcher;
+    const int BATCH_SIZE = 15;
+};
+
+
 
-    QString m_dirPath;
+// Worker task answering a query that narrows down the previous, completed
+// one from that search's results instead of walking the tree again.
+// FileName results are filtered by name without touching the disk; for
+// FileContent only the files that had hits are searched again.
+class RefineSearchWorker : public QRunnable
+{
+public:
+    RefineSearchWorker(std::shared_ptr<const SearchResultSet> previous, const QString &searchText,
+                       const SearchOptions &options, SearchManager *manager, int generation);
+    void run() override;
+
+private:
+    std::shared_ptr<const SearchResultSet> m_previous;
+    int m_generation;
     QString m_searchText;
     SearchOptions m_options;
     SearchManager *m_manager;
+    PatternMatcher m_matcher;
     const int BATCH_SIZE = 15;
+    const int FILES_PER_TASK = 64;
 };
 
 
@@ -75,56 +210,141 @@ private:
 
 
 
-class SearchManager : public QObject
+class SearchManager : public QObject, public TraversalJob
 {
     Q_OBJECT
 public:
-    explicit SearchManager(QObject *parent = nullptr);
+    // Command line tools pass IndexManager::OnDemand, they should not watch or build in the background
+    explicit SearchManager(QObject *parent = nullptr, IndexManager::Mode indexMode = IndexManager::Watching);
     ~SearchManager();
 
+    // Replaces a running search. Neither waits for workers: those of an older
+    // search stop at their next check and anything they still report is dropped.
     void startSearch(const QString &searchText, const QString &rootPath, const SearchOptions &options = SearchOptions());
     void stopSearch();
     bool isSearching() const;
 
+    // Whether the last search completed and every match of searchText is among its results
+    bool canRefine(const QString &searchText, const QString &rootPath, const SearchOptions &options) const;
+    // Searches again within previous, the results of the last search, with its root and options
+    void refineSearch(const QString &searchText, std::shared_ptr<const SearchResultSet> previous);
+
+    // Every search gets a new number, anything tagged with an older one is dropped
+    int generation() const;
+
+    // Traces every search and writes it to path as Chrome trace-event JSON once
+    // it completes or is stopped. Empty turns tracing off. Starts from $BOBA_TRACE.
+    void setTracePath(const QString &path);
+
+    // Concurrency the stages settled on, as last reported by stagesChanged()
+    SearchStages stages() const;
+
     // Thread-safe methods for worker tasks
-    void reportResults(const QList<SearchResult> &results);
-    void incrementCounters(int files, int directories);
-    bool shouldStop() const;
-    void workerFinished();
-    void addDirectoryToQueue(const QString &dirPath);  // Workers can add new directories
+    void reportResults(int generation, const QList<SearchResult> &results);    // Waits while the UI is behind
+    void incrementCounters(int generation, int files, int directories);
+    bool shouldStop(int generation) const;
+    void workerFinished(int generation, int count = 1);
+    void addDirectoryToQueue(int workerIndex, DirHandle dir);  // Workers can add new directories
+    bool reserveDirHandle();                  // Budget for descriptors of queued directories
+    void releaseDirHandle();
+    void addCandidateFiles(int generation, const QStringList &filePaths);
+    void submitFile(int generation, const QString &filePath, const DirScanner::Metadata &metadata);  // To the read stage
+    void recordTraversal(int generation, int directories, qint64 entries, qint64 latencyNs);
+    void addIgnoredEntries(int generation, int count);
+    int ignoredEntries() const;         // Entries pruned by ignore rules, subtrees count once
+
+    IndexManager *indexManager() const;
+    std::shared_ptr<const SearchPattern> searchPattern() const;
+    EncodingCache &encodingCache();     // Kept across searches
+    IgnoreRuleCache &ignoreRuleCache();
+    SearchStats &stats();               // Of the running or last search, complete once it finished
+    QJsonObject statsJson() const;      // stats() with what was searched and the counters, GUI thread
+
+    // TraversalJob
+    void processDirectory(int workerIndex, DirHandle &dir) override;
+    void traversalFinished() override;
 
 signals:
     void searchProgress(int filesProcessed, int directoriesProcessed);
     void resultsFound(const QList<SearchResult> &results);
     void searchCompleted(int totalResults);
     void searchCancelled();
+    void stagesChanged(const SearchStages &stages);
 
 private slots:
     void onProgressTimer();
-    void performSearch();
+    void onDeliveryTimer();
     void finishSearch();
 
 private:
+    struct ResultBatch
+    {
+        int generation = 0;
+        QList<SearchResult> results;
+    };
+
+    void cancelSearch();
+    void writeTrace();
+    void beginSearch(const QString &searchText, const QString &rootPath, const SearchOptions &options);
+    void performSearch();
     void startInitialSearch();
+    void startPendingWalk();
+    bool addWorker(int generation);       // False once the search is cancelled
 
 
     mutable QMutex m_mutex;
-    mutable QMutex m_resultMutex;
-    mutable QMutex m_queueMutex;  // For thread-safe work queue
     QString m_searchText;
     QString m_rootPath;
     SearchOptions m_options;
-
-    QAtomicInt m_shouldStop;
+    std::shared_ptr<const SearchPattern> m_pattern;
+    EncodingCache m_encodingCache;
+    IgnoreRuleCache m_ignoreRuleCache;
+    SearchStats m_stats;
+    QString m_tracePath;
+
+    QAtomicInt m_generation;
+    bool m_running;               // UI thread only, cleared by completion or cancellation
+    bool m_lastCompleted;         // The last search ran to the end, its results can be refined
     QAtomicInt m_filesProcessed;
     QAtomicInt m_directoriesProcessed;
+    QAtomicInt m_entriesIgnored;
     QAtomicInt m_resultsFound;
-    QAtomicInt m_activeWorkers;
+    QAtomicInteger<quint64> m_activeWorkers;     // Generation in the high half, count in the low
+    QAtomicInt m_openDirHandles;
 
     QThreadPool *m_threadPool;
+    TraversalScheduler *m_traversal;
+    QAtomicInt m_walkGeneration;  // Search the running walk belongs to
+    SearchPipeline *m_pipeline;   // Read and match stages of FileContent walks
+    bool m_walkPending;           // Waiting for a cancelled walk to drain
+    DirHandle m_pendingRoot;
+    std::vector<std::unique_ptr<DirectorySearchWorker>> m_directoryWorkers;  // One per traversal thread
+
+    // Traversal threads per root device, learned across searches
+    QMutex m_traversalTunerMutex;
+    std::map<quint64, ConcurrencyTuner> m_traversalTuners;
+    ConcurrencyTuner *m_traversalTuner;
+    SearchStages m_stages;
     QTimer *m_progressTimer;
-    QQueue<QString> m_workQueue;  // Thread-safe work queue
-    QWaitCondition m_hasWork;     // Signal when work is available
+
+    // Result batches on their way from the workers to the UI thread, which
+    // takes them off once per frame for a limited time
+    MpscRing<ResultBatch> m_results;
+    QTimer *m_deliveryTimer;
+    bool m_finishPending;         // Workers are done, completion waits for the ring to drain
+
+    IndexManager *m_indexManager;
+    bool m_indexPending;          // Live walk of an unindexed root, index it once done
+    bool m_answeredFromIndex;     // The search is served by an index instead of a walk
+
+    // Queued directories beyond this are reopened by path
+    static constexpr int MAX_OPEN_DIR_HANDLES = 256;
+    static constexpr int MAX_TRAVERSAL_THREADS = 64;
+    static constexpr int MAX_READ_THREADS = 32;      // Shared by all devices, their tuners pick how many read at once
+    static constexpr int RESULT_RING_BATCHES = 4096;
+    static constexpr int DELIVERY_INTERVAL_MS = 16;     // About one frame
+    static constexpr int DELIVERY_BUDGET_MS = 8;        // Of each frame spent inserting rows
+    static constexpr int DELIVERY_CHUNK = 1024;         // Results per resultsFound signal
 };
 
 #endif // SEARCHMANAGER_H
@@ -0,0 +1,770 @@
+#include "searchpattern.h"
+#include "regexdfa.h"
+#include "ahocorasick.h"
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cstring>
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define BOBA_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Bytes in rough order of how common they are in source code and prose.
+// Anything not listed (control bytes, capitals, UTF-8 sequences) counts as rare.
+const char COMMON_BYTES[] =
+    " etaoinsrlhdcupmfgy\n_b.w()v,k;=x\"/-'*{}0jq1z>2<:[]\t#+&!|3$%456789@?\\^~`\r";
+
+int byteFrequency(uchar byte)
+{
+    static const QByteArray ranks = []() {
+        QByteArray table(256, '\0');
+        const int count = int(sizeof(COMMON_BYTES)) - 1;
+        for (int i = 0; i < count; ++i) {
+            table[uchar(COMMON_BYTES[i])] = char(count - i);
+        }
+        return table;
+    }();
+    return uchar(ranks.at(byte));
+}
+
+inline uchar foldAscii(uchar byte)
+{
+    return (byte >= 'A' && byte <= 'Z') ? byte + ('a' - 'A') : byte;
+}
+
+inline uchar otherCase(uchar byte)
+{
+    if (byte >= 'a' && byte <= 'z') {
+        return byte - ('a' - 'A');
+    }
+    return byte;
+}
+
+// Byte folding policies the kernels are instantiated with
+struct ExactBytes
+{
+    static constexpr bool Folds = false;
+    static uchar fold(uchar byte) { return byte; }
+};
+
+struct AsciiFold
+{
+    static constexpr bool Folds = true;
+    static uchar fold(uchar byte) { return foldAscii(byte); }
+};
+
+bool hasCaseVariants(char32_t ch)
+{
+    const QString s = QString::fromUcs4(&ch, 1);
+    return s.toLower() != s || s.toUpper() != s || s.toCaseFolded() != s;
+}
+
+inline bool isAsciiWordByte(uchar byte)
+{
+    const uchar lower = byte | 0x20;
+    return (lower >= 'a' && lower <= 'z') || (byte >= '0' && byte <= '9') || byte == '_';
+}
+
+bool isWordCodePoint(char32_t ch)
+{
+    return ch == '_' || QChar::isLetterOrNumber(ch) || QChar::category(ch) == QChar::Mark_NonSpacing;
+}
+
+bool isWordSequence(const uchar *bytes, qsizetype length)
+{
+    const QList<uint> codePoints = QString::fromUtf8(reinterpret_cast<const char *>(bytes), length).toUcs4();
+    return !codePoints.isEmpty() && isWordCodePoint(codePoints.first());
+}
+
+// Whether the character ending right before pos is a word character
+bool isWordBefore(const uchar *data, qsizetype pos)
+{
+    if (pos == 0) {
+        return false;
+    }
+    if (data[pos - 1] < 0x80) {
+        return isAsciiWordByte(data[pos - 1]);
+    }
+    qsizetype start = pos - 1;
+    while (start > 0 && pos - start < 4 && (data[start] & 0xc0) == 0x80) {
+        --start;
+    }
+    return isWordSequence(data + start, pos - start);
+}
+
+// Whether the character starting at pos is a word character
+bool isWordAt(const uchar *data, qsizetype size, qsizetype pos)
+{
+    if (pos >= size) {
+        return false;
+    }
+    if (data[pos] < 0x80) {
+        return isAsciiWordByte(data[pos]);
+    }
+    const qsizetype length = data[pos] >= 0xf0 ? 4 : data[pos] >= 0xe0 ? 3 : 2;
+    return isWordSequence(data + pos, qMin(length, size - pos));
+}
+
+bool isWordBefore(const QString &text, qsizetype pos)
+{
+    if (pos == 0) {
+        return false;
+    }
+    if (pos >= 2 && text.at(pos - 1).isLowSurrogate() && text.at(pos - 2).isHighSurrogate()) {
+        return isWordCodePoint(QChar::surrogateToUcs4(text.at(pos - 2), text.at(pos - 1)));
+    }
+    return isWordCodePoint(text.at(pos - 1).unicode());
+}
+
+bool isWordAt(const QString &text, qsizetype pos)
+{
+    if (pos >= text.size()) {
+        return false;
+    }
+    if (pos + 1 < text.size() && text.at(pos).isHighSurrogate() && text.at(pos + 1).isLowSurrogate()) {
+        return isWordCodePoint(QChar::surrogateToUcs4(text.at(pos), text.at(pos + 1)));
+    }
+    return isWordCodePoint(text.at(pos).unicode());
+}
+
+// Length in UTF-16 code units of UTF-8 bytes
+int utf16Length(const char *data, qsizetype size)
+{
+    int length = 0;
+    for (qsizetype i = 0; i < size; ++i) {
+        const uchar byte = uchar(data[i]);
+        if ((byte & 0xc0) != 0x80) {
+            length += byte >= 0xf0 ? 2 : 1;
+        }
+    }
+    return length;
+}
+
+bool findTerm(const AhoCorasick &automaton, bool wholeWord, const uchar *data, qsizetype size, qsizetype from,
+              AhoCorasick::Hit &hit)
+{
+    if (!wholeWord) {
+        return automaton.find(data, size, from, nullptr, hit);
+    }
+    return automaton.find(data, size, from, [data, size](const AhoCorasick::Hit &candidate) {
+        return !isWordBefore(data, candidate.start) && !isWordAt(data, size, candidate.end);
+    }, hit);
+}
+
+}
+
+SearchPattern::SearchPattern(const QString &text, Qt::CaseSensitivity caseSensitivity, bool wholeWord, Syntax syntax)
+    : m_text(text)
+    , m_kernel(caseSensitivity == Qt::CaseSensitive ? CaseSensitive : AsciiFolded)
+    , m_wholeWord(wholeWord)
+    , m_syntax(syntax)
+    , m_find(nullptr)
+    , m_offset1(0)
+    , m_offset2(0)
+{
+    if (syntax != Literal) {
+        m_program = RegexProgram::compile(text, syntax == Glob ? RegexProgram::Glob : RegexProgram::Regex,
+                                          caseSensitivity, wholeWord, &m_errorString);
+        if (!m_program) {
+            return;
+        }
+
+        // Decoding kernels cannot skip ahead cheaply, those literals are left to the DFA
+        const QString literal = m_program->requiredLiteral();
+        if (literal.toUtf8().size() >= MIN_PREFILTER_BYTES) {
+            std::shared_ptr<const SearchPattern> prefilter = std::make_shared<const SearchPattern>(literal, caseSensitivity, false);
+            if (prefilter->kernel() != UnicodeFolded) {
+                m_prefilter = prefilter;
+            }
+        }
+        return;
+    }
+
+    if (m_kernel == AsciiFolded) {
+        for (char32_t ch : text.toUcs4()) {
+            if (ch >= 0x80 && hasCaseVariants(ch)) {
+                m_kernel = UnicodeFolded;
+            }
+        }
+    }
+
+    m_needle = text.toUtf8();
+    if (m_kernel != CaseSensitive) {
+        for (char &byte : m_needle) {
+            byte = char(foldAscii(uchar(byte)));
+        }
+    }
+
+    switch (m_kernel) {
+    case CaseSensitive:
+        m_find = wholeWord ? &findBytes<ExactBytes, true> : &findBytes<ExactBytes, false>;
+        break;
+    case AsciiFolded:
+        m_find = wholeWord ? &findBytes<AsciiFold, true> : &findBytes<AsciiFold, false>;
+        break;
+    case UnicodeFolded:
+        break;
+    }
+
+    // Pick the two rarest bytes at different offsets
+    const qsizetype length = m_needle.size();
+    for (qsizetype i = 1; i < length; ++i) {
+        if (byteFrequency(uchar(m_needle[i])) < byteFrequency(uchar(m_needle[m_offset1]))) {
+            m_offset1 = i;
+        }
+    }
+    m_offset2 = m_offset1;
+    for (qsizetype i = 0; i < length; ++i) {
+        if (i != m_offset1 && (m_offset2 == m_offset1
+                               || byteFrequency(uchar(m_needle[i])) < byteFrequency(uchar(m_needle[m_offset2])))) {
+            m_offset2 = i;
+        }
+    }
+
+    const uchar rare1 = length ? uchar(m_needle[m_offset1]) : 0;
+    const uchar rare2 = length ? uchar(m_needle[m_offset2]) : 0;
+    m_rare1[0] = rare1;
+    m_rare1[1] = m_kernel == CaseSensitive ? rare1 : otherCase(rare1);
+    m_rare2[0] = rare2;
+    m_rare2[1] = m_kernel == CaseSensitive ? rare2 : otherCase(rare2);
+}
+
+SearchPattern::SearchPattern(const QStringList &terms, Qt::CaseSensitivity caseSensitivity, bool wholeWord)
+    : m_text(terms.join(QLatin1String(", ")))
+    , m_terms(terms)
+    , m_kernel(caseSensitivity == Qt::CaseSensitive ? CaseSensitive : AsciiFolded)
+    , m_wholeWord(wholeWord)
+    , m_syntax(Terms)
+    , m_automaton(std::make_shared<const AhoCorasick>(terms, caseSensitivity))
+    , m_find(nullptr)
+    , m_offset1(0)
+    , m_offset2(0)
+{
+}
+
+const QString &SearchPattern::text() const
+{
+    return m_text;
+}
+
+const QStringList &SearchPattern::terms() const
+{
+    return m_terms;
+}
+
+SearchPattern::Kernel SearchPattern::kernel() const
+{
+    return m_kernel;
+}
+
+bool SearchPattern::wholeWord() const
+{
+    return m_wholeWord;
+}
+
+SearchPattern::Syntax SearchPattern::syntax() const
+{
+    return m_syntax;
+}
+
+bool SearchPattern::isValid() const
+{
+    return !usesDfa() || m_program;
+}
+
+const QString &SearchPattern::errorString() const
+{
+    return m_errorString;
+}
+
+QStringList SearchPattern::requiredLiterals() const
+{
+    switch (m_syntax) {
+    case Literal:
+        return {m_text};
+    case Terms:
+        return m_terms;
+    case Regex:
+    case Glob:
+        break;
+    }
+    if (!m_program || m_program->requiredLiteral().isEmpty()) {
+        return {};
+    }
+    return {m_program->requiredLiteral()};
+}
+
+bool SearchPattern::usesDfa() const
+{
+    return m_syntax == Regex || m_syntax == Glob;
+}
+
+qsizetype SearchPattern::find(const char *data, qsizetype size, qsizetype from) const
+{
+    if (m_automaton) {
+        AhoCorasick::Hit hit;
+        return findTerm(*m_automaton, m_wholeWord, reinterpret_cast<const uchar *>(data), size, from, hit) ? hit.start : -1;
+    }
+    if (m_find) {
+        return m_find(*this, reinterpret_cast<const uchar *>(data), size, from);
+    }
+
+    // Unicode folding can change byte lengths, match on the decoded text. Decoded a growing
+    // slice of whole lines at a time, so a hit close by does not cost the rest of the data.
+    qsizetype sliceSize = FIRST_FIND_SLICE;
+    while (from < size) {
+        const qsizetype sliceEnd = lineSliceEnd(data, size, from, sliceSize);
+        const QString text = QString::fromUtf8(data + from, sliceEnd - from);
+        const qsizetype hit = findText(text, 0);
+        if (hit >= 0) {
+            return from + text.left(hit).toUtf8().size();
+        }
+        from = sliceEnd + 1;
+        sliceSize = qMin(sliceSize * 2, SLICE_SIZE);
+    }
+    return -1;
+}
+
+bool SearchPattern::matchesName(const char *name, qsizetype length, int *term) const
+{
+    if (m_automaton) {
+        AhoCorasick::Hit hit;
+        if (!findTerm(*m_automaton, m_wholeWord, reinterpret_cast<const uchar *>(name), length, 0, hit)) {
+            return false;
+        }
+        if (term) {
+            *term = hit.term;
+        }
+        return true;
+    }
+    if (m_find) {
+        return m_find(*this, reinterpret_cast<const uchar *>(name), length, 0) >= 0;
+    }
+    return findText(QString::fromUtf8(name, length), 0) >= 0;
+}
+
+bool SearchPattern::matchesName(const QString &name, int *term) const
+{
+    if (m_automaton) {
+        const QByteArray bytes = name.toUtf8();
+        return matchesName(bytes.constData(), bytes.size(), term);
+    }
+    if (m_find) {
+        const QByteArray bytes = name.toUtf8();
+        return m_find(*this, reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), 0) >= 0;
+    }
+    return findText(name, 0) >= 0;
+}
+
+qsizetype SearchPattern::findText(const QString &text, qsizetype from) const
+{
+    return m_wholeWord ? findUnicode<true>(*this, text, from) : findUnicode<false>(*this, text, from);
+}
+
+// Simple case folding only, one character to one: QString has no full folding
+// that maps "ß" to "ss" and keeps offsets into the text
+template <bool WholeWord>
+qsizetype SearchPattern::findUnicode(const SearchPattern &pattern, const QString &text, qsizetype from)
+{
+    for (;;) {
+        const qsizetype hit = text.indexOf(pattern.m_text, from, Qt::CaseInsensitive);
+        if (hit < 0 || !WholeWord) {
+            return hit;
+        }
+        if (!isWordBefore(text, hit) && !isWordAt(text, hit + pattern.m_text.size())) {
+            return hit;
+        }
+        from = hit + 1;
+    }
+}
+
+template <typename Fold, bool WholeWord>
+qsizetype SearchPattern::findBytes(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from)
+{
+    const qsizetype length = pattern.m_needle.size();
+    if (from + length > size) {
+        return -1;
+    }
+    if (length == 0) {
+        return from;
+    }
+
+#ifdef BOBA_X86_SIMD
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2 ? scanAvx2<Fold, WholeWord>(pattern, data, size, from)
+                   : scanSse2<Fold, WholeWord>(pattern, data, size, from);
+#else
+    return scanScalar<Fold, WholeWord>(pattern, data, size, from);
+#endif
+}
+
+template <typename Fold, bool WholeWord>
+bool SearchPattern::accept(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype pos)
+{
+    const uchar *needle = reinterpret_cast<const uchar *>(pattern.m_needle.constData());
+    const qsizetype length = pattern.m_needle.size();
+    for (qsizetype i = 0; i < length; ++i) {
+        if (Fold::fold(data[pos + i]) != needle[i]) {
+            return false;
+        }
+    }
+    if (WholeWord) {
+        return !isWordBefore(data, pos) && !isWordAt(data, size, pos + length);
+    }
+    return true;
+}
+
+template <typename Fold, bool WholeWord>
+qsizetype SearchPattern::scanScalar(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from)
+{
+    const qsizetype last = size - pattern.m_needle.size();
+    for (qsizetype pos = from; pos <= last; ++pos) {
+        const uchar byte = data[pos + pattern.m_offset1];
+        if ((byte == pattern.m_rare1[0] || byte == pattern.m_rare1[1])
+            && accept<Fold, WholeWord>(pattern, data, size, pos)) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+#ifdef BOBA_X86_SIMD
+template <typename Fold, bool WholeWord>
+qsizetype SearchPattern::scanSse2(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from)
+{
+    const __m128i rare1a = _mm_set1_epi8(char(pattern.m_rare1[0]));
+    const __m128i rare1b = _mm_set1_epi8(char(pattern.m_rare1[1]));
+    const __m128i rare2a = _mm_set1_epi8(char(pattern.m_rare2[0]));
+    const __m128i rare2b = _mm_set1_epi8(char(pattern.m_rare2[1]));
+
+    // Every load stays inside the buffer while 16 starting positions fit
+    const qsizetype last = size - pattern.m_needle.size();
+    qsizetype pos = from;
+    for (; pos + 15 <= last; pos += 16) {
+        const __m128i block1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + pattern.m_offset1));
+        const __m128i block2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + pattern.m_offset2));
+        __m128i eq1 = _mm_cmpeq_epi8(block1, rare1a);
+        __m128i eq2 = _mm_cmpeq_epi8(block2, rare2a);
+        if constexpr (Fold::Folds) {
+            eq1 = _mm_or_si128(eq1, _mm_cmpeq_epi8(block1, rare1b));
+            eq2 = _mm_or_si128(eq2, _mm_cmpeq_epi8(block2, rare2b));
+        }
+
+        quint32 mask = quint32(_mm_movemask_epi8(_mm_and_si128(eq1, eq2)));
+        while (mask) {
+            const qsizetype candidate = pos + qCountTrailingZeroBits(mask);
+            if (accept<Fold, WholeWord>(pattern, data, size, candidate)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return scanScalar<Fold, WholeWord>(pattern, data, size, pos);
+}
+
+template <typename Fold, bool WholeWord>
+__attribute__((target("avx2")))
+qsizetype SearchPattern::scanAvx2(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from)
+{
+    const __m256i rare1a = _mm256_set1_epi8(char(pattern.m_rare1[0]));
+    const __m256i rare1b = _mm256_set1_epi8(char(pattern.m_rare1[1]));
+    const __m256i rare2a = _mm256_set1_epi8(char(pattern.m_rare2[0]));
+    const __m256i rare2b = _mm256_set1_epi8(char(pattern.m_rare2[1]));
+
+    const qsizetype last = size - pattern.m_needle.size();
+    qsizetype pos = from;
+    for (; pos + 31 <= last; pos += 32) {
+        const __m256i block1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + pattern.m_offset1));
+        const __m256i block2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + pattern.m_offset2));
+        __m256i eq1 = _mm256_cmpeq_epi8(block1, rare1a);
+        __m256i eq2 = _mm256_cmpeq_epi8(block2, rare2a);
+        if constexpr (Fold::Folds) {
+            eq1 = _mm256_or_si256(eq1, _mm256_cmpeq_epi8(block1, rare1b));
+            eq2 = _mm256_or_si256(eq2, _mm256_cmpeq_epi8(block2, rare2b));
+        }
+
+        quint32 mask = quint32(_mm256_movemask_epi8(_mm256_and_si256(eq1, eq2)));
+        while (mask) {
+            const qsizetype candidate = pos + qCountTrailingZeroBits(mask);
+            if (accept<Fold, WholeWord>(pattern, data, size, candidate)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return scanSse2<Fold, WholeWord>(pattern, data, size, pos);
+}
+#endif
+
+void SearchPattern::matchLines(const char *data, qsizetype size, int maxMatches,
+                               const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const
+{
+    if (m_automaton) {
+        matchLinesTerms(data, size, maxMatches, shouldStop, matches);
+        return;
+    }
+    if (!m_find) {
+        matchLinesUnicode(data, size, maxMatches, shouldStop, matches);
+        return;
+    }
+
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    const qsizetype length = m_needle.size();
+    qsizetype pos = 0;
+    qsizetype lineFloor = 0;    // Start of the line pos is in, or earlier
+    qsizetype counted = 0;      // Newlines before this offset are in lineNumber
+    int lineNumber = 1;
+    int found = 0;
+
+    while (pos < size && found < maxMatches) {
+        if (shouldStop()) {
+            return;
+        }
+
+        // Slices overlap by the needle length so no match is cut in half.
+        // Whole-word checks look one character past the slice, theirs end at a line break.
+        const qsizetype sliceEnd = m_wholeWord ? lineSliceEnd(data, size, pos) : qMin(size, pos + SLICE_SIZE + length);
+        const qsizetype hit = m_find(*this, bytes, sliceEnd, pos);
+        if (hit < 0) {
+            if (sliceEnd == size) {
+                break;
+            }
+            pos = sliceEnd - length + 1;
+            continue;
+        }
+
+        const qsizetype lineEnd = appendLine(data, size, hit, length, lineFloor, counted, lineNumber, matches);
+        found++;
+        pos = lineEnd + 1;
+        lineFloor = pos;
+    }
+}
+
+void SearchPattern::matchLinesTerms(const char *data, qsizetype size, int maxMatches,
+                                    const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    const qsizetype length = m_automaton->maxTermLength();
+    qsizetype pos = 0;
+    qsizetype lineFloor = 0;
+    qsizetype counted = 0;
+    int lineNumber = 1;
+    int found = 0;
+
+    while (length > 0 && pos < size && found < maxMatches) {
+        if (shouldStop()) {
+            return;
+        }
+
+        // Same slicing as for a single needle, overlapping by the longest term
+        const qsizetype sliceEnd = m_wholeWord ? lineSliceEnd(data, size, pos) : qMin(size, pos + SLICE_SIZE + length);
+        AhoCorasick::Hit hit;
+        if (!findTerm(*m_automaton, m_wholeWord, bytes, sliceEnd, pos, hit)) {
+            if (sliceEnd == size) {
+                break;
+            }
+            pos = sliceEnd - length + 1;
+            continue;
+        }
+
+        const qsizetype lineEnd = appendLine(data, size, hit.start, hit.end - hit.start, lineFloor, counted, lineNumber, matches);
+        matches.last().term = hit.term;
+        found++;
+        pos = lineEnd + 1;
+        lineFloor = pos;
+    }
+}
+
+qsizetype SearchPattern::appendLine(const char *data, qsizetype size, qsizetype hit, qsizetype hitLength,
+                                    qsizetype lineFloor, qsizetype &counted, int &lineNumber, QList<ContentMatch> &matches)
+{
+    lineNumber += int(std::count(data + counted, data + hit, '\n'));
+    counted = hit;
+
+    qsizetype lineStart = hit;
+    while (lineStart > lineFloor && data[lineStart - 1] != '\n') {
+        --lineStart;
+    }
+    const char *newline = static_cast<const char *>(std::memchr(data + hit, '\n', size_t(size - hit)));
+    const qsizetype lineEnd = newline ? newline - data : size;
+
+    // Minified files have megabyte lines, only decode around the hit
+    qsizetype textStart = qMax(lineStart, hit - MAX_CONTEXT_BYTES);
+    qsizetype textEnd = qMin(lineEnd, hit + hitLength + MAX_CONTEXT_BYTES);
+    while (textStart < hit && (uchar(data[textStart]) & 0xc0) == 0x80) {
+        ++textStart;
+    }
+    while (textEnd < lineEnd && (uchar(data[textEnd]) & 0xc0) == 0x80) {
+        --textEnd;
+    }
+
+    matches.append({lineNumber, QString::fromUtf8(data + textStart, textEnd - textStart),
+                    utf16Length(data + textStart, hit - textStart)});
+    return lineEnd;
+}
+
+qsizetype SearchPattern::lineSliceEnd(const char *data, qsizetype size, qsizetype pos, qsizetype sliceSize)
+{
+    if (size - pos <= sliceSize) {
+        return size;
+    }
+    const char *newline = static_cast<const char *>(std::memchr(data + pos + sliceSize, '\n', size_t(size - pos - sliceSize)));
+    return newline ? newline - data : size;
+}
+
+void SearchPattern::matchLinesUnicode(const char *data, qsizetype size, int maxMatches,
+                                      const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const
+{
+    // Decoded a slice of whole lines at a time, instead of the whole file at once
+    qsizetype sliceStart = 0;
+    int lineNumber = 1;
+    int found = 0;
+
+    while (sliceStart < size && found < maxMatches) {
+        if (shouldStop()) {
+            return;
+        }
+
+        const qsizetype sliceEnd = lineSliceEnd(data, size, sliceStart);
+        const QString text = QString::fromUtf8(data + sliceStart, sliceEnd - sliceStart);
+        qsizetype pos = 0;
+        qsizetype counted = 0;
+
+        while (found < maxMatches) {
+            const qsizetype hit = findText(text, pos);
+            if (hit < 0) {
+                break;
+            }
+
+            lineNumber += int(std::count(text.constData() + counted, text.constData() + hit, QChar('\n')));
+            counted = hit;
+
+            const qsizetype lineStart = text.lastIndexOf('\n', hit) + 1;
+            qsizetype lineEnd = text.indexOf('\n', hit);
+            if (lineEnd < 0) {
+                lineEnd = text.size();
+            }
+
+            matches.append({lineNumber, text.mid(lineStart, lineEnd - lineStart), int(hit - lineStart)});
+            found++;
+            pos = lineEnd + 1;
+        }
+
+        // The rest of the slice's lines, and the line break it ends at
+        lineNumber += int(std::count(text.constData() + counted, text.constData() + text.size(), QChar('\n'))) + 1;
+        sliceStart = sliceEnd + 1;
+    }
+}
+
+
+
+PatternMatcher::PatternMatcher(std::shared_ptr<const SearchPattern> pattern)
+    : m_pattern(std::move(pattern))
+{
+    if (m_pattern->m_program) {
+        // Globs name whole files, regexes may match any part of a name
+        m_nameDfa.reset(new LazyDfa(m_pattern->m_program, m_pattern->m_syntax == SearchPattern::Glob));
+        m_lineDfa.reset(new LazyDfa(m_pattern->m_program, false));
+    }
+}
+
+PatternMatcher::~PatternMatcher() = default;
+
+const SearchPattern &PatternMatcher::pattern() const
+{
+    return *m_pattern;
+}
+
+bool PatternMatcher::matchesName(const char *name, qsizetype length, int *term)
+{
+    if (!m_pattern->usesDfa()) {
+        return m_pattern->matchesName(name, length, term);
+    }
+    return m_nameDfa && m_nameDfa->matches(reinterpret_cast<const uchar *>(name), length);
+}
+
+bool PatternMatcher::matchesName(const QString &name, int *term)
+{
+    if (!m_pattern->usesDfa()) {
+        return m_pattern->matchesName(name, term);
+    }
+    const QByteArray bytes = name.toUtf8();
+    return matchesName(bytes.constData(), bytes.size());
+}
+
+void PatternMatcher::matchLines(const char *data, qsizetype size, int maxMatches,
+                                const std::function<bool()> &shouldStop, QList<ContentMatch> &matches)
+{
+    if (!m_pattern->usesDfa()) {
+        m_pattern->matchLines(data, size, maxMatches, shouldStop, matches);
+    } else if (m_lineDfa) {
+        matchLinesDfa(data, size, maxMatches, shouldStop, matches);
+    }
+}
+
+void PatternMatcher::matchLinesDfa(const char *data, qsizetype size, int maxMatches,
+                                   const std::function<bool()> &shouldStop, QList<ContentMatch> &matches)
+{
+    // A final line break does not start another, empty line
+    const bool hasLines = size > 0;
+    if (hasLines && data[size - 1] == '\n') {
+        size--;
+    }
+
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    const SearchPattern *prefilter = m_pattern->m_prefilter.get();
+    qsizetype pos = 0;          // Always a line start unless the prefilter skipped ahead
+    qsizetype lineFloor = 0;
+    qsizetype counted = 0;
+    int lineNumber = 1;
+    int found = 0;
+
+    while (hasLines && pos <= size && found < maxMatches) {
+        if (shouldStop()) {
+            return;
+        }
+
+        qsizetype from = pos;
+        qsizetype to;
+        if (prefilter) {
+            // Only lines holding the required literal can match, the DFA sees just those
+            const qsizetype length = prefilter->m_needle.size();
+            const qsizetype sliceEnd = qMin(size, pos + SearchPattern::SLICE_SIZE + length);
+            const qsizetype hit = prefilter->find(data, sliceEnd, pos);
+            if (hit < 0) {
+                if (sliceEnd == size) {
+                    break;
+                }
+                pos = sliceEnd - length + 1;
+                continue;
+            }
+            from = hit;
+            while (from > lineFloor && data[from - 1] != '\n') {
+                --from;
+            }
+            const char *newline = static_cast<const char *>(std::memchr(data + hit, '\n', size_t(size - hit)));
+            to = newline ? newline - data : size;
+        } else {
+            // Slices end at a line break, which the DFA treats like the end of the data
+            const qsizetype sliceEnd = qMin(size, pos + SearchPattern::SLICE_SIZE);
+            const char *newline = static_cast<const char *>(std::memchr(data + sliceEnd, '\n', size_t(size - sliceEnd)));
+            to = newline ? newline - data : size;
+        }
+
+        // Every byte reaches the DFA at most once, matching stays linear
+        const qsizetype end = m_lineDfa->find(bytes + from, to - from);
+        if (end < 0) {
+            pos = to + 1;
+            lineFloor = pos;
+            continue;
+        }
+
+        const qsizetype lineEnd = SearchPattern::appendLine(data, size, from + end, 0, lineFloor, counted, lineNumber, matches);
+        found++;
+        pos = lineEnd + 1;
+        lineFloor = pos;
+    }
+}
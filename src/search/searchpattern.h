@@ -0,0 +1,176 @@
+#ifndef SEARCHPATTERN_H
+#define SEARCHPATTERN_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+#include <functional>
+#include <memory>
+
+class RegexProgram;
+class LazyDfa;
+class AhoCorasick;
+
+struct ContentMatch
+{
+    int lineNumber;
+    QString line;       // Matching line, decoded, clipped around the hit if very long
+    int column;         // Position of the hit in line, of its end for regexes and globs
+    int term = -1;      // Index of the matching term for the Terms syntax
+};
+
+
+
+// A search text compiled once per search and shared read-only by every
+// worker, for file names and file contents alike. Matching runs on raw
+// UTF-8 bytes with a kernel picked at compile time:
+//  - case-sensitive: bytes compared as they are
+//  - ASCII case-folded: needles whose letters are all ASCII
+//  - Unicode case-folded: needles with non-ASCII letters, matched on decoded text.
+//    Folding is one character to one, so "ß" does not match "ss".
+// each with or without the whole-word check.
+// Candidates are found by scanning for the two rarest bytes of the needle
+// at their relative offsets (16 or 32 bytes at a time with SSE2/AVX2).
+//
+// Regexes and globs compile to a RegexProgram instead, run by a lazy DFA
+// per thread (see PatternMatcher). A literal every match must contain is
+// searched for first with the kernels above, only lines holding it reach
+// the DFA.
+//
+// A list of terms compiles to an Aho-Corasick automaton matching all of
+// them in one pass. Case-insensitive terms fold ASCII letters, others match
+// in their original, lower and upper case forms.
+class SearchPattern
+{
+public:
+    enum Kernel
+    {
+        CaseSensitive,
+        AsciiFolded,
+        UnicodeFolded,
+    };
+
+    enum Syntax
+    {
+        Literal,
+        Regex,
+        Glob,           // Matches whole file names, any part of a line in contents
+        Terms,          // Any of a list of literal terms
+    };
+
+    SearchPattern(const QString &text, Qt::CaseSensitivity caseSensitivity, bool wholeWord, Syntax syntax = Literal);
+    SearchPattern(const QStringList &terms, Qt::CaseSensitivity caseSensitivity, bool wholeWord);
+
+    const QString &text() const;
+    const QStringList &terms() const;
+    Kernel kernel() const;
+    bool wholeWord() const;
+    Syntax syntax() const;
+
+    // Regexes and globs can fail to compile
+    bool isValid() const;
+    const QString &errorString() const;
+
+    // Literals one of which every match contains, for the trigram indexes. Empty if there are none.
+    QStringList requiredLiterals() const;
+
+    // The functions below match Literal and Terms patterns only, PatternMatcher handles every syntax
+
+    // Offset of the first match starting at or after from, or -1
+    qsizetype find(const char *data, qsizetype size, qsizetype from) const;
+
+    // For file names straight from the directory entry. term is set to the matching term for Terms.
+    bool matchesName(const char *name, qsizetype length, int *term = nullptr) const;
+    bool matchesName(const QString &name, int *term = nullptr) const;
+
+    // Collects up to maxMatches matching lines, at most one match per line
+    void matchLines(const char *data, qsizetype size, int maxMatches,
+                    const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const;
+
+private:
+    friend class PatternMatcher;
+    using FindFunction = qsizetype (*)(const SearchPattern &, const uchar *, qsizetype, qsizetype);
+
+    template <typename Fold, bool WholeWord>
+    static qsizetype findBytes(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from);
+    template <typename Fold, bool WholeWord>
+    static qsizetype scanScalar(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from);
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+    template <typename Fold, bool WholeWord>
+    static qsizetype scanSse2(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from);
+    template <typename Fold, bool WholeWord>
+    static qsizetype scanAvx2(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype from);
+#endif
+    template <typename Fold, bool WholeWord>
+    static bool accept(const SearchPattern &pattern, const uchar *data, qsizetype size, qsizetype pos);
+    template <bool WholeWord>
+    static qsizetype findUnicode(const SearchPattern &pattern, const QString &text, qsizetype from);
+
+    bool usesDfa() const;
+    qsizetype findText(const QString &text, qsizetype from) const;
+    void matchLinesTerms(const char *data, qsizetype size, int maxMatches,
+                         const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const;
+    void matchLinesUnicode(const char *data, qsizetype size, int maxMatches,
+                           const std::function<bool()> &shouldStop, QList<ContentMatch> &matches) const;
+    // End of a slice starting at pos that ends at a line break, so the characters around a hit are all in it
+    static qsizetype lineSliceEnd(const char *data, qsizetype size, qsizetype pos, qsizetype sliceSize = SLICE_SIZE);
+
+    // Appends the line holding a hit and returns where that line ends
+    static qsizetype appendLine(const char *data, qsizetype size, qsizetype hit, qsizetype hitLength,
+                                qsizetype lineFloor, qsizetype &counted, int &lineNumber, QList<ContentMatch> &matches);
+
+    // Files are searched in slices so cancellation is noticed in large files
+    static constexpr qsizetype SLICE_SIZE = 4 * 1024 * 1024;
+    // First slice decoded by find() on the Unicode kernel, doubled up to SLICE_SIZE while nothing is found
+    static constexpr qsizetype FIRST_FIND_SLICE = 4096;
+    // Bytes of a matching line kept on either side of the hit
+    static constexpr qsizetype MAX_CONTEXT_BYTES = 1024;
+    // Shorter required literals are too common to be worth searching for first
+    static constexpr qsizetype MIN_PREFILTER_BYTES = 2;
+
+    QString m_text;
+    QStringList m_terms;
+    Kernel m_kernel;
+    bool m_wholeWord;
+    Syntax m_syntax;
+    QString m_errorString;
+    std::shared_ptr<const RegexProgram> m_program;
+    std::shared_ptr<const SearchPattern> m_prefilter;   // Required literal of a regex or glob
+    std::shared_ptr<const AhoCorasick> m_automaton;     // Terms only
+    FindFunction m_find;
+    QByteArray m_needle;        // UTF-8, ASCII letters lower-cased unless case-sensitive
+    qsizetype m_offset1;        // Offsets of the two rarest needle bytes
+    qsizetype m_offset2;
+    uchar m_rare1[2];           // Both cases of each rare byte
+    uchar m_rare2[2];
+};
+
+
+
+// Matches a shared SearchPattern from one thread. Regexes and globs keep
+// the DFA states built so far here, literal patterns need no state.
+class PatternMatcher
+{
+public:
+    explicit PatternMatcher(std::shared_ptr<const SearchPattern> pattern);
+    ~PatternMatcher();
+
+    const SearchPattern &pattern() const;
+
+    bool matchesName(const char *name, qsizetype length, int *term = nullptr);
+    bool matchesName(const QString &name, int *term = nullptr);
+
+    void matchLines(const char *data, qsizetype size, int maxMatches,
+                    const std::function<bool()> &shouldStop, QList<ContentMatch> &matches);
+
+private:
+    void matchLinesDfa(const char *data, qsizetype size, int maxMatches,
+                       const std::function<bool()> &shouldStop, QList<ContentMatch> &matches);
+
+    std::shared_ptr<const SearchPattern> m_pattern;
+    std::unique_ptr<LazyDfa> m_nameDfa;
+    std::unique_ptr<LazyDfa> m_lineDfa;
+};
+
+#endif // SEARCHPATTERN_H
@@ -0,0 +1,607 @@
+#include "searchpipeline.h"
+#include "searchmanager.h"
+#include <QElapsedTimer>
+#include <QFileInfo>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+void FileContents::close()
+{
+    file.reset();
+}
+
+SearchPipeline::Device::Device(quint64 id, int maxReaders)
+    : id(id)
+    , name(SearchPipeline::deviceName(id))
+    , rotational(SearchPipeline::isRotational(id))
+    , tuner(rotational ? 1 : INITIAL_READERS, 1, maxReaders)
+{
+}
+
+SearchPipeline::SearchPipeline(SearchManager *manager, int readThreads, int matchThreads)
+    : m_manager(manager)
+    , m_generation(0)
+    , m_readOrder(Auto)
+    , m_quit(false)
+    , m_lastDevice(nullptr)
+    , m_nextDevice(0)
+    , m_queuedFiles(0)
+    , m_bytesInFlight(0)
+    , m_matchTuner(matchThreads, 1, matchThreads)
+{
+    for (int i = 0; i < qMax(1, readThreads); ++i) {
+        std::unique_ptr<StageThread> reader(new StageThread);
+        reader->thread = QThread::create([this, i]() { readLoop(i); });
+        reader->thread->setObjectName(QString("Read %1").arg(i));
+        m_readers.push_back(std::move(reader));
+    }
+    for (int i = 0; i < qMax(1, matchThreads); ++i) {
+        std::unique_ptr<StageThread> matcher(new StageThread);
+        matcher->thread = QThread::create([this, i]() { matchLoop(i); });
+        matcher->thread->setObjectName(QString("Match %1").arg(i));
+        m_matchers.push_back(std::move(matcher));
+    }
+
+    // Threads start once every slot exists
+    for (const std::unique_ptr<StageThread> &reader : m_readers) {
+        reader->thread->start();
+    }
+    for (const std::unique_ptr<StageThread> &matcher : m_matchers) {
+        matcher->thread->start();
+    }
+}
+
+SearchPipeline::~SearchPipeline()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_quit = true;
+        dropQueued();
+        m_readable.wakeAll();
+        m_matchable.wakeAll();
+        m_room.wakeAll();
+    }
+
+    for (const std::unique_ptr<StageThread> &reader : m_readers) {
+        reader->thread->wait();
+        delete reader->thread;
+    }
+    for (const std::unique_ptr<StageThread> &matcher : m_matchers) {
+        matcher->thread->wait();
+        delete matcher->thread;
+    }
+}
+
+void SearchPipeline::begin(int generation, ReadOrder readOrder, const WorkerFactory &createWorker)
+{
+    // Built here, threads pick them up with the first file of the search
+    std::vector<std::unique_ptr<DirectorySearchWorker>> workers;
+    for (size_t i = 0; i < m_readers.size() + m_matchers.size(); ++i) {
+        workers.push_back(createWorker());
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_generation = generation;
+    m_readOrder = readOrder;
+    dropQueued();
+    size_t next = 0;
+    for (const std::unique_ptr<StageThread> &reader : m_readers) {
+        reader->next = std::move(workers[next++]);
+    }
+    for (const std::unique_ptr<StageThread> &matcher : m_matchers) {
+        matcher->next = std::move(workers[next++]);
+    }
+    m_room.wakeAll();
+}
+
+void SearchPipeline::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    dropQueued();
+    m_room.wakeAll();
+}
+
+void SearchPipeline::dropQueued()
+{
+    // Files of cancelled searches are never read, nobody counts them anymore
+    for (const std::unique_ptr<Device> &device : m_devices) {
+        device->queue.clear();
+    }
+    m_queuedFiles = 0;
+    for (FileContents &contents : m_matchQueue) {
+        m_bytesInFlight -= contents.metadata.size;
+        contents.close();
+    }
+    m_matchQueue.clear();
+}
+
+void SearchPipeline::submit(int generation, const QString &path, const DirScanner::Metadata &metadata)
+{
+    SearchTrace::waitForLock(m_mutex, "lock pipeline");
+    QMutexLocker locker(&m_mutex);
+    while (m_queuedFiles >= MAX_QUEUED_FILES) {
+        if (m_quit || m_manager->shouldStop(generation)) {
+            return;
+        }
+        SearchTrace::Span span("backpressure");
+        m_room.wait(&m_mutex, 50);      // Also notices a cancelled search
+    }
+    if (generation != m_generation) {
+        return;
+    }
+
+    device(metadata.device)->queue.push_back({generation, path, metadata});
+    m_queuedFiles++;
+    m_readable.wakeOne();
+}
+
+SearchPipeline::Device *SearchPipeline::device(quint64 id)
+{
+    // Files arrive directory by directory, almost always from the last device
+    if (m_lastDevice && m_lastDevice->id == id) {
+        return m_lastDevice;
+    }
+    for (const std::unique_ptr<Device> &device : m_devices) {
+        if (device->id == id) {
+            m_lastDevice = device.get();
+            return m_lastDevice;
+        }
+    }
+    m_devices.emplace_back(new Device(id, int(m_readers.size())));
+    m_lastDevice = m_devices.back().get();
+    return m_lastDevice;
+}
+
+SearchPipeline::Device *SearchPipeline::readableDevice()
+{
+    // Round robin over devices with queued files and a free read slot
+    for (size_t i = 0; i < m_devices.size(); ++i) {
+        Device *device = m_devices[(m_nextDevice + i) % m_devices.size()].get();
+        if (device->queue.empty() || device->inFlight >= device->tuner.limit()) {
+            continue;
+        }
+
+        // A file larger than the whole budget still gets read, on its own
+        const qint64 size = device->queue.front().metadata.size;
+        if (m_bytesInFlight > 0 && m_bytesInFlight + size > MAX_BYTES_IN_FLIGHT) {
+            return nullptr;
+        }
+        m_nextDevice = (m_nextDevice + i + 1) % m_devices.size();
+        return device;
+    }
+    return nullptr;
+}
+
+bool SearchPipeline::readsSorted(const Device &device) const
+{
+    return m_readOrder == Physical || (m_readOrder == Auto && device.rotational);
+}
+
+void SearchPipeline::sortByLocation(std::vector<FileRead> &reads)
+{
+    // Files with a known first extent go by it, the rest by inode after them; inodes
+    // are allocated close to their data on most file systems
+    struct Location
+    {
+        bool unknown;
+        quint64 offset;
+        size_t index;
+        bool operator<(const Location &other) const
+        {
+            return unknown != other.unknown ? other.unknown : offset < other.offset;
+        }
+    };
+    std::vector<Location> locations;
+    locations.reserve(reads.size());
+    for (size_t i = 0; i < reads.size(); ++i) {
+        bool known = false;
+        const quint64 offset = physicalOffset(reads[i].path, &known);
+        locations.push_back({!known, known ? offset : reads[i].metadata.inode, i});
+    }
+    std::sort(locations.begin(), locations.end());
+
+    std::vector<FileRead> sorted;
+    sorted.reserve(reads.size());
+    for (const Location &location : locations) {
+        sorted.push_back(std::move(reads[location.index]));
+    }
+    reads.swap(sorted);
+}
+
+quint64 SearchPipeline::physicalOffset(const QString &path, bool *known)
+{
+    *known = false;
+#ifdef Q_OS_LINUX
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    // Only the first extent is asked for, without syncing delayed allocations
+    struct
+    {
+        fiemap map;
+        fiemap_extent extent;
+    } request = {};
+    request.map.fm_start = 0;
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    quint64 offset = 0;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0
+        && !(request.map.fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)) {
+        offset = request.map.fm_extents[0].fe_physical;
+        *known = true;
+    }
+    ::close(fd);
+    return offset;
+#else
+    Q_UNUSED(path);
+    return 0;
+#endif
+}
+
+bool SearchPipeline::adoptWorker(StageThread &thread, int generation)
+{
+    if (generation != m_generation) {
+        return false;
+    }
+    if (!thread.worker || thread.worker->generation() != generation) {
+        if (!thread.next || thread.next->generation() != generation) {
+            return false;
+        }
+        thread.worker = std::move(thread.next);
+    }
+    return true;
+}
+
+void SearchPipeline::recycle(QByteArray &buffer)
+{
+    if (!buffer.isEmpty() && buffer.size() <= MAX_SPARE_BUFFER_SIZE && int(m_spareBuffers.size()) < MAX_SPARE_BUFFERS) {
+        m_spareBuffers.push_back(std::move(buffer));
+    }
+    buffer = QByteArray();
+}
+
+void SearchPipeline::readLoop(int index)
+{
+    StageThread &self = *m_readers[index];
+    UringReader uring(URING_ENTRIES);   // One ring per thread, without one files are read one by one
+    std::vector<FileRead> reads;
+    std::vector<FileContents> contents;
+    std::vector<bool> loaded;
+
+    QMutexLocker locker(&m_mutex);
+    for (;;) {
+        Device *device = nullptr;
+        while (!m_quit && !(device = readableDevice())) {
+            SearchTrace::Span span("idle");
+            m_readable.wait(&m_mutex);
+        }
+        if (m_quit) {
+            break;
+        }
+
+        if (readsSorted(*device)) {
+            readSweep(self, *device, locker);
+            continue;
+        }
+
+        // A batch takes as many of the device's free read slots as the ring holds.
+        // Bytes are budgeted from the stat'ed size until the file is matched.
+        const int batch = uring.isValid() ? uring.batchSize() : 1;
+        reads.clear();
+        do {
+            reads.push_back(std::move(device->queue.front()));
+            device->queue.pop_front();
+            m_queuedFiles--;
+            device->inFlight++;
+            m_bytesInFlight += reads.back().metadata.size;
+        } while (int(reads.size()) < batch && !device->queue.empty() && device->inFlight < device->tuner.limit()
+                 && m_bytesInFlight + device->queue.front().metadata.size <= MAX_BYTES_IN_FLIGHT);
+        m_room.wakeAll();
+
+        contents.clear();
+        contents.resize(reads.size());
+        for (FileContents &file : contents) {
+            if (m_spareBuffers.empty()) {
+                break;
+            }
+            file.buffer = std::move(m_spareBuffers.back());
+            m_spareBuffers.pop_back();
+        }
+        const int generation = reads.front().generation;
+        const bool current = adoptWorker(self, generation);
+        locker.unlock();
+
+        QElapsedTimer timer;
+        timer.start();
+        loaded.assign(reads.size(), false);
+        if (current) {
+            readFiles(*self.worker, uring, reads, contents, loaded);
+        }
+        const qint64 latencyNs = timer.nsecsElapsed();
+
+        SearchTrace::waitForLock(m_mutex, "lock pipeline");
+        locker.relock();
+        device->inFlight -= int(reads.size());
+
+        // Every file of a batch waited for all of it
+        int operations = 0;
+        qint64 units = 0;
+        for (const FileContents &file : contents) {
+            if (file.size > 0) {
+                operations++;
+                units += file.size + FILE_COST_BYTES;
+            }
+        }
+        if (operations > 0 && device->tuner.record(operations, units, latencyNs * operations)) {
+            m_readable.wakeAll();
+        }
+
+        int finished = 0;
+        for (size_t i = 0; i < reads.size(); ++i) {
+            if (loaded[i] && reads[i].generation == m_generation) {
+                m_matchQueue.push_back(std::move(contents[i]));
+                m_matchable.wakeOne();
+                continue;
+            }
+
+            // Skipped or unreadable, nothing left to match
+            m_bytesInFlight -= reads[i].metadata.size;
+            recycle(contents[i].buffer);
+            contents[i].close();
+            if (current && reads[i].generation == generation) {
+                finished++;
+            }
+        }
+        m_readable.wakeAll();
+        if (finished > 0) {
+            locker.unlock();
+            m_manager->workerFinished(generation, finished);
+            SearchTrace::waitForLock(m_mutex, "lock pipeline");
+            locker.relock();
+        }
+    }
+}
+
+void SearchPipeline::readSweep(StageThread &self, Device &device, QMutexLocker<QMutex> &locker)
+{
+    // One sweep takes a read slot and as many queued files as the byte budget allows
+    std::vector<FileRead> reads;
+    do {
+        reads.push_back(std::move(device.queue.front()));
+        device.queue.pop_front();
+        m_queuedFiles--;
+        m_bytesInFlight += reads.back().metadata.size;
+    } while (int(reads.size()) < SORT_BATCH && !device.queue.empty()
+             && m_bytesInFlight + device.queue.front().metadata.size <= MAX_BYTES_IN_FLIGHT);
+    device.inFlight++;
+    m_room.wakeAll();
+    const int generation = reads.front().generation;
+    const bool current = adoptWorker(self, generation);
+    locker.unlock();
+
+    if (current) {
+        sortByLocation(reads);
+    }
+
+    // Files go to the matchers one by one, as the heads pass them
+    for (const FileRead &read : reads) {
+        FileContents contents;
+        QElapsedTimer timer;
+        timer.start();
+        const bool loaded = current && !m_manager->shouldStop(generation)
+                            && self.worker->readFile(read.path, read.metadata, contents);
+        const qint64 latencyNs = timer.nsecsElapsed();
+
+        SearchTrace::waitForLock(m_mutex, "lock pipeline");
+        locker.relock();
+        if (contents.size > 0 && device.tuner.record(1, contents.size + FILE_COST_BYTES, latencyNs)) {
+            m_readable.wakeAll();
+        }
+        if (loaded && read.generation == m_generation) {
+            m_matchQueue.push_back(std::move(contents));
+            m_matchable.wakeOne();
+            locker.unlock();
+            continue;
+        }
+        m_bytesInFlight -= read.metadata.size;
+        recycle(contents.buffer);
+        contents.close();
+        m_readable.wakeOne();
+        locker.unlock();
+        if (current) {
+            m_manager->workerFinished(generation);
+        }
+    }
+
+    SearchTrace::waitForLock(m_mutex, "lock pipeline");
+    locker.relock();
+    device.inFlight--;
+    m_readable.wakeAll();
+}
+
+void SearchPipeline::readFiles(DirectorySearchWorker &worker, UringReader &uring, const std::vector<FileRead> &reads,
+                               std::vector<FileContents> &contents, std::vector<bool> &loaded)
+{
+    // Small files go through the ring together, large ones and everything without a ring the blocking way
+    std::vector<UringReader::Request> requests;
+    std::vector<size_t> requested;
+    for (size_t i = 0; i < reads.size(); ++i) {
+        const FileRead &read = reads[i];
+        if (!uring.isValid() || read.metadata.size > URING_MAX_SIZE) {
+            loaded[i] = worker.readFile(read.path, read.metadata, contents[i]);
+            continue;
+        }
+        if (!worker.prepareRead(read.path, read.metadata, contents[i])) {
+            continue;
+        }
+
+        UringReader::Request request;
+        request.path = QFile::encodeName(read.path);
+        request.maxSize = qMax<qint64>(read.metadata.size, 4096);   // Like readFile(), a file that grew is cut there
+        request.buffer = std::move(contents[i].buffer);
+        requests.push_back(std::move(request));
+        requested.push_back(i);
+    }
+    if (requests.empty()) {
+        return;
+    }
+
+    // Every file waits for the whole batch, so the batch is what gets timed, not its files
+    SearchTrace::Span span("read batch", "files", qint64(requests.size()));
+    QElapsedTimer timer;
+    timer.start();
+    uring.read(requests);
+    const qint64 latencyNs = timer.nsecsElapsed();
+    qint64 bytes = 0;
+    for (size_t k = 0; k < requests.size(); ++k) {
+        const size_t i = requested[k];
+        UringReader::Request &request = requests[k];
+        contents[i].buffer = std::move(request.buffer);
+        if (!request.answered) {
+            // The ring broke down halfway, the rest is read the blocking way
+            loaded[i] = worker.readFile(reads[i].path, reads[i].metadata, contents[i]);
+        } else if (request.size > 0) {
+            bytes += request.size;
+            contents[i].size = request.size;
+            loaded[i] = worker.finishRead(contents[i]);
+        }
+    }
+    m_manager->stats().record(worker.generation(), SearchStats::ReadBatch, latencyNs, bytes);
+}
+
+void SearchPipeline::matchLoop(int index)
+{
+    StageThread &self = *m_matchers[index];
+    QList<SearchResult> results;
+    int finished = 0;
+    int batchGeneration = 0;
+
+    QMutexLocker locker(&m_mutex);
+    for (;;) {
+        // Matchers beyond the tuned count wait, like all of them when there is nothing to match
+        while (!m_quit && (m_matchQueue.empty() || index >= m_matchTuner.limit())) {
+            if (finished > 0) {
+                // Results reach the search before their files count as done, and before sleeping
+                locker.unlock();
+                flush(batchGeneration, results, finished);
+                SearchTrace::waitForLock(m_mutex, "lock pipeline");
+                locker.relock();
+                continue;
+            }
+            SearchTrace::Span span("idle");
+            m_matchable.wait(&m_mutex);
+        }
+        if (m_quit) {
+            break;
+        }
+
+        FileContents contents = std::move(m_matchQueue.front());
+        m_matchQueue.pop_front();
+        const bool current = adoptWorker(self, contents.generation);
+        locker.unlock();
+
+        if (contents.generation != batchGeneration) {
+            flush(batchGeneration, results, finished);
+            batchGeneration = contents.generation;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        if (current) {
+            self.worker->matchFile(contents, results);
+        }
+        contents.close();
+        const qint64 latencyNs = timer.nsecsElapsed();
+        if (current) {
+            finished++;
+        }
+        if (results.size() >= RESULT_BATCH_SIZE) {
+            flush(batchGeneration, results, finished);
+        }
+
+        SearchTrace::waitForLock(m_mutex, "lock pipeline");
+        locker.relock();
+        m_bytesInFlight -= contents.metadata.size;
+        recycle(contents.buffer);
+        m_readable.wakeOne();
+        if (current && m_matchTuner.record(1, contents.size + FILE_COST_BYTES, latencyNs)) {
+            m_matchable.wakeAll();
+        }
+    }
+}
+
+void SearchPipeline::flush(int generation, QList<SearchResult> &results, int &finished)
+{
+    if (!results.isEmpty()) {
+        m_manager->reportResults(generation, results);
+        results.clear();
+    }
+    if (finished > 0) {
+        m_manager->workerFinished(generation, finished);
+        finished = 0;
+    }
+}
+
+int SearchPipeline::matchThreads() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_matchTuner.limit();
+}
+
+QList<DeviceStage> SearchPipeline::deviceStages() const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<DeviceStage> stages;
+    for (const std::unique_ptr<Device> &device : m_devices) {
+        DeviceStage stage;
+        stage.device = device->id;
+        stage.name = device->name;
+        stage.readers = device->tuner.limit();
+        stage.sorted = readsSorted(*device);
+        stage.latencyUs = device->tuner.meanLatencyNs() / 1000;
+        stage.bytesPerSecond = device->tuner.unitsPerSecond();
+        stages.append(stage);
+    }
+    return stages;
+}
+
+bool SearchPipeline::isRotational(quint64 device)
+{
+#ifdef Q_OS_LINUX
+    // Partitions have no queue of their own, their disk is one level up
+    const QString base = QString("/sys/dev/block/%1:%2/").arg(major(dev_t(device))).arg(minor(dev_t(device)));
+    for (const QString &path : {base + "queue/rotational", base + "../queue/rotational"}) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            return file.readAll().trimmed() == "1";
+        }
+    }
+    return false;
+#else
+    Q_UNUSED(device);
+    return false;
+#endif
+}
+
+QString SearchPipeline::deviceName(quint64 device)
+{
+#ifdef Q_OS_LINUX
+    // /sys/dev/block/8:1 links to .../block/sda/sda1
+    const QString id = QString("%1:%2").arg(major(dev_t(device))).arg(minor(dev_t(device)));
+    const QString target = QFileInfo(QString("/sys/dev/block/") + id).symLinkTarget();
+    return target.isEmpty() ? id : QFileInfo(target).fileName();
+#else
+    return QString::number(device);
+#endif
+}
@@ -0,0 +1,193 @@
+#ifndef SEARCHPIPELINE_H
+#define SEARCHPIPELINE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "concurrencytuner.h"
+#include "dirscanner.h"
+#include "filesniffer.h"
+#include "uringreader.h"
+
+class SearchManager;
+class DirectorySearchWorker;
+struct SearchResult;
+
+// A file read by the read stage, waiting to be matched
+struct FileContents
+{
+    int generation = 0;
+    QString path;
+    DirScanner::Metadata metadata = {};
+    FileSniffer::Encoding encoding = FileSniffer::Unknown;
+    QByteArray buffer;              // Read files, size bytes of it are valid
+    std::unique_ptr<QFile> file;    // Only open while it is being read
+    qint64 size = 0;
+
+    const char *data() const { return buffer.constData(); }
+    void close();
+};
+
+
+
+// What the stages of a search run with, for showing in the UI
+struct DeviceStage
+{
+    quint64 device = 0;
+    QString name;
+    int readers = 0;
+    bool sorted = false;            // Read in physical order
+    qint64 latencyUs = 0;
+    double bytesPerSecond = 0;
+
+    bool operator==(const DeviceStage &other) const
+    {
+        return device == other.device && readers == other.readers && sorted == other.sorted;
+    }
+};
+
+struct SearchStages
+{
+    int traversalThreads = 0;
+    int matchThreads = 0;
+    QList<DeviceStage> devices;
+
+    bool operator==(const SearchStages &other) const
+    {
+        return traversalThreads == other.traversalThreads && matchThreads == other.matchThreads
+               && devices == other.devices;
+    }
+    bool operator!=(const SearchStages &other) const { return !(*this == other); }
+};
+
+
+
+// The read and match stages of a FileContent walk. Traversal threads only
+// list directories and submit the files worth reading. Readers queue them
+// per block device and keep as many reads in flight on each as its tuner
+// allows, so an NVMe drive gets deep queues and a disk with heads gets few.
+// Where io_uring is available a reader submits a whole batch of small
+// files at once, so one slow file does not hold up a thread. Disks with
+// heads instead get sweeps: a batch of queued files sorted by where they
+// lie on the disk, read one after the other. Matchers take
+// the read files and search them, as many at once as pays off on the CPU.
+// What was learned about a device is kept across searches.
+class SearchPipeline
+{
+public:
+    using WorkerFactory = std::function<std::unique_ptr<DirectorySearchWorker>()>;
+
+    // Order the files queued for one device are read in
+    enum ReadOrder
+    {
+        Auto,           // Physical on rotational devices, discovery elsewhere
+        Discovery,      // As the walk finds them
+        Physical,       // In batches sorted by first extent (FIEMAP), or inode where that is unknown
+    };
+
+    SearchPipeline(SearchManager *manager, int readThreads, int matchThreads);
+    ~SearchPipeline();
+
+    // GUI thread, before files of generation are submitted. Workers come
+    // from createWorker, one per thread. Files of other searches are dropped.
+    void begin(int generation, ReadOrder readOrder, const WorkerFactory &createWorker);
+    void clear();
+
+    // Traversal threads, each file counted as a search worker already.
+    // Waits while too many files are queued, unless the search stops.
+    void submit(int generation, const QString &path, const DirScanner::Metadata &metadata);
+
+    int matchThreads() const;
+    QList<DeviceStage> deviceStages() const;
+
+    // Kernel name of the block device, "nvme0n1p2" or "8:1" when unknown
+    static QString deviceName(quint64 device);
+    // Whether the disk behind device has heads to move, per /sys/block/*/queue/rotational
+    static bool isRotational(quint64 device);
+
+private:
+    struct FileRead
+    {
+        int generation;
+        QString path;
+        DirScanner::Metadata metadata;
+    };
+
+    struct Device
+    {
+        Device(quint64 id, int maxReaders);
+
+        quint64 id;
+        QString name;
+        bool rotational;
+        std::deque<FileRead> queue;
+        int inFlight = 0;
+        ConcurrencyTuner tuner;
+    };
+
+    struct StageThread
+    {
+        QThread *thread = nullptr;
+        std::unique_ptr<DirectorySearchWorker> worker;
+        std::unique_ptr<DirectorySearchWorker> next;   // For the search that begins
+    };
+
+    void readLoop(int index);
+    void readSweep(StageThread &self, Device &device, QMutexLocker<QMutex> &locker);
+    void readFiles(DirectorySearchWorker &worker, UringReader &uring, const std::vector<FileRead> &reads,
+                   std::vector<FileContents> &contents, std::vector<bool> &loaded);
+    void matchLoop(int index);
+    Device *device(quint64 id);
+    Device *readableDevice();
+    bool readsSorted(const Device &device) const;
+    static void sortByLocation(std::vector<FileRead> &reads);
+    static quint64 physicalOffset(const QString &path, bool *known);
+    bool adoptWorker(StageThread &thread, int generation);
+    void recycle(QByteArray &buffer);
+    void flush(int generation, QList<SearchResult> &results, int &finished);
+    void dropQueued();
+
+    static constexpr int MAX_QUEUED_FILES = 4096;
+    static constexpr qint64 MAX_BYTES_IN_FLIGHT = 64 * 1024 * 1024;    // Read but not matched yet
+    static constexpr int MAX_SPARE_BUFFERS = 64;
+    static constexpr qsizetype MAX_SPARE_BUFFER_SIZE = 1024 * 1024;  // Larger ones are freed
+    static constexpr qint64 FILE_COST_BYTES = 4096;    // A file costs a block however small
+    static constexpr int INITIAL_READERS = 4;
+    static constexpr int SORT_BATCH = 256;          // Files sorted and read in one sweep
+    static constexpr int RESULT_BATCH_SIZE = 15;
+    static constexpr unsigned URING_ENTRIES = 64;
+    static constexpr qint64 URING_MAX_SIZE = 256 * 1024;   // Larger files are read the blocking way
+
+    SearchManager *m_manager;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_readable;      // Files queued, or room for more reads
+    QWaitCondition m_matchable;
+    QWaitCondition m_room;          // For submitters waiting on a full queue
+    int m_generation;
+    ReadOrder m_readOrder;
+    bool m_quit;
+
+    std::vector<std::unique_ptr<Device>> m_devices;
+    Device *m_lastDevice;
+    size_t m_nextDevice;
+    int m_queuedFiles;
+
+    std::deque<FileContents> m_matchQueue;
+    qint64 m_bytesInFlight;
+    std::vector<QByteArray> m_spareBuffers;
+    ConcurrencyTuner m_matchTuner;
+
+    std::vector<std::unique_ptr<StageThread>> m_readers;
+    std::vector<std::unique_ptr<StageThread>> m_matchers;
+};
+
+#endif // SEARCHPIPELINE_H
@@ -0,0 +1,87 @@
+#include "searchresultset.h"
+
+int SearchResultSet::size() const
+{
+    return int(m_directoryOf.size());
+}
+
+void SearchResultSet::append(const SearchResult &result)
+{
+    m_directoryOf.push_back(m_paths.directory(QStringView(result.fullPath).left(result.nameOffset)));
+    m_names.push_back(m_paths.addName(result.fileName()));
+    m_termOf.push_back(result.term);
+    m_snippets.append(result.matchedLine);
+    m_snippetEnds.push_back(m_snippets.size());
+    m_sizes.push_back(result.fileSize);
+    m_modified.push_back(result.modifiedMSecs);
+    m_lines.push_back(result.lineNumber);
+    m_types.push_back(quint8(result.type));
+    m_hasMetadata.push_back(result.hasMetadata);
+}
+
+SearchResult SearchResultSet::at(int row) const
+{
+    SearchResult result;
+    result.fullPath = directoryPath(row);
+    result.nameOffset = int(result.fullPath.size());
+    result.fullPath += name(row);
+    result.type = type(row);
+    result.hasMetadata = m_hasMetadata[row];
+    result.fileSize = m_sizes[row];
+    result.modifiedMSecs = m_modified[row];
+    result.matchedLine = snippet(row).toString();
+    result.lineNumber = m_lines[row];
+    result.term = m_termOf[row];
+    return result;
+}
+
+QString SearchResultSet::filePath(int row) const
+{
+    return m_paths.filePath(m_directoryOf[row], m_names[row]);
+}
+
+QString SearchResultSet::directoryPath(int row) const
+{
+    return m_paths.directoryPath(m_directoryOf[row]);
+}
+
+QStringView SearchResultSet::name(int row) const
+{
+    return m_paths.name(m_names[row]);
+}
+
+QStringView SearchResultSet::snippet(int row) const
+{
+    const qsizetype start = row > 0 ? m_snippetEnds[row - 1] : 0;
+    return QStringView(m_snippets).mid(start, m_snippetEnds[row] - start);
+}
+
+DirScanner::EntryType SearchResultSet::type(int row) const
+{
+    return DirScanner::EntryType(m_types[row]);
+}
+
+bool SearchResultSet::hasMetadata(int row) const
+{
+    return m_hasMetadata[row];
+}
+
+qint64 SearchResultSet::fileSize(int row) const
+{
+    return m_sizes[row];
+}
+
+qint64 SearchResultSet::modifiedMSecs(int row) const
+{
+    return m_modified[row];
+}
+
+int SearchResultSet::lineNumber(int row) const
+{
+    return m_lines[row];
+}
+
+int SearchResultSet::term(int row) const
+{
+    return m_termOf[row];
+}
@@ -0,0 +1,52 @@
+#ifndef SEARCHRESULTSET_H
+#define SEARCHRESULTSET_H
+
+#include <QList>
+#include <QString>
+#include <vector>
+#include "patharena.h"
+#include "searchmanager.h"
+
+// Results of one search stored column by column. A row is a handful of
+// integers: its parent directory is a node of the set's path arena, its
+// name a slice of the arena and its matched line a slice of one shared
+// buffer. Only appended to by one thread; once handed to another (to
+// refine a search) it is no longer changed. Destroying it frees a fixed
+// number of blocks however many rows it holds.
+class SearchResultSet
+{
+public:
+    int size() const;
+    void append(const SearchResult &result);
+
+    // Back in the form workers produce, with the path rebuilt
+    SearchResult at(int row) const;
+
+    QString filePath(int row) const;
+    QString directoryPath(int row) const;     // With a trailing '/'
+    QStringView name(int row) const;
+    QStringView snippet(int row) const;
+    DirScanner::EntryType type(int row) const;
+    bool hasMetadata(int row) const;
+    qint64 fileSize(int row) const;
+    qint64 modifiedMSecs(int row) const;
+    int lineNumber(int row) const;
+    int term(int row) const;
+
+private:
+    PathArena m_paths;
+
+    // One entry per row
+    std::vector<PathArena::NodeId> m_directoryOf;
+    std::vector<PathArena::Slice> m_names;
+    std::vector<qsizetype> m_snippetEnds;   // Into m_snippets, a row starts where the previous one ends
+    std::vector<qint64> m_sizes;
+    std::vector<qint64> m_modified;         // Milliseconds since the epoch
+    std::vector<qint32> m_lines;
+    std::vector<qint32> m_termOf;           // -1 for none
+    std::vector<quint8> m_types;            // DirScanner::EntryType
+    std::vector<bool> m_hasMetadata;
+    QString m_snippets;
+};
+
+#endif // SEARCHRESULTSET_H
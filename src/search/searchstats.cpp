@@ -0,0 +1,208 @@
+#include "searchstats.h"
+
+#include <QtAlgorithms>
+
+namespace {
+
+std::atomic<quint64> nextStatsId(1);
+
+// The slot this thread last recorded into, and whose it is
+thread_local quint64 t_statsId = 0;
+thread_local void *t_slot = nullptr;
+
+void add(std::atomic<quint64> &counter, quint64 value)
+{
+    // Only the owning thread writes, a plain load and store is enough
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+}
+
+SearchStats::SearchStats()
+    : m_id(nextStatsId.fetch_add(1))
+    , m_epoch(0)
+{
+}
+
+SearchStats::~SearchStats()
+{
+}
+
+void SearchStats::record(int generation, Stage stage, qint64 latencyNs, qint64 units)
+{
+    // A cancelled search's workers finish what they were doing. Should one pass this
+    // check right before a reset, its slot keeps the old epoch and is not summed.
+    const quint64 epoch = quint64(quint32(generation));
+    if (m_epoch.load(std::memory_order_acquire) != epoch) {
+        return;
+    }
+
+    ThreadSlot *threadSlot = slot();
+    if (threadSlot->epoch.load(std::memory_order_relaxed) != epoch) {
+        for (StageSlot &stageSlot : threadSlot->stages) {
+            stageSlot.count.store(0, std::memory_order_relaxed);
+            stageSlot.units.store(0, std::memory_order_relaxed);
+            stageSlot.totalNs.store(0, std::memory_order_relaxed);
+            stageSlot.maxNs.store(0, std::memory_order_relaxed);
+            for (std::atomic<quint64> &count : stageSlot.buckets) {
+                count.store(0, std::memory_order_relaxed);
+            }
+        }
+        threadSlot->epoch.store(epoch, std::memory_order_release);
+    }
+
+    const quint64 latency = quint64(qMax<qint64>(0, latencyNs));
+    StageSlot &stageSlot = threadSlot->stages[stage];
+    add(stageSlot.count, 1);
+    add(stageSlot.units, quint64(qMax<qint64>(0, units)));
+    add(stageSlot.totalNs, latency);
+    if (latency > stageSlot.maxNs.load(std::memory_order_relaxed)) {
+        stageSlot.maxNs.store(latency, std::memory_order_relaxed);
+    }
+    add(stageSlot.buckets[bucket(latency)], 1);
+}
+
+void SearchStats::reset(int generation)
+{
+    m_epoch.store(quint64(quint32(generation)), std::memory_order_release);
+}
+
+QList<SearchStats::StageSummary> SearchStats::summary() const
+{
+    QList<StageSummary> stages(STAGE_COUNT);
+    std::vector<quint64> buckets(size_t(STAGE_COUNT) * BUCKETS, 0);
+    const quint64 epoch = m_epoch.load(std::memory_order_acquire);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const std::unique_ptr<ThreadSlot> &threadSlot : m_slots) {
+            if (threadSlot->epoch.load(std::memory_order_acquire) != epoch) {
+                continue;       // Nothing recorded since the reset
+            }
+            for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+                const StageSlot &stageSlot = threadSlot->stages[stage];
+                StageSummary &summary = stages[stage];
+                summary.count += qint64(stageSlot.count.load(std::memory_order_relaxed));
+                summary.units += qint64(stageSlot.units.load(std::memory_order_relaxed));
+                summary.totalNs += qint64(stageSlot.totalNs.load(std::memory_order_relaxed));
+                summary.maxNs = qMax(summary.maxNs, qint64(stageSlot.maxNs.load(std::memory_order_relaxed)));
+                for (int i = 0; i < BUCKETS; ++i) {
+                    buckets[size_t(stage) * BUCKETS + i] += stageSlot.buckets[i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    // Percentiles from the merged histograms, reported as the top of their bucket
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        StageSummary &summary = stages[stage];
+        quint64 total = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            total += buckets[size_t(stage) * BUCKETS + i];
+        }
+        if (total == 0) {
+            continue;
+        }
+        const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+        qint64 *targets[] = {&summary.p50Ns, &summary.p90Ns, &summary.p99Ns, &summary.p999Ns};
+        quint64 seen = 0;
+        int next = 0;
+        for (int i = 0; i < BUCKETS && next < 4; ++i) {
+            seen += buckets[size_t(stage) * BUCKETS + i];
+            while (next < 4 && double(seen) >= fractions[next] * double(total)) {
+                *targets[next] = qMin(qint64(bucketValue(i)), summary.maxNs);
+                next++;
+            }
+        }
+    }
+    return stages;
+}
+
+QJsonObject SearchStats::toJson() const
+{
+    const QList<StageSummary> stages = summary();
+    QJsonObject object;
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        const StageSummary &summary = stages.at(stage);
+        QJsonObject stageObject;
+        stageObject.insert("count", summary.count);
+        stageObject.insert("units", summary.units);
+        stageObject.insert("totalNs", summary.totalNs);
+        stageObject.insert("meanNs", summary.count > 0 ? summary.totalNs / summary.count : 0);
+        stageObject.insert("p50Ns", summary.p50Ns);
+        stageObject.insert("p90Ns", summary.p90Ns);
+        stageObject.insert("p99Ns", summary.p99Ns);
+        stageObject.insert("p999Ns", summary.p999Ns);
+        stageObject.insert("maxNs", summary.maxNs);
+        object.insert(stageName(Stage(stage)), stageObject);
+    }
+    return object;
+}
+
+const char *SearchStats::stageName(Stage stage)
+{
+    switch (stage) {
+    case ReadDir:
+        return "readdir";
+    case Stat:
+        return "stat";
+    case Open:
+        return "open";
+    case Read:
+        return "read";
+    case ReadBatch:
+        return "readbatch";
+    case Match:
+        return "match";
+    case Emit:
+        return "emit";
+    default:
+        return "unknown";
+    }
+}
+
+SearchStats::ThreadSlot *SearchStats::slot()
+{
+    if (t_statsId == m_id) {
+        return static_cast<ThreadSlot *>(t_slot);
+    }
+
+    // First record of this thread here, or it recorded into other stats since
+    QMutexLocker locker(&m_mutex);
+    const Qt::HANDLE thread = QThread::currentThreadId();
+    ThreadSlot *threadSlot = m_threads.value(thread);
+    if (!threadSlot) {
+        m_slots.push_back(std::unique_ptr<ThreadSlot>(new ThreadSlot()));
+        threadSlot = m_slots.back().get();
+        threadSlot->epoch.store(~quint64(0), std::memory_order_relaxed);    // Zeroed on first use
+        m_threads.insert(thread, threadSlot);
+    }
+    t_statsId = m_id;
+    t_slot = threadSlot;
+    return threadSlot;
+}
+
+int SearchStats::bucket(quint64 value)
+{
+    // Values below SUB_BUCKETS have a bucket each, above that every power of two gets SUB_BUCKETS
+    if (value < quint64(SUB_BUCKETS)) {
+        return int(value);
+    }
+    const int exponent = 63 - int(qCountLeadingZeroBits(value));
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    const int subBucket = int((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+quint64 SearchStats::bucketValue(int bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return quint64(bucket);
+    }
+    const int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    const quint64 subBucket = quint64(bucket % SUB_BUCKETS);
+    const int shift = exponent - SUB_BUCKET_BITS;
+    return ((quint64(SUB_BUCKETS) + subBucket + 1) << shift) - 1;
+}
@@ -0,0 +1,98 @@
+#ifndef SEARCHSTATS_H
+#define SEARCHSTATS_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Where the time of a search goes, per stage of the hot path. Every thread
+// records into a slot of its own, found through a thread-local pointer, and
+// is the only one writing it: no locks, no shared cache lines, no atomic
+// read-modify-write, only relaxed loads and stores. Latencies go into
+// log-linear histograms in the style of HdrHistogram, 16 buckets per power
+// of two, so percentiles are within about 6% from nanoseconds to hours.
+// Readers sum the slots whenever they ask, while threads keep recording.
+class SearchStats
+{
+public:
+    enum Stage
+    {
+        ReadDir,        // Listing a directory, units are entries
+        Stat,           // One stat of an entry
+        Open,           // Opening a file for reading
+        Read,           // Reading a file, units are bytes
+        ReadBatch,      // Opening and reading a batch of files through io_uring, units are bytes
+        Match,          // Matching a file's text or a directory's names, units are bytes
+        Emit,           // Handing a batch of results on, units are results
+        STAGE_COUNT
+    };
+
+    struct StageSummary
+    {
+        qint64 count = 0;
+        qint64 units = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        qint64 p50Ns = 0;
+        qint64 p90Ns = 0;
+        qint64 p99Ns = 0;
+        qint64 p999Ns = 0;
+    };
+
+    SearchStats();
+    ~SearchStats();
+
+    SearchStats(const SearchStats &) = delete;
+    SearchStats &operator=(const SearchStats &) = delete;
+
+    // Any thread. Threads zero their own slot the first time they record after a reset.
+    // Records of another search than the one reset for are dropped.
+    void record(int generation, Stage stage, qint64 latencyNs, qint64 units = 1);
+    // Starts over for the search of generation
+    void reset(int generation);
+
+    QList<StageSummary> summary() const;
+    QJsonObject toJson() const;
+
+    static const char *stageName(Stage stage);
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 43;        // 2^43 ns is over two hours, longer is clamped
+    static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    struct StageSlot
+    {
+        std::atomic<quint64> count;
+        std::atomic<quint64> units;
+        std::atomic<quint64> totalNs;
+        std::atomic<quint64> maxNs;
+        std::atomic<quint64> buckets[BUCKETS];
+    };
+
+    // Aligned so neighbouring threads never share a line
+    struct alignas(64) ThreadSlot
+    {
+        std::atomic<quint64> epoch;
+        StageSlot stages[STAGE_COUNT];
+    };
+
+    ThreadSlot *slot();
+    static int bucket(quint64 value);
+    static quint64 bucketValue(int bucket);      // Highest value in the bucket
+
+    const quint64 m_id;                 // Thread-local pointers are keyed by it, addresses get reused
+    std::atomic<quint64> m_epoch;       // Generation of the search recorded, slots of others are left out
+
+    mutable QMutex m_mutex;
+    QHash<Qt::HANDLE, ThreadSlot *> m_threads;    // A thread that ended leaves its slot to the next one with its id
+    std::vector<std::unique_ptr<ThreadSlot>> m_slots;
+};
+
+#endif // SEARCHSTATS_H
@@ -0,0 +1,213 @@
+#include "searchtrace.h"
+
+#include <QSaveFile>
+#include <QThread>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+std::atomic<bool> SearchTrace::s_enabled(false);
+
+namespace {
+
+struct Event
+{
+    const char *name;
+    const char *argName;
+    qint64 startNs;
+    qint64 durationNs;
+    qint64 arg;
+};
+
+// Most recent events kept per thread, about 320 KiB each
+constexpr quint64 RING_EVENTS = 8192;
+
+struct ThreadBuffer
+{
+    int tid = 0;
+    QString name;
+    std::atomic<bool> owned{true};      // A live thread records here
+    std::atomic<quint64> session{0};    // Events are of this session
+    std::atomic<quint64> head{0};       // Events written in it, the ring holds the last RING_EVENTS
+    std::atomic<bool> writing{false};   // An event is being stored, write() waits for it
+    std::vector<Event> events;
+};
+
+QMutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;   // Outlives threads, their events are still written
+std::atomic<quint64> currentSession(0);
+std::atomic<qint64> sessionStartNs(0);
+
+// Gives the buffer back when its thread ends, for the next thread once written
+struct BufferOwner
+{
+    ThreadBuffer *buffer = nullptr;
+    ~BufferOwner()
+    {
+        if (buffer) {
+            buffer->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+thread_local BufferOwner t_owner;
+
+ThreadBuffer *threadBuffer()
+{
+    if (t_owner.buffer) {
+        return t_owner.buffer;
+    }
+
+    QMutexLocker locker(&registryMutex);
+    ThreadBuffer *buffer = nullptr;
+    const quint64 session = currentSession.load(std::memory_order_acquire);
+    for (const std::unique_ptr<ThreadBuffer> &candidate : registry) {
+        if (!candidate->owned.load(std::memory_order_acquire) && candidate->session.load(std::memory_order_relaxed) != session) {
+            buffer = candidate.get();
+            break;
+        }
+    }
+    if (!buffer) {
+        registry.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer));
+        buffer = registry.back().get();
+        buffer->tid = int(registry.size());
+        buffer->events.resize(RING_EVENTS);
+    }
+    buffer->owned.store(true, std::memory_order_relaxed);
+    buffer->session.store(session, std::memory_order_relaxed);
+    buffer->head.store(0, std::memory_order_relaxed);
+    const QString threadName = QThread::currentThread()->objectName();
+    buffer->name = threadName.isEmpty() ? QString("Thread %1").arg(buffer->tid) : threadName;
+    t_owner.buffer = buffer;
+    return buffer;
+}
+
+QByteArray escaped(const QString &text)
+{
+    QByteArray utf8 = text.toUtf8();
+    utf8.replace('\\', "\\\\");
+    utf8.replace('"', "\\\"");
+    return utf8;
+}
+
+}
+
+void SearchTrace::start()
+{
+    sessionStartNs.store(now(), std::memory_order_relaxed);
+    currentSession.fetch_add(1, std::memory_order_acq_rel);
+    s_enabled.store(true, std::memory_order_release);
+}
+
+bool SearchTrace::write(const QString &path)
+{
+    // Sequentially consistent with complete(): a thread either sees tracing off or is seen writing
+    s_enabled.store(false, std::memory_order_seq_cst);
+    const quint64 session = currentSession.load(std::memory_order_acquire);
+    const qint64 startNs = sessionStartNs.load(std::memory_order_relaxed);
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    // Written as it goes, a long trace is millions of events
+    QByteArray out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                     "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Boba search\"}}";
+    QMutexLocker locker(&registryMutex);
+    for (const std::unique_ptr<ThreadBuffer> &buffer : registry) {
+        while (buffer->writing.load(std::memory_order_seq_cst)) {
+            QThread::yieldCurrentThread();
+        }
+    }
+    for (const std::unique_ptr<ThreadBuffer> &buffer : registry) {
+        if (buffer->session.load(std::memory_order_acquire) != session) {
+            continue;
+        }
+        const quint64 head = buffer->head.load(std::memory_order_acquire);
+        if (head == 0) {
+            continue;
+        }
+        out += QString(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%1,\"args\":{\"name\":\"")
+                   .arg(buffer->tid).toUtf8();
+        out += escaped(buffer->name);
+        out += "\"}}";
+
+        for (quint64 i = head > RING_EVENTS ? head - RING_EVENTS : 0; i < head; ++i) {
+            const Event &event = buffer->events[i % RING_EVENTS];
+            if (event.startNs < startNs) {
+                continue;       // Began before tracing did
+            }
+            out += ",\n{\"name\":\"";
+            out += event.name;
+            out += "\",\"cat\":\"search\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+            out += QByteArray::number(buffer->tid);
+            out += ",\"ts\":";
+            out += QByteArray::number(double(event.startNs - startNs) / 1000.0, 'f', 3);
+            out += ",\"dur\":";
+            out += QByteArray::number(double(event.durationNs) / 1000.0, 'f', 3);
+            if (event.argName) {
+                out += ",\"args\":{\"";
+                out += event.argName;
+                out += "\":";
+                out += QByteArray::number(event.arg);
+                out += "}";
+            }
+            out += "}";
+            if (out.size() > 1024 * 1024) {
+                file.write(out);
+                out.clear();
+            }
+        }
+    }
+    out += "\n]}\n";
+    file.write(out);
+    return file.commit();
+}
+
+void SearchTrace::waitForLock(QMutex &mutex, const char *name)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    if (mutex.tryLock()) {
+        mutex.unlock();
+        return;
+    }
+    const qint64 startNs = now();
+    mutex.lock();
+    mutex.unlock();
+    complete(name, startNs);
+}
+
+void SearchTrace::complete(const char *name, qint64 startNs, const char *argName, qint64 arg)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    const qint64 endNs = now();
+
+    // Only this thread writes its buffer, write() reads it once tracing is off and no event is half stored
+    ThreadBuffer *buffer = threadBuffer();
+    buffer->writing.store(true, std::memory_order_seq_cst);
+    if (!s_enabled.load(std::memory_order_seq_cst)) {
+        buffer->writing.store(false, std::memory_order_release);
+        return;
+    }
+
+    // A new session starts it over
+    const quint64 session = currentSession.load(std::memory_order_acquire);
+    if (buffer->session.load(std::memory_order_relaxed) != session) {
+        buffer->head.store(0, std::memory_order_relaxed);
+        buffer->session.store(session, std::memory_order_release);
+    }
+    const quint64 head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % RING_EVENTS] = {name, argName, startNs, endNs - startNs, arg};
+    buffer->head.store(head + 1, std::memory_order_release);
+    buffer->writing.store(false, std::memory_order_release);
+}
+
+qint64 SearchTrace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
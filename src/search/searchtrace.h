@@ -0,0 +1,66 @@
+#ifndef SEARCHTRACE_H
+#define SEARCHTRACE_H
+
+#include <QMutex>
+#include <QString>
+#include <atomic>
+
+// Opt-in timeline of what every search thread does, written as Chrome
+// trace-event JSON for Perfetto or chrome://tracing. Threads record spans
+// (scanning a directory, reading, matching, reporting) and waits (idle,
+// backpressure, contended locks) into a ring buffer of their own, keeping
+// the most recent events; nothing is shared between threads while
+// recording. Disabled, a span costs one relaxed load and no clock read.
+// Process-wide, like the threads it follows.
+class SearchTrace
+{
+public:
+    // Times its scope, if tracing was on when it began and still is at its end
+    class Span
+    {
+    public:
+        Span(const char *name, const char *argName = nullptr, qint64 arg = 0)
+            : m_name(isEnabled() ? name : nullptr)
+            , m_argName(argName)
+            , m_arg(arg)
+            , m_startNs(m_name ? now() : 0)
+        {
+        }
+        ~Span()
+        {
+            if (m_name) {
+                complete(m_name, m_startNs, m_argName, m_arg);
+            }
+        }
+        void setArg(qint64 arg) { m_arg = arg; }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        const char *m_name;
+        const char *m_argName;
+        qint64 m_arg;
+        qint64 m_startNs;
+    };
+
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Drops what was recorded before and starts recording
+    static void start();
+    // Stops recording and writes everything recorded since start()
+    static bool write(const QString &path);
+
+    // Records how long mutex takes to become free, when it is contended. Call
+    // right before locking it; costs a tryLock and unlock while tracing.
+    static void waitForLock(QMutex &mutex, const char *name);
+
+    // name and argName must be string literals, they are stored as pointers
+    static void complete(const char *name, qint64 startNs, const char *argName = nullptr, qint64 arg = 0);
+    static qint64 now();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+#endif // SEARCHTRACE_H
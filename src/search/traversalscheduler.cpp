@@ -0,0 +1,249 @@
+#include "traversalscheduler.h"
+#include "searchtrace.h"
+#include <QDebug>
+
+TraversalScheduler::TraversalScheduler(int threadCount)
+    : m_job(nullptr)
+    , m_injected(nullptr)
+    , m_pending(0)
+    , m_sleepers(0)
+    , m_activeThreads(qMax(1, threadCount))
+    , m_quit(false)
+    , m_busy(false)
+{
+    for (int i = 0; i < qMax(1, threadCount); ++i) {
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->random = quint32(i) * 2654435761u + 1;
+        m_workers.push_back(std::move(worker));
+    }
+
+    // Threads start once every deque exists, they steal from each other
+    for (int i = 0; i < int(m_workers.size()); ++i) {
+        m_workers[i]->thread = QThread::create([this, i]() { workerLoop(i); });
+        m_workers[i]->thread->setObjectName(QString("Traversal %1").arg(i));
+        m_workers[i]->thread->start();
+    }
+}
+
+TraversalScheduler::~TraversalScheduler()
+{
+    waitForDone();
+
+    m_quit.store(true, std::memory_order_release);
+    {
+        QMutexLocker locker(&m_idleMutex);
+        m_wake.wakeAll();
+        m_unparked.wakeAll();
+    }
+
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        worker->thread->wait();
+        delete worker->thread;
+        while (DirTask *task = worker->freeList) {
+            worker->freeList = task->nextFree;
+            delete task;
+        }
+    }
+}
+
+int TraversalScheduler::threadCount() const
+{
+    return int(m_workers.size());
+}
+
+void TraversalScheduler::setActiveThreads(int count)
+{
+    m_activeThreads.store(qBound(1, count, threadCount()), std::memory_order_release);
+
+    QMutexLocker locker(&m_idleMutex);
+    m_unparked.wakeAll();
+}
+
+int TraversalScheduler::activeThreads() const
+{
+    return m_activeThreads.load(std::memory_order_acquire);
+}
+
+void TraversalScheduler::start(TraversalJob *job, const DirHandle &root)
+{
+    waitForDone();
+    {
+        QMutexLocker locker(&m_doneMutex);
+        m_busy = true;
+    }
+
+    DirTask *task = new DirTask;
+    task->dir = root;
+
+    m_pending.store(1, std::memory_order_relaxed);
+    m_job.store(job, std::memory_order_relaxed);
+    m_injected.store(task, std::memory_order_seq_cst);
+    wakeOne();
+}
+
+void TraversalScheduler::push(int workerIndex, const DirHandle &dir)
+{
+    Worker &worker = *m_workers[workerIndex];
+    DirTask *task = allocateTask(worker);
+    task->dir = dir;
+
+    // Counted before it becomes visible, so the count cannot reach zero early
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    worker.deque.push(task);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+        wakeOne();
+    }
+}
+
+bool TraversalScheduler::isBusy() const
+{
+    QMutexLocker locker(&m_doneMutex);
+    return m_busy;
+}
+
+void TraversalScheduler::waitForDone()
+{
+    QMutexLocker locker(&m_doneMutex);
+    while (m_busy) {
+        m_done.wait(&m_doneMutex);
+    }
+}
+
+void TraversalScheduler::workerLoop(int index)
+{
+    Worker &self = *m_workers[index];
+    int idleRounds = 0;
+
+    while (!m_quit.load(std::memory_order_acquire)) {
+        if (index >= m_activeThreads.load(std::memory_order_acquire)) {
+            park(index);
+            continue;
+        }
+
+        DirTask *task = findTask(index);
+        if (!task) {
+            if (++idleRounds < SPIN_ROUNDS) {
+                QThread::yieldCurrentThread();
+            } else {
+                sleep();
+                idleRounds = 0;
+            }
+            continue;
+        }
+        idleRounds = 0;
+
+        TraversalJob *job = m_job.load(std::memory_order_acquire);
+        job->processDirectory(index, task->dir);
+        task->dir = DirHandle();
+        releaseTask(self, task);
+
+        // Whoever completes the last directory ends the traversal
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_job.store(nullptr, std::memory_order_relaxed);
+            job->traversalFinished();
+
+            QMutexLocker locker(&m_doneMutex);
+            m_busy = false;
+            m_done.wakeAll();
+        }
+    }
+}
+
+TraversalScheduler::DirTask *TraversalScheduler::findTask(int index)
+{
+    Worker &self = *m_workers[index];
+    if (DirTask *task = self.deque.pop()) {
+        return task;
+    }
+
+    if (m_injected.load(std::memory_order_relaxed)) {
+        if (DirTask *task = m_injected.exchange(nullptr, std::memory_order_acq_rel)) {
+            return task;
+        }
+    }
+
+    // Steal from the others, starting at a random victim
+    const int count = int(m_workers.size());
+    for (int round = 0; round < STEAL_ROUNDS && count > 1; ++round) {
+        self.random ^= self.random << 13;
+        self.random ^= self.random >> 17;
+        self.random ^= self.random << 5;
+        const int start = int(self.random % quint32(count));
+        for (int i = 0; i < count; ++i) {
+            const int victim = (start + i) % count;
+            if (victim == index) {
+                continue;
+            }
+            if (DirTask *task = m_workers[victim]->deque.steal()) {
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool TraversalScheduler::hasVisibleWork() const
+{
+    if (m_injected.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        if (!worker->deque.isEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TraversalScheduler::sleep()
+{
+    QMutexLocker locker(&m_idleMutex);
+
+    // Pairs with the fence in push(): either the pusher sees us sleeping or we see its work
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!hasVisibleWork() && !m_quit.load(std::memory_order_acquire)) {
+        SearchTrace::Span span("idle");
+        m_wake.wait(&m_idleMutex);
+    }
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void TraversalScheduler::park(int index)
+{
+    QMutexLocker locker(&m_idleMutex);
+    while (index >= m_activeThreads.load(std::memory_order_acquire) && !m_quit.load(std::memory_order_acquire)) {
+        SearchTrace::Span span("parked");
+        m_unparked.wait(&m_idleMutex);
+    }
+}
+
+void TraversalScheduler::wakeOne()
+{
+    QMutexLocker locker(&m_idleMutex);
+    m_wake.wakeOne();
+}
+
+TraversalScheduler::DirTask *TraversalScheduler::allocateTask(Worker &worker)
+{
+    if (DirTask *task = worker.freeList) {
+        worker.freeList = task->nextFree;
+        worker.freeCount--;
+        return task;
+    }
+    return new DirTask;
+}
+
+void TraversalScheduler::releaseTask(Worker &worker, DirTask *task)
+{
+    // Stolen tasks end up on the thief's list, cap it so lists stay balanced
+    if (worker.freeCount >= MAX_FREE_TASKS) {
+        delete task;
+        return;
+    }
+    task->nextFree = worker.freeList;
+    worker.freeList = task;
+    worker.freeCount++;
+}
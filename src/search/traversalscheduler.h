@@ -0,0 +1,100 @@
+#ifndef TRAVERSALSCHEDULER_H
+#define TRAVERSALSCHEDULER_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "dirscanner.h"
+#include "workstealingdeque.h"
+
+// Work handed to the scheduler: called for every directory of one traversal
+class TraversalJob
+{
+public:
+    virtual ~TraversalJob() = default;
+
+    // Runs on worker workerIndex. Subdirectories found are handed back with
+    // TraversalScheduler::push() from the same call. The job owns dir.fd.
+    virtual void processDirectory(int workerIndex, DirHandle &dir) = 0;
+
+    // Called once, on the worker that completed the last directory
+    virtual void traversalFinished() = 0;
+};
+
+
+
+// Long-lived traversal threads with one work-stealing deque each.
+// Directories found by a worker go to its own deque and are processed
+// depth-first; idle workers steal the oldest (shallowest) directories of
+// others. A traversal is over when the count of outstanding directories,
+// kept with a single atomic, drops to zero.
+class TraversalScheduler
+{
+public:
+    explicit TraversalScheduler(int threadCount);
+    ~TraversalScheduler();
+
+    int threadCount() const;
+
+    // Workers beyond count park until it is raised again, others steal what they left queued
+    void setActiveThreads(int count);
+    int activeThreads() const;
+
+    // Starts a traversal at root once the previous one is done
+    void start(TraversalJob *job, const DirHandle &root);
+    // Only from TraversalJob::processDirectory() on that worker
+    void push(int workerIndex, const DirHandle &dir);
+
+    bool isBusy() const;
+    void waitForDone();
+
+private:
+    struct DirTask
+    {
+        DirHandle dir;
+        DirTask *nextFree = nullptr;
+    };
+
+    struct alignas(64) Worker
+    {
+        WorkStealingDeque<DirTask> deque;
+        DirTask *freeList = nullptr;
+        int freeCount = 0;
+        quint32 random = 0;
+        QThread *thread = nullptr;
+    };
+
+    void workerLoop(int index);
+    DirTask *findTask(int index);
+    bool hasVisibleWork() const;
+    void sleep();
+    void park(int index);
+    void wakeOne();
+    DirTask *allocateTask(Worker &worker);
+    void releaseTask(Worker &worker, DirTask *task);
+
+    static constexpr int STEAL_ROUNDS = 2;
+    static constexpr int SPIN_ROUNDS = 64;          // Failed searches before going to sleep
+    static constexpr int MAX_FREE_TASKS = 1024;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<TraversalJob *> m_job;
+    std::atomic<DirTask *> m_injected;              // Root of a new traversal
+    std::atomic<qint64> m_pending;                  // Directories pushed but not yet processed
+    std::atomic<int> m_sleepers;
+    std::atomic<int> m_activeThreads;
+    std::atomic<bool> m_quit;
+
+    QMutex m_idleMutex;
+    QWaitCondition m_wake;
+    QWaitCondition m_unparked;      // Separate, so parked workers never swallow a wake meant for work
+
+    mutable QMutex m_doneMutex;
+    QWaitCondition m_done;
+    bool m_busy;
+};
+
+#endif // TRAVERSALSCHEDULER_H
@@ -0,0 +1,340 @@
+#include "uringreader.h"
+
+#if defined(Q_OS_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BOBA_IO_URING
+#endif
+#endif
+
+#ifdef BOBA_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+enum Operation
+{
+    Open,
+    Stat,
+    Read,
+};
+
+quint64 userData(int index, Operation operation)
+{
+    return (quint64(index) << 2) | quint64(operation);
+}
+
+}
+#endif
+
+UringReader::UringReader(unsigned entries)
+    : m_fd(-1)
+    , m_entries(0)
+    , m_sqRing(nullptr)
+    , m_sqRingSize(0)
+    , m_cqRing(nullptr)
+    , m_cqRingSize(0)
+    , m_sqes(nullptr)
+    , m_sqesSize(0)
+    , m_sqHead(nullptr)
+    , m_sqTail(nullptr)
+    , m_sqMask(0)
+    , m_sqArray(nullptr)
+    , m_cqHead(nullptr)
+    , m_cqTail(nullptr)
+    , m_cqMask(0)
+    , m_cqes(nullptr)
+    , m_pending(0)
+    , m_localTail(0)
+{
+#ifdef BOBA_IO_URING
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (m_fd < 0) {
+        m_fd = -1;      // ENOSYS, EPERM under seccomp or io_uring_disabled
+        return;
+    }
+
+    // Every operation a batch needs has to be there, the first kernels had neither openat nor statx
+    const unsigned probeOps = 256;
+    std::vector<char> probeBuffer(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeBuffer.data());
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, probeOps) < 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    for (unsigned op : {unsigned(IORING_OP_OPENAT), unsigned(IORING_OP_STATX), unsigned(IORING_OP_READ)}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            ::close(m_fd);
+            m_fd = -1;
+            return;
+        }
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = qMax(m_sqRingSize, m_cqRingSize);
+        m_cqRingSize = 0;
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    if (m_cqRingSize > 0) {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            munmap(m_sqRing, m_sqRingSize);
+            m_sqRing = nullptr;
+            ::close(m_fd);
+            m_fd = -1;
+            return;
+        }
+    } else {
+        m_cqRing = m_sqRing;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        if (m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        m_sqRing = m_cqRing = nullptr;
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    char *sq = static_cast<char *>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = cq + params.cq_off.cqes;
+    m_entries = params.sq_entries;
+    m_localTail = *m_sqTail;
+#else
+    Q_UNUSED(entries);
+#endif
+}
+
+UringReader::~UringReader()
+{
+#ifdef BOBA_IO_URING
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+bool UringReader::isValid() const
+{
+    return m_fd >= 0;
+}
+
+int UringReader::batchSize() const
+{
+    // Opening takes two entries per file, an openat and a statx
+    return int(m_entries / 2);
+}
+
+bool UringReader::read(std::vector<Request> &requests)
+{
+    for (Request &request : requests) {
+        request.answered = false;
+        request.size = 0;
+    }
+    const int batch = batchSize();
+    for (size_t first = 0; first < requests.size() && isValid(); first += batch) {
+        const int count = int(qMin<size_t>(batch, requests.size() - first));
+        if (!readBatch(requests.data() + first, count)) {
+            return false;
+        }
+    }
+    return isValid();
+}
+
+bool UringReader::readBatch(Request *requests, int count)
+{
+#ifdef BOBA_IO_URING
+    std::vector<int> fds(count, -1);
+    std::vector<struct statx> stats(count);
+    std::vector<qint64> wanted(count, 0);
+
+    // Open and stat everything in one submission
+    for (int i = 0; i < count; ++i) {
+        io_uring_sqe *openEntry = static_cast<io_uring_sqe *>(nextEntry());
+        openEntry->opcode = IORING_OP_OPENAT;
+        openEntry->fd = AT_FDCWD;
+        openEntry->addr = quint64(quintptr(requests[i].path.constData()));
+        openEntry->open_flags = O_RDONLY | O_CLOEXEC;
+        openEntry->user_data = userData(i, Open);
+
+        io_uring_sqe *statEntry = static_cast<io_uring_sqe *>(nextEntry());
+        statEntry->opcode = IORING_OP_STATX;
+        statEntry->fd = AT_FDCWD;
+        statEntry->addr = quint64(quintptr(requests[i].path.constData()));
+        statEntry->len = STATX_SIZE;
+        statEntry->off = quint64(quintptr(&stats[i]));
+        statEntry->user_data = userData(i, Stat);
+    }
+    bool ok = submitAndWait(unsigned(2 * count));
+
+    io_uring_cqe *cqes = static_cast<io_uring_cqe *>(m_cqes);
+    unsigned head = *m_cqHead;
+    const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe &cqe = cqes[head & m_cqMask];
+        const int index = int(cqe.user_data >> 2);
+        if ((cqe.user_data & 3) == Open) {
+            fds[index] = cqe.res;
+            if (cqe.res < 0) {
+                requests[index].size = cqe.res;
+                requests[index].answered = true;
+            }
+        } else if (cqe.res == 0) {
+            wanted[index] = qMin<qint64>(qint64(stats[index].stx_size), requests[index].maxSize);
+        } else {
+            wanted[index] = requests[index].maxSize;     // No size, read as much as allowed
+        }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    // Then read each opened file into a buffer of its size, again all at once.
+    // Short reads are continued in further rounds.
+    std::vector<qint64> offsets(count, 0);
+    while (ok) {
+        unsigned reads = 0;
+        for (int i = 0; i < count; ++i) {
+            if (fds[i] < 0 || requests[i].answered) {
+                continue;
+            }
+            if (offsets[i] >= wanted[i]) {
+                requests[i].size = offsets[i];
+                requests[i].answered = true;
+                continue;
+            }
+            if (requests[i].buffer.size() < wanted[i]) {
+                requests[i].buffer.resize(wanted[i]);
+            }
+            io_uring_sqe *readEntry = static_cast<io_uring_sqe *>(nextEntry());
+            readEntry->opcode = IORING_OP_READ;
+            readEntry->fd = fds[i];
+            readEntry->addr = quint64(quintptr(requests[i].buffer.data() + offsets[i]));
+            readEntry->len = unsigned(wanted[i] - offsets[i]);
+            readEntry->off = quint64(offsets[i]);
+            readEntry->user_data = userData(i, Read);
+            reads++;
+        }
+        if (reads == 0) {
+            break;
+        }
+        ok = submitAndWait(reads);
+
+        head = *m_cqHead;
+        const unsigned readTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != readTail; ++head) {
+            const io_uring_cqe &cqe = cqes[head & m_cqMask];
+            const int index = int(cqe.user_data >> 2);
+            if (cqe.res < 0) {
+                requests[index].size = cqe.res;
+                requests[index].answered = true;
+            } else if (cqe.res == 0) {
+                requests[index].size = offsets[index];     // Shrank since statx
+                requests[index].answered = true;
+            } else {
+                offsets[index] += cqe.res;
+            }
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+        }
+    }
+    return ok;
+#else
+    Q_UNUSED(requests);
+    Q_UNUSED(count);
+    return false;
+#endif
+}
+
+void *UringReader::nextEntry()
+{
+#ifdef BOBA_IO_URING
+    // Batches never hold more than the ring, so there is always room once the last one was reaped
+    const unsigned index = m_localTail & m_sqMask;
+    io_uring_sqe *entry = static_cast<io_uring_sqe *>(m_sqes) + index;
+    std::memset(entry, 0, sizeof(io_uring_sqe));
+    m_sqArray[index] = index;
+    m_localTail++;
+    m_pending++;
+    return entry;
+#else
+    return nullptr;
+#endif
+}
+
+bool UringReader::submitAndWait(unsigned count)
+{
+#ifdef BOBA_IO_URING
+    __atomic_store_n(m_sqTail, m_localTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = m_pending;
+    m_pending = 0;
+
+    // Waits until every completion is in, the kernel takes entries it already has only once
+    for (;;) {
+        const unsigned head = *m_cqHead;
+        const unsigned ready = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) - head;
+        if (toSubmit == 0 && ready >= count) {
+            return true;
+        }
+        const int result = int(syscall(__NR_io_uring_enter, m_fd, toSubmit, count - qMin(ready, count),
+                                       IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (result < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+
+            // Broken for good, everything else goes the blocking way
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        toSubmit -= qMin(unsigned(result), toSubmit);
+    }
+#else
+    Q_UNUSED(count);
+    return false;
+#endif
+}
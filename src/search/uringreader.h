@@ -0,0 +1,70 @@
+#ifndef URINGREADER_H
+#define URINGREADER_H
+
+#include <QByteArray>
+#include <vector>
+
+// Reads batches of small files through io_uring. The openat and statx of
+// every file in a batch go to the kernel in one submission, then the reads,
+// sized by what statx found, in a second one. A slow file only delays its
+// own completion, the rest of the batch is not waiting behind it.
+// Talks to the kernel directly, so nothing beyond the kernel headers is
+// needed to build. Where io_uring or one of the operations is missing
+// (old kernels, seccomp, other systems) isValid() is false and callers
+// use their blocking path; the same build runs everywhere.
+class UringReader
+{
+public:
+    struct Request
+    {
+        QByteArray path;        // Native encoding
+        qint64 maxSize = 0;     // Read at most this much
+        QByteArray buffer;      // Resized to fit, reused when large enough
+        bool answered = false;  // Read or failed, otherwise left to the blocking path
+        qint64 size = 0;        // Bytes read, or -errno
+    };
+
+    explicit UringReader(unsigned entries = 64);
+    ~UringReader();
+
+    UringReader(const UringReader &) = delete;
+    UringReader &operator=(const UringReader &) = delete;
+
+    bool isValid() const;
+    // Files per submission, larger batches are split
+    int batchSize() const;
+
+    // Opens, stats and reads every request. False when the ring failed,
+    // the requests not answered then need the blocking path.
+    bool read(std::vector<Request> &requests);
+
+private:
+    bool readBatch(Request *requests, int count);
+    bool submitAndWait(unsigned count);
+    void *nextEntry();
+
+    int m_fd;
+    unsigned m_entries;
+
+    // Shared with the kernel
+    void *m_sqRing;
+    size_t m_sqRingSize;
+    void *m_cqRing;
+    size_t m_cqRingSize;
+    void *m_sqes;
+    size_t m_sqesSize;
+
+    unsigned *m_sqHead;
+    unsigned *m_sqTail;
+    unsigned m_sqMask;
+    unsigned *m_sqArray;
+    unsigned *m_cqHead;
+    unsigned *m_cqTail;
+    unsigned m_cqMask;
+    void *m_cqes;
+
+    unsigned m_pending;         // Queued but not submitted yet
+    unsigned m_localTail;       // Published to the kernel on submit
+};
+
+#endif // URINGREADER_H
@@ -0,0 +1,128 @@
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Chase-Lev work-stealing deque of pointers.
+// The owning thread pushes and pops at the bottom without locks; any other
+// thread may steal from the top. The buffer grows on demand, retired
+// buffers are kept until the deque is destroyed since thieves may still
+// be reading them.
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+        : m_top(0), m_bottom(0), m_array(new Array(capacity))
+    {
+    }
+
+    ~WorkStealingDeque()
+    {
+        delete m_array.load(std::memory_order_relaxed);
+        for (Array *array : m_retired) {
+            delete array;
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    // Owner only
+    void push(T *item)
+    {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        int64_t top = m_top.load(std::memory_order_acquire);
+        Array *array = m_array.load(std::memory_order_relaxed);
+        if (bottom - top > array->capacity - 1) {
+            array = grow(array, top, bottom);
+        }
+        array->put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only, returns nullptr when empty
+    T *pop()
+    {
+        int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array *array = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T *item = array->get(bottom);
+        if (top == bottom) {
+            // Last item, race the thieves for it
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread, returns nullptr when empty or when another thread won the item
+    T *steal()
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        Array *array = m_array.load(std::memory_order_acquire);
+        T *item = array->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Approximate, only meant as a hint
+    bool isEmpty() const
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array
+    {
+        explicit Array(int64_t size) : capacity(size), mask(size - 1), slots(new std::atomic<T *>[size]) {}
+        ~Array() { delete[] slots; }
+
+        T *get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T *item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+
+        int64_t capacity;   // Power of two
+        int64_t mask;
+        std::atomic<T *> *slots;
+    };
+
+    Array *grow(Array *array, int64_t top, int64_t bottom)
+    {
+        Array *bigger = new Array(array->capacity * 2);
+        for (int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, array->get(i));
+        }
+        m_retired.push_back(array);
+        m_array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    // Owner and thieves hammer different ends, keep them on separate cache lines
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) std::atomic<Array *> m_array;
+    std::vector<Array *> m_retired;
+};
+
+#endif // WORKSTEALINGDEQUE_H
@@ -6,14 +6,17 @@
 #include <QApplication>
 #include <QStyle>
 #include <QPushButton>
+#include <QLocale>
 
 FileDetailsWidget::FileDetailsWidget(QWidget *parent)
     : QWidget{parent}
     , ui(new Ui::FileDetailsWidget)
+    , sizeService(new DirectorySizeService(this))
 {
     ui->setupUi(this);
 
     connect(ui->closeButton, &QPushButton::clicked, this, &FileDetailsWidget::onCloseButtonClicked);
+    connect(sizeService, &DirectorySizeService::sizeChanged, this, &FileDetailsWidget::onDirectorySizeChanged);
     hide();
 }
 
@@ -49,10 +52,15 @@ void FileDetailsWidget::updateDetails()
     // File path
     ui->pathLabel->setText(currentFileInfo.absolutePath());
 
-    // File size
+    // File size, folders are added up in the background
     if (currentFileInfo.isFile()) {
+        sizeService->cancel();
         ui->sizeLabel->setText(QString("Size: %1").arg(formatFileSize(currentFileInfo.size())));
+    } else if (currentFileInfo.isDir()) {
+        ui->sizeLabel->setText("Size: calculating...");
+        sizeService->request(currentFileInfo.absoluteFilePath());
     } else {
+        sizeService->cancel();
         ui->sizeLabel->setText("Size: -");
     }
 
@@ -92,6 +100,7 @@ void FileDetailsWidget::updateDetails()
 
 void FileDetailsWidget::clearDetails()
 {
+    sizeService->cancel();
     ui->iconLabel->clear();
     ui->nameLabel->clear();
     ui->pathLabel->clear();
@@ -112,13 +121,13 @@ QString FileDetailsWidget::formatFileSize(qint64 size)
     const qint64 TB = GB * 1024;
 
     if (size >= TB) {
-        return QString::number(size / TB, 'f', 2) + " TB";
+        return QString::number(double(size) / TB, 'f', 2) + " TB";
     } else if (size >= GB) {
-        return QString::number(size / GB, 'f', 2) + " GB";
+        return QString::number(double(size) / GB, 'f', 2) + " GB";
     } else if (size >= MB) {
-        return QString::number(size / MB, 'f', 2) + " MB";
+        return QString::number(double(size) / MB, 'f', 2) + " MB";
     } else if (size >= KB) {
-        return QString::number(size / KB, 'f', 2) + " KB";
+        return QString::number(double(size) / KB, 'f', 2) + " KB";
     } else {
         return QString::number(size) + " bytes";
     }
@@ -142,8 +151,22 @@ QString FileDetailsWidget::getFileTypeDescription(const QFileInfo &info)
     }
 }
 
+void FileDetailsWidget::onDirectorySizeChanged(const QString &path, const DirectorySize &size)
+{
+    // Totals of a folder no longer shown may still arrive
+    if (!currentFileInfo.isDir() || path != currentFileInfo.absoluteFilePath()) {
+        return;
+    }
+    const QLocale locale;
+    ui->sizeLabel->setText(QString("Size: %1 (%2 files, %3 folders, %4 on disk)%5")
+                               .arg(formatFileSize(size.bytes), locale.toString(size.files),
+                                    locale.toString(size.directories), formatFileSize(size.allocatedBytes),
+                                    size.complete ? QString() : QString("...")));
+}
+
 void FileDetailsWidget::onCloseButtonClicked()
 {
+    sizeService->cancel();
     emit closeRequested();
     hide();
 }
@@ -5,6 +5,7 @@
 #include <QFileInfo>
 #include <QPixmap>
 #include <QIcon>
+#include "../search/directorysizeservice.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -23,6 +24,7 @@ public:
 
 private slots:
     void onCloseButtonClicked();
+    void onDirectorySizeChanged(const QString &path, const DirectorySize &size);
 
 private:
     void updateDetails();
@@ -31,6 +33,7 @@ private:
 
     Ui::FileDetailsWidget *ui;
     QFileInfo currentFileInfo;
+    DirectorySizeService *sizeService;
 
 signals:
     void closeRequested();
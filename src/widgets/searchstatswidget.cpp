@@ -0,0 +1,102 @@
+#include "searchstatswidget.h"
+#include "../search/searchstats.h"
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QJsonDocument>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QVBoxLayout>
+
+SearchStatsWidget::SearchStatsWidget(QWidget *parent)
+    : QWidget{parent}
+    , summaryLabel(new QLabel(this))
+    , stageTable(new QTableWidget(SearchStats::STAGE_COUNT, 9, this))
+{
+    stageTable->setHorizontalHeaderLabels({"Count", "Units", "Total", "Mean", "p50", "p90", "p99", "p99.9", "Max"});
+    QStringList stageNames;
+    for (int stage = 0; stage < SearchStats::STAGE_COUNT; ++stage) {
+        stageNames.append(SearchStats::stageName(SearchStats::Stage(stage)));
+    }
+    stageTable->setVerticalHeaderLabels(stageNames);
+    stageTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    stageTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    stageTable->setToolTip("Units are entries for readdir, bytes for read and match, results for emit");
+
+    QPushButton *saveButton = new QPushButton("Save JSON...", this);
+    QPushButton *closeButton = new QPushButton("Close", this);
+    connect(saveButton, &QPushButton::clicked, this, &SearchStatsWidget::onSaveButtonClicked);
+    connect(closeButton, &QPushButton::clicked, this, &SearchStatsWidget::closeRequested);
+
+    QHBoxLayout *topLayout = new QHBoxLayout;
+    topLayout->addWidget(summaryLabel, 1);
+    topLayout->addWidget(saveButton);
+    topLayout->addWidget(closeButton);
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(4, 4, 4, 4);
+    layout->addLayout(topLayout);
+    layout->addWidget(stageTable);
+}
+
+void SearchStatsWidget::setStats(const QJsonObject &stats)
+{
+    currentStats = stats;
+    summaryLabel->setText(QString("\"%1\" in %2: %3 files, %4 folders, %5 results")
+                              .arg(stats.value("searchText").toString(), stats.value("rootPath").toString())
+                              .arg(stats.value("filesProcessed").toInteger())
+                              .arg(stats.value("directoriesProcessed").toInteger())
+                              .arg(stats.value("results").toInteger()));
+
+    const QJsonObject stages = stats.value("stages").toObject();
+    for (int stage = 0; stage < SearchStats::STAGE_COUNT; ++stage) {
+        const QJsonObject values = stages.value(SearchStats::stageName(SearchStats::Stage(stage))).toObject();
+        const QStringList cells = {
+            QString::number(values.value("count").toInteger()),
+            QString::number(values.value("units").toInteger()),
+            formatDuration(values.value("totalNs").toInteger()),
+            formatDuration(values.value("meanNs").toInteger()),
+            formatDuration(values.value("p50Ns").toInteger()),
+            formatDuration(values.value("p90Ns").toInteger()),
+            formatDuration(values.value("p99Ns").toInteger()),
+            formatDuration(values.value("p999Ns").toInteger()),
+            formatDuration(values.value("maxNs").toInteger()),
+        };
+        for (int column = 0; column < cells.size(); ++column) {
+            QTableWidgetItem *item = stageTable->item(stage, column);
+            if (!item) {
+                item = new QTableWidgetItem;
+                item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                stageTable->setItem(stage, column, item);
+            }
+            item->setText(cells.at(column));
+        }
+    }
+}
+
+void SearchStatsWidget::onSaveButtonClicked()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, "Save Search Statistics", "search-stats.json",
+                                                          "JSON (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(currentStats).toJson()) < 0) {
+        QMessageBox::warning(this, "Error", "Could not write:\n" + fileName);
+    }
+}
+
+QString SearchStatsWidget::formatDuration(qint64 ns)
+{
+    if (ns < 10 * 1000) {
+        return QString("%1 ns").arg(ns);
+    }
+    if (ns < 10 * 1000 * 1000) {
+        return QString("%1 µs").arg(ns / 1000.0, 0, 'f', 1);
+    }
+    if (ns < qint64(10) * 1000 * 1000 * 1000) {
+        return QString("%1 ms").arg(ns / 1e6, 0, 'f', 1);
+    }
+    return QString("%1 s").arg(ns / 1e9, 0, 'f', 2);
+}
@@ -0,0 +1,32 @@
+#ifndef SEARCHSTATSWIDGET_H
+#define SEARCHSTATSWIDGET_H
+
+#include <QWidget>
+#include <QJsonObject>
+#include <QLabel>
+#include <QTableWidget>
+
+// Per-stage counts and latency percentiles of a search, as dumped by
+// SearchManager::statsJson(). Can save the dump it shows as JSON.
+class SearchStatsWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit SearchStatsWidget(QWidget *parent = nullptr);
+    void setStats(const QJsonObject &stats);
+
+private slots:
+    void onSaveButtonClicked();
+
+private:
+    static QString formatDuration(qint64 ns);
+
+    QLabel *summaryLabel;
+    QTableWidget *stageTable;
+    QJsonObject currentStats;
+
+signals:
+    void closeRequested();
+};
+
+#endif // SEARCHSTATSWIDGET_H